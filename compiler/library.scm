@@ -80,44 +80,6 @@
 (define list
   (lambda lst lst))
 
-(define length
-  (lambda (lst)
-    (#%length-aux lst 0)))
-
-(define #%length-aux
-  (lambda (lst n)
-    (if (pair? lst)
-        (#%length-aux (cdr lst) (#%+ n 1))
-        n)))
-
-(define append
-  (lambda (lst1 lst2)
-    (if (pair? lst1)
-        (cons (car lst1) (append (cdr lst1) lst2))
-        lst2)))
-
-(define reverse
-  (lambda (lst)
-    (#%reverse-aux lst '())))
-
-(define #%reverse-aux
-  (lambda (lst rev)
-    (if (pair? lst)
-        (#%reverse-aux (cdr lst) (cons (car lst) rev))
-        rev)))
-
-(define list-ref
-  (lambda (lst i)
-    (if (= i 0)
-        (car lst)
-        (list-ref (cdr lst) (#%- i 1)))))
-
-(define list-set!
-  (lambda (lst i x)
-    (if (= i 0)
-        (set-car! lst x)
-        (list-set! (cdr lst) (#%- i 1) x))))
-
 (define max
   (lambda (x y)
     (if (> x y) x y)))
@@ -192,63 +154,52 @@
        (lambda (r)
          (return-to-cont k r))))))
 
-(define root-k #f)
-(define readyq #f)
+;; Tasks are managed by the VM scheduler: the run queue is kept by the VM
+;; and a task switch doesn't allocate anything but the continuation of the
+;; suspended task.
 
 (define start-first-process
   (lambda (thunk)
     ;; rest of the program, after call to start-first-process
-    (set! root-k (get-cont))
-    (set! readyq (cons #f #f))
-    ;; initialize thread queue, which is a circular list of continuations
-    (set-cdr! readyq readyq)
+    (#%start-scheduler)
     (thunk)))
 
 (define spawn
   (lambda (thunk)
-    (let* ((k (get-cont))
-           (next (cons k (cdr readyq))))
-      ;; add a new link to the circular list
-      (set-cdr! readyq next)
-      ;; Run thunk with root-k as cont.
-      (graft-to-cont root-k (lambda () (thunk) (exit))))))
+    ;; Run thunk with the rest of the program as cont.
+    (#%spawn (lambda () (thunk) (exit)))))
 
 (define exit
   (lambda ()
-    (let ((next (cdr readyq)))
-      (if (eq? next readyq) ; queue is empty
-          #f
-          (begin
-            ;; step once on the circular list
-            (set-cdr! readyq (cdr next))
-            ;; invoke next thread
-            (return-to-cont (car next) #f))))))
+    (#%exit)))
 
 (define yield
   (lambda ()
-    (let ((k (get-cont)))
-      ;; save the current continuation
-      (set-car! readyq k)
-      ;; step once on the circular list
-      (set! readyq (cdr readyq))
-      ;; run the next thread
-      (let ((next-k (car readyq)))
-        (set-car! readyq #f)
-        (return-to-cont next-k #f)))))
+    (#%yield)))
+
+(define fd-wait
+  (lambda (fd events timeout)
+    (#%fd-wait fd events timeout)))
+
+(define wakeup-wait
+  (lambda (channel timeout)
+    (#%wakeup-wait channel timeout)))
+
+(define wakeup
+  (lambda (channel)
+    (#%wakeup channel)))
+
+(define socket-sendto
+  (lambda (socket v start end host port)
+    (#%socket-sendto socket v (cons start end) (cons host port))))
 
 (define number->string
-  (lambda (n)
-    (list->string
-     (if (< n 0)
-         (cons #\- (#%number->string-aux (neg n) '()))
-         (#%number->string-aux n '())))))
+  (lambda (n . radix)
+    (#%number->string n (if (pair? radix) (car radix) 10))))
 
-(define #%number->string-aux
-  (lambda (n lst)
-    (let ((rest (cons (#%+ #\0 (remainder n 10)) lst)))
-      (if (< n 10)
-          rest
-          (#%number->string-aux (quotient n 10) rest)))))
+(define string->number
+  (lambda (s . radix)
+    (#%string->number s (if (pair? radix) (car radix) 10))))
 
 (define caar
   (lambda (p)
@@ -287,49 +238,89 @@
   (lambda (p)
     (cdr (cdr (cdr p)))))
 
-(define equal?
-  (lambda (x y)
-    (cond ((eq? x y)
-	   #t)
-	  ((and (pair? x) (pair? y))
-	   (and (equal? (car x) (car y))
-		(equal? (cdr x) (cdr y))))
-	  ((and (u8vector? x) (u8vector? y))
-	   (u8vector-equal? x y))
-	  (else
-	   #f))))
-
-(define u8vector-equal?
-  (lambda (x y)
-    (let ((lx (u8vector-length x)))
-      (if (= lx (u8vector-length y))
-	  (#%u8vector-equal?-loop x y (- lx 1))
-	  #f))))
-
-(define #%u8vector-equal?-loop
-  (lambda (x y l)
-    (if (= l 0)
-	#t
-	(and (= (u8vector-ref x l) (u8vector-ref y l))
-	     (#%u8vector-equal?-loop x y (#%- l 1))))))
-
-(define assoc
-  (lambda (t l)
-    (cond ((null? l)
-	   #f)
-	  ((equal? t (caar l))
-	   (car l))
-	  (else
-	   (assoc t (cdr l))))))
-
-(define memq
-  (lambda (t l)
-    (cond ((null? l)
-	   #f)
-	  ((eq? (car l) t)
-	   l)
-	  (else
-	   (memq t (cdr l))))))
+;; Sorting. With < or > as order, numbers are sorted by native primitives
+;; (a merge sort relinking the pairs of a list, an introsort for vectors).
+;; Lists holding bignums are left to the generic sort.
+;; Other procedures use a merge sort relinking the pairs with set-cdr!.
+
+(define sort!
+  (lambda (lst less?)
+    (cond ((eq? less? <)
+           (or (#%list-sort! lst #f)
+               (#%merge-sort! lst (length lst) less?)))
+          ((eq? less? >)
+           (or (#%list-sort! lst #t)
+               (#%merge-sort! lst (length lst) less?)))
+          (else
+           (#%merge-sort! lst (length lst) less?)))))
+
+(define sort
+  (lambda (lst less?)
+    (sort! (append lst '()) less?)))
+
+(define list-tail
+  (lambda (lst k)
+    (if (= k 0)
+        lst
+        (list-tail (cdr lst) (#%- k 1)))))
+
+(define #%merge-sort!
+  (lambda (lst n less?)
+    (if (< n 2)
+        lst
+        (let* ((half (#%div-non-neg n 2))
+               (last (list-tail lst (#%- half 1)))
+               (rest (cdr last)))
+          (begin (set-cdr! last '())
+                 (#%merge! (#%merge-sort! lst half less?)
+                           (#%merge-sort! rest (#%- n half) less?)
+                           less?))))))
+
+(define #%merge!
+  (lambda (a b less?)
+    (cond ((null? a)
+           b)
+          ((null? b)
+           a)
+          ((less? (car b) (car a))
+           (begin (#%merge-loop! b a (cdr b) less?) b))
+          (else
+           (begin (#%merge-loop! a (cdr a) b less?) a)))))
+
+(define #%merge-loop!
+  (lambda (last a b less?)
+    (cond ((null? a)
+           (set-cdr! last b))
+          ((null? b)
+           (set-cdr! last a))
+          ((less? (car b) (car a))
+           (begin (set-cdr! last b) (#%merge-loop! b a (cdr b) less?)))
+          (else
+           (begin (set-cdr! last a) (#%merge-loop! a (cdr a) b less?))))))
+
+(define vector-sort!
+  (lambda (v less?)
+    (cond ((eq? less? <)
+           (#%vector-sort! v #f))
+          ((eq? less? >)
+           (#%vector-sort! v #t))
+          (else
+           (let* ((u8? (u8vector? v))
+                  (n   (if u8? (u8vector-length v) (numvector-length v)))
+                  (lst (#%vector->list v (if u8? u8vector-ref numvector-ref) n '())))
+             (#%list->vector! v (if u8? u8vector-set! numvector-set!) (sort! lst less?) 0))))))
+
+(define #%vector->list
+  (lambda (v ref i lst)
+    (if (= i 0)
+        lst
+        (#%vector->list v ref (#%- i 1) (cons (ref v (#%- i 1)) lst)))))
+
+(define #%list->vector!
+  (lambda (v set lst i)
+    (if (pair? lst)
+        (begin (set v i (car lst))
+               (#%list->vector! v set (cdr lst) (#%+ i 1))))))
 
 (define vector list)
 (define vector-ref list-ref)
@@ -339,35 +330,84 @@
   (lambda x
     (list->u8vector x)))
 
-(define list->u8vector
+(define make-u8vector
+  (lambda (n x)
+    (let ((v (#%make-u8vector n)))
+      (#%u8vector-fill! v x 0 n)
+      v)))
+
+(define u8vector-fill!
+  (lambda (v x)
+    (#%u8vector-fill! v x 0 (u8vector-length v))))
+
+(define u8vector-copy!
+  (lambda (source source-start target target-start n)
+    (#%u8vector-copy! source source-start target (cons target-start n))))
+
+(define u8vector-index
+  (lambda (v x)
+    (#%u8vector-index v x 0 (u8vector-length v))))
+
+(define make-s16vector
+  (lambda (n . x)
+    (#%make-numvector 1 n (if (pair? x) (car x) 0))))
+
+(define s16vector?
+  (lambda (x)
+    (eq? (#%numvector-kind x) 1)))
+
+(define s16vector
+  (lambda x
+    (#%list->numvector 1 x)))
+
+(define list->s16vector
+  (lambda (x)
+    (#%list->numvector 1 x)))
+
+(define s16vector-length numvector-length)
+(define s16vector-ref numvector-ref)
+(define s16vector-set! numvector-set!)
+
+(define make-s32vector
+  (lambda (n . x)
+    (#%make-numvector 2 n (if (pair? x) (car x) 0))))
+
+(define s32vector?
   (lambda (x)
-    (let* ((n (length x))
-	         (v (#%make-u8vector n)))
-      (#%list->u8vector-loop v 0 x)
+    (eq? (#%numvector-kind x) 2)))
+
+(define s32vector
+  (lambda x
+    (#%list->numvector 2 x)))
+
+(define list->s32vector
+  (lambda (x)
+    (#%list->numvector 2 x)))
+
+(define s32vector-length numvector-length)
+(define s32vector-ref numvector-ref)
+(define s32vector-set! numvector-set!)
+
+(define #%list->numvector
+  (lambda (kind x)
+    (let ((v (#%make-numvector kind (length x) 0)))
+      (#%list->numvector-loop v 0 x)
       v)))
 
-(define #%list->u8vector-loop
+(define #%list->numvector-loop
   (lambda (v n x)
-          (u8vector-set! v n (car x))
-          (if (not (null? (cdr x)))
-       	    (#%list->u8vector-loop v (#%+ n 1) (cdr x)))))
+    (if (pair? x)
+        (begin (numvector-set! v n (car x))
+               (#%list->numvector-loop v (#%+ n 1) (cdr x))))))
 
-(define make-u8vector
-  (lambda (n x)
-          (#%make-u8vector-loop (#%make-u8vector n) (- n 1) x)))
+(define make-eq-table
+  (lambda ()
+    (#%make-table #f)))
 
-(define #%make-u8vector-loop
-  (lambda (v n x)
-          (if (>= n 0)
-            (begin (u8vector-set! v n x)
-                   (#%make-u8vector-loop v (- n 1) x))
-            v)))
+(define make-equal-table
+  (lambda ()
+    (#%make-table #t)))
 
-(define u8vector-copy!
-  (lambda (source source-start target target-start n)
-    (if (> n 0)
-        (begin (u8vector-set! target target-start
-                              (u8vector-ref source source-start))
-               (u8vector-copy! source (+ source-start 1)
-                               target (+ target-start 1)
-                               (- n 1))))))
+(define table-ref
+  (lambda (t k . default)
+    (#%table-ref t k (if (pair? default) (car default) #f))))
@@ -4,6 +4,8 @@
 #include <unistd.h>
 #include <string.h>
 
+#include "../main/include/image.h"
+
 #define    INFO_MSG(format, ...) fprintf(stderr,    "\nINFO - In " format ".\n", ## __VA_ARGS__)
 #define WARNING_MSG(format, ...) fprintf(stderr, "\nWARNING - In " format ".\n", ## __VA_ARGS__)
 #define   ERROR_MSG(format, ...) fprintf(stderr,   "\nERROR - In " format ".\n", ## __VA_ARGS__)
@@ -122,12 +124,60 @@ bool read_hex_file(char * filename, uint8_t * buffer, int size)
   return !error;
 }
 
+// Writes the program of size bytes as a program image (see image.h)
+bool write_image_file(char * filename, uint8_t * buffer, int size)
+{
+  uint8_t  pad[IMAGE_ALIGN] = { 0 };
+  uint32_t start  = sizeof(image_header) + sizeof(image_section);
+  uint32_t offset = (start + IMAGE_ALIGN - 1) & ~(IMAGE_ALIGN - 1);
+
+  struct {
+    image_header  hdr;
+    image_section sec;
+  } img;
+
+  if ((size < 4) || (size > 0xFFFF)) {
+    ERROR("write_image_file", "Program size out of range");
+    return false;
+  }
+
+  memset(&img, 0, sizeof(img));
+  memcpy(img.hdr.magic, IMAGE_MAGIC, 4);
+  img.hdr.version       = IMAGE_VERSION;
+  img.hdr.section_count = 1;
+  img.hdr.size          = offset + size;
+  img.hdr.constants     = buffer[2];
+  img.hdr.globals       = buffer[3];
+  img.hdr.entry_point   = 4 + (buffer[2] * 5);
+  img.sec.kind          = IMAGE_SECTION_PROGRAM;
+  img.sec.offset        = offset;
+  img.sec.length        = size;
+
+  img.hdr.hash      = image_hash(image_hash(IMAGE_HASH_INIT, &img.sec, sizeof(img.sec)), buffer, size);
+  img.hdr.data_hash = IMAGE_HASH_INIT;
+
+  if ((f = fopen(filename, "wb")) == NULL) {
+    ERROR_MSG("write_image_file: Unable to open file %s", filename);
+    return false;
+  }
+
+  fwrite(&img, 1, start, f);
+  fwrite(pad, 1, offset - start, f);
+  fwrite(buffer, 1, size, f);
+  fclose(f);
+
+  return true;
+}
+
 int main(int argc, char **argv)
 {
-  if (argc != 3) {
+  bool image = (argc == 4) && (strcmp(argv[1], "-i") == 0);
+
+  if ((argc != 3) && !image) {
     fprintf(stderr,
       "\n"
-      "Usage: hex2bin input_hex_file output_bin_file\n\n"
+      "Usage: hex2bin [-i] input_hex_file output_bin_file\n\n"
+      "  -i  Write a program image for the workstation VM\n\n"
       "(c) GPL3 - Guy Turcotte - January 2018\n"
     );
 
@@ -137,6 +187,8 @@ int main(int argc, char **argv)
     uint8_t * buffer;
     bool      result;
 
+    if (image) argv++;
+
     result = false;
 
     buffer = calloc(60000, 1);
@@ -147,7 +199,10 @@ int main(int argc, char **argv)
 
       EXPECT_TRUE(result, "main: Unable to read test.hex properly");
 
-      if (result) {
+      if (result && image) {
+        result = write_image_file(argv[2], buffer, max_addr);
+      }
+      else if (result) {
         if ((f = fopen(argv[2], "wb")) == NULL) {
           ERROR_MSG("main: Unable to open file %s", argv[2]);
           result = false;
@@ -0,0 +1,320 @@
+#include "esp32-scheme-vm.h"
+
+#if WORKSTATION
+
+#include "vm-arch.h"
+#include "mm.h"
+#include "hexfile.h"
+#include "interpreter.h"
+#include "testing.h"
+#include "ports.h"
+#include "files.h"
+#include "snapshot.h"
+
+#define BATCH 1
+#include "batch.h"
+
+#include <pthread.h>
+#include <time.h>
+
+typedef struct {
+  char   * program_filename;
+  char   * input_filename;   // NULL if the program has no input
+  char   * output;           // Captured console output
+  size_t   output_size;
+  bool     completed;        // false if fatal error or unable to load
+  double   duration;         // in seconds
+  int      gc_count;
+  double   max_gc_time;      // in seconds
+} batch_job;
+
+PRIVATE batch_job     * jobs;
+PRIVATE int             job_count;
+PRIVATE int             next_job;
+PRIVATE pthread_mutex_t next_job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+PRIVATE double elapsed_time()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/** run_job().
+
+  Runs a job in a new virtual machine context. A fatal error of the
+  program comes back here through the context exit point, such that the
+  other jobs are not disturbed.
+
+ */
+
+PRIVATE void run_job(batch_job * job)
+{
+  jmp_buf exit_point;
+  double  start = elapsed_time();
+
+  vm_context * ctx = vm_new_context();
+
+  job->completed = false;
+
+  if (ctx == NULL) {
+    ERROR("run_job", "Unable to allocate a VM context");
+    return;
+  }
+
+  vm_select(ctx);
+
+  vm->out = open_memstream(&job->output, &job->output_size);
+  vm->in  = fopen(job->input_filename != NULL ? job->input_filename : "/dev/null", "r");
+
+  if (vm->in == NULL) {
+    ERROR_MSG("run_job: Unable to open input file %s.", job->input_filename);
+  }
+  else if ((vm->out != NULL) &&
+           program_load(job->program_filename) &&
+           (snapshot_loaded() ? snapshot_restore() : mm_init(vm->program))) {
+
+    vm->exit_point = &exit_point;
+
+    if (setjmp(exit_point) == 0) {
+      interpreter();
+      job->completed = true;
+    }
+
+    vm->exit_point = NULL;
+  }
+
+  job->duration        = elapsed_time() - start;
+  job->gc_count        = vm->gc_call_counter;
+  job->max_gc_time     = vm->max_gc_duration;
+
+  ports_release();
+  files_release();
+
+  if (vm->out != NULL) fclose(vm->out);
+  if (vm->in  != NULL) fclose(vm->in);
+  program_release();
+
+  vm_delete_context(ctx);
+}
+
+PRIVATE void * worker(void * arg)
+{
+  int i;
+
+  for (;;) {
+    pthread_mutex_lock(&next_job_lock);
+    i = next_job++;
+    pthread_mutex_unlock(&next_job_lock);
+
+    if (i >= job_count) break;
+
+    run_job(&jobs[i]);
+  }
+
+  return NULL;
+}
+
+PRIVATE void run_jobs(int thread_count)
+{
+  pthread_t threads[thread_count];
+  int       i, started;
+
+  next_job = 0;
+
+  for (started = 0; started < thread_count; started++) {
+    if (pthread_create(&threads[started], NULL, worker, NULL) != 0) {
+      WARNING("run_jobs", "Unable to start all threads");
+      break;
+    }
+  }
+
+  // If no thread could be started, the jobs are run by this one
+  if (started == 0) worker(NULL);
+
+  for (i = 0; i < started; i++) pthread_join(threads[i], NULL);
+}
+
+PRIVATE void report()
+{
+  int    i;
+  int    failed    = 0;
+  int    gc_count  = 0;
+  double job_time  = 0.0;
+  double max_gc    = 0.0;
+
+  for (i = 0; i < job_count; i++) {
+    batch_job * job = &jobs[i];
+
+    printf("==> %s%s%s <==\n",
+           job->program_filename,
+           job->input_filename != NULL ? " < " : "",
+           job->input_filename != NULL ? job->input_filename : "");
+    if (job->output != NULL) fwrite(job->output, 1, job->output_size, stdout);
+  }
+  fflush(stdout);
+
+  fprintf(stderr, "\n%5s  %-6s  %10s  %8s  %11s  %s\n",
+          "Job", "Status", "Time (ms)", "GC Count", "Max GC (ms)", "Program");
+
+  for (i = 0; i < job_count; i++) {
+    batch_job * job = &jobs[i];
+
+    fprintf(stderr, "%5d  %-6s  %10.3f  %8d  %11.3f  %s%s%s\n",
+            i + 1,
+            job->completed ? "OK" : "FAILED",
+            job->duration * 1000.0,
+            job->gc_count,
+            job->max_gc_time * 1000.0,
+            job->program_filename,
+            job->input_filename != NULL ? " < " : "",
+            job->input_filename != NULL ? job->input_filename : "");
+
+    if (!job->completed) failed++;
+    gc_count += job->gc_count;
+    job_time += job->duration;
+    if (job->max_gc_time > max_gc) max_gc = job->max_gc_time;
+  }
+
+  fprintf(stderr,
+    "\nJobs: %d  Failed: %d  Jobs Time: %.3f ms  GC Count: %d  Max GC: %.3f ms\n",
+    job_count, failed, job_time * 1000.0, gc_count, max_gc * 1000.0);
+}
+
+bool batch_run(char ** filenames, int count, int thread_count, bool inputs)
+{
+  int    i;
+  bool   result = true;
+  double start;
+
+  job_count = inputs ? count - 1 : count;
+
+  if (job_count <= 0) {
+    ERROR("batch_run", "No job to run");
+    return false;
+  }
+
+  if ((jobs = calloc(job_count, sizeof(batch_job))) == NULL) {
+    ERROR("batch_run", "Unable to allocate jobs table");
+    return false;
+  }
+
+  for (i = 0; i < job_count; i++) {
+    if (inputs) {
+      jobs[i].program_filename = filenames[0];
+      jobs[i].input_filename   = filenames[i + 1];
+    }
+    else {
+      jobs[i].program_filename = filenames[i];
+    }
+  }
+
+  if (thread_count <= 0) thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+  if (thread_count <= 0) thread_count = 1;
+  if (thread_count > job_count) thread_count = job_count;
+
+  start = elapsed_time();
+  run_jobs(thread_count);
+
+  report();
+  fprintf(stderr, "Threads: %d  Wall Time: %.3f ms\n",
+          thread_count, (elapsed_time() - start) * 1000.0);
+
+  for (i = 0; i < job_count; i++) {
+    result = result && jobs[i].completed;
+    free(jobs[i].output);
+  }
+
+  free(jobs);
+  jobs = NULL;
+
+  return result;
+}
+
+#if TESTS
+
+// Writes a program as an Intel Hex file
+PRIVATE bool write_hex_file(char * filename, uint8_t * code, int size)
+{
+  FILE    * f;
+  uint8_t   checksum;
+  int       i;
+
+  if ((f = fopen(filename, "w")) == NULL) return false;
+
+  checksum = size;
+  fprintf(f, ":%02X000000", size);
+  for (i = 0; i < size; i++) {
+    fprintf(f, "%02X", code[i]);
+    checksum += code[i];
+  }
+  fprintf(f, "%02X\n:00000001FF\n", (uint8_t) -checksum);
+  fclose(f);
+
+  return true;
+}
+
+void batch_tests()
+{
+  TESTM("batch");
+
+  TEST("Job Execution");
+
+    uint8_t hello[] = {
+      0xD7, 0xFB, 0, 0,       //     header: no constant, no global
+      0xA0, 0x45,             //  4: LDC 65
+      0x05,                   //  6: LDCS 1
+      0xE9,                   //  7: #%putchar
+      0xC0                    //  8: #%halt
+    };
+
+    uint8_t fatal[] = {
+      0xD7, 0xFB, 0, 0,       //     header: no constant, no global
+      0x05,                   //  4: LDCS 1
+      0xC8,                   //  5: car
+      0xC0                    //  6: #%halt
+    };
+
+    char hello_name[] = "/tmp/batch-hello-XXXXXX";
+    char fatal_name[] = "/tmp/batch-fatal-XXXXXX";
+
+    close(mkstemp(hello_name));
+    close(mkstemp(fatal_name));
+
+    EXPECT_TRUE(write_hex_file(hello_name, hello, sizeof(hello)), "Unable to write test program");
+    EXPECT_TRUE(write_hex_file(fatal_name, fatal, sizeof(fatal)), "Unable to write test program");
+
+    vm_context * main_ctx = vm;
+    batch_job    job      = { .program_filename = hello_name };
+
+    run_job(&job);
+
+    EXPECT_TRUE(job.completed,                     "Job not completed");
+    EXPECT_TRUE(job.output_size == 1,              "Job output size is wrong");
+    EXPECT_TRUE((job.output != NULL) && (job.output[0] == 'A'), "Job output not captured");
+    EXPECT_TRUE(vm == main_ctx,                    "Context not restored after the job");
+    free(job.output);
+
+    job = (batch_job) { .program_filename = fatal_name };
+
+    run_job(&job);
+
+    EXPECT_TRUE(!job.completed,                    "Job with a fatal error reported as completed");
+    EXPECT_TRUE(vm == main_ctx,                    "Context not restored after a fatal error");
+    free(job.output);
+
+  TEST("Thread Pool");
+
+    char * names[] = { hello_name, hello_name, fatal_name, hello_name };
+
+    EXPECT_TRUE( batch_run(names, 2, 2, false),  "Batch of good programs failed");
+    EXPECT_TRUE(!batch_run(names, 4, 3, false),  "Batch failure not reported");
+    EXPECT_TRUE( batch_run(names, 3, 0, true),   "Batch of inputs failed");
+
+    unlink(hello_name);
+    unlink(fatal_name);
+}
+#endif
+
+#endif // WORKSTATION
@@ -16,30 +16,26 @@
  * bignum_tmp3 => div mul
  * bignum_tmp4 => div mul
  * bignum_tmp5 => div
+ *
+ * They are kept in the vm_context (vm->bignum_tmp1 ...).
  */
 
-static cell_p bignum_tmp1,
-              bignum_tmp2,
-              bignum_tmp3,
-              bignum_tmp4,
-              bignum_tmp5;
-
 void bignum_gc_init()
 {
-	bignum_tmp1 = NIL;
-	bignum_tmp2 = NIL;
-	bignum_tmp3 = NIL;
-	bignum_tmp4 = NIL;
-	bignum_tmp5 = NIL;
+	vm->bignum_tmp1 = NIL;
+	vm->bignum_tmp2 = NIL;
+	vm->bignum_tmp3 = NIL;
+	vm->bignum_tmp4 = NIL;
+	vm->bignum_tmp5 = NIL;
 }
 
 void bignum_gc_mark()
 {
-	mm_mark(bignum_tmp1);
-	mm_mark(bignum_tmp2);
-	mm_mark(bignum_tmp3);
-	mm_mark(bignum_tmp4);
-	mm_mark(bignum_tmp5);
+	mm_mark(vm->bignum_tmp1);
+	mm_mark(vm->bignum_tmp2);
+	mm_mark(vm->bignum_tmp3);
+	mm_mark(vm->bignum_tmp4);
+	mm_mark(vm->bignum_tmp5);
 }
 
 PRIVATE integer integer_hi(integer x)
@@ -157,26 +153,26 @@ PRIVATE integer shr(integer x)   // TODO have shift_right
 	//  by the original x, so we're good. Same situation in most other
 	//  bignum operations.
 
-	bignum_tmp1 = NIL;
+	vm->bignum_tmp1 = NIL;
 	digit d;
 
 	for (;;) {
 		if (obj_eq(x, ZERO) || obj_eq(x, NEG1)) {
-			bignum_tmp1 = norm(bignum_tmp1, x);
+			vm->bignum_tmp1 = norm(vm->bignum_tmp1, x);
 			break;
 		}
 
 		d = integer_lo(x);
 		x = integer_hi(x);
-		bignum_tmp1 =
+		vm->bignum_tmp1 =
 		        new_bignum((d >> 1) |
 		                      ((integer_lo(x) & 1) ? (1 << (digit_width - 1)) : 0),
-		                      bignum_tmp1);
+		                      vm->bignum_tmp1);
 	}
 
 	// clear the root then return
-	cell_p tmp = bignum_tmp1;
-	bignum_tmp1 = NIL;
+	cell_p tmp = vm->bignum_tmp1;
+	vm->bignum_tmp1 = NIL;
 	return tmp;
 }
 
@@ -200,12 +196,12 @@ PRIVATE integer shl(integer x)
 	integer negc = ZERO; /* negative carry */
 	integer temp;
 
-	bignum_tmp1 = NIL;
+	vm->bignum_tmp1 = NIL;
 	digit d;
 
 	for (;;) {
 		if (obj_eq(x, negc)) {
-			bignum_tmp1 = norm(bignum_tmp1, x);
+			vm->bignum_tmp1 = norm(vm->bignum_tmp1, x);
 			break;
 		}
 
@@ -213,13 +209,13 @@ PRIVATE integer shl(integer x)
 		x = integer_hi(x);
 		temp = negc;
 		negc = negative_carry(d & (1 << (digit_width - 1)));
-		bignum_tmp1 =
-		        new_bignum((d << 1) | obj_eq(temp, NEG1), bignum_tmp1);
+		vm->bignum_tmp1 =
+		        new_bignum((d << 1) | obj_eq(temp, NEG1), vm->bignum_tmp1);
 	}
 
 	// clear the root then return
-	cell_p tmp = bignum_tmp1;
-	bignum_tmp1 = NIL;
+	cell_p tmp = vm->bignum_tmp1;
+	vm->bignum_tmp1 = NIL;
 	return tmp;
 }
 
@@ -231,21 +227,21 @@ PRIVATE integer shift_left(integer x, uint16_t n)
 		return x;
 	}
 
-	bignum_tmp2 = x;
+	vm->bignum_tmp2 = x;
 
 	while (n & (digit_width-1)) {
-		bignum_tmp2 = shl(bignum_tmp2);
+		vm->bignum_tmp2 = shl(vm->bignum_tmp2);
 		n--;
 	}
 
 	while (n > 0) {
-		bignum_tmp2 = new_bignum(0, bignum_tmp2);
+		vm->bignum_tmp2 = new_bignum(0, vm->bignum_tmp2);
 		n -= digit_width;
 	}
 
 	// clear the root then return
-	cell_p tmp = bignum_tmp2;
-	bignum_tmp2 = NIL;
+	cell_p tmp = vm->bignum_tmp2;
+	vm->bignum_tmp2 = NIL;
 	return tmp;
 }
 
@@ -274,16 +270,16 @@ PRIVATE integer scale(digit n, integer x)
 		return x;
 	}
 
-	bignum_tmp1 = NIL;
+	vm->bignum_tmp1 = NIL;
 	carry = 0;
 
 	for (;;) {
 		if (obj_eq(x, ZERO)) {
 			if (carry <= MAX_SMALL_INT_VALUE) {
-				bignum_tmp1 = norm(bignum_tmp1, ENCODE_SMALL_INT(carry));
+				vm->bignum_tmp1 = norm(vm->bignum_tmp1, ENCODE_SMALL_INT(carry));
 			}
       else {
-				bignum_tmp1 = norm(bignum_tmp1, new_bignum(carry, ZERO));
+				vm->bignum_tmp1 = norm(vm->bignum_tmp1, new_bignum(carry, ZERO));
 			}
 
 			break;
@@ -294,10 +290,10 @@ PRIVATE integer scale(digit n, integer x)
 
 			// -1 as a literal is wrong with SIXPIC, thus the double negative
 			if (carry >= ((1 << digit_width) + MIN_SMALL_INT_VALUE)) {
-				bignum_tmp1 = norm(bignum_tmp1, ENCODE_SMALL_INT(carry));
+				vm->bignum_tmp1 = norm(vm->bignum_tmp1, ENCODE_SMALL_INT(carry));
 			}
       else {
-				bignum_tmp1 = norm(bignum_tmp1, new_bignum(carry, NEG1));
+				vm->bignum_tmp1 = norm(vm->bignum_tmp1, new_bignum(carry, NEG1));
 			}
 
 			break;
@@ -308,15 +304,43 @@ PRIVATE integer scale(digit n, integer x)
 
 		x = integer_hi(x);
 		carry = m >> digit_width;
-		bignum_tmp1 = new_bignum(m, bignum_tmp1);
+		vm->bignum_tmp1 = new_bignum(m, vm->bignum_tmp1);
 	}
 
 	// clear the root then return
-	cell_p tmp = bignum_tmp1;
-	bignum_tmp1 = NIL;
+	cell_p tmp = vm->bignum_tmp1;
+	vm->bignum_tmp1 = NIL;
 	return tmp;
 }
 
+/** fixnum_to_bignum().
+
+  Returns the fixnum x as a normalized bignum, such that it can be used in
+  bignum operations.
+
+ */
+
+integer fixnum_to_bignum(integer x)
+{
+  int32_t value = RAM_GET_FIXNUM_VALUE(x);
+  int32_t hi    = value >> digit_width;
+
+  if ((value >= MIN_SMALL_INT_VALUE) && (value <= MAX_SMALL_INT_VALUE)) {
+    return ENCODE_SMALL_INT(value);
+  }
+
+  if ((hi >= MIN_SMALL_INT_VALUE) && (hi <= MAX_SMALL_INT_VALUE)) {
+    return new_bignum(value, ENCODE_SMALL_INT(hi));
+  }
+
+  vm->bignum_tmp5 = new_bignum(hi, (hi < 0) ? NEG1 : ZERO);
+
+  x = new_bignum(value, vm->bignum_tmp5);
+  vm->bignum_tmp5 = NIL;
+
+  return x;
+}
+
 uint8_t cmp(integer x, integer y)
 {
 	/* cmp(x,y) return 0 when x<y, 2 when x>y, and 1 when x=y */
@@ -373,18 +397,18 @@ integer add(integer x, integer y)
 	/* add(x,y) returns the sum of the integers x and y */
 
 	integer negc = ZERO; /* negative carry */
-	bignum_tmp1 = NIL; /* #f terminated for the norm function */
+	vm->bignum_tmp1 = NIL; /* #f terminated for the norm function */
 	digit dx;
 	digit dy;
 
 	for (;;) {
 		if (obj_eq(x, negc)) {
-			bignum_tmp1 = norm(bignum_tmp1, y);
+			vm->bignum_tmp1 = norm(vm->bignum_tmp1, y);
 			break;
 		}
 
 		if (obj_eq(y, negc)) {
-			bignum_tmp1 = norm(bignum_tmp1, x);
+			vm->bignum_tmp1 = norm(vm->bignum_tmp1, x);
 			break;
 		}
 
@@ -403,12 +427,12 @@ integer add(integer x, integer y)
 		x = integer_hi(x);
 		y = integer_hi(y);
 
-		bignum_tmp1 = new_bignum(dx, bignum_tmp1);
+		vm->bignum_tmp1 = new_bignum(dx, vm->bignum_tmp1);
 	}
 
 	// clear the root then return
-	cell_p tmp = bignum_tmp1;
-	bignum_tmp1 = NIL;
+	cell_p tmp = vm->bignum_tmp1;
+	vm->bignum_tmp1 = NIL;
 	return tmp;
 }
 
@@ -416,18 +440,18 @@ integer sub(integer x, integer y)
 {
 	/* sub(x,y) returns the difference of the integers x and y */
 	integer negc = NEG1; /* negative carry */
-	bignum_tmp1 = NIL;
+	vm->bignum_tmp1 = NIL;
 	digit dx;
 	digit dy;
 
 	for (;;) {
 		if (obj_eq(x, negc) && (obj_eq(y, ZERO) || obj_eq(y, NEG1))) {
-			bignum_tmp1 = norm(bignum_tmp1, invert(y));
+			vm->bignum_tmp1 = norm(vm->bignum_tmp1, invert(y));
 			break;
 		}
 
 		if (obj_eq(y, invert(negc))) {
-			bignum_tmp1 = norm(bignum_tmp1, x);
+			vm->bignum_tmp1 = norm(vm->bignum_tmp1, x);
 			break;
 		}
 
@@ -446,12 +470,12 @@ integer sub(integer x, integer y)
 		x = integer_hi(x);
 		y = integer_hi(y);
 
-		bignum_tmp1 = new_bignum(dx, bignum_tmp1);
+		vm->bignum_tmp1 = new_bignum(dx, vm->bignum_tmp1);
 	}
 
 	// clear the root then return
-	cell_p tmp = bignum_tmp1;
-	bignum_tmp1 = NIL;
+	cell_p tmp = vm->bignum_tmp1;
+	vm->bignum_tmp1 = NIL;
 	return tmp; // TODO have macro for that.
 }
 
@@ -460,12 +484,12 @@ integer mulnonneg(integer x, integer y)
 	/* mulnonneg(x,y) returns the product of the integers x and y
 	   where x is nonnegative */
 
-	bignum_tmp3 = NIL;
-	bignum_tmp4 = scale(integer_lo(x), y);
+	vm->bignum_tmp3 = NIL;
+	vm->bignum_tmp4 = scale(integer_lo(x), y);
 
 	for (;;) {
-		bignum_tmp3 = new_bignum(integer_lo(bignum_tmp4), bignum_tmp3);
-		bignum_tmp4 = integer_hi(bignum_tmp4);
+		vm->bignum_tmp3 = new_bignum(integer_lo(vm->bignum_tmp4), vm->bignum_tmp3);
+		vm->bignum_tmp4 = integer_hi(vm->bignum_tmp4);
 		x = integer_hi(x);
 
 		if (obj_eq(x, ZERO)) {
@@ -473,15 +497,15 @@ integer mulnonneg(integer x, integer y)
 		}
 
 		// We need to register the result of scale because add can cause GC.
-		bignum_tmp2 = scale(integer_lo(x), y);
-		bignum_tmp4 = add(bignum_tmp4, bignum_tmp2);
+		vm->bignum_tmp2 = scale(integer_lo(x), y);
+		vm->bignum_tmp4 = add(vm->bignum_tmp4, vm->bignum_tmp2);
 	}
 
-	cell_p tmp1 = bignum_tmp3;
-	cell_p tmp2 = bignum_tmp4;
-	bignum_tmp2 = NIL;
-	bignum_tmp3 = NIL;
-	bignum_tmp4 = NIL;
+	cell_p tmp1 = vm->bignum_tmp3;
+	cell_p tmp2 = vm->bignum_tmp4;
+	vm->bignum_tmp2 = NIL;
+	vm->bignum_tmp3 = NIL;
+	vm->bignum_tmp4 = NIL;
 
 	return norm(tmp1, tmp2);
 }
@@ -493,33 +517,33 @@ integer divnonneg(integer x, integer y)
 
 	// x and y end up pointing to newly allocated bignums, so we need
 	// to register them with the GC.
-	bignum_tmp4 = x;
-	bignum_tmp5 = y;
+	vm->bignum_tmp4 = x;
+	vm->bignum_tmp5 = y;
 
-	bignum_tmp3 = ZERO;
-	uint16_t lx = integer_length(bignum_tmp4);
-	uint16_t ly = integer_length(bignum_tmp5);
+	vm->bignum_tmp3 = ZERO;
+	uint16_t lx = integer_length(vm->bignum_tmp4);
+	uint16_t ly = integer_length(vm->bignum_tmp5);
 
 	if (lx >= ly) {
 		lx = lx - ly;
 
-		bignum_tmp5 = shift_left(bignum_tmp5, lx);
+		vm->bignum_tmp5 = shift_left(vm->bignum_tmp5, lx);
 
 		do {
-			bignum_tmp3 = shl(bignum_tmp3);
+			vm->bignum_tmp3 = shl(vm->bignum_tmp3);
 
-			if (cmp(bignum_tmp4, bignum_tmp5) >= 1) {
-				bignum_tmp4 = sub(bignum_tmp4, bignum_tmp5);
-				bignum_tmp3 = add(POS1, bignum_tmp3);
+			if (cmp(vm->bignum_tmp4, vm->bignum_tmp5) >= 1) {
+				vm->bignum_tmp4 = sub(vm->bignum_tmp4, vm->bignum_tmp5);
+				vm->bignum_tmp3 = add(POS1, vm->bignum_tmp3);
 			}
 
-			bignum_tmp5 = shr(bignum_tmp5);
+			vm->bignum_tmp5 = shr(vm->bignum_tmp5);
 		} while (lx-- != 0);
 	}
 
-	cell_p tmp = bignum_tmp3;
-	bignum_tmp3 = NIL;
-	bignum_tmp4 = NIL;
+	cell_p tmp = vm->bignum_tmp3;
+	vm->bignum_tmp3 = NIL;
+	vm->bignum_tmp4 = NIL;
 	return tmp;
 }
 
@@ -527,23 +551,23 @@ integer bitwise_ior(integer x, integer y)
 {
 	/* returns the bitwise inclusive or of x and y */
 
-	bignum_tmp1 = NIL;
+	vm->bignum_tmp1 = NIL;
 
 	for (;;) {
 		if (obj_eq(x, ZERO)) {
-			cell_p tmp = bignum_tmp1;
-			bignum_tmp1 = NIL;
+			cell_p tmp = vm->bignum_tmp1;
+			vm->bignum_tmp1 = NIL;
 			return norm(tmp, x);
 		}
 
 		if (obj_eq(x, NEG1)) {
-			cell_p tmp = bignum_tmp1;
-			bignum_tmp1 = NIL;
+			cell_p tmp = vm->bignum_tmp1;
+			vm->bignum_tmp1 = NIL;
 			return norm(tmp, x);
 		}
 
-		bignum_tmp1 = new_bignum(integer_lo(x) | integer_lo(y),
-		                           bignum_tmp1);
+		vm->bignum_tmp1 = new_bignum(integer_lo(x) | integer_lo(y),
+		                           vm->bignum_tmp1);
 		x = integer_hi(x);
 		y = integer_hi(y);
 	}
@@ -553,23 +577,23 @@ integer bitwise_and(integer x, integer y)
 {
 	/* returns the bitwise inclusive and of x and y */
 
-	bignum_tmp1 = NIL;
+	vm->bignum_tmp1 = NIL;
 
 	for (;;) {
 		if (obj_eq(x, ZERO)) {
-			cell_p tmp = bignum_tmp1;
-			bignum_tmp1 = NIL;
+			cell_p tmp = vm->bignum_tmp1;
+			vm->bignum_tmp1 = NIL;
 			return norm(tmp, ZERO);
 		}
 
 		if (obj_eq(x, NEG1)) {
-			cell_p tmp = bignum_tmp1;
-			bignum_tmp1 = NIL;
+			cell_p tmp = vm->bignum_tmp1;
+			vm->bignum_tmp1 = NIL;
 			return norm(tmp, y);
 		}
 
-		bignum_tmp1 = new_bignum(integer_lo(x) & integer_lo(y),
-		                           bignum_tmp1);
+		vm->bignum_tmp1 = new_bignum(integer_lo(x) & integer_lo(y),
+		                           vm->bignum_tmp1);
 		x = integer_hi(x);
 		y = integer_hi(y);
 	}
@@ -579,22 +603,22 @@ integer bitwise_not(integer x)
 {
 	/* returns the bitwise not of x */
 
-	bignum_tmp1 = NIL;
+	vm->bignum_tmp1 = NIL;
 
 	for (;;) {
 		if (obj_eq(x, ZERO)) {
-			cell_p tmp = bignum_tmp1;
-			bignum_tmp1 = NIL;
+			cell_p tmp = vm->bignum_tmp1;
+			vm->bignum_tmp1 = NIL;
 			return norm(tmp, NEG1);
 		}
 
 		if (obj_eq(x, NEG1)) {
-			cell_p tmp = bignum_tmp1;
-			bignum_tmp1 = NIL;
+			cell_p tmp = vm->bignum_tmp1;
+			vm->bignum_tmp1 = NIL;
 			return norm(tmp, ZERO);
 		}
 
-		bignum_tmp1 = new_bignum(~integer_lo(x), bignum_tmp1);
+		vm->bignum_tmp1 = new_bignum(~integer_lo(x), vm->bignum_tmp1);
 
 		x = integer_hi(x);
 	}
@@ -604,23 +628,23 @@ integer bitwise_xor(integer x, integer y)   // TODO similar to ior (only diff is
 {
 	/* returns the bitwise inclusive or of x and y */
 
-	bignum_tmp1 = NIL;
+	vm->bignum_tmp1 = NIL;
 
 	for (;;) {
 		if (obj_eq(x, ZERO)) {
-			cell_p tmp = bignum_tmp1;
-			bignum_tmp1 = NIL;
+			cell_p tmp = vm->bignum_tmp1;
+			vm->bignum_tmp1 = NIL;
 			return norm(tmp, y);
 		}
 
 		if (obj_eq(x, NEG1)) {
-			cell_p tmp = bignum_tmp1;
-			bignum_tmp1 = NIL;
+			cell_p tmp = vm->bignum_tmp1;
+			vm->bignum_tmp1 = NIL;
 			return norm(tmp, x);
 		}
 
-		bignum_tmp1 = new_bignum(integer_lo(x) ^ integer_lo(y),
-		                           bignum_tmp1);
+		vm->bignum_tmp1 = new_bignum(integer_lo(x) ^ integer_lo(y),
+		                           vm->bignum_tmp1);
 		x = integer_hi(x);
 		y = integer_hi(y);
 	}
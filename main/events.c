@@ -0,0 +1,754 @@
+// events
+// Builtin Indexes: 47..49, 53
+
+#include "esp32-scheme-vm.h"
+#include "vm-arch.h"
+#include "mm.h"
+#include "testing.h"
+
+#include "interpreter.h"
+#include "primitives.h"
+
+#define EVENTS 1
+#include "events.h"
+
+#if __linux__
+  #define EPOLL 1
+  #include <sys/epoll.h>
+  #include <sys/eventfd.h>
+#endif
+
+#if WORKSTATION
+  #include <errno.h>
+  #include <poll.h>
+  #include <time.h>
+#else
+  #include "esp_timer.h"
+#endif
+
+// epoll data of the wake-up eventfd. The data of a file descriptor is the
+// file descriptor itself: all its waiters share one registration.
+
+#define WAKEUP_KEY 0xFFFFFFFFFFFFFFFFULL
+
+uint32_t events_now()
+{
+  #if WORKSTATION
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+  #else
+    return (uint32_t)(esp_timer_get_time() / 1000);
+  #endif
+}
+
+/** events_open().
+
+  Creates the epoll instance and the wake-up eventfd of the current
+  context, the first time the event loop is used.
+
+ */
+
+PRIVATE void events_open()
+{
+  #if EPOLL
+    if (vm->epoll_fd >= 0) return;
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = WAKEUP_KEY };
+
+    vm->epoll_fd  = epoll_create1(EPOLL_CLOEXEC);
+    vm->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if ((vm->epoll_fd < 0) || (vm->wakeup_fd < 0)) {
+      FATAL("events_open", "Unable to create the event loop");
+    }
+
+    epoll_ctl(vm->epoll_fd, EPOLL_CTL_ADD, vm->wakeup_fd, &ev);
+  #endif
+}
+
+void events_close()
+{
+  #if EPOLL
+    if (vm->epoll_fd  >= 0) close(vm->epoll_fd);
+    if (vm->wakeup_fd >= 0) close(vm->wakeup_fd);
+  #endif
+
+  vm->epoll_fd = vm->wakeup_fd = -1;
+}
+
+/** Timer wheel.
+
+  A waiter with a deadline is linked in the bucket of its deadline. As the
+  buckets are checked every ms (of elapsed time) in turn, only the waiters
+  whose deadline could be reached are visited. A deadline more than
+  TIMER_WHEEL_SIZE ms away stays in its bucket for more turns of the wheel.
+
+ */
+
+PRIVATE void timer_insert(uint8_t slot)
+{
+  event_waiter * w = &vm->waiters[slot];
+  uint8_t bucket   = w->deadline % TIMER_WHEEL_SIZE;
+
+  if (vm->timer_count++ == 0) {
+    vm->timer_tick = events_now();
+  }
+
+  w->next = vm->timer_wheel[bucket];
+  vm->timer_wheel[bucket] = slot + 1;
+}
+
+PRIVATE void timer_remove(uint8_t slot)
+{
+  uint8_t * link = &vm->timer_wheel[vm->waiters[slot].deadline % TIMER_WHEEL_SIZE];
+
+  while (*link != slot + 1) {
+    link = &vm->waiters[*link - 1].next;
+  }
+
+  *link = vm->waiters[slot].next;
+  vm->timer_count--;
+}
+
+/** events_watch().
+
+  Registers fd in the epoll instance with the events of all its waiters,
+  or removes it when no waiter is left. The registration is one-shot: it
+  is armed again after an event for the waiters still waiting. Returns
+  false if fd can't be waited on.
+
+ */
+
+#if EPOLL
+PRIVATE bool events_watch(int fd)
+{
+  struct epoll_event ev = { .events = EPOLLONESHOT, .data.u64 = (uint32_t) fd };
+  bool waited = false;
+
+  for (uint8_t slot = 0; slot < EVENT_WAITERS; slot++) {
+    event_waiter * w = &vm->waiters[slot];
+
+    if (w->used && (w->fd == fd)) {
+      waited = true;
+      if (w->mode & EVENT_READ)  ev.events |= EPOLLIN;
+      if (w->mode & EVENT_WRITE) ev.events |= EPOLLOUT;
+    }
+  }
+
+  if (!waited) {
+    epoll_ctl(vm->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    return true;
+  }
+
+  return (epoll_ctl(vm->epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0) ||
+         ((errno == ENOENT) && (epoll_ctl(vm->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0));
+}
+#endif
+
+/** events_add().
+
+  Reserves a waiter slot for the running task and sets it to be suspended
+  at the next instruction. fd is -1 if not waiting on a file descriptor,
+  channel is -1 if not waiting on a wake-up channel and timeout (in ms) is
+  negative if there is no deadline.
+
+ */
+
+PRIVATE void events_add(int fd, uint8_t mode, int8_t channel, int32_t timeout)
+{
+  uint8_t slot;
+
+  if (vm->waiter_count >= EVENT_WAITERS) {
+    FATAL("events_add", "Too many waiting tasks");
+  }
+
+  for (slot = 0; vm->waiters[slot].used; slot++) ;
+
+  event_waiter * w = &vm->waiters[slot];
+
+  w->used     = true;
+  w->task     = NIL;
+  w->fd       = fd;
+  w->mode     = mode & (EVENT_READ | EVENT_WRITE);
+  w->channel  = channel;
+  w->timed    = timeout >= 0;
+  w->deadline = events_now() + timeout;
+
+  if (fd >= 0) {
+    #if EPOLL
+      events_open();
+
+      if (!events_watch(fd)) {
+        w->used = false;
+        events_watch(fd);
+        FATAL("fd-wait", "Unable to wait on this file descriptor");
+      }
+    #else
+      w->used = false;
+      FATAL("fd-wait", "Not supported on this platform");
+    #endif
+  }
+
+  if (w->timed) timer_insert(slot);
+
+  vm->waiter_count++;
+  vm->suspending = slot + 1;
+  vm->slice_left = 1;
+}
+
+/** events_park().
+
+  Keeps the continuation of the suspended task in its waiter slot.
+
+ */
+
+void events_park(cell_p k)
+{
+  vm->waiters[vm->suspending - 1].task = k;
+  vm->suspending = 0;
+}
+
+/** event_wake().
+
+  Replaces the placeholder on the stack of a waiting task with the result
+  of its wait and puts the task back in the run queue.
+
+ */
+
+PRIVATE void event_wake(uint8_t slot, cell_p result)
+{
+  event_waiter * w = &vm->waiters[slot];
+
+  RAM_SET_CAR(RAM_GET_CLOSURE_ENV(RAM_GET_CONT_CLOSURE(w->task)), result);
+  task_push_back(w->task);
+
+  if (w->timed) timer_remove(slot);
+
+  w->used = false;
+  w->task = NIL;
+  vm->waiter_count--;
+
+  #if EPOLL
+    if (w->fd >= 0) events_watch(w->fd);
+  #endif
+}
+
+PRIVATE void events_wake_channels(uint32_t channels)
+{
+  for (uint8_t slot = 0; slot < EVENT_WAITERS; slot++) {
+    event_waiter * w = &vm->waiters[slot];
+
+    if (w->used && (w->task != NIL) && (w->channel >= 0) &&
+        (channels & (1UL << w->channel))) {
+      event_wake(slot, TRUE);
+    }
+  }
+}
+
+/** timers_expire().
+
+  Wakes up the waiters whose deadline is reached, checking the buckets of
+  the time elapsed since the last check.
+
+ */
+
+PRIVATE void timers_expire(uint32_t now)
+{
+  uint32_t ticks = now - vm->timer_tick;
+
+  if (vm->timer_count == 0) return;
+
+  if (ticks >= TIMER_WHEEL_SIZE) ticks = TIMER_WHEEL_SIZE - 1;
+
+  for (uint32_t tick = now - ticks; tick != now + 1; tick++) {
+    uint8_t next = vm->timer_wheel[tick % TIMER_WHEEL_SIZE];
+
+    while (next) {
+      uint8_t slot = next - 1;
+      event_waiter * w = &vm->waiters[slot];
+
+      next = w->next;
+
+      if ((w->task != NIL) && ((int32_t)(w->deadline - now) <= 0)) {
+        event_wake(slot, (w->channel >= 0) ? FALSE : ENCODE_SMALL_INT(0));
+      }
+    }
+  }
+
+  vm->timer_tick = now;
+}
+
+/** events_timeout().
+
+  Returns the number of ms until the nearest deadline of the waiting tasks,
+  -1 if none. A deadline beyond a turn of the wheel is looked at again after
+  TIMER_WHEEL_SIZE ms.
+
+ */
+
+PRIVATE int32_t events_timeout()
+{
+  uint32_t now = events_now();
+
+  if (vm->timer_count == 0) return -1;
+
+  for (uint32_t tick = vm->timer_tick; tick != now + TIMER_WHEEL_SIZE; tick++) {
+    uint8_t next = vm->timer_wheel[tick % TIMER_WHEEL_SIZE];
+
+    while (next) {
+      event_waiter * w = &vm->waiters[next - 1];
+
+      if ((int32_t)(w->deadline - tick) <= 0) {
+        return ((int32_t)(tick - now) > 0) ? (int32_t)(tick - now) : 0;
+      }
+      next = w->next;
+    }
+  }
+
+  return TIMER_WHEEL_SIZE;
+}
+
+/** events_poll().
+
+  Moves the tasks whose event occurred to the run queue. If block is true,
+  waits until at least one event occurs.
+
+ */
+
+void events_poll(bool block)
+{
+  int32_t timeout = block ? events_timeout() : 0;
+
+  #if EPOLL
+    struct epoll_event ready[EVENT_WAITERS];
+    int count;
+
+    events_open();
+
+    do {
+      count = epoll_wait(vm->epoll_fd, ready, EVENT_WAITERS, timeout);
+    } while ((count < 0) && (errno == EINTR));
+
+    for (int i = 0; i < count; i++) {
+      uint64_t key = ready[i].data.u64;
+
+      if (key == WAKEUP_KEY) {
+        uint64_t counter;
+
+        if (read(vm->wakeup_fd, &counter, sizeof(counter)) < 0) {
+          // Already read, nothing to do
+        }
+      }
+      else {
+        // Wakes up the waiters of the file descriptor interested in the
+        // events that occurred, the others stay registered
+
+        int fd     = (int)(uint32_t) key;
+        uint32_t e = ready[i].events;
+        uint8_t events =
+          ((e & EPOLLIN)               ? EVENT_READ  : 0) |
+          ((e & EPOLLOUT)              ? EVENT_WRITE : 0) |
+          ((e & (EPOLLERR | EPOLLHUP)) ? EVENT_ERROR : 0);
+        bool woken = false;
+
+        for (uint8_t slot = 0; slot < EVENT_WAITERS; slot++) {
+          event_waiter * w = &vm->waiters[slot];
+
+          if (w->used && (w->task != NIL) && (w->fd == fd) &&
+              (events & (w->mode | EVENT_ERROR))) {
+            event_wake(slot, ENCODE_SMALL_INT(events & (w->mode | EVENT_ERROR)));
+            woken = true;
+          }
+        }
+
+        if (!woken) events_watch(fd);
+      }
+    }
+  #else
+    // No file descriptor to wait on: sleep by small steps to see the
+    // channels woken up by other threads
+
+    if (timeout != 0) {
+      if ((timeout < 0) || (timeout > 10)) timeout = 10;
+
+      #if WORKSTATION
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = timeout * 1000000L };
+        nanosleep(&ts, NULL);
+      #else
+        vTaskDelay(timeout / portTICK_PERIOD_MS + 1);
+      #endif
+    }
+  #endif
+
+  uint32_t channels = __atomic_exchange_n(&vm->wakeups, 0, __ATOMIC_ACQ_REL);
+
+  if (channels) events_wake_channels(channels);
+
+  timers_expire(events_now());
+}
+
+/** events_next_task().
+
+  Returns the next task to run, waiting in the event loop if no task is
+  ready.
+
+ */
+
+cell_p events_next_task()
+{
+  while (vm->run_queue_count == 0) {
+    if (vm->waiter_count == 0) {
+      FATAL("events_next_task", "No task left to run");
+    }
+    events_poll(true);
+  }
+
+  return task_pop_front();
+}
+
+/** events_fd_ready().
+
+  Waits, blocking the whole virtual machine, up to timeout ms for fd to
+  have data to read.
+
+ */
+
+bool events_fd_ready(int fd, int32_t timeout)
+{
+  #if WORKSTATION
+    struct pollfd p = { .fd = fd, .events = POLLIN };
+
+    return poll(&p, 1, timeout) > 0;
+  #else
+    vTaskDelay(1);
+    return true;
+  #endif
+}
+
+/** vm_wakeup().
+
+  Wakes up the tasks of the virtual machine ctx waiting on channel. This
+  can be called from any thread.
+
+ */
+
+void vm_wakeup(vm_context * ctx, uint8_t channel)
+{
+  __atomic_fetch_or(&ctx->wakeups, 1UL << (channel & 31), __ATOMIC_ACQ_REL);
+
+  #if EPOLL
+    uint64_t one = 1;
+
+    if ((ctx->wakeup_fd >= 0) && (write(ctx->wakeup_fd, &one, sizeof(one)) < 0)) {
+      // The counter is already set
+    }
+  #endif
+}
+
+PRIVATE int32_t decode_timeout(cell_p p)
+{
+  return (p == FALSE) ? -1 : decode_int(p);
+}
+
+PRIMITIVE(#%fd-wait, fd_wait, 3, 47)
+{
+  /* reg1 is the file descriptor (-1 for none), reg2 the events
+     (1: read, 2: write) and reg3 the timeout in ms (#f for none). The
+     result is the events that occurred, 0 on timeout. */
+
+  decode_2_int_args();
+  vm->a3 = decode_timeout(vm->reg3);
+
+  if ((vm->a1 < 0) && (vm->a3 < 0)) {
+    TYPE_ERROR("fd-wait", "file descriptor or timeout");
+  }
+
+  events_add(vm->a1, vm->a2, -1, vm->a3);
+
+  vm->reg1 = FALSE;
+  vm->reg2 = vm->reg3 = NIL;
+}
+
+PRIMITIVE(#%wakeup-wait, wakeup_wait, 2, 48)
+{
+  /* reg1 is the channel, reg2 the timeout in ms (#f for none). The result
+     is #t if woken up, #f on timeout. */
+
+  vm->a1 = decode_int(vm->reg1);
+  vm->a2 = decode_timeout(vm->reg2);
+
+  if ((vm->a1 < 0) || (vm->a1 > 31)) {
+    ERROR("wakeup-wait", "channel out of range");
+  }
+
+  events_add(-1, 0, vm->a1 & 31, vm->a2);
+
+  vm->reg1 = FALSE;
+  vm->reg2 = NIL;
+}
+
+PRIMITIVE_UNSPEC(#%wakeup, wakeup, 1, 49)
+{
+  vm->a1 = decode_int(vm->reg1);
+
+  if ((vm->a1 < 0) || (vm->a1 > 31)) {
+    ERROR("wakeup", "channel out of range");
+  }
+
+  events_wake_channels(1UL << (vm->a1 & 31));
+
+  vm->reg1 = NIL;
+}
+
+PRIMITIVE(#%sleep, sleep, 1, 53)
+{
+  /* reg1 is the duration in ms. The result is 0. */
+  vm->a1 = decode_int(vm->reg1);
+
+  events_add(-1, 0, -1, (vm->a1 < 0) ? 0 : vm->a1);
+
+  vm->reg1 = FALSE;
+}
+
+#if TESTS
+
+#include <pthread.h>
+#include <sys/socket.h>
+
+PRIVATE void * wakeup_thread(void * ctx)
+{
+  struct timespec ts = { .tv_sec = 0, .tv_nsec = 10000000L };
+
+  nanosleep(&ts, NULL);
+  vm_wakeup((vm_context *) ctx, 5);
+
+  return NULL;
+}
+
+// Calls a waiting primitive like the interpreter does: the result is pushed
+// and the task is suspended before the next instruction.
+
+PRIVATE void wait_call(void (* prim)())
+{
+  prim();
+  vm->env = new_pair(vm->reg1, vm->env);
+  vm->slice_left = 0;
+  task_switch();
+}
+
+void events_tests()
+{
+  TESTM("events");
+
+  TEST("Timer");
+
+    uint32_t start = events_now();
+
+    vm->env  = new_pair(encode_int(1), NIL);
+    vm->pc.c = vm->program;
+
+    vm->reg1 = encode_int(-1); vm->reg2 = encode_int(0); vm->reg3 = encode_int(20);
+    wait_call(primitive_fd_wait);
+
+    EXPECT_TRUE(events_now() - start >= 20,         "Deadline not reached");
+    EXPECT_TRUE(vm->waiter_count == 0,              "Waiter not released");
+    EXPECT_TRUE(RAM_GET_CAR(vm->env) == encode_int(0),  "Timeout result not on the stack");
+    EXPECT_TRUE(RAM_GET_CAR(RAM_GET_CDR(vm->env)) == encode_int(1), "Stack of the task not restored");
+    EXPECT_TRUE(vm->pc.c == vm->program,                    "Task not resumed at the next instruction");
+
+  #if EPOLL
+  TEST("File descriptor");
+
+    int fds[2];
+
+    EXPECT_TRUE(pipe(fds) == 0, "Unable to create a pipe");
+    EXPECT_TRUE(write(fds[1], "x", 1) == 1, "Unable to write in the pipe");
+
+    vm->reg1 = encode_int(fds[0]); vm->reg2 = encode_int(EVENT_READ); vm->reg3 = FALSE;
+    wait_call(primitive_fd_wait);
+
+    EXPECT_TRUE(RAM_GET_CAR(vm->env) == encode_int(EVENT_READ), "Read event not received");
+
+    vm->reg1 = encode_int(fds[1]); vm->reg2 = encode_int(EVENT_WRITE); vm->reg3 = encode_int(1000);
+    wait_call(primitive_fd_wait);
+
+    EXPECT_TRUE(RAM_GET_CAR(vm->env) == encode_int(EVENT_WRITE), "Write event not received");
+
+    close(fds[0]);
+    close(fds[1]);
+
+  TEST("Waiters sharing a file descriptor");
+
+    // Task 1 waits for a socket to be readable, task 2 for the same socket
+    // to be writable
+
+    EXPECT_TRUE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "Unable to create a socket pair");
+
+    vm->env  = new_pair(encode_int(2), NIL);
+    save_cont(); task_push_back(vm->cont);
+    vm->env  = new_pair(encode_int(1), NIL);
+    vm->cont = NIL;
+
+    vm->reg1 = encode_int(fds[0]); vm->reg2 = encode_int(EVENT_READ); vm->reg3 = FALSE;
+    wait_call(primitive_fd_wait);
+
+    EXPECT_TRUE(RAM_GET_CAR(vm->env) == encode_int(2), "Other task not resumed");
+
+    vm->reg1 = encode_int(fds[0]); vm->reg2 = encode_int(EVENT_WRITE); vm->reg3 = encode_int(1000);
+    wait_call(primitive_fd_wait);
+
+    EXPECT_TRUE(RAM_GET_CAR(vm->env) == encode_int(EVENT_WRITE), "Write event not received");
+    EXPECT_TRUE(RAM_GET_CAR(RAM_GET_CDR(vm->env)) == encode_int(2), "Writer not resumed");
+    EXPECT_TRUE(vm->waiter_count == 1, "Reader not waiting anymore");
+
+    EXPECT_TRUE(write(fds[1], "x", 1) == 1, "Unable to write on the socket");
+
+    task_resume(events_next_task());
+
+    EXPECT_TRUE(RAM_GET_CAR(vm->env) == encode_int(EVENT_READ), "Read event not received");
+    EXPECT_TRUE(RAM_GET_CAR(RAM_GET_CDR(vm->env)) == encode_int(1), "Reader not resumed");
+    EXPECT_TRUE(vm->waiter_count == 0, "Waiter not released");
+
+    close(fds[0]);
+    close(fds[1]);
+  #endif
+
+  TEST("Wake-up");
+
+    cell_p other;
+
+    vm->env  = new_pair(encode_int(2), NIL);
+    save_cont(); other = vm->cont; task_push_back(other);
+
+    vm->env  = new_pair(encode_int(1), NIL);
+
+    vm->reg1 = encode_int(3); vm->reg2 = FALSE;
+    wait_call(primitive_wakeup_wait);
+
+    EXPECT_TRUE(RAM_GET_CAR(vm->env) == encode_int(2), "Other task not resumed");
+    EXPECT_TRUE(vm->waiter_count == 1,             "Task not waiting");
+
+    mm_gc();
+
+    vm->reg1 = encode_int(3);
+    primitive_wakeup();
+
+    EXPECT_TRUE(vm->waiter_count == 0,    "Task not woken up");
+    EXPECT_TRUE(vm->run_queue_count == 1, "Task not in the run queue");
+
+    task_switch();
+
+    EXPECT_TRUE(RAM_GET_CAR(vm->env) == TRUE, "Wake-up result not on the stack");
+    EXPECT_TRUE(RAM_GET_CAR(RAM_GET_CDR(vm->env)) == encode_int(1), "Stack of the task not restored");
+
+    task_pop_front();
+
+    vm->reg1 = encode_int(4); vm->reg2 = encode_int(10);
+    wait_call(primitive_wakeup_wait);
+
+    EXPECT_TRUE(RAM_GET_CAR(vm->env) == FALSE, "Wake-up timeout result not on the stack");
+
+  TEST("Wake-up from another thread");
+
+    pthread_t thread;
+
+    pthread_create(&thread, NULL, wakeup_thread, vm);
+
+    vm->reg1 = encode_int(5); vm->reg2 = FALSE;
+    wait_call(primitive_wakeup_wait);
+
+    pthread_join(thread, NULL);
+
+    EXPECT_TRUE(RAM_GET_CAR(vm->env) == TRUE, "Wake-up result not on the stack");
+
+  TEST("Timer wheel");
+
+    // Three tasks sleeping 30, 100 (more than a turn of the wheel) and 5 ms
+
+    vm->env  = new_pair(encode_int(3), NIL);
+    save_cont(); task_push_back(vm->cont);
+    vm->env  = new_pair(encode_int(2), NIL);
+    save_cont(); task_push_back(vm->cont);
+    vm->env  = new_pair(encode_int(1), NIL);
+    vm->cont = NIL;
+
+    start = events_now();
+
+    vm->reg1 = encode_int(30);  wait_call(primitive_sleep);
+    vm->reg1 = encode_int(100); wait_call(primitive_sleep);
+    vm->reg1 = encode_int(5);   wait_call(primitive_sleep);
+
+    EXPECT_TRUE(RAM_GET_CAR(RAM_GET_CDR(vm->env)) == encode_int(2), "Shortest sleep not first");
+    EXPECT_TRUE(vm->timer_count == 2, "Timers not kept in the wheel");
+
+    task_resume(events_next_task());
+
+    EXPECT_TRUE(RAM_GET_CAR(RAM_GET_CDR(vm->env)) == encode_int(1), "Second sleep not second");
+    EXPECT_TRUE(events_now() - start >= 30, "Second deadline not reached");
+
+    task_resume(events_next_task());
+
+    EXPECT_TRUE(RAM_GET_CAR(RAM_GET_CDR(vm->env)) == encode_int(3), "Longest sleep not last");
+    EXPECT_TRUE(events_now() - start >= 100, "Last deadline not reached");
+    EXPECT_TRUE(RAM_GET_CAR(vm->env) == encode_int(0), "Sleep result not on the stack");
+    EXPECT_TRUE(vm->timer_count == 0, "Timers left in the wheel");
+
+    // A waiter woken up before its deadline leaves the wheel
+
+    vm->env  = new_pair(encode_int(4), vm->env);
+    save_cont(); task_push_back(vm->cont);
+    vm->env  = RAM_GET_CDR(vm->env);
+
+    vm->reg1 = encode_int(6); vm->reg2 = encode_int(1000);
+    wait_call(primitive_wakeup_wait);
+
+    EXPECT_TRUE(vm->timer_count == 1, "Timer not in the wheel");
+
+    vm->reg1 = encode_int(6);
+    primitive_wakeup();
+
+    EXPECT_TRUE(vm->timer_count == 0, "Timer not removed from the wheel");
+
+    task_switch();
+    task_pop_front();
+
+    EXPECT_TRUE(RAM_GET_CAR(vm->env) == TRUE, "Wake-up result not on the stack");
+
+  TEST("Waiting in the interpreter");
+
+    // (set! g (#%fd-wait -1 0 10))
+
+    uint8_t pgm[] = {
+      0xD7, 0xFB, 0, 1,       //     header: no constant, 1 global
+      0x03,                   //  4: LDCS -1
+      0x04,                   //  5: LDCS 0
+      0x0E,                   //  6: LDCS 10
+      0xEF,                   //  7: #%fd-wait
+      0x50,                   //  8: STS 0
+      0xC0                    //  9: #%halt
+    };
+
+    uint8_t * saved_program = vm->program;
+
+    vm->program  = pgm;
+    vm->max_addr = sizeof(pgm);
+    vm->env      = NIL;
+    start    = events_now();
+
+    interpreter();
+
+    EXPECT_TRUE(events_now() - start >= 10, "Deadline not reached");
+    EXPECT_TRUE(GLOBAL_GET(0) == ZERO,      "Timeout result not stored");
+    EXPECT_TRUE(vm->env == NIL,                 "Stack not empty after the wait");
+
+    GLOBAL_SET(0, NIL);
+    vm->program = saved_program;
+
+  vm->env  = NIL;
+  vm->cont = NIL;
+  vm->reg1 = vm->reg2 = vm->reg3 = NIL;
+  mm_gc();
+}
+#endif
@@ -9,8 +9,9 @@
 #define HEXFILE 1
 #include "hexfile.h"
 
-PRIVATE FILE *f;
-PRIVATE uint8_t checksum;
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 PRIVATE uint8_t hex2bin(char ch)
 {
@@ -20,7 +21,7 @@ PRIVATE uint8_t hex2bin(char ch)
   return 0;
 }
 
-PRIVATE uint8_t hex2byte(char **str)
+PRIVATE uint8_t hex2byte(char **str, uint8_t * checksum)
 {
   uint8_t val;
 
@@ -28,17 +29,17 @@ PRIVATE uint8_t hex2byte(char **str)
   val = hex2bin(*(*str)++);
   if (**str == 0) return 0;
   val = (val << 4) + hex2bin(*(*str)++);
-  checksum += val;
+  *checksum += val;
 
   return val;
 }
 
-PRIVATE uint16_t hex2short(char **str)
+PRIVATE uint16_t hex2short(char **str, uint8_t * checksum)
 {
   uint16_t val;
 
-  val = hex2byte(str);
-  val = (val << 8) + hex2byte(str);
+  val = hex2byte(str, checksum);
+  val = (val << 8) + hex2byte(str, checksum);
 
   return val;
 }
@@ -47,6 +48,9 @@ bool read_hex_file(char * filename, uint8_t * buffer, int size)
 {
   char line[100];
 
+  FILE   * f;
+  uint8_t  checksum;
+
   uint8_t  len;
   uint16_t addr;
   uint8_t  type;
@@ -60,7 +64,7 @@ bool read_hex_file(char * filename, uint8_t * buffer, int size)
   }
 
   completed = error = false;
-  max_addr = 0;
+  vm->max_addr = 0;
 
   while (!feof(f) && !completed && !error) {
     if (fgets(line, 99, f) == NULL) {
@@ -71,9 +75,9 @@ bool read_hex_file(char * filename, uint8_t * buffer, int size)
     while (*ptr == ' ') ptr++;
     if (*ptr++ == ':') {
       checksum = 0;
-      len  = hex2byte(&ptr);
-      addr = hex2short(&ptr);
-      type = hex2byte(&ptr);
+      len  = hex2byte(&ptr, &checksum);
+      addr = hex2short(&ptr, &checksum);
+      type = hex2byte(&ptr, &checksum);
 
       switch (type) {
         case 0 :  // Data
@@ -81,24 +85,24 @@ bool read_hex_file(char * filename, uint8_t * buffer, int size)
             ERROR("read_hex_file", "buffer too short");
             error = true;
           }
-          while (len--) buffer[addr++] = hex2byte(&ptr);
+          while (len--) buffer[addr++] = hex2byte(&ptr, &checksum);
           break;
 
         case 1 :  // EOF
-          while (len--) hex2byte(&ptr);
+          while (len--) hex2byte(&ptr, &checksum);
           completed = true;
           break;
 
         default :
           WARNING_MSG("read_hex_file: Unsupported record type: %d.", type);
-          while (len--) hex2byte(&ptr);
+          while (len--) hex2byte(&ptr, &checksum);
           break;
       }
 
-      if (addr > max_addr) max_addr = addr;
+      if (addr > vm->max_addr) vm->max_addr = addr;
 
       if (!error) {
-        hex2byte(&ptr);
+        hex2byte(&ptr, &checksum);
         if (checksum != 0) {
           ERROR("read_hex_file", "Bad Checksum");
           error = true;
@@ -110,7 +114,7 @@ bool read_hex_file(char * filename, uint8_t * buffer, int size)
   fclose (f);
 
   #if DEBUGGING
-    INFO_MSG("read_hex_file: Load size: %u\n", max_addr);
+    INFO_MSG("read_hex_file: Load size: %u\n", vm->max_addr);
   #endif
 
   // Little endian...
@@ -119,11 +123,246 @@ bool read_hex_file(char * filename, uint8_t * buffer, int size)
   return !error;
 }
 
+/** image_program().
+
+  Returns the program of the image of size bytes at address img, NULL if
+  the image is not valid.
+
+ */
+
+PRIVATE uint8_t * image_program(uint8_t * img, size_t size)
+{
+  image_header  * hdr = (image_header *) img;
+  image_section * sec = NULL;
+  uint8_t       * pgm;
+  uint32_t        hash;
+  size_t          start;
+
+  if ((size < sizeof(image_header)) || (memcmp(hdr->magic, IMAGE_MAGIC, 4) != 0)) {
+    ERROR("image_program", "Not a program image");
+    return NULL;
+  }
+
+  start = sizeof(image_header) + hdr->section_count * sizeof(image_section);
+
+  if ((hdr->version != IMAGE_VERSION) || (hdr->size != size) || (start > size)) {
+    ERROR("image_program", "Image version or size is wrong");
+    return NULL;
+  }
+
+  for (int i = 0; i < hdr->section_count; i++) {
+    if ((hdr->sections[i].offset < start) || (hdr->sections[i].offset > size) ||
+        (hdr->sections[i].length > (size - hdr->sections[i].offset))) {
+      ERROR("image_program", "Image section out of bounds");
+      return NULL;
+    }
+    if (hdr->sections[i].kind == IMAGE_SECTION_PROGRAM) sec = &hdr->sections[i];
+  }
+
+  if ((sec == NULL) || (sec->length < 4) || (sec->length > 0xFFFF)) {
+    ERROR("image_program", "No program in image");
+    return NULL;
+  }
+
+  pgm = img + sec->offset;
+
+  if ((pgm[0] != 0xD7) || (pgm[1] != 0xFB) ||
+      (pgm[2] != hdr->constants) || (pgm[3] != hdr->globals) ||
+      (hdr->entry_point != (4 + (hdr->constants * 5))) || (hdr->entry_point >= sec->length)) {
+    ERROR("image_program", "Program header is wrong");
+    return NULL;
+  }
+
+  hash = image_hash(IMAGE_HASH_INIT, hdr->sections, hdr->section_count * sizeof(image_section));
+  hash = image_hash(hash, pgm, sec->length);
+
+  if (hash != hdr->hash) {
+    ERROR("image_program", "Bad image hash");
+    return NULL;
+  }
+
+  if (image_check) {
+    hash = IMAGE_HASH_INIT;
+    for (int i = 0; i < hdr->section_count; i++) {
+      if (&hdr->sections[i] != sec) {
+        hash = image_hash(hash, img + hdr->sections[i].offset, hdr->sections[i].length);
+      }
+    }
+
+    if (hash != hdr->data_hash) {
+      ERROR("image_program", "Bad image data hash");
+      return NULL;
+    }
+  }
+
+  vm->max_addr = sec->length;
+
+  return pgm;
+}
+
+/** program_load().
+
+  Loads the program of file filename and sets program. A program image
+  (see image.h) is mapped in memory and used in place. The mapping is
+  private and writable, such that the heaps of a snapshot are copied on
+  write only. Otherwise, the file is read as an Intel HEX file in a new
+  buffer. Returns false if the program can't be loaded.
+
+ */
+
+bool program_load(char * filename)
+{
+  struct stat st;
+  uint8_t   * img;
+  int         fd;
+  char        magic[4];
+
+  vm->image = NULL;
+  vm->program   = NULL;
+
+  if ((fd = open(filename, O_RDONLY)) < 0) {
+    ERROR_MSG("program_load: Unable to open file %s.", filename);
+    return false;
+  }
+
+  if ((read(fd, magic, 4) != 4) || (memcmp(magic, IMAGE_MAGIC, 4) != 0)) {
+    close(fd);
+
+    if ((vm->program = calloc(65536, 1)) == NULL) {
+      ERROR("program_load", "Unable to allocate program space");
+      return false;
+    }
+
+    return read_hex_file(filename, vm->program, 65536);
+  }
+
+  if ((fstat(fd, &st) < 0) ||
+      ((img = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+    ERROR_MSG("program_load: Unable to map file %s.", filename);
+    close(fd);
+    return false;
+  }
+
+  close(fd);
+
+  if ((vm->program = image_program(img, st.st_size)) == NULL) {
+    munmap(img, st.st_size);
+    return false;
+  }
+
+  vm->image      = img;
+  vm->image_size = st.st_size;
+
+  return true;
+}
+
+/** image_section_find().
+
+  Returns the section of the given kind of the image of the loaded
+  program, NULL if there is none.
+
+ */
+
+image_section * image_section_find(uint32_t kind)
+{
+  image_header * hdr = (image_header *) vm->image;
+
+  if (hdr == NULL) return NULL;
+
+  for (int i = 0; i < hdr->section_count; i++) {
+    if (hdr->sections[i].kind == kind) return &hdr->sections[i];
+  }
+
+  return NULL;
+}
+
+/** program_release().
+
+  Releases the program loaded by program_load().
+
+ */
+
+void program_release()
+{
+  if (vm->image != NULL) {
+    munmap(vm->image, vm->image_size);
+  }
+  else {
+    free(vm->program);
+  }
+
+  vm->image = NULL;
+  vm->program   = NULL;
+}
+
 #if TESTS
+
+// Writes a program as a program image, with the byte at index bad of the
+// program changed after the hash computation if bad >= 0
+PRIVATE bool write_image_file(char * filename, uint8_t * code, int size, int bad)
+{
+  FILE       * f;
+  uint8_t      pad[IMAGE_ALIGN] = { 0 };
+  uint32_t     start = sizeof(image_header) + sizeof(image_section);
+  uint32_t     offset = (start + IMAGE_ALIGN - 1) & ~(IMAGE_ALIGN - 1);
+  struct {
+    image_header  hdr;
+    image_section sec;
+  } img = {
+    .hdr = { .magic = IMAGE_MAGIC, .version = IMAGE_VERSION, .section_count = 1,
+             .size = offset + size, .data_hash = IMAGE_HASH_INIT,
+             .constants = code[2], .globals = code[3], .entry_point = 4 + (code[2] * 5) },
+    .sec = { .kind = IMAGE_SECTION_PROGRAM, .offset = offset, .length = size }
+  };
+
+  img.hdr.hash = image_hash(image_hash(IMAGE_HASH_INIT, &img.sec, sizeof(img.sec)), code, size);
+
+  if ((f = fopen(filename, "wb")) == NULL) return false;
+
+  fwrite(&img, 1, start, f);
+  fwrite(pad, 1, offset - start, f);
+  for (int i = 0; i < size; i++) fputc((i == bad) ? code[i] ^ 1 : code[i], f);
+  fclose(f);
+
+  return true;
+}
+
 void hexfile_tests()
 {
   TESTM("hexfile");
 
+  TEST("Program image");
+
+    uint8_t pgm[] = {
+      0xD7, 0xFB, 0, 0,       //     header: no constant, no global
+      0x05,                   //  4: LDCS 1
+      0xC0                    //  5: #%halt
+    };
+
+    char       name[] = "/tmp/image-XXXXXX";
+    uint8_t  * pg     = vm->program;
+    uint16_t   size   = vm->max_addr;
+
+    close(mkstemp(name));
+
+    EXPECT_TRUE(write_image_file(name, pgm, sizeof(pgm), -1), "Unable to write test image");
+    EXPECT_TRUE(program_load(name), "Unable to load image");
+    EXPECT_TRUE((vm->image != NULL) && (vm->program != NULL) && (memcmp(vm->program, pgm, sizeof(pgm)) == 0),
+                "Image program not mapped");
+    EXPECT_TRUE(vm->max_addr == sizeof(pgm), "Image program size is wrong");
+
+    program_release();
+
+    EXPECT_TRUE(write_image_file(name, pgm, sizeof(pgm), 5), "Unable to write test image");
+    EXPECT_TRUE(!program_load(name), "Corrupted image loaded");
+    EXPECT_TRUE(vm->image == NULL, "Rejected image still mapped");
+
+    program_release();
+    unlink(name);
+
+    vm->program  = pg;
+    vm->max_addr = size;
+
   uint8_t * buffer;
 
   buffer = calloc(40000, 1);
@@ -0,0 +1,33 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#if WORKSTATION
+
+  #ifdef BATCH
+    #define PUBLIC
+  #else
+    #define PUBLIC extern
+  #endif
+
+  /** Batch Runner.
+
+    Runs a list of programs concurrently on a pool of thread_count threads
+    (the number of cores if thread_count is 0). Each job gets its own virtual
+    machine context, with its own heaps, and its output is captured. Once all
+    jobs are completed, the outputs are written on stdout in the order of the
+    list and a summary of timing and GC statistics is written on stderr.
+
+    If inputs is true, the first file is the program and each of the other
+    files is the input (console) of a separate run of that program.
+
+    Returns true if all jobs completed without a fatal error.
+
+   */
+
+  PUBLIC bool batch_run(char ** filenames, int count, int thread_count, bool inputs);
+
+  #undef PUBLIC
+
+#endif // WORKSTATION
+
+#endif
@@ -34,6 +34,8 @@ PUBLIC integer bitwise_ior(integer x, integer y);
 PUBLIC integer bitwise_and(integer x, integer y);
 PUBLIC integer bitwise_not(integer x);
 
+PUBLIC integer fixnum_to_bignum(integer x);
+
 PUBLIC void bignum_gc_init();
 PUBLIC void bignum_gc_mark();
 
@@ -20,6 +20,7 @@ extern void terminate();
   #include <stdio.h>
   #include <unistd.h>
   #include <string.h>
+  #include <setjmp.h>
 
   typedef enum { false, true } bool;
 
@@ -27,6 +28,9 @@ extern void terminate();
   #define DEBUGGING 1
   #define TRACING   1
   #define TESTS     1
+  #define PROFILING 1
+
+  #define CONFIG_DEBUG_STRINGS 1
 #endif
 
 #if ESP32
@@ -40,6 +44,7 @@ extern void terminate();
   #define DEBUGGING 1
   #define TRACING   0
   #define TESTS     0
+  #define PROFILING 0
   #define VERBOSE   true
 #endif
 
@@ -65,7 +70,7 @@ extern void terminate();
   #define    INFO(a, b)   if (verbose) { fprintf(stderr, "\nINFO - In %s: %s.\n", a, b); }
 
   #define TYPE_ERROR(proc, exp) FATAL(proc, "Expecting \"" exp "\"")
-  #define EXPECT(test, proc, exp) { if (!(test)) { fprintf(stderr, "\nAt [%p]: ", (void *)(last_pc.c - program)); TYPE_ERROR(proc, exp); } }
+  #define EXPECT(test, proc, exp) { if (!(test)) { fprintf(stderr, "\nAt [%p]: ", (void *)(vm->last_pc.c - vm->program)); TYPE_ERROR(proc, exp); } }
   #define MARK(c) { if (verbose) { fputc(c, stderr); fflush(stderr); } }
 #else
   #define   FATAL_MSG(format, ...) terminate()
@@ -0,0 +1,50 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#ifdef EVENTS
+  #define PUBLIC
+#else
+  #define PUBLIC extern
+#endif
+
+/** Event Loop.
+
+  A task waiting for an event (a file descriptor ready for reading or
+  writing, a wake-up channel or a deadline) is suspended and parked in the
+  waiters table of the vm context, such that the other tasks can run
+  meanwhile. When no task is ready to run, the virtual machine blocks in
+  the event loop (epoll on Linux) until a waiting task can be resumed.
+
+  A waiting primitive returns a placeholder value, that is pushed on the
+  stack as usual, and sets vm->suspending. The task is suspended by
+  task_switch() at the next instruction. Once the event occurs, the
+  placeholder is replaced by the result on the stack of the waiting task
+  and the task is put back in the run queue.
+
+  Deadlines are kept in a timer wheel. Sleeping with #%sleep or waiting
+  with a timeout consumes no CPU: the virtual machine blocks in epoll_wait
+  (or nanosleep, or vTaskDelay on the ESP32) until the nearest deadline.
+
+  Wake-up channels (0..31) can be signaled by other tasks of the same
+  virtual machine with the #%wakeup primitive, or by other threads with
+  vm_wakeup().
+
+ */
+
+#define EVENT_READ   1
+#define EVENT_WRITE  2
+#define EVENT_ERROR  4
+
+PUBLIC uint32_t events_now();
+
+PUBLIC void   events_park(cell_p k);
+PUBLIC void   events_poll(bool block);
+PUBLIC cell_p events_next_task();
+PUBLIC void   events_close();
+
+PUBLIC bool events_fd_ready(int fd, int32_t timeout);
+
+PUBLIC void vm_wakeup(vm_context * ctx, uint8_t channel);
+
+#undef PUBLIC
+#endif
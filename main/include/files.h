@@ -0,0 +1,21 @@
+#ifndef FILES_H
+#define FILES_H
+
+#ifdef FILES
+  #define PUBLIC
+#else
+  #define PUBLIC extern
+#endif
+
+/** Mapped Files.
+
+  The files mapped in memory with file-map are kept in the maps table of
+  the context until file-unmap. The ones left are released with the
+  context.
+
+ */
+
+PUBLIC void files_release();
+
+#undef PUBLIC
+#endif
@@ -0,0 +1,494 @@
+              case 0 :
+                TRACE("  (%s <%d>)\n", "socket", 1);
+                vm->reg1 = pop();
+                primitive_socket();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 1 :
+                TRACE("  (%s <%d>)\n", "socket-bind", 3);
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_socket_bind();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 2 :
+                TRACE("  (%s <%d>)\n", "socket-listen", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_socket_listen();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 3 :
+                TRACE("  (%s <%d>)\n", "socket-accept", 1);
+                vm->reg1 = pop();
+                primitive_socket_accept();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 4 :
+                TRACE("  (%s <%d>)\n", "socket-connect", 3);
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_socket_connect();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 5 :
+                TRACE("  (%s <%d>)\n", "socket-recv", 4);
+                vm->reg4 = pop();
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_socket_recv();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 6 :
+                TRACE("  (%s <%d>)\n", "socket-send", 4);
+                vm->reg4 = pop();
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_socket_send();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 7 :
+                TRACE("  (%s <%d>)\n", "#%socket-sendto", 4);
+                vm->reg4 = pop();
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_socket_sendto();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 8 :
+                TRACE("  (%s <%d>)\n", "socket-close", 1);
+                vm->reg1 = pop();
+                primitive_socket_close();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 9 :
+                TRACE("  (%s <%d>)\n", "socket-set-nonblocking!", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_socket_set_nonblocking();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 10 :
+                TRACE("  (%s <%d>)\n", "socket-local-port", 1);
+                vm->reg1 = pop();
+                primitive_socket_local_port();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 11 :
+                TRACE("  (%s <%d>)\n", "file-open", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_file_open();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 12 :
+                TRACE("  (%s <%d>)\n", "file-read", 4);
+                vm->reg4 = pop();
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_file_read();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 13 :
+                TRACE("  (%s <%d>)\n", "file-write", 4);
+                vm->reg4 = pop();
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_file_write();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 14 :
+                TRACE("  (%s <%d>)\n", "file-seek", 3);
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_file_seek();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 15 :
+                TRACE("  (%s <%d>)\n", "file-close", 1);
+                vm->reg1 = pop();
+                primitive_file_close();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 16 :
+                TRACE("  (%s <%d>)\n", "file-map", 1);
+                vm->reg1 = pop();
+                primitive_file_map();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 17 :
+                TRACE("  (%s <%d>)\n", "file-map-length", 1);
+                vm->reg1 = pop();
+                primitive_file_map_length();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 18 :
+                TRACE("  (%s <%d>)\n", "file-map-read", 3);
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_file_map_read();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 19 :
+                TRACE("  (%s <%d>)\n", "file-unmap", 1);
+                vm->reg1 = pop();
+                primitive_file_unmap();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 20 :
+                TRACE("  (%s <%d>)\n", "#%u8vector-copy!", 4);
+                vm->reg4 = pop();
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_u8vector_copy();
+                break;
+
+              case 21 :
+                TRACE("  (%s <%d>)\n", "#%u8vector-fill!", 4);
+                vm->reg4 = pop();
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_u8vector_fill();
+                break;
+
+              case 22 :
+                TRACE("  (%s <%d>)\n", "u8vector-equal?", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_u8vector_equal();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 23 :
+                TRACE("  (%s <%d>)\n", "u8vector-compare", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_u8vector_compare();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 24 :
+                TRACE("  (%s <%d>)\n", "#%u8vector-index", 4);
+                vm->reg4 = pop();
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_u8vector_index();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 25 :
+                TRACE("  (%s <%d>)\n", "list->u8vector", 1);
+                vm->reg1 = pop();
+                primitive_list2u8vector();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 26 :
+                TRACE("  (%s <%d>)\n", "#%make-numvector", 3);
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_make_numvector();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 27 :
+                TRACE("  (%s <%d>)\n", "#%numvector-kind", 1);
+                vm->reg1 = pop();
+                primitive_numvector_kind();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 28 :
+                TRACE("  (%s <%d>)\n", "numvector-length", 1);
+                vm->reg1 = pop();
+                primitive_numvector_length();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 29 :
+                TRACE("  (%s <%d>)\n", "numvector-ref", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_numvector_ref();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 30 :
+                TRACE("  (%s <%d>)\n", "numvector-set!", 3);
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_numvector_set();
+                break;
+
+              case 31 :
+                TRACE("  (%s <%d>)\n", "numvector-add!", 3);
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_numvector_add();
+                break;
+
+              case 32 :
+                TRACE("  (%s <%d>)\n", "numvector-mul!", 4);
+                vm->reg4 = pop();
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_numvector_mul();
+                break;
+
+              case 33 :
+                TRACE("  (%s <%d>)\n", "numvector-scale!", 4);
+                vm->reg4 = pop();
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_numvector_scale();
+                break;
+
+              case 34 :
+                TRACE("  (%s <%d>)\n", "numvector-dot", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_numvector_dot();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 35 :
+                TRACE("  (%s <%d>)\n", "numvector-sum", 1);
+                vm->reg1 = pop();
+                primitive_numvector_sum();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 36 :
+                TRACE("  (%s <%d>)\n", "numvector-min", 1);
+                vm->reg1 = pop();
+                primitive_numvector_min();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 37 :
+                TRACE("  (%s <%d>)\n", "numvector-max", 1);
+                vm->reg1 = pop();
+                primitive_numvector_max();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 38 :
+                TRACE("  (%s <%d>)\n", "numvector-fir!", 4);
+                vm->reg4 = pop();
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_numvector_fir();
+                break;
+
+              case 39 :
+                TRACE("  (%s <%d>)\n", "#%make-table", 1);
+                vm->reg1 = pop();
+                primitive_make_table();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 40 :
+                TRACE("  (%s <%d>)\n", "#%table-ref", 3);
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_table_ref();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 41 :
+                TRACE("  (%s <%d>)\n", "table-set!", 3);
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_table_set();
+                break;
+
+              case 42 :
+                TRACE("  (%s <%d>)\n", "table-delete!", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_table_delete();
+                break;
+
+              case 43 :
+                TRACE("  (%s <%d>)\n", "table-count", 1);
+                vm->reg1 = pop();
+                primitive_table_count();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 44 :
+                TRACE("  (%s <%d>)\n", "table?", 1);
+                vm->reg1 = pop();
+                primitive_table_p();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 45 :
+                TRACE("  (%s <%d>)\n", "table->list", 1);
+                vm->reg1 = pop();
+                primitive_table_to_list();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 46 :
+                TRACE("  (%s <%d>)\n", "length", 1);
+                vm->reg1 = pop();
+                primitive_length();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 47 :
+                TRACE("  (%s <%d>)\n", "append", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_append();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 48 :
+                TRACE("  (%s <%d>)\n", "reverse", 1);
+                vm->reg1 = pop();
+                primitive_reverse();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 49 :
+                TRACE("  (%s <%d>)\n", "reverse!", 1);
+                vm->reg1 = pop();
+                primitive_reverse_bang();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 50 :
+                TRACE("  (%s <%d>)\n", "list-ref", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_list_ref();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 51 :
+                TRACE("  (%s <%d>)\n", "list-set!", 3);
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_list_set();
+                break;
+
+              case 52 :
+                TRACE("  (%s <%d>)\n", "memq", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_memq();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 53 :
+                TRACE("  (%s <%d>)\n", "assq", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_assq();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 54 :
+                TRACE("  (%s <%d>)\n", "#%list-sort!", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_list_sort();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 55 :
+                TRACE("  (%s <%d>)\n", "#%vector-sort!", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_vector_sort();
+                break;
+
+              case 56 :
+                TRACE("  (%s <%d>)\n", "equal?", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_equal_p();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 57 :
+                TRACE("  (%s <%d>)\n", "assoc", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_assoc();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 58 :
+                TRACE("  (%s <%d>)\n", "#%number->string", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_number_to_string();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 59 :
+                TRACE("  (%s <%d>)\n", "#%string->number", 2);
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_string_to_number();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
+
+              case 60 :
+                TRACE("  (%s <%d>)\n", "#%write-number", 3);
+                vm->reg3 = pop();
+                vm->reg2 = pop();
+                vm->reg1 = pop();
+                primitive_write_number();
+                break;
+
+              case 61 :
+                TRACE("  (%s <%d>)\n", "snapshot", 1);
+                vm->reg1 = pop();
+                primitive_snapshot();
+                vm->env = new_pair(vm->reg1, vm->env);
+                break;
@@ -44,8 +44,94 @@ const char * const primitive_names[] = {
   "print",
   "clock",
   "#%getchar-wait",
-  "#%putchar"
+  "#%putchar",
+  "#%start-scheduler",
+  "#%spawn",
+  "#%yield",
+  "#%exit",
+  "set-time-slice!",
+  "#%fd-wait",
+  "#%wakeup-wait",
+  "#%wakeup",
+  "#%write-string",
+  "#%flush-output",
+  "#%set-flush-policy!",
+  "#%sleep",
+  "clock-us",
+  "clock-ns",
+  "cycle-counter",
+  "string->symbol",
+  "symbol->string",
+  "#%open-output-port",
+  "#%close-output-port",
+  "",
+  "",
+  "",
+  "socket",
+  "socket-bind",
+  "socket-listen",
+  "socket-accept",
+  "socket-connect",
+  "socket-recv",
+  "socket-send",
+  "#%socket-sendto",
+  "socket-close",
+  "socket-set-nonblocking!",
+  "socket-local-port",
+  "file-open",
+  "file-read",
+  "file-write",
+  "file-seek",
+  "file-close",
+  "file-map",
+  "file-map-length",
+  "file-map-read",
+  "file-unmap",
+  "#%u8vector-copy!",
+  "#%u8vector-fill!",
+  "u8vector-equal?",
+  "u8vector-compare",
+  "#%u8vector-index",
+  "list->u8vector",
+  "#%make-numvector",
+  "#%numvector-kind",
+  "numvector-length",
+  "numvector-ref",
+  "numvector-set!",
+  "numvector-add!",
+  "numvector-mul!",
+  "numvector-scale!",
+  "numvector-dot",
+  "numvector-sum",
+  "numvector-min",
+  "numvector-max",
+  "numvector-fir!",
+  "#%make-table",
+  "#%table-ref",
+  "table-set!",
+  "table-delete!",
+  "table-count",
+  "table?",
+  "table->list",
+  "length",
+  "append",
+  "reverse",
+  "reverse!",
+  "list-ref",
+  "list-set!",
+  "memq",
+  "assq",
+  "#%list-sort!",
+  "#%vector-sort!",
+  "equal?",
+  "assoc",
+  "#%number->string",
+  "#%string->number",
+  "#%write-number",
+  "snapshot"
 };
+
+const int primitive_count = 126;
 #endif /* CONFIG_DEBUG_STRINGS */
 
 extern void primitive_return();
@@ -89,3 +175,87 @@ extern void primitive_print();
 extern void primitive_clock();
 extern void primitive_getchar_wait();
 extern void primitive_putchar();
+extern void primitive_start_scheduler();
+extern void primitive_spawn();
+extern void primitive_yield();
+extern void primitive_exit();
+extern void primitive_set_time_slice();
+extern void primitive_fd_wait();
+extern void primitive_wakeup_wait();
+extern void primitive_wakeup();
+extern void primitive_write_string();
+extern void primitive_flush_output();
+extern void primitive_set_flush_policy();
+extern void primitive_sleep();
+extern void primitive_clock_us();
+extern void primitive_clock_ns();
+extern void primitive_cycle_counter();
+extern void primitive_string_to_symbol();
+extern void primitive_symbol_to_string();
+extern void primitive_open_output_port();
+extern void primitive_close_output_port();
+extern void primitive_();
+extern void primitive_();
+extern void primitive_();
+extern void primitive_socket();
+extern void primitive_socket_bind();
+extern void primitive_socket_listen();
+extern void primitive_socket_accept();
+extern void primitive_socket_connect();
+extern void primitive_socket_recv();
+extern void primitive_socket_send();
+extern void primitive_socket_sendto();
+extern void primitive_socket_close();
+extern void primitive_socket_set_nonblocking();
+extern void primitive_socket_local_port();
+extern void primitive_file_open();
+extern void primitive_file_read();
+extern void primitive_file_write();
+extern void primitive_file_seek();
+extern void primitive_file_close();
+extern void primitive_file_map();
+extern void primitive_file_map_length();
+extern void primitive_file_map_read();
+extern void primitive_file_unmap();
+extern void primitive_u8vector_copy();
+extern void primitive_u8vector_fill();
+extern void primitive_u8vector_equal();
+extern void primitive_u8vector_compare();
+extern void primitive_u8vector_index();
+extern void primitive_list2u8vector();
+extern void primitive_make_numvector();
+extern void primitive_numvector_kind();
+extern void primitive_numvector_length();
+extern void primitive_numvector_ref();
+extern void primitive_numvector_set();
+extern void primitive_numvector_add();
+extern void primitive_numvector_mul();
+extern void primitive_numvector_scale();
+extern void primitive_numvector_dot();
+extern void primitive_numvector_sum();
+extern void primitive_numvector_min();
+extern void primitive_numvector_max();
+extern void primitive_numvector_fir();
+extern void primitive_make_table();
+extern void primitive_table_ref();
+extern void primitive_table_set();
+extern void primitive_table_delete();
+extern void primitive_table_count();
+extern void primitive_table_p();
+extern void primitive_table_to_list();
+extern void primitive_length();
+extern void primitive_append();
+extern void primitive_reverse();
+extern void primitive_reverse_bang();
+extern void primitive_list_ref();
+extern void primitive_list_set();
+extern void primitive_memq();
+extern void primitive_assq();
+extern void primitive_list_sort();
+extern void primitive_vector_sort();
+extern void primitive_equal_p();
+extern void primitive_assoc();
+extern void primitive_number_to_string();
+extern void primitive_string_to_number();
+extern void primitive_write_number();
+extern void primitive_snapshot();
@@ -3,13 +3,22 @@
 
 #if WORKSTATION
 
+  #include "image.h"
+
   #ifdef HEXFILE
     #define PUBLIC
   #else
     #define PUBLIC extern
   #endif
 
-  bool read_hex_file(char * filename, uint8_t * buffer, int size);
+  // Also check the data hash of the images (see image.h)
+  PUBLIC bool image_check;
+
+  PUBLIC bool read_hex_file(char * filename, uint8_t * buffer, int size);
+  PUBLIC bool program_load(char * filename);
+  PUBLIC void program_release();
+
+  PUBLIC image_section * image_section_find(uint32_t kind);
 
   #undef PUBLIC
 
@@ -0,0 +1,72 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+/** Program images.
+
+  A program image holds a compiled program ready to be used in place by
+  the workstation VM, that maps it in memory instead of parsing an Intel
+  HEX file. It is written by hex2bin -i.
+
+  The image starts with an image_header, followed by the section table.
+  The content of the sections comes next, each section starting on a
+  IMAGE_ALIGN bytes boundary. The IMAGE_SECTION_PROGRAM section is the
+  program as loaded at address 0 from the Intel HEX file: the D7 FB
+  markers, the constants and globals counts, the ROM cells, the code and
+  the data pools.
+
+  A snapshot (see snapshot.h) is a program image with four more sections:
+  the state of the VM and its RAM and vector heaps.
+
+  The hash is the 32 bits FNV-1a hash of the section table followed by
+  the program section, checked each time the image is loaded. data_hash
+  is the hash of the other sections, in the order of the table. It is
+  only checked on demand (picobit-vm -c): the heaps of a snapshot are not
+  read when it is mapped, only the pages used by the program are. All
+  values are little endian.
+
+  This header is shared with hex2bin and only depends on stdint.h.
+
+ */
+
+#define IMAGE_MAGIC     "SVMI"
+#define IMAGE_VERSION   2
+#define IMAGE_ALIGN     16
+
+#define IMAGE_SECTION_PROGRAM   1
+#define IMAGE_SECTION_STATE     2   // Snapshots only (see snapshot.h)
+#define IMAGE_SECTION_RAM_DATA  3
+#define IMAGE_SECTION_RAM_FLAGS 4
+#define IMAGE_SECTION_VECTORS   5
+
+#define IMAGE_HASH_INIT       2166136261u
+#define IMAGE_HASH(h, byte)   (((h) ^ (byte)) * 16777619u)
+
+static inline uint32_t image_hash(uint32_t h, const void * data, uint32_t length)
+{
+  const uint8_t * bytes = data;
+
+  for (uint32_t i = 0; i < length; i++) h = IMAGE_HASH(h, bytes[i]);
+
+  return h;
+}
+
+typedef struct {
+  uint32_t kind;
+  uint32_t offset;      // From the start of the image
+  uint32_t length;
+} image_section;
+
+typedef struct {
+  char     magic[4];
+  uint16_t version;
+  uint16_t section_count;
+  uint32_t size;        // Of the whole image
+  uint32_t hash;        // Section table and program section
+  uint32_t data_hash;   // Other sections
+  uint16_t constants;   // Number of ROM cells, byte 2 of the program
+  uint16_t globals;     // Byte 3 of the program
+  uint32_t entry_point; // Offset of the first instruction in the program
+  image_section sections[];
+} image_header;
+
+#endif
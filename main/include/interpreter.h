@@ -19,6 +19,16 @@
 
 PUBLIC uint8_t prepare_arguments(int8_t nbr_args);
 PUBLIC void build_environment(uint8_t nbr_args);
+PUBLIC void closure_environment(uint8_t nbr_args);
+PUBLIC void loop_environment(uint8_t discard, uint8_t nbr_args);
+
+PUBLIC void save_cont();
+
+PUBLIC void   task_push_front(cell_p k);
+PUBLIC void   task_push_back(cell_p k);
+PUBLIC cell_p task_pop_front();
+PUBLIC void   task_resume(cell_p k);
+PUBLIC void   task_switch();
 
 PUBLIC void interpreter();
 
@@ -9,7 +9,7 @@
 
 PUBLIC void kb_init();
 PUBLIC void kb_restore();
-PUBLIC char kb_getch(void);
+PUBLIC char kb_getch(FILE * in);
 
 #undef PUBLIC
 #endif
@@ -45,20 +45,15 @@
      space from the ESP-IDF. ROM indices start at 0xE000 up to the lenght of the ROM
      cells array.  The maximum indice to access ROM must be lower than
      65536 - 512: 0xFE00.
-   */
-
-  PRIVATE cell_p   free_cells;
-  PRIVATE vector_p vector_free_cells;
 
-  #if DEBUGGING
-    PRIVATE uint16_t   free_cells_count;
-    PRIVATE uint16_t   used_cells_count;
-    PRIVATE uint16_t vector_cells_count;
-  #endif
+     The free lists and the cell counters are kept in the vm_context
+     (vm-arch.h).
+   */
 
 #endif
 
-PUBLIC bool   mm_init(uint8_t * program);
+PUBLIC bool   mm_init(uint8_t * pgm);
+PUBLIC void   mm_release();
 PUBLIC void   mm_mark(cell_p p);
 PUBLIC void   mm_gc();
 PUBLIC cell_p mm_new_ram_cell();
@@ -71,13 +66,5 @@ PUBLIC void   unmark_ram();
   PUBLIC bool is_free(cell_p p);
 #endif
 
-#if STATISTICS
-  PUBLIC double max_gc_duration;
-#endif
-
-#if STATISTICS
-  PUBLIC int gc_call_counter;
-#endif
-
 #undef PUBLIC
 #endif
@@ -0,0 +1,46 @@
+#ifndef PORTS_H
+#define PORTS_H
+
+#ifdef PORTS
+  #define PUBLIC
+#else
+  #define PUBLIC extern
+#endif
+
+/** Output Ports.
+
+  Output is accumulated in a buffer of each port and written to its file
+  when the buffer is flushed, explicitly (#%flush-output) or according to
+  the flush policy of the port:
+
+    - the buffer reached the flush size of the port (always)
+    - a newline was written (PORT_FLUSH_LINE)
+    - the console is about to be read (PORT_FLUSH_READ)
+
+  Port 0 is the console (vm->out) and port 1 is stderr. They are opened
+  at their first use. The console is line buffered when it is a terminal.
+  The other ports are opened on the file descriptor of a file or a socket
+  (#%open-output-port) and flushed when their buffer is full.
+
+ */
+
+#define CONSOLE_PORT    0
+#define ERROR_PORT      1
+
+#define PORT_FLUSH_LINE 1
+#define PORT_FLUSH_READ 2
+
+PUBLIC int8_t port_open(FILE * file, uint8_t policy);
+PUBLIC void   port_close(uint8_t port);
+
+PUBLIC void port_putc(uint8_t port, char ch);
+PUBLIC void port_write(uint8_t port, const uint8_t * data, uint16_t length);
+PUBLIC void port_printf(uint8_t port, const char * format, ...);
+PUBLIC void port_flush(uint8_t port);
+
+PUBLIC void ports_flush_on_read();
+PUBLIC void ports_flush_all();
+PUBLIC void ports_release();
+
+#undef PUBLIC
+#endif
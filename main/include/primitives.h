@@ -3,6 +3,7 @@
 
 #ifdef CONFIG_DEBUG_STRINGS
   extern const char* const primitive_names[];
+  extern const int primitive_count;
 #endif /* CONFIG_DEBUG_STRINGS */
 
 /* For the primitive scanning pass. */
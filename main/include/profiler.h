@@ -0,0 +1,107 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#if PROFILING
+
+  #include <signal.h>
+
+  #ifdef PROFILER
+    #define PUBLIC
+  #else
+    #define PUBLIC extern
+  #endif
+
+  /** Execution profiler.
+
+    Started with the -p option of picobit-vm, the profiler counts the
+    executions of each instruction and the CPU cycles elapsed until the
+    next one. The counts and cycles are accumulated per opcode, per
+    primitive index (the extended ones included) and per bytecode address.
+    The cycles of a primitive include the garbage collections it triggers.
+
+    At the end of the program, profile_report() prints the tables sorted by
+    cycles on stderr and writes all the counters in a JSON file:
+
+      { "program": ..., "instructions": ..., "cycles": ...,
+        "opcodes":    [ { "name": ..., "count": ..., "cycles": ... }, ... ],
+        "primitives": [ { "index": ..., "name": ..., "count": ..., "cycles": ... }, ... ],
+        "addresses":  [ { "pc": ..., "opcode": ..., "count": ..., "cycles": ... }, ... ] }
+
+    The cycles are read from rdtsc on x86, cntvct on ARM64 (a fixed
+    frequency counter) and from the monotonic clock in ns elsewhere.
+
+   */
+
+  #define PROFILE_OPCODES     28    // See profile_opcode()
+  #define PROFILE_PRIMITIVES 320    // 64 short and 256 extended
+  #define PROFILE_TOP_COUNT   20    // Rows of the address table report
+
+  typedef struct {
+    uint64_t count;
+    uint64_t cycles;
+  } profile_counter;
+
+  struct profile {
+    char            * filename;     // Of the JSON file
+    char            * program_name;
+    uint32_t          size;         // Of the program, entries of addresses
+    profile_counter   opcodes[PROFILE_OPCODES];
+    profile_counter   primitives[PROFILE_PRIMITIVES];
+    profile_counter * addresses;
+    uint64_t          last_cycles;
+    int32_t           last_address; // -1 before the first instruction
+  };
+
+  PUBLIC bool profile_start(char * filename, char * program_name);
+  PUBLIC void profile_step(const uint8_t * p);
+  PUBLIC bool profile_report();
+  PUBLIC void profile_release();
+
+  /** Sampling profiler.
+
+    Started with the -P option of picobit-vm, the sampler takes
+    PROFILE_SAMPLE_HZ samples per second of CPU time (SIGPROF). The
+    signal handler only sets profile_sample_due: the sample is taken by
+    profile_sample() at the next instruction, when the heap is consistent.
+    It records the procedure of the pc and those of the return addresses
+    of the cont chain, that is the Scheme call stack (tail calls excluded).
+
+    The procedures are found by following the code from the program entry
+    point: the targets of CALL, JUMP, CLOS and LOOP instructions are the
+    procedure entries and every instruction reached from an entry without
+    going through another one belongs to it. The procedures are named from
+    the symbol file of the program if there is one (prog.sym for prog.hex
+    or prog.img), with one "address name" line per procedure, address
+    being the one of its entry (its number of arguments byte). The other
+    ones are named proc@address, the code at the program entry point
+    toplevel.
+
+    At the end of the program, profile_sampling_report() writes the stacks
+    in the folded format of flame graphs tools, one line per distinct
+    stack, the outermost procedure first, followed by its sample count:
+
+      toplevel;proc@87;fib 42
+
+    The samples are aggregated as they are taken, such that the memory
+    used doesn't grow with the time the program runs.
+
+    As the timer and its signal, the sampler is shared by all the threads
+    of the process: it is not available with batches.
+
+   */
+
+  #define PROFILE_SAMPLE_HZ 1000
+  #define PROFILE_MAX_DEPTH  256   // Outermost frames replaced by [truncated]
+
+  PUBLIC volatile sig_atomic_t profile_sample_due;
+
+  PUBLIC bool profile_sampling_start(char * filename, char * program_filename);
+  PUBLIC void profile_sample(const uint8_t * p);
+  PUBLIC bool profile_sampling_report();
+  PUBLIC void profile_sampling_release();
+
+  #undef PUBLIC
+
+#endif // PROFILING
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#if WORKSTATION
+
+  #ifdef SNAPSHOT
+    #define PUBLIC
+  #else
+    #define PUBLIC extern
+  #endif
+
+  /** Snapshots.
+
+    A snapshot is a program image (see image.h) holding, with the program,
+    the complete state of the VM at the time it was taken: the RAM heap
+    (data and flags, including the globals), the vector heap, the
+    registers, the program counter and the task scheduler state.
+
+    It is taken by the snapshot primitive, that returns #f. Once the
+    snapshot is loaded with program_load(), snapshot_restore() points the
+    heaps of the context to the mapped image, without any copy or sweep,
+    and interpreter() resumes the program just after the snapshot
+    primitive, this time returning #t.
+
+    Open files, sockets and the content of the output port buffers are
+    not part of a snapshot. A snapshot can't be taken while tasks are
+    waiting for events or while files are mapped.
+
+   */
+
+  typedef struct {
+    uint32_t pc_offset;             // In the program
+    cell_p   stack;                 // env
+    cell_p   continuation;          // cont
+    cell_p   free_cells;
+    cell_p   heap_top;
+    vector_p vector_free_cells;
+    uint16_t free_cells_count;
+    uint16_t used_cells_count;
+    uint16_t vector_cells_count;
+    cell_p   root_task;
+    cell_p   symbols;
+    uint8_t  tables;
+    uint8_t  run_queue_head;
+    uint8_t  run_queue_count;
+    uint32_t time_slice;
+    uint32_t slice_left;
+    cell_p   run_queue[RUN_QUEUE_SIZE];
+  } snapshot_state;
+
+  PUBLIC bool snapshot_write(char * filename);
+  PUBLIC bool snapshot_loaded();
+  PUBLIC bool snapshot_restore();
+
+  #undef PUBLIC
+
+#endif // WORKSTATION
+
+#endif
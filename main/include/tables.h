@@ -0,0 +1,43 @@
+#ifndef TABLES_H
+#define TABLES_H
+
+#ifdef TABLES
+  #define PUBLIC
+#else
+  #define PUBLIC extern
+#endif
+
+/** Hash Tables.
+
+  A hash table is a RAM vector of kind VECTOR_TABLE. Its bytes are a
+  header followed by the slots (open addressing, linear probing). Keys and
+  values are cells: the GC marks them through tables_gc_mark().
+
+  When a table grows, the new slots replace the ones of the table and the
+  old slots are kept in a vector pointed at by the header. Each operation
+  on the table moves a few entries from the old slots to the new ones,
+  such that no operation pays for the whole resize.
+
+ */
+
+typedef struct {
+  uint16_t count;     // Entries, old slots included
+  uint16_t used;      // Slots not empty, deleted ones included
+  uint16_t capacity;  // Slots, a power of 2
+  cell_p   old;       // Vector of the old slots, NIL if none
+  uint16_t migrate;   // Next old slot to move
+  uint8_t  equal;     // Keys are compared with equal? instead of eq?
+} table_header;
+
+typedef struct {
+  cell_p key;
+  cell_p value;
+} table_slot;
+
+PUBLIC cell_p table_new(bool equal);
+PUBLIC cell_p table_get(cell_p t, cell_p key, cell_p deflt);
+PUBLIC void   table_put(cell_p t, cell_p key, cell_p value);
+PUBLIC void   tables_gc_mark();
+
+#undef PUBLIC
+#endif
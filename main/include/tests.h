@@ -14,6 +14,16 @@ PUBLIC void interpreter_tests();
 PUBLIC void kb_tests();
 PUBLIC void mm_tests();
 PUBLIC void vm_arch_tests();
+PUBLIC void batch_tests();
+PUBLIC void events_tests();
+PUBLIC void ports_tests();
+PUBLIC void primitives_socket_tests();
+PUBLIC void primitives_file_tests();
+PUBLIC void primitives_numvector_tests();
+PUBLIC void primitives_table_tests();
+PUBLIC void primitives_symbol_tests();
+PUBLIC void snapshot_tests();
+PUBLIC void profiler_tests();
 
 #undef PUBLIC
 #endif
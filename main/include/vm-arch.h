@@ -132,24 +132,24 @@ Cells Definitions.
 
    symbol
 
-      For now, no symbols information are present. Its address in the ROM
-      constant area insure its uniqueness. A symbol as a constant will be showned
-      that way:
+      Its address insures its uniqueness: symbols are compared with eq?.
+
+      A ROM symbol with the user_1 flag set has a name: CHARS IDX is the
+      byte address in the program of a null terminated string, in the
+      symbol names pool located after the code. Older programs have
+      symbols without a name (CHARS IDX is 0xFFFF, user_1 is 0).
 
       +----+------+----+---------------+----------------+
-      | 00 | 1101 | GC |      NIL      |       NIL      |
+      | 01 | 1101 | GC |      NIL      |    CHARS IDX   |
       +----+------+----+---------------+----------------+
          2     4     2        16               16
 
-      The following could be implemented later:
-
-      The Symbol table is in the ROM area. The char list is an index (byte index
-      in the constant string pool) to a null terminated string containing the
-      human representation of the symbol. Next point to the next symbol cell in
-      the symbol table. The chars list pointer in unique for each symbol.
+      A RAM symbol is created by string->symbol for a name that is not the
+      one of a ROM symbol. CHARS is its name, a string cell also used as key
+      of the intern table (see primitives-symbol.c).
 
       +----+------+----+---------------+----------------+
-      | 00 | 1101 | GC |   CHARS LST   |       NEXT     |
+      | 00 | 1101 | GC |      NIL      |      CHARS     |
       +----+------+----+---------------+----------------+
          2     4     2        16               16
 
@@ -428,6 +428,16 @@ typedef cell_flags * cell_flags_ptr;
   CLOSR   Build closure from entry point pc + a - 128
           10111001 aaaaaaaa
 
+  LOOP    Self tail call of the current procedure at entry point a. The
+          arguments on TOS replace the parameters of the current frame in
+          front of the closure environment, the d stack slots sitting
+          between them are discarded.
+          10111010 dddddddd aaaaaaaa aaaaaaaa
+
+  PRIMX   Call extended primitive 64 + i (the primitives 0..63 are called
+          with opcodes 11iiiiii)
+          10111101 iiiiiiii
+
   LD      Load global value to TOS, located at the beginning of the RAM Heap
           Space. iiiiiiii is an index in the heap space.
           10111110 iiiiiiii
@@ -458,6 +468,8 @@ typedef cell_flags * cell_flags_ptr;
 #define INSTR_BRR                  ((uint8_t) 0xB7)
 #define INSTR_BRRF                 ((uint8_t) 0xB8)
 #define INSTR_CLOSR                ((uint8_t) 0xB9)
+#define INSTR_LOOP                 ((uint8_t) 0xBA)
+#define INSTR_PRIMX                ((uint8_t) 0xBD)
 #define INSTR_LD                   ((uint8_t) 0xBE)
 #define INSTR_ST                   ((uint8_t) 0xBF)
 
@@ -481,134 +493,158 @@ typedef cell_flags * cell_flags_ptr;
 #define ROM_MAX_ADDR               ((IDX) 0xFE00)
 #define ROM_IDX(p)                 (p & 0x1FFF)
 
-#define RAM_IS_PAIR(p)             (ram_heap_flags[p].type ==         CONS_TYPE)
-#define RAM_IS_CONTINUATION(p)     (ram_heap_flags[p].type == CONTINUATION_TYPE)
-#define RAM_IS_CLOSURE(p)          (ram_heap_flags[p].type ==      CLOSURE_TYPE)
-#define RAM_IS_FIXNUM(p)           (ram_heap_flags[p].type ==       FIXNUM_TYPE)
-#define RAM_IS_BIGNUM(p)           (ram_heap_flags[p].type ==       BIGNUM_TYPE)
-#define RAM_IS_STRING(p)           (ram_heap_flags[p].type ==       STRING_TYPE)
-#define RAM_IS_CSTRING(p)          (ram_heap_flags[p].type ==      CSTRING_TYPE)
-#define RAM_IS_VECTOR(p)           (ram_heap_flags[p].type ==       VECTOR_TYPE)
-#define RAM_IS_SYMBOL(p)           (ram_heap_flags[p].type ==       SYMBOL_TYPE)
+#define RAM_IS_PAIR(p)             (vm->ram_heap_flags[p].type ==         CONS_TYPE)
+#define RAM_IS_CONTINUATION(p)     (vm->ram_heap_flags[p].type == CONTINUATION_TYPE)
+#define RAM_IS_CLOSURE(p)          (vm->ram_heap_flags[p].type ==      CLOSURE_TYPE)
+#define RAM_IS_FIXNUM(p)           (vm->ram_heap_flags[p].type ==       FIXNUM_TYPE)
+#define RAM_IS_BIGNUM(p)           (vm->ram_heap_flags[p].type ==       BIGNUM_TYPE)
+#define RAM_IS_STRING(p)           (vm->ram_heap_flags[p].type ==       STRING_TYPE)
+#define RAM_IS_CSTRING(p)          (vm->ram_heap_flags[p].type ==      CSTRING_TYPE)
+#define RAM_IS_VECTOR(p)           (vm->ram_heap_flags[p].type ==       VECTOR_TYPE)
+#define RAM_IS_SYMBOL(p)           (vm->ram_heap_flags[p].type ==       SYMBOL_TYPE)
 #define RAM_IS_NUMBER(p)           (RAM_IS_FIXNUM(p) || RAM_IS_BIGNUM(p))
 
-#define ROM_IS_PAIR(p)             (rom_heap[ROM_IDX(p)].type ==         CONS_TYPE)
-#define ROM_IS_CONTINUATION(p)     (rom_heap[ROM_IDX(p)].type == CONTINUATION_TYPE)
-#define ROM_IS_CLOSURE(p)          (rom_heap[ROM_IDX(p)].type ==      CLOSURE_TYPE)
-#define ROM_IS_FIXNUM(p)           (rom_heap[ROM_IDX(p)].type ==       FIXNUM_TYPE)
-#define ROM_IS_BIGNUM(p)           (rom_heap[ROM_IDX(p)].type ==       BIGNUM_TYPE)
-#define ROM_IS_STRING(p)           (rom_heap[ROM_IDX(p)].type ==       STRING_TYPE)
-#define ROM_IS_CSTRING(p)          (rom_heap[ROM_IDX(p)].type ==      CSTRING_TYPE)
-#define ROM_IS_VECTOR(p)           (rom_heap[ROM_IDX(p)].type ==       VECTOR_TYPE)
-#define ROM_IS_SYMBOL(p)           (rom_heap[ROM_IDX(p)].type ==       SYMBOL_TYPE)
+#define ROM_IS_PAIR(p)             (vm->rom_heap[ROM_IDX(p)].type ==         CONS_TYPE)
+#define ROM_IS_CONTINUATION(p)     (vm->rom_heap[ROM_IDX(p)].type == CONTINUATION_TYPE)
+#define ROM_IS_CLOSURE(p)          (vm->rom_heap[ROM_IDX(p)].type ==      CLOSURE_TYPE)
+#define ROM_IS_FIXNUM(p)           (vm->rom_heap[ROM_IDX(p)].type ==       FIXNUM_TYPE)
+#define ROM_IS_BIGNUM(p)           (vm->rom_heap[ROM_IDX(p)].type ==       BIGNUM_TYPE)
+#define ROM_IS_STRING(p)           (vm->rom_heap[ROM_IDX(p)].type ==       STRING_TYPE)
+#define ROM_IS_CSTRING(p)          (vm->rom_heap[ROM_IDX(p)].type ==      CSTRING_TYPE)
+#define ROM_IS_VECTOR(p)           (vm->rom_heap[ROM_IDX(p)].type ==       VECTOR_TYPE)
+#define ROM_IS_SYMBOL(p)           (vm->rom_heap[ROM_IDX(p)].type ==       SYMBOL_TYPE)
 #define ROM_IS_NUMBER(p)           (ROM_IS_FIXNUM(p) || ROM_IS_BIGNUM(p))
 
-#define IN_RAM(p)                  (p >= reserved_cells_count) && (p < ram_heap_size)
+#define IN_RAM(p)                  (p >= vm->reserved_cells_count) && (p < vm->ram_heap_size)
 #define IN_ROM(p)                  (p >= ROM_START_ADDR) && (p < ROM_MAX_ADDR)
 
-#define RAM_GET_TYPE(p)            ram_heap_flags[p].type
-#define RAM_SET_TYPE(p, t)         ram_heap_flags[p].type = t
+#define RAM_GET_TYPE(p)            vm->ram_heap_flags[p].type
+#define RAM_SET_TYPE(p, t)         vm->ram_heap_flags[p].type = t
 
-#define RAM_GET_BITS(p)            ram_heap_flags[p].bits
+#define RAM_GET_BITS(p)            vm->ram_heap_flags[p].bits
 
-#define RAM_GET_CAR(p)             ram_heap_data[p].cons.car_p
-#define RAM_GET_CDR(p)             ram_heap_data[p].cons.cdr_p
+#define RAM_GET_CAR(p)             vm->ram_heap_data[p].cons.car_p
+#define RAM_GET_CDR(p)             vm->ram_heap_data[p].cons.cdr_p
 
-#define RAM_SET_CAR(p, v)          ram_heap_data[p].cons.car_p = v
-#define RAM_SET_CDR(p, v)          ram_heap_data[p].cons.cdr_p = v
+#define RAM_SET_CAR(p, v)          vm->ram_heap_data[p].cons.car_p = v
+#define RAM_SET_CDR(p, v)          vm->ram_heap_data[p].cons.cdr_p = v
 
-#define ROM_GET_CAR(p)             rom_heap[ROM_IDX(p)].cons.car_p
-#define ROM_GET_CDR(p)             rom_heap[ROM_IDX(p)].cons.cdr_p
+#define ROM_GET_CAR(p)             vm->rom_heap[ROM_IDX(p)].cons.car_p
+#define ROM_GET_CDR(p)             vm->rom_heap[ROM_IDX(p)].cons.cdr_p
 
-#define RAM_IS_MARKED(p)           (ram_heap_flags[p].gc_mark == 1)
-#define RAM_IS_NOT_MARKED(p)       (ram_heap_flags[p].gc_mark == 0)
-#define RAM_SET_MARK(p)            ram_heap_flags[p].gc_mark = 1
-#define RAM_CLR_MARK(p)            ram_heap_flags[p].gc_mark = 0
+#define RAM_IS_MARKED(p)           (vm->ram_heap_flags[p].gc_mark == 1)
+#define RAM_IS_NOT_MARKED(p)       (vm->ram_heap_flags[p].gc_mark == 0)
+#define RAM_SET_MARK(p)            vm->ram_heap_flags[p].gc_mark = 1
+#define RAM_CLR_MARK(p)            vm->ram_heap_flags[p].gc_mark = 0
 
-#define RAM_IS_FLIPPED(p)          (ram_heap_flags[p].gc_flip == 1)
-#define RAM_SET_FLIP(p)            ram_heap_flags[p].gc_flip = 1
-#define RAM_CLR_FLIP(p)            ram_heap_flags[p].gc_flip = 0
+#define RAM_IS_FLIPPED(p)          (vm->ram_heap_flags[p].gc_flip == 1)
+#define RAM_SET_FLIP(p)            vm->ram_heap_flags[p].gc_flip = 1
+#define RAM_CLR_FLIP(p)            vm->ram_heap_flags[p].gc_flip = 0
 
-#define RAM_IS_USER_1_SET(p)       (ram_heap_flags[p].user_1 == 1)
-#define RAM_SET_USER_1(p)          ram_heap_flags[p].user_1 = 1
-#define RAM_CLR_USER_1(p)          ram_heap_flags[p].user_1 = 0
+#define RAM_IS_USER_1_SET(p)       (vm->ram_heap_flags[p].user_1 == 1)
+#define RAM_SET_USER_1(p)          vm->ram_heap_flags[p].user_1 = 1
+#define RAM_CLR_USER_1(p)          vm->ram_heap_flags[p].user_1 = 0
 
-#define RAM_IS_USER_2_SET(p)       (ram_heap_flags[p].user_2 == 1)
-#define RAM_SET_USER_2(p)          ram_heap_flags[p].user_2 = 1
-#define RAM_CLR_USER_2(p)          ram_heap_flags[p].user_2 = 0
+#define RAM_IS_USER_2_SET(p)       (vm->ram_heap_flags[p].user_2 == 1)
+#define RAM_SET_USER_2(p)          vm->ram_heap_flags[p].user_2 = 1
+#define RAM_CLR_USER_2(p)          vm->ram_heap_flags[p].user_2 = 0
 
-#define HAS_NO_RIGHT_LINK(p)       ((ram_heap_flags[p].bits & 0x30) != 0)
-#define HAS_RIGHT_LINK(p)          ((ram_heap_flags[p].bits & 0x30) == 0)
-#define HAS_LEFT_LINK(p)           ((ram_heap_flags[p].bits & 0x20) == 0)
+#define HAS_NO_RIGHT_LINK(p)       ((vm->ram_heap_flags[p].bits & 0x30) != 0)
+#define HAS_RIGHT_LINK(p)          ((vm->ram_heap_flags[p].bits & 0x30) == 0)
+#define HAS_LEFT_LINK(p)           ((vm->ram_heap_flags[p].bits & 0x20) == 0)
 
 // Fixnum
 
-#define RAM_GET_FIXNUM_VALUE(p)    ram_heap_data[p].fixnum.value
-#define ROM_GET_FIXNUM_VALUE(p)    rom_heap[ROM_IDX(p)].fixnum.value
+#define RAM_GET_FIXNUM_VALUE(p)    vm->ram_heap_data[p].fixnum.value
+#define ROM_GET_FIXNUM_VALUE(p)    vm->rom_heap[ROM_IDX(p)].fixnum.value
 
-#define RAM_SET_FIXNUM_VALUE(p, v) ram_heap_data[p].fixnum.value = v
+#define RAM_SET_FIXNUM_VALUE(p, v) vm->ram_heap_data[p].fixnum.value = v
 
 // Bignum
 
-#define RAM_GET_BIGNUM_VALUE(p)    ram_heap_data[p].bignum.num_part
-#define ROM_GET_BIGNUM_VALUE(p)    rom_heap[ROM_IDX(p)].bignum.num_part
+#define RAM_GET_BIGNUM_VALUE(p)    vm->ram_heap_data[p].bignum.num_part
+#define ROM_GET_BIGNUM_VALUE(p)    vm->rom_heap[ROM_IDX(p)].bignum.num_part
 
-#define RAM_GET_BIGNUM_HI(p)       ram_heap_data[p].bignum.next_p
-#define ROM_GET_BIGNUM_HI(p)       rom_heap[ROM_IDX(p)].bignum.next_p
+#define RAM_GET_BIGNUM_HI(p)       vm->ram_heap_data[p].bignum.next_p
+#define ROM_GET_BIGNUM_HI(p)       vm->rom_heap[ROM_IDX(p)].bignum.next_p
 
-#define RAM_SET_BIGNUM_HI(p,h)     ram_heap_data[p].bignum.next_p = h
-#define RAM_SET_BIGNUM_VALUE(p,v)  ram_heap_data[p].bignum.num_part = v
+#define RAM_SET_BIGNUM_HI(p,h)     vm->ram_heap_data[p].bignum.next_p = h
+#define RAM_SET_BIGNUM_VALUE(p,v)  vm->ram_heap_data[p].bignum.num_part = v
 
 // Vector
 
-#define RAM_GET_VECTOR_LENGTH(p)   ram_heap_data[p].vector.length
-#define ROM_GET_VECTOR_LENGTH(p)   rom_heap[ROM_IDX(p)].vector.length
+#define RAM_GET_VECTOR_LENGTH(p)   vm->ram_heap_data[p].vector.length
+#define ROM_GET_VECTOR_LENGTH(p)   vm->rom_heap[ROM_IDX(p)].vector.length
+
+#define RAM_SET_VECTOR_LENGTH(p, v) vm->ram_heap_data[p].vector.length = v
+
+#define RAM_SET_VECTOR_START(p, v) vm->ram_heap_data[p].vector.start_p = v
+#define RAM_GET_VECTOR_START(p)    vm->ram_heap_data[p].vector.start_p
+#define ROM_GET_VECTOR_START(p)    vm->rom_heap[ROM_IDX(p)].vector.start_p
+
+// The bytes of a ROM u8vector are either a list of byte cells or, when the
+// user_1 flag is set, packed in the program, the start being their address
+
+#define ROM_IS_PACKED_VECTOR(p)    (vm->rom_heap[ROM_IDX(p)].user_1 == 1)
+#define ROM_GET_VECTOR_BYTES(p)    (vm->program + ROM_GET_VECTOR_START(p))
 
-#define RAM_SET_VECTOR_LENGTH(p, v) ram_heap_data[p].vector.length = v
+#define ROM_IS_NAMED_SYMBOL(p)     (vm->rom_heap[ROM_IDX(p)].user_1 == 1)
+#define ROM_GET_SYMBOL_NAME(p)     ((char *) (vm->program + vm->rom_heap[ROM_IDX(p)].symbol.chars_idx))
+#define RAM_GET_SYMBOL_NAME(p)     vm->ram_heap_data[p].symbol.chars_idx
+#define RAM_SET_SYMBOL_NAME(p, v)  vm->ram_heap_data[p].symbol.chars_idx = v
+#define RAM_SET_SYMBOL_NEXT(p, v)  vm->ram_heap_data[p].symbol.next_p = v
 
-#define RAM_SET_VECTOR_START(p, v) ram_heap_data[p].vector.start_p = v
-#define RAM_GET_VECTOR_START(p)    ram_heap_data[p].vector.start_p
-#define ROM_GET_VECTOR_START(p)    rom_heap[ROM_IDX(p)].vector.start_p
+// The kind of elements of a RAM vector is kept in the user flags (0 for
+// u8vectors, see primitives-numvector.c and primitives-table.c)
 
-#define VECTOR_GET_LENGTH(p)       vector_heap[p].vector.length
-#define VECTOR_GET_RAM_PTR(p)      vector_heap[p].vector.start_p
+#define VECTOR_U8                  0
+#define VECTOR_S16                 1
+#define VECTOR_S32                 2
+#define VECTOR_TABLE               3
 
-#define VECTOR_SET_LENGTH(p, l)    vector_heap[p].vector.length = l
-#define VECTOR_SET_RAM_PTR(p, r)   vector_heap[p].vector.start_p = r
+#define RAM_GET_VECTOR_KIND(p)     ((vm->ram_heap_flags[p].user_2 << 1) | vm->ram_heap_flags[p].user_1)
+#define RAM_SET_VECTOR_KIND(p, k)  (vm->ram_heap_flags[p].user_1 = (k) & 1, vm->ram_heap_flags[p].user_2 = ((k) >> 1) & 1)
+#define RAM_IS_U8VECTOR(p)         (RAM_IS_VECTOR(p) && (RAM_GET_VECTOR_KIND(p) == VECTOR_U8))
 
-#define VECTOR_IS_USED(p)          (vector_heap[p].gc_mark == 1)
-#define VECTOR_IS_FREE(p)          (vector_heap[p].gc_mark == 0)
+#define VECTOR_GET_LENGTH(p)       vm->vector_heap[p].vector.length
+#define VECTOR_GET_RAM_PTR(p)      vm->vector_heap[p].vector.start_p
 
-#define VECTOR_SET_USED(p)         vector_heap[p].gc_mark = 1
-#define VECTOR_SET_FREE(p)         vector_heap[p].gc_mark = 0
+#define VECTOR_SET_LENGTH(p, l)    vm->vector_heap[p].vector.length = l
+#define VECTOR_SET_RAM_PTR(p, r)   vm->vector_heap[p].vector.start_p = r
 
-#define VECTOR_GET_BYTE(p, i)      *(((uint8_t *) &vector_heap[p]) + i)
-#define VECTOR_SET_BYTE(p, i, b)   *(((uint8_t *) &vector_heap[p]) + i) = b
+#define VECTOR_IS_USED(p)          (vm->vector_heap[p].gc_mark == 1)
+#define VECTOR_IS_FREE(p)          (vm->vector_heap[p].gc_mark == 0)
+
+#define VECTOR_SET_USED(p)         vm->vector_heap[p].gc_mark = 1
+#define VECTOR_SET_FREE(p)         vm->vector_heap[p].gc_mark = 0
+
+#define VECTOR_GET_BYTE(p, i)      *(((uint8_t *) &vm->vector_heap[p]) + i)
+#define VECTOR_SET_BYTE(p, i, b)   *(((uint8_t *) &vm->vector_heap[p]) + i) = b
 
 // String
 
-#define RAM_STRING_GET_CHARS(p)    ram_heap_data[p].string.chars_p
-#define ROM_STRING_GET_CHARS(p)    rom_heap[ROM_IDX(p)].string.chars_p
+#define RAM_STRING_GET_CHARS(p)    vm->ram_heap_data[p].string.chars_p
+#define ROM_STRING_GET_CHARS(p)    vm->rom_heap[ROM_IDX(p)].string.chars_p
 
-#define RAM_STRING_SET_CHARS(p, v) ram_heap_data[p].string.chars_p = v
-#define RAM_STRING_CLR_UNUSED(p)   ram_heap_data[p].string.unused = 0
+#define RAM_STRING_SET_CHARS(p, v) vm->ram_heap_data[p].string.chars_p = v
+#define RAM_STRING_CLR_UNUSED(p)   vm->ram_heap_data[p].string.unused = 0
 
 
 // Continuation
 
-#define RAM_GET_CONT_CLOSURE(p)    ram_heap_data[p].continuation.closure_p
-#define RAM_GET_CONT_PARENT(p)     ram_heap_data[p].continuation.parent_p
+#define RAM_GET_CONT_CLOSURE(p)    vm->ram_heap_data[p].continuation.closure_p
+#define RAM_GET_CONT_PARENT(p)     vm->ram_heap_data[p].continuation.parent_p
 
-#define RAM_SET_CONT_CLOSURE(p, v) ram_heap_data[p].continuation.closure_p = v
-#define RAM_SET_CONT_PARENT(p,v)   ram_heap_data[p].continuation.parent_p = v
+#define RAM_SET_CONT_CLOSURE(p, v) vm->ram_heap_data[p].continuation.closure_p = v
+#define RAM_SET_CONT_PARENT(p,v)   vm->ram_heap_data[p].continuation.parent_p = v
 
 // Closure
 
-#define RAM_GET_CLOSURE_ENV(p)            ram_heap_data[p].closure.environment_p
-#define RAM_GET_CLOSURE_ENTRY_POINT(p)    ram_heap_data[p].closure.entry_point_p
+#define RAM_GET_CLOSURE_ENV(p)            vm->ram_heap_data[p].closure.environment_p
+#define RAM_GET_CLOSURE_ENTRY_POINT(p)    vm->ram_heap_data[p].closure.entry_point_p
 
-#define RAM_SET_CLOSURE_ENV(p, v)         ram_heap_data[p].closure.environment_p = v
-#define RAM_SET_CLOSURE_ENTRY_POINT(p, v) ram_heap_data[p].closure.entry_point_p = v
+#define RAM_SET_CLOSURE_ENV(p, v)         vm->ram_heap_data[p].closure.environment_p = v
+#define RAM_SET_CLOSURE_ENTRY_POINT(p, v) vm->ram_heap_data[p].closure.entry_point_p = v
 
 // Globals
 
@@ -651,22 +687,187 @@ typedef cell_flags * cell_flags_ptr;
 
  */
 
-PUBLIC cell_p env, cont, reg1, reg2, reg3, reg4;
-PUBLIC code_p entry;
-PUBLIC uint8_t * program;
-PUBLIC uint16_t max_addr;
-PUBLIC int32_t a1, a2, a3;
+/** VM Context.
+
+  All the state of a virtual machine (registers, heaps and memory management
+  data) is kept in a vm_context structure, such that many independent virtual
+  machines can be hosted by the same process, each one with its own heaps.
+  The context in use is pointed at by vm. On a workstation, vm is local to
+  each thread: a thread runs the virtual machine it has selected with
+  vm_select(). The fields of the current context are always accessed
+  through vm (vm->reg1, vm->env, ...).
+
+ */
 
-PUBLIC union {
+typedef union {
   uint8_t  * c;
   uint16_t * s;
-} pc, last_pc;
+} code_ptr;
+
+#define RUN_QUEUE_SIZE 128
+#define EVENT_WAITERS   32
+#define TIMER_WHEEL_SIZE 64
+
+typedef struct {
+  bool     used;
+  cell_p   task;      // Continuation of the waiting task
+  int      fd;        // File descriptor waited on, -1 if none
+  uint8_t  mode;      // Events waited on fd (EVENT_READ, EVENT_WRITE)
+  int8_t   channel;   // Wake-up channel waited on, -1 if none
+  bool     timed;
+  uint32_t deadline;  // In ms, see events_now()
+  uint8_t  next;      // Next waiter slot + 1 in the timer wheel bucket
+} event_waiter;
+
+#define OUTPUT_PORTS        8
+#define PORT_BUFFER_SIZE  512
+
+typedef struct {
+  FILE    * file;        // NULL if the port is not opened
+  uint8_t * buffer;      // Allocated at the first write
+  uint16_t  count;
+  uint16_t  flush_size;  // The buffer is flushed when count reaches it
+  uint8_t   policy;      // PORT_FLUSH_LINE | PORT_FLUSH_READ (ports.h)
+} output_port;
+
+#define MAPPED_FILES 4
+
+typedef struct {
+  uint8_t * data;  // NULL if the map is not used
+  size_t    size;
+} mapped_file;
+
+typedef struct vm_context {
+  cell_p env, cont, reg1, reg2, reg3, reg4;
+  code_p entry;
+  uint8_t * program;
+  uint16_t max_addr;
+  int32_t a1, a2, a3;
+  code_ptr pc, last_pc;
+
+  uint16_t global_count;
+  uint8_t reserved_cells_count;
+
+  IDX vector_heap_size;
+
+  cell_data_ptr  ram_heap_data;
+  cell_flags_ptr ram_heap_flags;
+  cell_p         ram_heap_end;
+  cell_p         ram_heap_top;  // Cells from there to the end were never allocated
+  IDX            ram_heap_size;
+
+  cell_ptr rom_heap;
+  cell_ptr vector_heap;
+
+  // Memory management (mm.c)
+
+  cell_p   free_cells;
+  vector_p vector_free_cells;
+
+  uint16_t   free_cells_count;
+  uint16_t   used_cells_count;
+  uint16_t vector_cells_count;
+  uint16_t free_allocated_count;
+
+  int    gc_call_counter;
+  double max_gc_duration;
+
+  // Temporary bignum roots (bignum.c)
+
+  cell_p bignum_tmp1, bignum_tmp2, bignum_tmp3, bignum_tmp4, bignum_tmp5;
+
+  uint64_t clock_start;     // ns, see clock
+  uint64_t hr_clock_start;  // ns, see clock-us and clock-ns
+
+  // Task scheduler (interpreter.c). The run queue is a circular buffer of
+  // the continuations of the tasks ready to run.
+
+  cell_p   run_queue[RUN_QUEUE_SIZE];
+  uint8_t  run_queue_head;
+  uint8_t  run_queue_count;
+  cell_p   root_task;   // Continuation of start-first-process
+  uint32_t time_slice;  // Instructions per task before preemption, 0 = none
+  uint32_t slice_left;
+
+  // Event loop (events.c). The waiting tasks are kept in the waiters table
+  // until their file descriptor is ready, their channel is woken up or their
+  // deadline is reached.
+
+  event_waiter waiters[EVENT_WAITERS];
+  uint8_t  waiter_count;
+  uint8_t  suspending;  // Waiter slot + 1 of the task to suspend, 0 if none
+  uint32_t wakeups;     // Channels woken up by other threads (vm_wakeup())
+  int      epoll_fd;    // -1 until the event loop is opened
+  int      wakeup_fd;
+
+  // Timer wheel: the waiters with a deadline are kept in the bucket of their
+  // deadline (in ms) modulo TIMER_WHEEL_SIZE, as lists of slot + 1.
+
+  uint8_t  timer_wheel[TIMER_WHEEL_SIZE];
+  uint8_t  timer_count;
+  uint32_t timer_tick;  // Time of the last expiration check
+
+  // Buffered output ports (ports.c)
+
+  output_port ports[OUTPUT_PORTS];
+
+  // Files mapped in memory (primitives-file.c)
+
+  mapped_file maps[MAPPED_FILES];
+
+  // True once a hash table was created: the GC must then mark their
+  // entries (primitives-table.c)
+
+  bool tables;
+
+  // Intern table of the symbols created by string->symbol, NIL until its
+  // first call (primitives-symbol.c)
+
+  cell_p symbols;
+
+  // Console ports, set to stdin and stdout by mm_init() if not redirected
+
+  FILE * in;
+  FILE * out;
+
+  #ifdef WORKSTATION
+    // If not NULL, terminate() returns there instead of exiting the process
+    jmp_buf * exit_point;
+
+    // Program image mapped by program_load() (hexfile.c), NULL if the
+    // program was read from an Intel HEX file
+    uint8_t * image;
+    size_t    image_size;
+
+    // Set by snapshot_restore() (snapshot.c): the heaps are in the image
+    // and interpreter() resumes at pc instead of the program entry point
+    bool heaps_mapped;
+    bool resume;
+  #endif
+
+  #if PROFILING
+    // Counters of the profiler (profiler.c), NULL if not profiling
+    struct profile * profile;
+  #endif
+} vm_context;
+
+#ifdef WORKSTATION
+  #define VM_THREAD_LOCAL __thread
+#else
+  #define VM_THREAD_LOCAL
+#endif
+
+PUBLIC VM_THREAD_LOCAL vm_context * vm;
+
+PUBLIC vm_context * vm_new_context();
+PUBLIC void         vm_delete_context(vm_context * ctx);
+PUBLIC void         vm_select(vm_context * ctx);
 
 PUBLIC void vm_arch_init();
 
 PUBLIC cell_p pop();
 
-PUBLIC cell_p new_closure(cell_p env, code_p code);
+PUBLIC cell_p new_closure(cell_p env_p, code_p code);
 PUBLIC cell_p new_cont(cell_p parent, cell_p closure);
 PUBLIC cell_p new_pair(cell_p car, cell_p cdr);
 PUBLIC cell_p new_string(cell_p chars_p);
@@ -676,22 +877,11 @@ PUBLIC cell_p new_vector(uint16_t length);
 
 PUBLIC int32_t decode_int(cell_p p);
 PUBLIC cell_p encode_int(int32_t val);
+PUBLIC cell_p encode_int32(int32_t val);
 
 PUBLIC void decode_2_int_args();
 
-PUBLIC uint16_t global_count;
-PUBLIC uint8_t reserved_cells_count;
-
-PUBLIC IDX vector_heap_size;
-
-PUBLIC cell_data_ptr  ram_heap_data;   // read/write
-PUBLIC cell_flags_ptr ram_heap_flags; // read/write
-PUBLIC cell_p   ram_heap_end;
-PUBLIC IDX      ram_heap_size; // as a number of cells
-
-PUBLIC cell_ptr rom_heap;  // read only
-
-PUBLIC cell_ptr vector_heap;
+PUBLIC uint8_t * u8vector_bytes(cell_p v, int32_t start, int32_t end);
 
 #undef PUBLIC
 #endif
@@ -5,11 +5,13 @@
 
 #define INTERPRETER 1
 #include "interpreter.h"
+#include "events.h"
+#include "profiler.h"
 
 #include "gen.primitives.h"
 
-#define NEXT_BYTE *pc.c++
-#define NEXT_SHORT *pc.s++
+#define NEXT_BYTE *vm->pc.c++
+#define NEXT_SHORT *vm->pc.s++
 
 /** tos().
 
@@ -19,13 +21,13 @@
 
 cell_p tos()
 {
-  cell_p p = env;
+  cell_p p = vm->env;
 
-  if (env == NIL) {
+  if (vm->env == NIL) {
     FATAL("tos", "Environment exhausted");
   }
   else {
-    env = RAM_GET_CDR(env);
+    vm->env = RAM_GET_CDR(vm->env);
   }
 
   return p;
@@ -33,7 +35,9 @@ cell_p tos()
 
 /** prepare_arguments().
 
-  Prepares reg1 for the following cases:
+  General path of a closure call, used by closure_environment() for
+  procedures with a rest parameter and for calls with a wrong number
+  of arguments. Prepares reg1 for the following cases:
 
   1. Fixed number of arguments: reg1 will point on the
      lexical environment
@@ -51,27 +55,27 @@ cell_p tos()
 uint8_t prepare_arguments(int8_t nbr_args)
 {
   // Retrieve closure from stack, keep the cons for later
-  reg2 = tos();
-  reg1 = RAM_GET_CAR(reg2); // reg1 is the closure
+  vm->reg2 = tos();
+  vm->reg1 = RAM_GET_CAR(vm->reg2); // reg1 is the closure
 
-  if (IN_RAM(reg1)) {
-    if (RAM_IS_CLOSURE(reg1)) {
-      entry = RAM_GET_CLOSURE_ENTRY_POINT(reg1);
+  if (IN_RAM(vm->reg1)) {
+    if (RAM_IS_CLOSURE(vm->reg1)) {
+      vm->entry = RAM_GET_CLOSURE_ENTRY_POINT(vm->reg1);
     }
     else {
-      FATAL_MSG("prepare_arguments: Expected closure cell at %d.", reg1);
+      FATAL_MSG("prepare_arguments: Expected closure cell at %d.", vm->reg1);
     }
   }
   else {
-    FATAL_MSG("prepare_arguments: Closure on TOS not in RAM: %d.", reg1);
+    FATAL_MSG("prepare_arguments: Closure on TOS not in RAM: %d.", vm->reg1);
   }
 
   // Retrieve number of arguments expected in the procedure entry point
-  uint8_t nbr_params = *(program + entry++);
+  uint8_t nbr_params = *(vm->program + vm->entry++);
 
-  if (reg1 != NIL) {
+  if (vm->reg1 != NIL) {
     // reg1 is the closure definitions
-    reg1 = RAM_GET_CLOSURE_ENV(reg1); // retrieve the environment
+    vm->reg1 = RAM_GET_CLOSURE_ENV(vm->reg1); // retrieve the environment
   }
 
   if ((nbr_params & 0x80) == 0) {
@@ -90,32 +94,121 @@ uint8_t prepare_arguments(int8_t nbr_args)
       ERROR("prepare_arguments", "Wrong number of arguments");
     }
 
-    reg3 = NIL;
+    vm->reg3 = NIL;
 
     // The loop is optimized to reuse the stack cons cells instead
     // of freeing and reallocating a cons. Save some garbage collecting job...
     while (nbr_args-- > nbr_params) {
-      reg4 = tos();
-      RAM_SET_CDR(reg4, reg3);
-      reg3 = reg4;
+      vm->reg4 = tos();
+      RAM_SET_CDR(vm->reg4, vm->reg3);
+      vm->reg3 = vm->reg4;
       //reg3 = new_pair(pop(), reg3);
     }
-    RAM_SET_CDR(reg2, reg1);
-    RAM_SET_CAR(reg2, reg3);
-    reg1 = reg2;
-    reg3 = reg4 = NIL;
+    RAM_SET_CDR(vm->reg2, vm->reg1);
+    RAM_SET_CAR(vm->reg2, vm->reg3);
+    vm->reg1 = vm->reg2;
+    vm->reg3 = vm->reg4 = NIL;
     nbr_args++;
   }
 
-  reg2 = NIL;
+  vm->reg2 = NIL;
   return nbr_args;
 }
 
 void save_cont()
 {
-  reg4 = new_closure(env, pc.c - program);
-  cont = new_cont(cont, reg4);
-  reg4 = NIL;
+  vm->reg4 = new_closure(vm->env, vm->pc.c - vm->program);
+  vm->cont = new_cont(vm->cont, vm->reg4);
+  vm->reg4 = NIL;
+}
+
+/** Task scheduler.
+
+  A task waiting to run is kept in the run queue as a continuation built
+  by save_cont() at the instruction where the task was suspended: its
+  closure holds the stack (env) and the address of the next instruction.
+  Contrary to a return-to-cont, resuming a task doesn't push any value on
+  its stack, the task continues as if it was never interrupted. Tasks can
+  then be suspended between any two instructions (preemption).
+
+  The queue is a circular buffer of the vm context, the continuations it
+  contains being roots for the garbage collector.
+
+ */
+
+void task_push_front(cell_p k)
+{
+  if (vm->run_queue_count >= RUN_QUEUE_SIZE) {
+    FATAL("task_push_front", "Run queue is full");
+  }
+
+  vm->run_queue_head = (vm->run_queue_head + RUN_QUEUE_SIZE - 1) % RUN_QUEUE_SIZE;
+  vm->run_queue[vm->run_queue_head] = k;
+  vm->run_queue_count++;
+}
+
+void task_push_back(cell_p k)
+{
+  if (vm->run_queue_count >= RUN_QUEUE_SIZE) {
+    FATAL("task_push_back", "Run queue is full");
+  }
+
+  vm->run_queue[(vm->run_queue_head + vm->run_queue_count) % RUN_QUEUE_SIZE] = k;
+  vm->run_queue_count++;
+}
+
+cell_p task_pop_front()
+{
+  cell_p k = vm->run_queue[vm->run_queue_head];
+
+  vm->run_queue[vm->run_queue_head] = NIL;
+  vm->run_queue_head = (vm->run_queue_head + 1) % RUN_QUEUE_SIZE;
+  vm->run_queue_count--;
+
+  return k;
+}
+
+void task_resume(cell_p k)
+{
+  EXPECT(RAM_IS_CONTINUATION(k), "task_resume", "continuation");
+
+  vm->reg2  = RAM_GET_CONT_CLOSURE(k);
+  vm->env   = RAM_GET_CLOSURE_ENV(vm->reg2);
+  vm->entry = RAM_GET_CLOSURE_ENTRY_POINT(vm->reg2);
+  vm->cont  = RAM_GET_CONT_PARENT(k);
+  vm->pc.c  = vm->program + vm->entry;
+  vm->reg2  = NIL;
+}
+
+/** task_switch().
+
+  Suspends the running task at the end of the run queue and resumes the
+  first one. Nothing is done if no other task is ready to run. If the
+  running task is waiting for an event, it is parked in the event loop
+  instead (see events.h).
+
+ */
+
+void task_switch()
+{
+  vm->slice_left = vm->time_slice;
+
+  if (vm->suspending) {
+    save_cont();
+    events_park(vm->cont);
+    task_resume(events_next_task());
+    return;
+  }
+
+  if (vm->waiter_count > 0) {
+    events_poll(false);
+  }
+
+  if (vm->run_queue_count > 0) {
+    save_cont();
+    task_push_back(vm->cont);
+    task_resume(task_pop_front());
+  }
 }
 
 /** build_environment.
@@ -127,16 +220,31 @@ void save_cont()
 
  */
 
+#define RELINK_ARG                 \
+  vm->reg2 = vm->env;              \
+  vm->env  = RAM_GET_CDR(vm->env); \
+  RAM_SET_CDR(vm->reg2, vm->reg1); \
+  vm->reg1 = vm->reg2
+
 void build_environment(uint8_t nbr_args)
 {
   // The loop is optimized to reuse the stack cons cells instead
   // of freeing and reallocating a cons. Save some garbage collecting job...
-
-  while (nbr_args--) {
-    reg2 = tos();
-    RAM_SET_CDR(reg2, reg1);
-    reg1 = reg2;
-    //reg1 = new_pair(pop(), reg1)
+  // Procedures rarely have more than 4 parameters: these are unrolled.
+
+  switch (nbr_args) {
+    case 4: RELINK_ARG;
+    case 3: RELINK_ARG;
+    case 2: RELINK_ARG;
+    case 1: RELINK_ARG;
+    case 0: break;
+    default:
+      while (nbr_args--) {
+        vm->reg2 = tos();
+        RAM_SET_CDR(vm->reg2, vm->reg1);
+        vm->reg1 = vm->reg2;
+        //reg1 = new_pair(pop(), reg1)
+      }
   }
 
   // while (nbr_args--) {
@@ -144,7 +252,77 @@ void build_environment(uint8_t nbr_args)
   //   reg1 = new_pair(reg3, reg1);
   // }
 
-  reg2 = NIL;
+  vm->reg2 = NIL;
+}
+
+/** closure_environment.
+
+  Prepares the call of the closure on TOS with nbr_args arguments (CALLC and
+  JUMPC instructions). On return, reg1 is the environment of the procedure and
+  entry points at its first instruction.
+
+  The entry header byte of a procedure with a rest parameter has bit 7 set,
+  so comparing it with nbr_args is enough to recognize the usual case: a
+  procedure with exactly nbr_args fixed parameters. The stack cons holding the
+  closure is then returned to the free list and the arguments are linked
+  in front of the closure environment. Anything else (rest parameter, wrong
+  number of arguments, not a closure) goes through prepare_arguments().
+
+ */
+
+void closure_environment(uint8_t nbr_args)
+{
+  cell_p closure = (vm->env == NIL) ? NIL : RAM_GET_CAR(vm->env);
+
+  if (IN_RAM(closure) &&
+      RAM_IS_CLOSURE(closure) &&
+      (*(vm->program + (vm->entry = RAM_GET_CLOSURE_ENTRY_POINT(closure))) == nbr_args)) {
+
+    vm->entry++;
+
+    vm->reg2 = vm->env;
+    vm->env  = RAM_GET_CDR(vm->env);
+    return_to_free_list(vm->reg2);
+
+    vm->reg1 = RAM_GET_CLOSURE_ENV(closure);
+    build_environment(nbr_args);
+  }
+  else {
+    build_environment(prepare_arguments(nbr_args));
+  }
+}
+
+/** loop_environment.
+
+  Used by a self tail call (LOOP instruction). The new arguments on top of
+  the stack are relinked in front of the closure environment, as
+  build_environment() does for a call. Compared to a JUMPC, the closure is
+  neither pushed nor checked and its entry header is not decoded. The frame
+  is not updated in place: the conses of the arguments were allocated when
+  they were pushed, and the discarded locals and the parameter cells of the
+  current frame are left as they are, as a continuation captured in the
+  loop body may still use them. They are reclaimed by the garbage
+  collector. A loop iteration thus still allocates nbr_args cells, but no
+  garbage collection can be fired from this function.
+
+  On entry, the stack is: args (last one on top), discard locals, params
+  (first one on top), closure environment.
+
+ */
+
+void loop_environment(uint8_t discard, uint8_t nbr_args)
+{
+  cell_p p = vm->env;
+
+  // Skip the arguments, the discarded locals and the parameters
+  for (int i = (2 * nbr_args) + discard; (i > 0) && (p != NIL); i--) {
+    p = RAM_GET_CDR(p);
+  }
+
+  vm->reg1 = p;
+  build_environment(nbr_args);
+  vm->env  = vm->reg1;
+  vm->reg1 = NIL;
 }
 
 void interpreter()
@@ -153,18 +331,37 @@ void interpreter()
   // contain non-managed values (i.e. values that can't be manipulated
   // with the garbage collection mechanism, as reg1 .. reg4)
 
-  static uint16_t r1;
+  uint16_t r1;
 
-  pc.c = program + (program[2] * 5) + 4;
+  #if WORKSTATION
+    // A restored snapshot continues where it was taken
+    if (vm->resume) {
+      vm->resume = false;
+    }
+    else {
+      vm->pc.c = vm->program + (vm->program[2] * 5) + 4;
+    }
+  #else
+    vm->pc.c = vm->program + (vm->program[2] * 5) + 4;
+  #endif
 
   for (;;) {
     #if DEBUGGING
-      if (pc.c >= (program + max_addr)) {
-        FATAL_MSG("Interpreter reached an non-program location: %d\n", (int) (pc.c - program));
+      if (vm->pc.c >= (vm->program + vm->max_addr)) {
+        FATAL_MSG("Interpreter reached an non-program location: %d\n", (int) (vm->pc.c - vm->program));
       }
     #endif
+    if (vm->slice_left && (--vm->slice_left == 0)) {
+      task_switch();
+    }
+
+    #if PROFILING
+      if (vm->profile != NULL) profile_step(vm->pc.c);
+      if (profile_sample_due) profile_sample(vm->pc.c);
+    #endif
+
     #if TRACING
-      last_pc = pc;
+      vm->last_pc = vm->pc;
     #endif
     uint8_t instr = NEXT_BYTE;
 
@@ -174,10 +371,10 @@ void interpreter()
         r1 = instr & 0x1F;
         TRACE("  LDCS %d\n", r1);
         if (r1 < 3) {
-          env = new_pair(r1 + 0xFFFD, env);
+          vm->env = new_pair(r1 + 0xFFFD, vm->env);
         }
         else {
-          env = new_pair((r1 - 3) + 0xFE00, env);
+          vm->env = new_pair((r1 - 3) + 0xFE00, vm->env);
         }
         break;
 
@@ -186,20 +383,20 @@ void interpreter()
         r1 = instr & 0x1F;
         TRACE("  LDSTK %d\n", r1);
 
-        reg1 = env;
-        while (r1-- && (reg1 != NIL)) {
-          reg1 = RAM_GET_CDR(reg1);
+        vm->reg1 = vm->env;
+        while (r1-- && (vm->reg1 != NIL)) {
+          vm->reg1 = RAM_GET_CDR(vm->reg1);
         }
-        env = new_pair(reg1 == NIL ? NIL : RAM_GET_CAR(reg1), env);
-        reg1 = NIL;
+        vm->env = new_pair(vm->reg1 == NIL ? NIL : RAM_GET_CAR(vm->reg1), vm->env);
+        vm->reg1 = NIL;
         break;
 
       case INSTR_LDS :
         r1 = instr & 0x0F;
         TRACE("  LDS %d\n", r1);
-        reg1 = GLOBAL_GET(r1);
-        env = new_pair(reg1, env);
-        reg1 = NIL;
+        vm->reg1 = GLOBAL_GET(r1);
+        vm->env = new_pair(vm->reg1, vm->env);
+        vm->reg1 = NIL;
         break;
 
       case INSTR_STS :
@@ -211,41 +408,41 @@ void interpreter()
       case INSTR_CALLC :  // Call with closure on TOS
         r1 = instr & 0x0F;
         TRACE("  CALLC %d\n", r1);
-        build_environment(prepare_arguments(r1));
+        closure_environment(r1);
         save_cont();
 
-        env = reg1;
-        pc.c = program + entry;
-        reg1 = reg2 = NIL;
+        vm->env = vm->reg1;
+        vm->pc.c = vm->program + vm->entry;
+        vm->reg1 = vm->reg2 = NIL;
         break;
 
       case INSTR_JUMPC :
         r1 = instr & 0x0F;
         TRACE("  JUMPC %d\n", r1);
-        build_environment(prepare_arguments(r1));
+        closure_environment(r1);
 
-        env = reg1;
-        pc.c = program + entry;
-        reg1 = reg2 = NIL;
+        vm->env = vm->reg1;
+        vm->pc.c = vm->program + vm->entry;
+        vm->reg1 = vm->reg2 = NIL;
         break;
 
       case INSTR_JUMPS :
-        entry = (pc.c - program) + (instr & 0x0F);
-        TRACE("  JUMPS %d\n", entry);
+        vm->entry = (vm->pc.c - vm->program) + (instr & 0x0F);
+        TRACE("  JUMPS %d\n", vm->entry);
 
-        reg1 = NIL;
-        build_environment(*(program + entry++));
+        vm->reg1 = NIL;
+        build_environment(*(vm->program + vm->entry++));
 
-        env = reg1;
-        pc.c = program + entry;
+        vm->env = vm->reg1;
+        vm->pc.c = vm->program + vm->entry;
 
-        reg1 = NIL;
+        vm->reg1 = NIL;
         break;
 
       case INSTR_BRSF :
         TRACE("  BRSF %d\n", instr & 0x0F);
         if (pop() == FALSE) {
-          pc.c += (instr & 0x0F);
+          vm->pc.c += (instr & 0x0F);
         }
         break;
 
@@ -253,143 +450,161 @@ void interpreter()
         r1 = ((instr & 0x0F) << 8) + NEXT_BYTE;
         TRACE("  LDC %d\n", r1);
         if (r1 < 3) {
-          env = new_pair(r1 += 0xFFFD, env);
+          vm->env = new_pair(r1 += 0xFFFD, vm->env);
         }
         else if (r1 < 260) {
-          env = new_pair((r1 - 3) + 0xFE00, env);
+          vm->env = new_pair((r1 - 3) + 0xFE00, vm->env);
         }
         else {
-          env = new_pair((r1 - 260) + ROM_START_ADDR, env);
+          vm->env = new_pair((r1 - 260) + ROM_START_ADDR, vm->env);
         }
         break;
 
       case INSTR_CALL: //  Call top-level procedure
         switch (instr) {
           case INSTR_CALL :
-            entry = NEXT_SHORT;
-            TRACE("  CALL %d\n", entry);
+            vm->entry = NEXT_SHORT;
+            TRACE("  CALL %d\n", vm->entry);
 
-            reg1 = NIL;
-            build_environment(*(program + entry++));
+            vm->reg1 = NIL;
+            build_environment(*(vm->program + vm->entry++));
             save_cont();
 
-            env = reg1;
-            pc.c = program + entry;
+            vm->env = vm->reg1;
+            vm->pc.c = vm->program + vm->entry;
 
-            reg1 = NIL;
+            vm->reg1 = NIL;
             break;
 
           case INSTR_JUMP : // Jump to top-level procedure
-            entry = NEXT_SHORT;
-            TRACE("  JUMP %d\n", entry);
+            vm->entry = NEXT_SHORT;
+            TRACE("  JUMP %d\n", vm->entry);
 
-            reg1 = NIL;
-            build_environment(*(program + entry++));
+            vm->reg1 = NIL;
+            build_environment(*(vm->program + vm->entry++));
 
-            env = reg1;
-            pc.c = program + entry;
+            vm->env = vm->reg1;
+            vm->pc.c = vm->program + vm->entry;
 
-            reg1 = NIL;
+            vm->reg1 = NIL;
             break;
 
           case INSTR_BR :
-            entry = NEXT_SHORT;
-            TRACE("  BR %d\n", entry);
-            pc.c = program + entry;
+            vm->entry = NEXT_SHORT;
+            TRACE("  BR %d\n", vm->entry);
+            vm->pc.c = vm->program + vm->entry;
             break;
 
           case INSTR_BRF :
-            entry = NEXT_SHORT;
-            TRACE("  BRF %d\n", entry);
+            vm->entry = NEXT_SHORT;
+            TRACE("  BRF %d\n", vm->entry);
             if (pop() == FALSE) {
-              pc.c = program + entry;
+              vm->pc.c = vm->program + vm->entry;
             }
             break;
 
           case INSTR_CLOS :
-            entry = NEXT_SHORT;
-            TRACE("  CLOS %d\n", entry);
+            vm->entry = NEXT_SHORT;
+            TRACE("  CLOS %d\n", vm->entry);
 
-            reg2 = tos();
-            reg3 = RAM_GET_CAR(reg2); // env
-            reg1 = new_closure(reg3, entry);
+            vm->reg2 = tos();
+            vm->reg3 = RAM_GET_CAR(vm->reg2); // env
+            vm->reg1 = new_closure(vm->reg3, vm->entry);
 
-            RAM_SET_CDR(reg2, env);  // Already set, but anyway...
-            RAM_SET_CAR(reg2, reg1);
+            RAM_SET_CDR(vm->reg2, vm->env);  // Already set, but anyway...
+            RAM_SET_CAR(vm->reg2, vm->reg1);
 
-            env = reg2;
-            reg1 = reg2 = reg3 = NIL;
+            vm->env = vm->reg2;
+            vm->reg1 = vm->reg2 = vm->reg3 = NIL;
             break;
 
           case INSTR_CALLR :
-            entry = NEXT_BYTE;
-            entry = (pc.c - program) + entry - 128;
+            vm->entry = NEXT_BYTE;
+            vm->entry = (vm->pc.c - vm->program) + vm->entry - 128;
 
-            TRACE("  CALLR %d\n", entry);
+            TRACE("  CALLR %d\n", vm->entry);
 
-            reg1 = NIL;
+            vm->reg1 = NIL;
 
-            build_environment(*(program + entry++));
+            build_environment(*(vm->program + vm->entry++));
             save_cont();
 
-            env = reg1;
-            pc.c = program + entry;
-            reg1 = NIL;
+            vm->env = vm->reg1;
+            vm->pc.c = vm->program + vm->entry;
+            vm->reg1 = NIL;
             break;
 
           case INSTR_JUMPR :
-            entry = NEXT_BYTE;
-            entry = (pc.c - program) + entry - 128;
+            vm->entry = NEXT_BYTE;
+            vm->entry = (vm->pc.c - vm->program) + vm->entry - 128;
 
-            TRACE("  JUMPR %d\n", entry);
+            TRACE("  JUMPR %d\n", vm->entry);
 
-            reg1 = NIL;
+            vm->reg1 = NIL;
 
-            build_environment(*(program + entry++));
+            build_environment(*(vm->program + vm->entry++));
 
-            env = reg1;
-            pc.c = program + entry;
-            reg1 = NIL;
+            vm->env = vm->reg1;
+            vm->pc.c = vm->program + vm->entry;
+            vm->reg1 = NIL;
             break;
 
           case INSTR_BRR :
-            entry = NEXT_BYTE;
-            entry =  (pc.c - program) + entry - 128;
-            TRACE("  BRR %d\n", entry);
-            pc.c = program + entry;
+            vm->entry = NEXT_BYTE;
+            vm->entry =  (vm->pc.c - vm->program) + vm->entry - 128;
+            TRACE("  BRR %d\n", vm->entry);
+            vm->pc.c = vm->program + vm->entry;
             break;
 
           case INSTR_BRRF :
-            entry = NEXT_BYTE;
-            entry =  (pc.c - program) + entry - 128;
-            TRACE("  BRRF %d\n", entry);
+            vm->entry = NEXT_BYTE;
+            vm->entry =  (vm->pc.c - vm->program) + vm->entry - 128;
+            TRACE("  BRRF %d\n", vm->entry);
             if (pop() == FALSE) {
-              pc.c = program + entry;
+              vm->pc.c = vm->program + vm->entry;
             }
             break;
 
           case INSTR_CLOSR :
-            entry = NEXT_BYTE ;
-            entry =  (pc.c - program) + entry - 128;
-            TRACE("  CLOSR %d\n", entry);
+            vm->entry = NEXT_BYTE ;
+            vm->entry =  (vm->pc.c - vm->program) + vm->entry - 128;
+            TRACE("  CLOSR %d\n", vm->entry);
+
+            vm->reg2 = tos();
+            vm->reg3 = RAM_GET_CAR(vm->reg2); // env
+            vm->reg1 = new_closure(vm->reg3, vm->entry);
 
-            reg2 = tos();
-            reg3 = RAM_GET_CAR(reg2); // env
-            reg1 = new_closure(reg3, entry);
+            RAM_SET_CDR(vm->reg2, vm->env);  // Already set, but anyway...
+            RAM_SET_CAR(vm->reg2, vm->reg1);
 
-            RAM_SET_CDR(reg2, env);  // Already set, but anyway...
-            RAM_SET_CAR(reg2, reg1);
+            vm->env = vm->reg2;
+            vm->reg1 = vm->reg2 = vm->reg3 = NIL;
+            break;
 
-            env = reg2;
-            reg1 = reg2 = reg3 = NIL;
+          case INSTR_LOOP :
+            r1 = NEXT_BYTE;
+            vm->entry = NEXT_SHORT;
+            TRACE("  LOOP %d %d\n", r1, vm->entry);
+
+            loop_environment(r1, *(vm->program + vm->entry++));
+
+            vm->pc.c = vm->program + vm->entry;
+            break;
+
+          case INSTR_PRIMX :
+            switch (NEXT_BYTE) {
+              #ifndef NO_PRIMITIVE_EXPAND
+                #include "gen.dispatchx.h"
+              #endif
+            }
             break;
 
           case INSTR_LD  :
             r1 = NEXT_BYTE;
             TRACE("  LD %d\n", r1);
-            reg1 = GLOBAL_GET(r1);
-            env = new_pair(reg1, env);
-            reg1 = NIL;
+            vm->reg1 = GLOBAL_GET(r1);
+            vm->env = new_pair(vm->reg1, vm->env);
+            vm->reg1 = NIL;
             break;
 
           case INSTR_ST :
@@ -412,5 +627,112 @@ void interpreter_tests()
 {
   TESTM("interpreter");
 
+  TEST("loop_environment()");
+
+    cell_p frame, local, arg1, arg2;
+
+    vm->env   = new_pair(encode_int(2), NIL);
+    vm->env   = new_pair(encode_int(1), vm->env);
+    frame = vm->env;
+    vm->env   = local = new_pair(encode_int(9), vm->env);
+    vm->env   = arg1  = new_pair(encode_int(10), vm->env);
+    vm->env   = arg2  = new_pair(encode_int(20), vm->env);
+
+    loop_environment(1, 2);
+
+    EXPECT_TRUE(vm->env == arg1,                                    "Arguments not relinked as the frame");
+    EXPECT_TRUE(RAM_GET_CAR(vm->env) == encode_int(10),             "First parameter is wrong");
+    EXPECT_TRUE(RAM_GET_CDR(vm->env) == arg2,                       "Second parameter is wrong");
+    EXPECT_TRUE(RAM_GET_CAR(RAM_GET_CDR(vm->env)) == encode_int(20), "Second parameter is wrong");
+    EXPECT_TRUE(RAM_GET_CDR(RAM_GET_CDR(vm->env)) == NIL,           "Closure environment not linked");
+    EXPECT_TRUE((RAM_GET_CAR(frame) == encode_int(1)) &&
+                (RAM_GET_CAR(RAM_GET_CDR(frame)) == encode_int(2)) &&
+                (RAM_GET_CDR(local) == frame), "Previous frame modified");
+    #if DEBUGGING
+      EXPECT_TRUE(!is_free(local) && !is_free(frame), "Cells of the previous frame freed");
+    #endif
+
+    vm->env = NIL;
+
+  TEST("closure_environment()");
+
+    uint8_t hdr[] = { 0x02, 0xFE };
+    cell_p  clos_env;
+
+    vm->program  = hdr;
+    vm->max_addr = sizeof(hdr);
+
+    // Fixed arity: (f 10 20) with f expecting 2 parameters
+
+    clos_env = new_pair(encode_int(7), NIL);
+    vm->env      = new_pair(encode_int(10), NIL);
+    vm->env      = new_pair(encode_int(20), vm->env);
+    vm->env      = new_pair(new_closure(clos_env, 0), vm->env);
+
+    closure_environment(2);
+
+    EXPECT_TRUE(vm->entry == 1,                                    "Entry not pointing after the header");
+    EXPECT_TRUE(vm->env == NIL,                                     "Arguments not removed from the stack");
+    EXPECT_TRUE(RAM_GET_CAR(vm->reg1) == encode_int(10),            "First parameter is wrong");
+    EXPECT_TRUE(RAM_GET_CAR(RAM_GET_CDR(vm->reg1)) == encode_int(20), "Second parameter is wrong");
+    EXPECT_TRUE(RAM_GET_CDR(RAM_GET_CDR(vm->reg1)) == clos_env,       "Closure environment not linked");
+
+    // Rest parameter: (g 10 20 30) with g expecting 1 fixed parameter
+
+    vm->env = new_pair(encode_int(10), NIL);
+    vm->env = new_pair(encode_int(20), vm->env);
+    vm->env = new_pair(encode_int(30), vm->env);
+    vm->env = new_pair(new_closure(clos_env, 1), vm->env);
+
+    closure_environment(3);
+
+    EXPECT_TRUE(vm->entry == 2,                          "Entry not pointing after the header");
+    EXPECT_TRUE(vm->env == NIL,                           "Arguments not removed from the stack");
+    EXPECT_TRUE(RAM_GET_CAR(vm->reg1) == encode_int(10),  "Fixed parameter is wrong");
+    vm->reg2 = RAM_GET_CAR(RAM_GET_CDR(vm->reg1));
+    EXPECT_TRUE((RAM_GET_CAR(vm->reg2) == encode_int(20)) &&
+                (RAM_GET_CAR(RAM_GET_CDR(vm->reg2)) == encode_int(30)) &&
+                (RAM_GET_CDR(RAM_GET_CDR(vm->reg2)) == NIL), "Rest parameter list is wrong");
+    EXPECT_TRUE(RAM_GET_CDR(RAM_GET_CDR(vm->reg1)) == clos_env, "Closure environment not linked");
+
+    vm->reg1 = vm->reg2 = NIL;
+    mm_gc();
+
+  TEST("LOOP instruction");
+
+    // (define (count-down n) (if (= n 0) n (let ((m n)) (count-down (- n 1)))))
+    // (set! g (count-down 200))
+
+    uint8_t pgm[] = {
+      0xD7, 0xFB, 0, 1,       //     header: no constant, 1 global
+      0xA0, 0xCB,             //  4: LDC 200
+      0xB0, 0x0B, 0x00,       //  6: CALL 11
+      0x50,                   //  9: STS 0
+      0xC0,                   // 10: #%halt
+      0x01,                   // 11: 1 parameter
+      0x20,                   // 12: LDSTK 0
+      0x04,                   // 13: LDCS 0
+      0xCE,                   // 14: =
+      0x92,                   // 15: BRSF 18
+      0x20,                   // 16: LDSTK 0
+      0xC1,                   // 17: return
+      0x20,                   // 18: LDSTK 0
+      0x20,                   // 19: LDSTK 0
+      0x05,                   // 20: LDCS 1
+      0xD0,                   // 21: #%-
+      0xBA, 0x01, 0x0B, 0x00  // 22: LOOP 1 11
+    };
+
+    vm->program  = pgm;
+    vm->max_addr = sizeof(pgm);
+
+    interpreter();
+
+    EXPECT_TRUE(GLOBAL_GET(0) == ZERO, "Self tail call loop returned a wrong value");
+    EXPECT_TRUE(vm->env == NIL,            "Stack not empty after LOOP execution");
+
+    GLOBAL_SET(0, NIL);
+    vm->cont = NIL;
+    mm_gc();
 }
 #endif
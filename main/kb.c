@@ -31,11 +31,11 @@ void kb_restore()
   #endif
 }
 
-char kb_getch(void)
+char kb_getch(FILE * in)
 {
   int ch;
 
-  ch = getchar();
+  ch = fgetc(in);
 
   return (char)((ch == EOF) ? 0 : ch);
 }
@@ -53,7 +53,7 @@ void kb_tests()
 
   printf("Please press any key, followed with character 'X': ");
   while (ch != 'X') {
-    ch = kb_getch();
+    ch = kb_getch(stdin);
     if (ch) printf("\nch = %c", ch);
   }
   putchar('\n');
@@ -16,18 +16,21 @@
 #include "hexfile.h"
 #include "kb.h"
 #include "interpreter.h"
+#include "batch.h"
+#include "snapshot.h"
+#include "profiler.h"
+#include "ports.h"
 #include "testing.h"
 
 #if WORKSTATION
   bool initialisations(char * program_filename)
   {
-    if ((program = calloc(65536, 1)) == NULL) {
-      FATAL("initialisations", "Unable to allocate program space");
-    }
-
-    if (!read_hex_file(program_filename, program, 65536)) return false;
+    if (!program_load(program_filename)) return false;
 
-    if (!mm_init(program)) return false;
+    if (snapshot_loaded()) {
+      if (!snapshot_restore()) return false;
+    }
+    else if (!mm_init(vm->program)) return false;
 
     vm_arch_init();
 
@@ -38,10 +41,20 @@
 
   void terminate()
   {
+    ports_flush_all();
+
+    // A batch job returns to its runner instead of exiting
+    if (vm->exit_point != NULL) longjmp(*vm->exit_point, 1);
+
+    #if PROFILING
+      if (vm->profile != NULL) profile_report();
+      profile_sampling_report();
+    #endif
+
     #if STATISTICS
-      INFO_MSG("terminate: GC Processing Count: %d.", gc_call_counter);
+      INFO_MSG("terminate: GC Processing Count: %d.", vm->gc_call_counter);
       #if WORKSTATION
-        INFO_MSG("terminate: Max GC Duration: %10.7f Sec.", max_gc_duration);
+        INFO_MSG("terminate: Max GC Duration: %10.7f Sec.", vm->max_gc_duration);
       #endif
       if (verbose) fputc('\n', stderr);
     #endif
@@ -55,8 +68,21 @@
   void usage(char * exename)
   {
     fprintf(stderr,
-      "Usage: %s [options] intelhex_filename\n"
+      "Usage: %s [options] program_filename\n"
+      "       %s -b [-j threads] program_filename...\n"
+      "       %s -b -i [-j threads] program_filename input_filename...\n"
+      "\nA program file is an Intel HEX file or a program image (hex2bin -i).\n"
       "\nOptions:\n"
+      "  -b  Batch: run the programs concurrently, each one in its own VM\n"
+      "  -c  Check the hash of the heaps of a snapshot when loading it\n"
+      "  -i  Batch: run the program once for each input file\n"
+      "  -j  Batch: number of threads (default: number of cores)\n"
+      #if PROFILING
+        "  -p  Profile: count the instructions and their cycles, written\n"
+        "      in the JSON file given and reported on stderr at the end\n"
+        "  -P  Sampling profile: Scheme call stacks sampled on CPU time,\n"
+        "      written as folded stacks (flame graphs) in the file given\n"
+      #endif
       #if TRACING
         "  -t  Trace\n"
       #endif
@@ -65,21 +91,29 @@
       #endif
       "  -v  Verbose\n"
       "  -V  Version\n"
-      "  -?  Print this message\n", exename);
+      "  -?  Print this message\n", exename, exename, exename);
   }
 
-  char * options = "vV?"
+  char * options = "vV?bcij:"
   #if TRACING
     "t"
   #endif
   #if TESTS
     "T"
   #endif
+  #if PROFILING
+    "p:P:"
+  #endif
   ;
 
   int main(int argc, char **argv)
   {
     int opt = 0;
+    bool batch = false;
+    bool inputs = false;
+    int thread_count = 0;
+    char * profile_filename = NULL;
+    char * sampling_filename = NULL;
     trace = false;
     verbose = false;
     char *fname;
@@ -88,6 +122,18 @@
         case 'v':
           verbose = true;
           break;
+        case 'b':
+          batch = true;
+          break;
+        case 'c':
+          image_check = true;
+          break;
+        case 'i':
+          inputs = true;
+          break;
+        case 'j':
+          thread_count = atoi(optarg);
+          break;
         #if TESTS
           case 'T':
             conduct_tests();
@@ -99,6 +145,14 @@
             trace = true;
             break;
         #endif
+        #if PROFILING
+          case 'p':
+            profile_filename = optarg;
+            break;
+          case 'P':
+            sampling_filename = optarg;
+            break;
+        #endif
         case '?':
           usage(argv[0]);
           return 1;
@@ -113,6 +167,15 @@
       }
     }
 
+    if (batch && ((profile_filename != NULL) || (sampling_filename != NULL))) {
+      ERROR("main", "Profiling is not available in batch mode");
+      return 1;
+    }
+
+    if (batch && (argc > optind)) {
+      return batch_run(&argv[optind], argc - optind, thread_count, inputs) ? 0 : 1;
+    }
+
     if ((optind > 0) && (argc > optind)) {
       fname = argv[optind];
     }
@@ -124,6 +187,15 @@
       ERROR("main", "Unable to properly initialise the environment");
     }
 
+    #if PROFILING
+      if ((profile_filename != NULL) && !profile_start(profile_filename, fname)) {
+        ERROR("main", "Unable to start the profiler");
+      }
+      if ((sampling_filename != NULL) && !profile_sampling_start(sampling_filename, fname)) {
+        ERROR("main", "Unable to start the sampling profiler");
+      }
+    #endif
+
     interpreter();
 
     #if DEBUGGING
@@ -152,8 +224,8 @@
 
     verbose = VERBOSE;
 
-    program = program_bin_start;
-    max_addr = program_bin_end - program_bin_start;
+    vm->program = program_bin_start;
+    vm->max_addr = program_bin_end - program_bin_start;
 
     #if DEBUGGING
       esp_chip_info_t chip_info;
@@ -170,12 +242,12 @@
 
     #endif
 
-    if (!mm_init(program)) return false;
+    if (!mm_init(vm->program)) return false;
 
     #if STATISTICS
-      printf("\nProgram Size: %d\n", max_addr);
-      printf("Ram Heap Size: %d\n", ram_heap_size);
-      printf("Vector Heap Size: %d\n", vector_heap_size);
+      printf("\nProgram Size: %d\n", vm->max_addr);
+      printf("Ram Heap Size: %d\n", vm->ram_heap_size);
+      printf("Vector Heap Size: %d\n", vm->vector_heap_size);
     #endif
     vm_arch_init();
 
@@ -186,9 +258,11 @@
 
   void terminate()
   {
+    ports_flush_all();
+
     #if STATISTICS
-      INFO_MSG("terminate: GC Processing Count: %d.", gc_call_counter);
-      INFO_MSG("terminate: Max GC Duration: %10.7f Sec.", max_gc_duration);
+      INFO_MSG("terminate: GC Processing Count: %d.", vm->gc_call_counter);
+      INFO_MSG("terminate: Max GC Duration: %10.7f Sec.", vm->max_gc_duration);
       fputc('\n', stderr);
     #endif
 
@@ -2,20 +2,31 @@
 #include "vm-arch.h"
 #include "testing.h"
 #include "bignum.h"
+#include "tables.h"
 
 #include <string.h>
 
 #if STATISTICS
   #include <time.h>
+
+  #ifdef WORKSTATION
+    // CPU time of the calling thread. Many virtual machines may be running
+    // at the same time (batch runner): the process time would count them all.
+    PRIVATE double gc_clock()
+    {
+      struct timespec ts;
+
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+      return ts.tv_sec + (ts.tv_nsec / 1e9);
+    }
+  #else
+    #define gc_clock() (((double) clock()) / CLOCKS_PER_SEC)
+  #endif
 #endif
 
 #define MM
 #include "mm.h"
 
-#if DEBUGGING
-  uint16_t free_allocated_count;
-#endif
-
 extern void show(cell_p p);
 
 /** Deutsch-Schorr-Waite Garbage Collection.
@@ -31,7 +42,7 @@ void mm_mark(cell_p p)
  	cell_p stack;
  	cell_p visit;
 
- 	if (p < ram_heap_end) {
+ 	if (p < vm->ram_heap_end) {
  		visit = NIL;
 
  push:
@@ -44,7 +55,7 @@ void mm_mark(cell_p p)
 
  				p = RAM_GET_CDR(visit);
 
- 				if (p < ram_heap_end) {
+ 				if (p < vm->ram_heap_end) {
  					RAM_SET_FLIP(visit);
  					RAM_SET_CDR(visit, stack);
  					goto push;
@@ -58,7 +69,7 @@ void mm_mark(cell_p p)
  visit_field1:
  				p = RAM_GET_CAR(visit);
 
- 				if (p < ram_heap_end) {
+ 				if (p < vm->ram_heap_end) {
  					RAM_SET_MARK(visit);
  					RAM_SET_CAR(visit, stack);
  					goto push;
@@ -69,7 +80,7 @@ void mm_mark(cell_p p)
  		}
 
  pop:
- 		if (stack < ram_heap_end) {
+ 		if (stack < vm->ram_heap_end) {
  			if (HAS_RIGHT_LINK(stack) && RAM_IS_FLIPPED(stack)) {
  				p = RAM_GET_CDR(stack);  /* pop through cdr */
  				RAM_SET_CDR(stack, visit);
@@ -103,10 +114,10 @@ void mm_mark(cell_p p)
   cell_p next;
 
   for (;;) {
-    while ((current < ram_heap_end) && RAM_IS_NOT_MARKED(current)) {
+    while ((current < vm->ram_heap_end) && RAM_IS_NOT_MARKED(current)) {
       RAM_SET_MARK(current);
       #if STATISTICS
-        used_cells_count++;
+        vm->used_cells_count++;
       #endif
       if (HAS_LEFT_LINK(current)) {
         next = RAM_GET_CAR(current);
@@ -119,7 +130,7 @@ void mm_mark(cell_p p)
     // Here, current left branch of the subtree is completed. We go up until we
     // find a node for which a right link was not processed or has no right
     // link.
-    while ((prev < ram_heap_end) && RAM_IS_FLIPPED(prev)) {
+    while ((prev < vm->ram_heap_end) && RAM_IS_FLIPPED(prev)) {
       RAM_CLR_FLIP(prev);
       next = RAM_GET_CDR(prev); // next is the upper node
       RAM_SET_CDR(prev, current); // re-establish the link down
@@ -127,7 +138,7 @@ void mm_mark(cell_p p)
       prev    = next;
     }
 
-    if (prev >= ram_heap_end) break;
+    if (prev >= vm->ram_heap_end) break;
 
     // If we found a node with a right branch, mark it for return and
     // go down that branch to process its own left path.
@@ -140,7 +151,7 @@ void mm_mark(cell_p p)
     }
     else {
       // We go up until a node with a right link or top of the tree is detected
-      while ((prev < ram_heap_end) && HAS_NO_RIGHT_LINK(prev)) {
+      while ((prev < vm->ram_heap_end) && HAS_NO_RIGHT_LINK(prev)) {
         next = RAM_GET_CAR(prev);
         RAM_SET_CAR(prev, current);
         current = prev;
@@ -155,7 +166,7 @@ void mm_mark(cell_p p)
 #if DEBUGGING
   void unmark_ram()
   {
-    cell_p p = ram_heap_end - 1;
+    cell_p p = vm->ram_heap_end - 1;
 
     do {
       RAM_CLR_MARK(p);
@@ -164,7 +175,9 @@ void mm_mark(cell_p p)
 
   bool is_free(cell_p p)
   {
-    cell_p f = free_cells;
+    if (p >= vm->ram_heap_top) return true;
+
+    cell_p f = vm->free_cells;
     while (f != NIL) {
       if (f == p) return true;
       f = RAM_GET_CDR(f);
@@ -173,23 +186,34 @@ void mm_mark(cell_p p)
   }
 #endif
 
+/** mm_sweep().
+
+  Threads the unmarked cells below ram_heap_top in the free list. The
+  cells above ram_heap_top are never touched: they are allocated in
+  sequence by mm_new_ram_cell() once the free list is empty, such that
+  a fresh heap doesn't need to be swept. Free cells found at the top of
+  the used area are given back to it instead of the free list.
+
+ */
+
 PRIVATE void mm_sweep()
 {
-  free_cells = NIL;
+  vm->free_cells = NIL;
 
   #if DEBUGGING
     // Used to check for fragmentation the heap
-    free_allocated_count = 0;
+    vm->free_allocated_count = 0;
   #endif
 
   #if STATISTICS
-    free_cells_count = 0;
+    vm->free_cells_count = 0;
   #endif
 
-  cell_p p = ram_heap_end - 1;
+  cell_p p = vm->ram_heap_top;
 
-  // Don't forget: p cannot be a negative number...
-  do {
+  // p is unsigned and reserved_cells_count could be 0: the loop test
+  // comes before the decrement
+  while (p-- > vm->reserved_cells_count) {
     if (RAM_IS_MARKED(p)) {
       RAM_CLR_MARK(p);
     }
@@ -198,44 +222,54 @@ PRIVATE void mm_sweep()
         VECTOR_SET_FREE(RAM_GET_VECTOR_START(p) - 1);
         RAM_SET_TYPE(p, CONS_TYPE);
       }
-      RAM_SET_CDR(p, free_cells);
-      free_cells = p;
+      if ((p + 1) == vm->ram_heap_top) {
+        vm->ram_heap_top = p;
+      }
+      else {
+        RAM_SET_CDR(p, vm->free_cells);
+        vm->free_cells = p;
 
-      #if STATISTICS
-        free_cells_count++;
-      #endif
+        #if STATISTICS
+          vm->free_cells_count++;
+        #endif
+      }
     }
-
-    // Last loop will have p = reserved_cells_count...
-    // This doesn't work: while (--p >= reserved_cells_count)
-    //    as reserved_cells_count could be 0 and p is unsigned...
-  } while (p-- > reserved_cells_count);
+  }
 
   // Reset mark bits in the globals area
-  if (reserved_cells_count > 0) {
-    do {
-      RAM_CLR_MARK(p);
-    } while (p-- > 0); // Last loop will have p = 0
-  }
+  for (p = 0; p < vm->reserved_cells_count; p++) RAM_CLR_MARK(p);
+
+  #if STATISTICS
+    vm->free_cells_count += vm->ram_heap_end - vm->ram_heap_top;
+  #endif
 }
 
+/** check_free_list().
+
+  Returns true if the free cells, in the free list and above ram_heap_top,
+  and the reserved cells add up to count.
+
+ */
+
 PRIVATE bool check_free_list(int count)
 {
-  cell_p next = free_cells;
+  cell_p next = vm->free_cells;
+
+  count -= vm->ram_heap_end - vm->ram_heap_top;
 
   while (next != NIL) {
     count--;
     next = RAM_GET_CDR(next);
   }
 
-  return count == reserved_cells_count;
+  return count == vm->reserved_cells_count;
 }
 
 void return_to_free_list(cell_p p)
 {
   RAM_SET_TYPE(p, CONS_TYPE);
-  RAM_SET_CDR(p, free_cells);
-  free_cells = p;
+  RAM_SET_CDR(p, vm->free_cells);
+  vm->free_cells = p;
 }
 
 void mm_gc()
@@ -243,42 +277,52 @@ void mm_gc()
   INFO_MSG("Garbage collection Started");
 
   #if STATISTICS
-    used_cells_count = 0;
-    gc_call_counter++;
+    vm->used_cells_count = 0;
+    vm->gc_call_counter++;
 
     double gc_duration;
-    clock_t start_time;
-    clock_t end_time;
-    start_time = clock();
+    double start_time;
+    double end_time;
+    start_time = gc_clock();
   #endif
 
-  for (uint8_t i = 0; i < reserved_cells_count; i++) mm_mark(i);
+  for (uint8_t i = 0; i < vm->reserved_cells_count; i++) mm_mark(i);
+
+  mm_mark(vm->reg1);
+  mm_mark(vm->reg2);
+  mm_mark(vm->reg3);
+  mm_mark(vm->reg4);
+  mm_mark(vm->cont);
+  mm_mark(vm->env);
+  mm_mark(vm->symbols);
 
-  mm_mark(reg1);
-  mm_mark(reg2);
-  mm_mark(reg3);
-  mm_mark(reg4);
-  mm_mark(cont);
-  mm_mark(env);
+  mm_mark(vm->root_task);
+  for (uint8_t i = 0; i < vm->run_queue_count; i++) {
+    mm_mark(vm->run_queue[(vm->run_queue_head + i) % RUN_QUEUE_SIZE]);
+  }
+  for (uint8_t i = 0; i < EVENT_WAITERS; i++) {
+    if (vm->waiters[i].used) mm_mark(vm->waiters[i].task);
+  }
 
   bignum_gc_mark();
+  tables_gc_mark();
 
   mm_sweep();
 
   #if STATISTICS
-    end_time = clock();
-    gc_duration = ((double)(end_time - start_time)) / CLOCKS_PER_SEC;
-    if (gc_duration > max_gc_duration) {
-      max_gc_duration = gc_duration;
+    end_time = gc_clock();
+    gc_duration = end_time - start_time;
+    if (gc_duration > vm->max_gc_duration) {
+      vm->max_gc_duration = gc_duration;
     }
   #endif
 
   #if DEBUGGING
-    if ((used_cells_count + free_cells_count) != ram_heap_size) {
+    if ((vm->used_cells_count + vm->free_cells_count) != vm->ram_heap_size) {
       WARNING_MSG(
         "mm_gc: HEAP FRAGMENTATION (heap_size: %d, total: %d)",
-        ram_heap_size,
-        used_cells_count + free_cells_count);
+        vm->ram_heap_size,
+        vm->used_cells_count + vm->free_cells_count);
     }
   #endif
 
@@ -297,7 +341,7 @@ PRIVATE void mm_compact_vector_space ()
 
   uint16_t cur_size;
 
-  while (cur < vector_free_cells) {
+  while (cur < vm->vector_free_cells) {
     cur_size  = VECTOR_GET_LENGTH(cur);
 
     if (cur_size == 0) FATAL("mm_compact_vector_space", "Vector Heap Structure is wrong");
@@ -320,7 +364,7 @@ PRIVATE void mm_compact_vector_space ()
         //int len = cur_size * sizeof(cell);
         //while (len--) *dst++ = *src++;
 
-        memcpy(&vector_heap[prev], &vector_heap[cur], cur_size * sizeof(cell));
+        memcpy(&vm->vector_heap[prev], &vm->vector_heap[cur], cur_size * sizeof(cell));
 
         VECTOR_SET_FREE(cur);
 
@@ -336,7 +380,7 @@ PRIVATE void mm_compact_vector_space ()
   }
 
   // free space is now all at the end
-  vector_free_cells = (prev == NIL) ? 0 : prev;
+  vm->vector_free_cells = (prev == NIL) ? 0 : prev;
 }
 
 cell_p mm_new_vector_cell(uint16_t length, cell_p from)
@@ -345,7 +389,7 @@ cell_p mm_new_vector_cell(uint16_t length, cell_p from)
   // this includes a sizeof(cell)-byte vector space header
   length = ((length + sizeof(cell) - 1) / sizeof(cell)) + 1;
 
-  if ((vector_heap_size - vector_free_cells) < length) {
+  if ((vm->vector_heap_size - vm->vector_free_cells) < length) {
 
     INFO_MSG("Vector Space compaction\n");
 
@@ -353,15 +397,15 @@ cell_p mm_new_vector_cell(uint16_t length, cell_p from)
     mm_compact_vector_space();
 
     // free space too small, trigger gc
-    if ((vector_heap_size - vector_free_cells) < length) { // we gc'd, but no space is big enough for the vector
+    if ((vm->vector_heap_size - vm->vector_free_cells) < length) { // we gc'd, but no space is big enough for the vector
       FATAL("alloc_vec_cell", "No room for vector");
     }
   }
 
-  cell_p o = vector_free_cells;
+  cell_p o = vm->vector_free_cells;
 
   // advance the free pointer
-  vector_free_cells += length;
+  vm->vector_free_cells += length;
 
   VECTOR_SET_LENGTH(o, length);
   VECTOR_SET_RAM_PTR(o, from);
@@ -374,107 +418,171 @@ cell_p mm_new_vector_cell(uint16_t length, cell_p from)
 
 cell_p mm_new_ram_cell()
 {
-  if (free_cells == NIL) {
-    INFO_MSG("Free Cells Allocated since last GC: %d\n", free_allocated_count);
+  cell_p p;
+
+  if ((vm->free_cells == NIL) && (vm->ram_heap_top == vm->ram_heap_end)) {
+    INFO_MSG("Free Cells Allocated since last GC: %d\n", vm->free_allocated_count);
     mm_gc();
-    if (free_cells == NIL) {
+    if ((vm->free_cells == NIL) && (vm->ram_heap_top == vm->ram_heap_end)) {
       FATAL("mm_gc", "MEMORY EXHAUSTED!!");
     }
   }
 
-  cell_p p = free_cells;
-  free_cells = RAM_GET_CDR(free_cells);
+  if (vm->free_cells != NIL) {
+    p = vm->free_cells;
+    vm->free_cells = RAM_GET_CDR(vm->free_cells);
+  }
+  else {
+    p = vm->ram_heap_top++;
+    RAM_SET_TYPE(p, CONS_TYPE);
+  }
 
   #if DEBUGGING
-    free_allocated_count++;
+    vm->free_allocated_count++;
   #endif
 
   return p;
 }
 
-bool mm_init(uint8_t * program)
+bool mm_init(uint8_t * pgm)
 {
-  reg1 =
-  reg2 =
-  reg3 =
-  reg4 =
-  cont =
-  env  = NIL;
+  vm->reg1 =
+  vm->reg2 =
+  vm->reg3 =
+  vm->reg4 =
+  vm->cont =
+  vm->env  = NIL;
 
   bignum_gc_init();
 
-  if ((program[0] != 0xD7) || (program[1] != 0xFB)) {
+  vm->root_task       = NIL;
+  vm->run_queue_head  = 0;
+  vm->run_queue_count = 0;
+  vm->time_slice      = 0;
+  vm->slice_left      = 0;
+
+  memset(vm->waiters, 0, sizeof(vm->waiters));
+  vm->waiter_count    = 0;
+  vm->suspending      = 0;
+  vm->wakeups         = 0;
+
+  memset(vm->timer_wheel, 0, sizeof(vm->timer_wheel));
+  vm->timer_count     = 0;
+
+  vm->tables          = false;
+  vm->symbols         = NIL;
+
+  if (vm->in  == NULL) vm->in  = stdin;
+  if (vm->out == NULL) vm->out = stdout;
+
+  if ((pgm[0] != 0xD7) || (pgm[1] != 0xFB)) {
     ERROR("mm_init", "Program markers are wrong");
     return false;
   }
 
-  global_count = program[3];
+  vm->global_count = pgm[3];
 
-  reserved_cells_count = (global_count + 1) >> 1;
+  vm->reserved_cells_count = (vm->global_count + 1) >> 1;
 
   #if STATISTICS
-    gc_call_counter = 0;
+    vm->gc_call_counter = 0;
   #endif
 
   #ifdef WORKSTATION
 
     #if STATISTICS
-      max_gc_duration = 0;
+      vm->max_gc_duration = 0;
     #endif
 
-    if ((ram_heap_data = (cell_data_ptr) calloc(RAM_HEAP_ALLOCATED, sizeof(cell_data)))  == NULL) return false;
-    if ((ram_heap_flags = (cell_flags_ptr) calloc(RAM_HEAP_ALLOCATED, sizeof(cell_flags)))  == NULL) return false;
-    ram_heap_size = RAM_HEAP_ALLOCATED;
+    // The heaps of a context are kept when it is initialized again
+    if (vm->ram_heap_data == NULL) {
+      if ((vm->ram_heap_data = (cell_data_ptr) calloc(RAM_HEAP_ALLOCATED, sizeof(cell_data)))  == NULL) return false;
+      if ((vm->ram_heap_flags = (cell_flags_ptr) calloc(RAM_HEAP_ALLOCATED, sizeof(cell_flags)))  == NULL) return false;
+      vm->ram_heap_size = RAM_HEAP_ALLOCATED;
 
-    if ((vector_heap = (cell_ptr) calloc(VECTOR_HEAP_ALLOCATED, sizeof(cell))) == NULL) return false;
-    vector_heap_size = VECTOR_HEAP_ALLOCATED;
+      if ((vm->vector_heap = (cell_ptr) calloc(VECTOR_HEAP_ALLOCATED, sizeof(cell))) == NULL) return false;
+      vm->vector_heap_size = VECTOR_HEAP_ALLOCATED;
+    }
+    else {
+      memset(vm->ram_heap_data,  0, vm->ram_heap_size    * sizeof(cell_data));
+      memset(vm->ram_heap_flags, 0, vm->ram_heap_size    * sizeof(cell_flags));
+      memset(vm->vector_heap,    0, vm->vector_heap_size * sizeof(cell));
+    }
 
   #else // ESP32
     // Todo: Memory Initialisation code for ESP32
 
     uint32_t byte_size = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
 
-    ram_heap_size = byte_size / sizeof(cell_data);
-    if ((ram_heap_data = (cell_data_ptr) heap_caps_calloc(ram_heap_size, sizeof(cell_data), MALLOC_CAP_8BIT))  == NULL) return false;
-    if ((ram_heap_flags = (cell_flags_ptr) heap_caps_calloc(ram_heap_size, sizeof(cell_flags), MALLOC_CAP_8BIT))  == NULL) return false;
+    vm->ram_heap_size = byte_size / sizeof(cell_data);
+    if ((vm->ram_heap_data = (cell_data_ptr) heap_caps_calloc(vm->ram_heap_size, sizeof(cell_data), MALLOC_CAP_8BIT))  == NULL) return false;
+    if ((vm->ram_heap_flags = (cell_flags_ptr) heap_caps_calloc(vm->ram_heap_size, sizeof(cell_flags), MALLOC_CAP_8BIT))  == NULL) return false;
 
     byte_size = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
-    vector_heap_size = byte_size / sizeof(cell);
-    if ((vector_heap = (cell_ptr) heap_caps_calloc(vector_heap_size, sizeof(cell), MALLOC_CAP_8BIT)) == NULL) return false;
+    vm->vector_heap_size = byte_size / sizeof(cell);
+    if ((vm->vector_heap = (cell_ptr) heap_caps_calloc(vm->vector_heap_size, sizeof(cell), MALLOC_CAP_8BIT)) == NULL) return false;
   #endif
 
-  rom_heap      = (cell_ptr) &program[4];
+  vm->rom_heap      = (cell_ptr) &pgm[4];
 
-  vector_free_cells = 0;
+  vm->vector_free_cells = 0;
 
-  if (ram_heap_size >= ROM_START_ADDR) {
+  if (vm->ram_heap_size >= ROM_START_ADDR) {
     ERROR("mm_init", "Ram heap size too large");
     return false;
   }
 
-  ram_heap_end  = ram_heap_size;
+  vm->ram_heap_end  = vm->ram_heap_size;
+
+  // No sweep: all the cells above the globals are allocated in sequence
+  // until the first garbage collection
+  vm->free_cells    = NIL;
+  vm->ram_heap_top  = vm->reserved_cells_count;
 
   #if STATISTICS
-    used_cells_count   = 0;
-    free_cells_count   = 0;
-    vector_cells_count = 0;
+    vm->used_cells_count   = 0;
+    vm->free_cells_count   = vm->ram_heap_end - vm->ram_heap_top;
+    vm->vector_cells_count = 0;
   #endif
 
-  for (cell_p i = 0; i < reserved_cells_count; i++) {
+  for (cell_p i = 0; i < vm->reserved_cells_count; i++) {
     RAM_SET_TYPE(i, CONS_TYPE);
     RAM_SET_CAR(i, NIL);
     RAM_SET_CDR(i, NIL);
   }
 
-  mm_sweep();
-
-  if (!check_free_list(ram_heap_size)) return false;
-
-  INFO_MSG("Globals Size: %u\nROM Constants Size: %u\n", program[3], program[2]);
+  INFO_MSG("Globals Size: %u\nROM Constants Size: %u\n", pgm[3], pgm[2]);
 
   return true;
 }
 
+/** mm_release().
+
+  Returns the heaps of the current context to the system.
+
+ */
+
+void mm_release()
+{
+  #ifdef WORKSTATION
+    if (!vm->heaps_mapped) {
+      free(vm->ram_heap_data);
+      free(vm->ram_heap_flags);
+      free(vm->vector_heap);
+    }
+    vm->heaps_mapped = false;
+  #else
+    heap_caps_free(vm->ram_heap_data);
+    heap_caps_free(vm->ram_heap_flags);
+    heap_caps_free(vm->vector_heap);
+  #endif
+
+  vm->ram_heap_data    = NULL;
+  vm->ram_heap_flags   = NULL;
+  vm->vector_heap      = NULL;
+  vm->ram_heap_size    = 0;
+  vm->vector_heap_size = 0;
+}
 
 #if TESTS
 
@@ -490,83 +598,85 @@ void mm_tests()
 
     EXPECT_TRUE(mm_init(pgm),                              "mm Initialisation failed"); // 13 cells required...
     EXPECT_TRUE(sizeof(cell) == 5,                         "Size of a single cell not equal to 5");
-    EXPECT_TRUE((((char *) &vector_heap[0]) + sizeof(cell)) == ((char *) &vector_heap[1]), "Cell structure alignment problems");
-    EXPECT_TRUE(check_free_list(ram_heap_size),            "Check Ram Heap Free Size return wrong count");
-    EXPECT_TRUE(global_count == 25,                        "Globals count != 25");
-    EXPECT_TRUE(reserved_cells_count == 13,                "Reserved cells count != 13");
-    EXPECT_TRUE(ram_heap_data != NULL,                     "Ram Heap data pointer is NULL");
-    EXPECT_TRUE(ram_heap_flags != NULL,                    "Ram Heap flags pointer is NULL");
-    EXPECT_TRUE(vector_heap != NULL,                       "Vector Heap pointer is NULL");
-    EXPECT_TRUE(ram_heap_size == RAM_HEAP_ALLOCATED,       "Ram Heap Size is wrong");
-    EXPECT_TRUE(vector_heap_size == VECTOR_HEAP_ALLOCATED, "Vector Heap Size is wrong");
-    EXPECT_TRUE(vector_free_cells == 0,                    "Vector Free Cells pointer is wrong");
-    EXPECT_TRUE(ram_heap_end == ram_heap_size,             "Ram Heap End and Size not equal");
-    EXPECT_TRUE(free_cells == 13,                          "Free Cells pointer must be pointing at index 0");
-    EXPECT_TRUE((reg1 == NIL) && (reg2 == NIL) && (reg3 == NIL) && (reg4 == NIL) && (env == NIL) && (cont == NIL), "All registers not initialized to NIL");
+    EXPECT_TRUE((((char *) &vm->vector_heap[0]) + sizeof(cell)) == ((char *) &vm->vector_heap[1]), "Cell structure alignment problems");
+    EXPECT_TRUE(check_free_list(vm->ram_heap_size),            "Check Ram Heap Free Size return wrong count");
+    EXPECT_TRUE(vm->global_count == 25,                        "Globals count != 25");
+    EXPECT_TRUE(vm->reserved_cells_count == 13,                "Reserved cells count != 13");
+    EXPECT_TRUE(vm->ram_heap_data != NULL,                     "Ram Heap data pointer is NULL");
+    EXPECT_TRUE(vm->ram_heap_flags != NULL,                    "Ram Heap flags pointer is NULL");
+    EXPECT_TRUE(vm->vector_heap != NULL,                       "Vector Heap pointer is NULL");
+    EXPECT_TRUE(vm->ram_heap_size == RAM_HEAP_ALLOCATED,       "Ram Heap Size is wrong");
+    EXPECT_TRUE(vm->vector_heap_size == VECTOR_HEAP_ALLOCATED, "Vector Heap Size is wrong");
+    EXPECT_TRUE(vm->vector_free_cells == 0,                    "Vector Free Cells pointer is wrong");
+    EXPECT_TRUE(vm->ram_heap_end == vm->ram_heap_size,             "Ram Heap End and Size not equal");
+    EXPECT_TRUE((vm->free_cells == NIL) && (vm->ram_heap_top == 13), "Fresh heap not in sequential allocation");
+    EXPECT_TRUE((vm->reg1 == NIL) && (vm->reg2 == NIL) && (vm->reg3 == NIL) && (vm->reg4 == NIL) && (vm->env == NIL) && (vm->cont == NIL), "All registers not initialized to NIL");
 
   TEST("Heap allocations");
 
     cell_p p = mm_new_ram_cell();
     EXPECT_TRUE(p == 13, "Allocated Cell must be at index 13");
-    EXPECT_TRUE(free_cells == 14, "Free Cells pointer expected to be at 14");
+    EXPECT_TRUE(vm->ram_heap_top == 14, "Heap top expected to be at 14");
 
     for (int i = 0; i < 5000; i++) {
       RAM_SET_TYPE(p, CONS_TYPE);
-      RAM_SET_CDR(p, env);
+      RAM_SET_CDR(p, vm->env);
       RAM_SET_CAR(p, FALSE);
-      env = p;
+      vm->env = p;
       p = mm_new_ram_cell();
     }
 
-    EXPECT_TRUE(free_cells == 5014, "Free Cells pointer expected to be at 5014");
+    EXPECT_TRUE(vm->ram_heap_top == 5014, "Heap top expected to be at 5014");
 
     RAM_SET_CAR(1000, 1005);
     mm_gc();
     EXPECT_TRUE(
-      free_cells_count == (ram_heap_size - 13 - 5000),
+      vm->free_cells_count == (vm->ram_heap_size - 13 - 5000),
       "Free Cells Count expected to be at %d but is %d",
-      (ram_heap_size - 13 - 5000),
-      free_cells_count
+      (vm->ram_heap_size - 13 - 5000),
+      vm->free_cells_count
     );
 
     RAM_SET_CDR(2000, RAM_GET_CDR(2000) - 1000);
     mm_gc();
     EXPECT_TRUE(
-      free_cells_count == (ram_heap_size - 13 - 4000),
+      vm->free_cells_count == (vm->ram_heap_size - 13 - 4000),
       "Free Cells count expected to be at %d but is %d",
-      (ram_heap_size - 13 - 4000),
-      free_cells_count
+      (vm->ram_heap_size - 13 - 4000),
+      vm->free_cells_count
     );
 
-    env = NIL;
+    vm->env = NIL;
     mm_gc();
-    EXPECT_TRUE(free_cells_count == (ram_heap_size - 13),
+    EXPECT_TRUE(vm->free_cells_count == (vm->ram_heap_size - 13),
       "Free Cells count expected to be at %d but is %d",
-      ram_heap_size - 13,
-      free_cells_count
+      vm->ram_heap_size - 13,
+      vm->free_cells_count
     );
+    EXPECT_TRUE((vm->ram_heap_top == 13) && (vm->free_cells == NIL), "Free cells at the top not returned to the heap top");
+    EXPECT_TRUE(check_free_list(vm->ram_heap_size), "Check Ram Heap Free Size return wrong count");
 
   TEST("Garbage Collector");
 
-    env = new_pair(FALSE, new_pair(TRUE, NIL));
-    show(env); putchar('\n');
+    vm->env = new_pair(FALSE, new_pair(TRUE, NIL));
+    show(vm->env); putchar('\n');
     mm_gc();
-    show(env); putchar('\n');
+    show(vm->env); putchar('\n');
 
-    env = new_pair(new_pair(encode_int(1500), FALSE), new_pair(TRUE, NIL));
-    show(env); putchar('\n');
+    vm->env = new_pair(new_pair(encode_int(1500), FALSE), new_pair(TRUE, NIL));
+    show(vm->env); putchar('\n');
     mm_gc();
-    show(env); putchar('\n');
+    show(vm->env); putchar('\n');
 
-    env = new_pair(
+    vm->env = new_pair(
       new_pair(NIL, new_closure(new_pair(TRUE, new_pair(FALSE, NIL)), 123)),
       new_pair(new_pair(FALSE, TRUE), NIL)
     );
-    show(env); putchar('\n');
+    show(vm->env); putchar('\n');
     mm_gc();
-    show(env); putchar('\n');
+    show(vm->env); putchar('\n');
 
-    env = new_pair(
+    vm->env = new_pair(
       new_pair(
         new_cont(
           NIL,
@@ -581,18 +691,18 @@ void mm_tests()
         FALSE, NIL
       )
     );
-    show(env); putchar('\n');
+    show(vm->env); putchar('\n');
     mm_gc();
-    show(env); putchar('\n');
+    show(vm->env); putchar('\n');
 
-    env = NIL;
+    vm->env = NIL;
     mm_gc();
 
   TEST("Vector allocations");
 
     vector_p v = mm_new_vector_cell(77, p);
     EXPECT_TRUE(v == 1,                         "Vector not pointing at first byte");
-    EXPECT_TRUE(vector_free_cells == 17,        "Vector Free Cells not pointing at index 17");
+    EXPECT_TRUE(vm->vector_free_cells == 17,        "Vector Free Cells not pointing at index 17");
     EXPECT_TRUE(VECTOR_GET_RAM_PTR(v - 1) == p, "Vector heap not pointing at vector header");
     EXPECT_TRUE(VECTOR_GET_LENGTH(v - 1) == 17, "Vector length in cells is wrong");
     EXPECT_TRUE(VECTOR_IS_USED(v - 1),          "Vector is not marked as used");
@@ -639,6 +749,6 @@ void mm_tests()
     VECTOR_SET_FREE(RAM_GET_VECTOR_START(p3) - 1);
     mm_compact_vector_space();
 
-    EXPECT_TRUE(vector_free_cells == 0, "Vector Free Cells pointer is wrong");
+    EXPECT_TRUE(vm->vector_free_cells == 0, "Vector Free Cells pointer is wrong");
 }
 #endif
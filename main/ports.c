@@ -0,0 +1,416 @@
+// ports
+// Builtin Indexes: 50..52, 59..60
+
+#include "esp32-scheme-vm.h"
+#include "vm-arch.h"
+#include "mm.h"
+#include "testing.h"
+
+#include "primitives.h"
+
+#define PORTS 1
+#include "ports.h"
+
+#include <stdarg.h>
+#include <unistd.h>
+
+/** port_get().
+
+  Returns the port, opening the console and error ports at their first
+  use and allocating the buffer at the first write.
+
+ */
+
+PRIVATE output_port * port_get(uint8_t port)
+{
+  output_port * p;
+
+  if (port >= OUTPUT_PORTS) {
+    FATAL("port", "Invalid port");
+    port = CONSOLE_PORT;
+  }
+
+  p = &vm->ports[port];
+
+  if (p->file == NULL) {
+    if (port == CONSOLE_PORT) {
+      p->file   = vm->out;
+      p->policy = PORT_FLUSH_READ | (isatty(fileno(vm->out)) ? PORT_FLUSH_LINE : 0);
+    }
+    else if (port == ERROR_PORT) {
+      p->file   = stderr;
+      p->policy = PORT_FLUSH_LINE;
+    }
+    else {
+      FATAL("port", "Port not opened");
+    }
+    p->flush_size = PORT_BUFFER_SIZE;
+  }
+
+  if (p->buffer == NULL) {
+    if ((p->buffer = malloc(PORT_BUFFER_SIZE)) == NULL) {
+      FATAL("port", "Unable to allocate a port buffer");
+    }
+  }
+
+  return p;
+}
+
+PRIVATE void port_flush_buffer(output_port * p)
+{
+  if (p->count > 0) {
+    fwrite(p->buffer, 1, p->count, p->file);
+    p->count = 0;
+  }
+  fflush(p->file);
+}
+
+/** port_open().
+
+  Opens a port writing to file. Returns the port number, -1 if all ports
+  are in use.
+
+ */
+
+int8_t port_open(FILE * file, uint8_t policy)
+{
+  for (uint8_t port = ERROR_PORT + 1; port < OUTPUT_PORTS; port++) {
+    output_port * p = &vm->ports[port];
+
+    if (p->file == NULL) {
+      p->file       = file;
+      p->policy     = policy;
+      p->flush_size = PORT_BUFFER_SIZE;
+      p->count      = 0;
+      return port;
+    }
+  }
+
+  return -1;
+}
+
+/** port_close().
+
+  Flushes the port and releases its buffer. The file of the port is closed,
+  except for the console and error ports.
+
+ */
+
+void port_close(uint8_t port)
+{
+  output_port * p = &vm->ports[port];
+
+  if (p->file != NULL) {
+    if (p->buffer != NULL) port_flush_buffer(p);
+    if (port > ERROR_PORT) fclose(p->file);
+  }
+
+  free(p->buffer);
+  memset(p, 0, sizeof(output_port));
+}
+
+void port_putc(uint8_t port, char ch)
+{
+  output_port * p = port_get(port);
+
+  p->buffer[p->count++] = ch;
+
+  if ((p->count >= p->flush_size) || ((ch == '\n') && (p->policy & PORT_FLUSH_LINE))) {
+    port_flush_buffer(p);
+  }
+}
+
+void port_write(uint8_t port, const uint8_t * data, uint16_t length)
+{
+  output_port * p = port_get(port);
+  bool newline = (p->policy & PORT_FLUSH_LINE) && (memchr(data, '\n', length) != NULL);
+
+  while (length > 0) {
+    uint16_t size = p->flush_size - p->count;
+
+    if (size > length) size = length;
+
+    memcpy(p->buffer + p->count, data, size);
+    p->count += size;
+    data     += size;
+    length   -= size;
+
+    if (p->count >= p->flush_size) port_flush_buffer(p);
+  }
+
+  if (newline) port_flush_buffer(p);
+}
+
+void port_printf(uint8_t port, const char * format, ...)
+{
+  char    str[64];
+  int     length;
+  va_list args;
+
+  va_start(args, format);
+  length = vsnprintf(str, sizeof(str), format, args);
+  va_end(args);
+
+  if (length >= (int) sizeof(str)) {
+    output_port * p = port_get(port);
+
+    port_flush_buffer(p);
+    va_start(args, format);
+    vfprintf(p->file, format, args);
+    va_end(args);
+  }
+  else if (length > 0) {
+    port_write(port, (uint8_t *) str, length);
+  }
+}
+
+void port_flush(uint8_t port)
+{
+  port_flush_buffer(port_get(port));
+}
+
+/** ports_flush_on_read().
+
+  Flushes the ports with the PORT_FLUSH_READ policy. Called before
+  reading the console, such that a prompt is visible.
+
+ */
+
+void ports_flush_on_read()
+{
+  for (uint8_t port = 0; port < OUTPUT_PORTS; port++) {
+    output_port * p = &vm->ports[port];
+
+    if ((p->file != NULL) && (p->count > 0) && (p->policy & PORT_FLUSH_READ)) {
+      port_flush_buffer(p);
+    }
+  }
+}
+
+void ports_flush_all()
+{
+  for (uint8_t port = 0; port < OUTPUT_PORTS; port++) {
+    output_port * p = &vm->ports[port];
+
+    if ((p->file != NULL) && (p->count > 0)) {
+      port_flush_buffer(p);
+    }
+  }
+}
+
+/** ports_release().
+
+  Flushes and closes all ports of the current context.
+
+ */
+
+void ports_release()
+{
+  for (uint8_t port = 0; port < OUTPUT_PORTS; port++) {
+    port_close(port);
+  }
+}
+
+PRIVATE void write_chars(uint8_t port, cell_p chars)
+{
+  while (chars != NIL) {
+    if (IN_RAM(chars)) {
+      port_putc(port, decode_int(RAM_GET_CAR(chars)));
+      chars = RAM_GET_CDR(chars);
+    }
+    else {
+      port_putc(port, decode_int(ROM_GET_CAR(chars)));
+      chars = ROM_GET_CDR(chars);
+    }
+  }
+}
+
+PRIMITIVE_UNSPEC(#%write-string, write_string, 2, 50)
+{
+  /* reg1 is a string or a u8vector, reg2 is the port */
+  vm->a2 = decode_int(vm->reg2);
+
+  if (IN_RAM(vm->reg1) && RAM_IS_STRING(vm->reg1)) {
+    write_chars(vm->a2, RAM_STRING_GET_CHARS(vm->reg1));
+  }
+  else if (IN_ROM(vm->reg1) && ROM_IS_STRING(vm->reg1)) {
+    write_chars(vm->a2, ROM_STRING_GET_CHARS(vm->reg1));
+  }
+  else if (IN_RAM(vm->reg1) && RAM_IS_VECTOR(vm->reg1) && (RAM_GET_VECTOR_KIND(vm->reg1) == VECTOR_U8)) {
+    port_write(vm->a2, &VECTOR_GET_BYTE(RAM_GET_VECTOR_START(vm->reg1), 0), RAM_GET_VECTOR_LENGTH(vm->reg1));
+  }
+  else if (IN_ROM(vm->reg1) && ROM_IS_VECTOR(vm->reg1) && ROM_IS_PACKED_VECTOR(vm->reg1)) {
+    port_write(vm->a2, ROM_GET_VECTOR_BYTES(vm->reg1), ROM_GET_VECTOR_LENGTH(vm->reg1));
+  }
+  else if (IN_ROM(vm->reg1) && ROM_IS_VECTOR(vm->reg1)) {
+    write_chars(vm->a2, ROM_GET_VECTOR_START(vm->reg1));
+  }
+  else {
+    TYPE_ERROR("write-string", "string or u8vector");
+  }
+
+  vm->reg1 = vm->reg2 = NIL;
+}
+
+PRIMITIVE_UNSPEC(#%flush-output, flush_output, 1, 51)
+{
+  port_flush(decode_int(vm->reg1));
+
+  vm->reg1 = NIL;
+}
+
+PRIMITIVE_UNSPEC(#%set-flush-policy!, set_flush_policy, 3, 52)
+{
+  /* reg1 is the port, reg2 the policy (1: line, 2: on read) and reg3
+     the flush size */
+  decode_2_int_args();
+  vm->a3 = decode_int(vm->reg3);
+
+  if ((vm->a3 < 1) || (vm->a3 > PORT_BUFFER_SIZE)) {
+    ERROR("set-flush-policy!", "flush size out of range");
+    vm->a3 = PORT_BUFFER_SIZE;
+  }
+
+  output_port * p = port_get(vm->a1);
+
+  p->policy     = vm->a2;
+  p->flush_size = vm->a3;
+
+  if (p->count >= p->flush_size) port_flush_buffer(p);
+
+  vm->reg1 = vm->reg2 = vm->reg3 = NIL;
+}
+
+PRIMITIVE(#%open-output-port, open_output_port, 1, 59)
+{
+  /* reg1 is the file descriptor of a file or a socket. The port writes
+     to a duplicate of it, such that closing the port leaves the
+     descriptor opened. Returns the port, #f if none is available. */
+  int    fd   = dup(decode_int(vm->reg1));
+  FILE * file = (fd < 0) ? NULL : fdopen(fd, "w");
+  int8_t port = (file == NULL) ? -1 : port_open(file, 0);
+
+  if (port < 0) {
+    if (file != NULL) fclose(file);
+    else if (fd >= 0) close(fd);
+    vm->reg1 = FALSE;
+  }
+  else {
+    vm->reg1 = encode_int(port);
+  }
+}
+
+PRIMITIVE_UNSPEC(#%close-output-port, close_output_port, 1, 60)
+{
+  vm->a1 = decode_int(vm->reg1);
+
+  if ((vm->a1 <= ERROR_PORT) || (vm->a1 >= OUTPUT_PORTS)) {
+    ERROR("close-output-port", "Invalid port");
+  }
+  else {
+    port_close(vm->a1);
+  }
+
+  vm->reg1 = NIL;
+}
+
+#if TESTS
+void ports_tests()
+{
+  char * output = NULL;
+  size_t size   = 0;
+  FILE * f      = open_memstream(&output, &size);
+  int8_t port;
+
+  TESTM("ports");
+
+  TEST("Flush policies");
+
+    port = port_open(f, 0);
+
+    EXPECT_TRUE(port > ERROR_PORT, "Unable to open a port");
+
+    vm->reg1 = encode_int(port); vm->reg2 = encode_int(0); vm->reg3 = encode_int(4);
+    primitive_set_flush_policy();
+
+    port_write(port, (uint8_t *) "abc", 3);
+    EXPECT_TRUE(size == 0, "Output written before the buffer is full");
+
+    port_putc(port, 'd');
+    EXPECT_TRUE((size == 4) && (memcmp(output, "abcd", 4) == 0), "Output not written when the buffer is full");
+
+    vm->reg1 = encode_int(port); vm->reg2 = encode_int(PORT_FLUSH_LINE); vm->reg3 = encode_int(PORT_BUFFER_SIZE);
+    primitive_set_flush_policy();
+
+    port_printf(port, "%d", 12);
+    EXPECT_TRUE(size == 4, "Output written before newline");
+
+    port_putc(port, '\n');
+    EXPECT_TRUE((size == 7) && (memcmp(output + 4, "12\n", 3) == 0), "Output not written at newline");
+
+    vm->reg1 = encode_int(port); vm->reg2 = encode_int(PORT_FLUSH_READ); vm->reg3 = encode_int(PORT_BUFFER_SIZE);
+    primitive_set_flush_policy();
+
+    port_putc(port, '>');
+    EXPECT_TRUE(size == 7, "Output written before read");
+
+    ports_flush_on_read();
+    EXPECT_TRUE(size == 8, "Output not written before read");
+
+  TEST("write-string");
+
+    vm->reg1 = new_vector(3);
+    VECTOR_SET_BYTE(RAM_GET_VECTOR_START(vm->reg1), 0, 'x');
+    VECTOR_SET_BYTE(RAM_GET_VECTOR_START(vm->reg1), 1, 'y');
+    VECTOR_SET_BYTE(RAM_GET_VECTOR_START(vm->reg1), 2, 'z');
+    vm->reg2 = encode_int(port);
+    primitive_write_string();
+
+    vm->reg1 = new_pair(encode_int('!'), NIL);
+    vm->reg1 = new_string(vm->reg1);
+    vm->reg2 = encode_int(port);
+    primitive_write_string();
+
+    vm->reg1 = encode_int(port);
+    primitive_flush_output();
+
+    EXPECT_TRUE((size == 12) && (memcmp(output + 8, "xyz!", 4) == 0), "u8vector or string not written");
+
+    port_close(port);
+    EXPECT_TRUE(vm->ports[port].file == NULL, "Port not closed");
+
+  TEST("Ports on file descriptors");
+
+    char name[] = "/tmp/port-XXXXXX";
+    char text[8];
+    int  fd     = mkstemp(name);
+
+    vm->reg1 = encode_int(fd);
+    primitive_open_output_port();
+    port = decode_int(vm->reg1);
+    EXPECT_TRUE((vm->reg1 != FALSE) && (port > ERROR_PORT), "Unable to open a port on a descriptor");
+
+    vm->reg1 = new_pair(encode_int('o'), NIL);
+    vm->reg1 = new_pair(encode_int('k'), vm->reg1);
+    vm->reg1 = new_string(vm->reg1);
+    vm->reg2 = encode_int(port);
+    primitive_write_string();
+
+    vm->reg1 = encode_int(port);
+    primitive_close_output_port();
+    EXPECT_TRUE(vm->ports[port].file == NULL, "Port not closed");
+
+    EXPECT_TRUE((pread(fd, text, sizeof(text), 0) == 2) && (memcmp(text, "ko", 2) == 0),
+                "Port output not written to the descriptor");
+
+    close(fd);
+    unlink(name);
+
+    vm->reg1 = encode_int(-1);
+    primitive_open_output_port();
+    EXPECT_TRUE(vm->reg1 == FALSE, "Port opened on an invalid descriptor");
+
+  free(output);
+  mm_gc();
+}
+#endif
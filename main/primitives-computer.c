@@ -1,5 +1,5 @@
 // primitives-computer
-// Builtin Indexes: 38..41
+// Builtin Indexes: 38..41, 54..56
 
 #include "esp32-scheme-vm.h"
 #include "vm-arch.h"
@@ -8,9 +8,20 @@
 
 #include "primitives.h"
 #include "kb.h"
+#include "events.h"
+#include "ports.h"
 
 #include <sys/time.h>
 
+#if WORKSTATION
+  #include <time.h>
+  #if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+  #endif
+#else
+  #include "esp_timer.h"
+#endif
+
 // most of this is for the host architecture
 // there's some PIC18 code in there too
 // it should eventually be moved to its own architecture
@@ -21,20 +32,20 @@ PRIVATE void show_it (cell_p o)
   cell_p cdr;
 
   #if 0
-    printf ("[%d]", o);
+    port_printf(CONSOLE_PORT, "[%d]", o);
   #endif
 
   if (o == FALSE) {
-    printf ("#f");
+    port_printf(CONSOLE_PORT, "#f");
   } else if (o == TRUE) {
-    printf ("#t");
+    port_printf(CONSOLE_PORT, "#t");
   } else if (o == NIL) {
-    printf ("()");
+    port_printf(CONSOLE_PORT, "()");
   } else if ((o >= SMALL_INT_START) && (o <= SMALL_INT_MAX)) {
-    printf ("%d", decode_int(o));
+    port_printf(CONSOLE_PORT, "%d", decode_int(o));
   } else {
     if ((IN_RAM(o) && (RAM_IS_BIGNUM(o) || RAM_IS_FIXNUM(o))) || (IN_ROM(o) && (ROM_IS_BIGNUM(o) || ROM_IS_FIXNUM(o)))) {
-      printf ("%d", decode_int(o));
+      port_printf(CONSOLE_PORT, "%d", decode_int(o));
     }
     else if ((IN_RAM(o) && RAM_IS_PAIR(o)) || (IN_ROM(o) && ROM_IS_PAIR(o))) {
       if (IN_RAM(o)) {
@@ -46,18 +57,18 @@ PRIVATE void show_it (cell_p o)
         cdr = ROM_GET_CDR(o);
       }
 
-      printf("(");
+      port_printf(CONSOLE_PORT, "(");
 
 loop:
       show_it(car);
 
       // if (RAM_IS_MARKED(o)) {
-      //   printf(" ...");
+      //   port_printf(CONSOLE_PORT, " ...");
       // }
       // else
       {
         if (cdr == NIL) {
-          printf(")");
+          port_printf(CONSOLE_PORT, ")");
         }
         else if ((IN_RAM(cdr) && RAM_IS_PAIR(cdr))
                    || (IN_ROM(cdr) && ROM_IS_PAIR(cdr))) {
@@ -70,43 +81,49 @@ loop:
             cdr = ROM_GET_CDR(cdr);
           }
 
-          printf(" ");
+          port_printf(CONSOLE_PORT, " ");
           goto loop;
         }
         else {
-          printf(" . ");
+          port_printf(CONSOLE_PORT, " . ");
           show_it(cdr);
-          printf(")");
+          port_printf(CONSOLE_PORT, ")");
         }
       }
     }
-    else if ((IN_RAM(o) && RAM_IS_SYMBOL(o)) || (IN_ROM(o) && ROM_IS_SYMBOL(o))) {
-      printf("#<symbol>");
+    else if (IN_RAM(o) && RAM_IS_SYMBOL(o)) {
+      show_it(RAM_GET_SYMBOL_NAME(o));
+    }
+    else if (IN_ROM(o) && ROM_IS_SYMBOL(o)) {
+      if (ROM_IS_NAMED_SYMBOL(o)) {
+        port_printf(CONSOLE_PORT, "%s", ROM_GET_SYMBOL_NAME(o));
+      }
+      else {
+        port_printf(CONSOLE_PORT, "#<symbol>");
+      }
     }
     else if (IN_RAM(o) && RAM_IS_STRING(o)) {
       o = RAM_STRING_GET_CHARS(o);
       while (o != NIL) {
-        putchar(decode_int(RAM_GET_CAR(o)));
+        port_putc(CONSOLE_PORT, decode_int(RAM_GET_CAR(o)));
         o = RAM_GET_CDR(o);
       }
-      fflush(stdout);
     }
     else if (IN_ROM(o) && ROM_IS_STRING(o)) {
       o =  ROM_STRING_GET_CHARS(o);
       while (o != NIL) {
-        putchar(decode_int(ROM_GET_CAR(o)));
+        port_putc(CONSOLE_PORT, decode_int(ROM_GET_CAR(o)));
         o = ROM_GET_CDR(o);
       }
-      fflush(stdout);
     }
     else if ((IN_RAM(o) && RAM_IS_CSTRING(o)) || (IN_ROM(o) && ROM_IS_CSTRING(o))) {
-      printf("#<c_string>");
+      port_printf(CONSOLE_PORT, "#<c_string>");
     }
     else if ((IN_RAM(o) && RAM_IS_VECTOR(o)) || (IN_ROM(o) && ROM_IS_VECTOR(o))) {
-      printf("#<vector %d>", o);
+      port_printf(CONSOLE_PORT, "#<vector %d>", o);
     }
     else if (IN_RAM(o) && RAM_IS_CONTINUATION(o)) {
-      printf("(");
+      port_printf(CONSOLE_PORT, "(");
       cdr = RAM_GET_CONT_PARENT(o);
       car = RAM_GET_CONT_CLOSURE(o);
       // ugly hack, takes advantage of the fact that pairs and
@@ -114,22 +131,20 @@ loop:
       goto loop;
     }
     else if (IN_RAM(o) && RAM_IS_CLOSURE(o)) {
-      cell_p env;
-      code_p entry;
+      cell_p env_p;
+      code_p entry_p;
 
-      env = RAM_GET_CLOSURE_ENV(o);
-      entry = RAM_GET_CLOSURE_ENTRY_POINT(o);
+      env_p   = RAM_GET_CLOSURE_ENV(o);
+      entry_p = RAM_GET_CLOSURE_ENTRY_POINT(o);
 
-      printf("{0x%04x ", (int) entry);
-      show_it(env);
-      printf("}");
+      port_printf(CONSOLE_PORT, "{0x%04x ", (int) entry_p);
+      show_it(env_p);
+      port_printf(CONSOLE_PORT, "}");
     }
     else {
       FATAL("show_it", "received an unknown structure");
     }
   }
-
-  fflush(stdout);
 }
 
 void show (cell_p o)
@@ -140,79 +155,135 @@ void show (cell_p o)
 PRIVATE void print (cell_p o)
 {
   show(o);
-  printf ("\n");
-  fflush (stdout);
+  port_putc(CONSOLE_PORT, '\n');
 }
 
 PRIMITIVE_UNSPEC(print, print, 1, 38)
 {
-  print(reg1);
+  print(vm->reg1);
 
-  reg1 = NIL;
+  vm->reg1 = NIL;
 }
 
 
-// To limit the value to something inside 32 bits,
-// a second is equal to 100 ticks.
+/** High resolution clocks.
 
-PRIVATE uint32_t read_clock ()
+  clock-us and clock-ns return the time elapsed since their first use, from
+  a monotonic clock, and cycle-counter the raw cycle counter of the CPU
+  (rdtsc on x86, cntvct on ARM64, CCOUNT on Xtensa). To keep the cost of a
+  reading low, the values are returned as fixnums, wrapping at 32 bits: the
+  ns clock wraps after about 2 seconds, the µs clock after 35 minutes.
+
+ */
+
+PRIVATE uint64_t monotonic_clock()
 {
-  uint32_t now = 0;
+  #if WORKSTATION
+    struct timespec ts;
 
-  static uint32_t start = 0;
-  struct timeval tv;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  #else
+    return (uint64_t) esp_timer_get_time() * 1000ULL;
+  #endif
+}
 
-  if (gettimeofday (&tv, NULL) == 0) {
-    now = tv.tv_sec * 100 + tv.tv_usec / 10000;
+PRIVATE uint64_t monotonic_ns()
+{
+  uint64_t now = monotonic_clock();
 
-    if (start == 0) {
-      start = now;
-    }
+  if (vm->hr_clock_start == 0) {
+    vm->hr_clock_start = now;
+  }
+
+  return now - vm->hr_clock_start;
+}
 
-    now -= start;
+// To limit the value to something inside 32 bits,
+// a second is equal to 100 ticks. The elapsed time is taken from the 64
+// bits clock before being divided, such that the ticks don't jump when
+// the ms counter of events_now() wraps.
+
+PRIVATE uint32_t read_clock ()
+{
+  uint64_t now = monotonic_clock();
+
+  if (vm->clock_start == 0) {
+    vm->clock_start = now;
   }
 
-  return now;
+  return (uint32_t) ((now - vm->clock_start) / 10000000ULL);
 }
 
 PRIMITIVE(clock, clock, 0, 39)
 {
-  reg1 = encode_int(read_clock());
+  vm->reg1 = encode_int32(read_clock());
+}
+
+PRIMITIVE(clock-us, clock_us, 0, 54)
+{
+  vm->reg1 = new_fixnum((int32_t)(monotonic_ns() / 1000));
+}
+
+PRIMITIVE(clock-ns, clock_ns, 0, 55)
+{
+  vm->reg1 = new_fixnum((int32_t) monotonic_ns());
+}
+
+PRIMITIVE(cycle-counter, cycle_counter, 0, 56)
+{
+  uint32_t count;
+
+  #if defined(__x86_64__) || defined(__i386__)
+    count = (uint32_t) __rdtsc();
+  #elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (v));
+    count = (uint32_t) v;
+  #elif ESP32
+    __asm__ __volatile__ ("rsr %0, ccount" : "=a" (count));
+  #else
+    count = (uint32_t) monotonic_ns();
+  #endif
+
+  vm->reg1 = new_fixnum((int32_t) count);
 }
 
 PRIMITIVE(#%getchar-wait, getchar_wait, 2, 40)
 {
   decode_2_int_args();
-  a1 = read_clock() + a1;
+  vm->a1 = read_clock() + vm->a1;
 
-  if (a2 < 1 || a2 > 3) {
+  if (vm->a2 < 1 || vm->a2 > 3) {
     ERROR("getchar-wait", "argument out of range");
   }
 
-  reg1 = reg2 = NIL;
-  a3 = 0;
+  vm->reg1 = vm->reg2 = NIL;
+  vm->a3 = 0;
+  ports_flush_on_read();
   do {
-    if ((a3 = kb_getch()))  {
+    if ((vm->a3 = kb_getch(vm->in)))  {
       break;
     }
-  } while (read_clock () < a1);
+    // Sleep until a char is available instead of polling
+    events_fd_ready(fileno(vm->in), (vm->a1 - (int32_t) read_clock()) * 10);
+  } while (read_clock () < vm->a1);
 
-  reg1 = encode_int(a3);
+  vm->reg1 = encode_int(vm->a3);
 }
 
 PRIMITIVE_UNSPEC(#%putchar, putchar, 2, 41)
 {
   decode_2_int_args ();
 
-  if (a1 > 255 || a2 < 1 || a2 > 3) {
+  if (vm->a1 > 255 || vm->a2 < 1 || vm->a2 > 3) {
     ERROR("putchar", "argument out of range");
   }
 
-  putchar (a1);
-  fflush (stdout);
+  port_putc(CONSOLE_PORT, vm->a1);
 
-  reg1 = NIL;
-  reg2 = NIL;
+  vm->reg1 = NIL;
+  vm->reg2 = NIL;
 }
 
 #if 0
@@ -220,29 +291,29 @@ PRIMITIVE(beep, beep, 2, 45)
 {
   decode_2_int_args ();
 
-  if (a1 < 1 || a1 > 255) {
+  if (vm->a1 < 1 || vm->a1 > 255) {
     ERROR("beep", "argument out of range");
   }
 
-  printf ("beep -> freq-div=%d duration=%d\n", a1, a2 );
+  printf ("beep -> freq-div=%d duration=%d\n", vm->a1, vm->a2 );
   fflush (stdout);
 
-  reg1 = NIL;
-  reg2 = NIL;
+  vm->reg1 = NIL;
+  vm->reg2 = NIL;
 }
 
 PRIMITIVE(adc, adc, 1, 46)
 {
   uint16 x;
 
-  a1 = decode_int (reg1);
+  vm->a1 = decode_int (vm->reg1);
 
-  if (a1 < 1 || a1 > 3) {
+  if (vm->a1 < 1 || vm->a1 > 3) {
     ERROR("adc", "argument out of range");
   }
 
 #ifdef  PICOBOARD2
-  x = adc( a1 );
+  x = adc( vm->a1 );
 #endif
 
 #ifdef CONFIG_ARCH_HOST
@@ -256,14 +327,14 @@ PRIMITIVE(adc, adc, 1, 46)
 #endif
 
 //	reg1 = encode_int (x);
-  reg1 = encode_int (0);
+  vm->reg1 = encode_int (0);
 }
 
 PRIMITIVE(sernum, sernum, 0, 47)
 {
   uint16 x = 0;
 
-  reg1 = encode_int (x);
+  vm->reg1 = encode_int (x);
 }
 
 
@@ -296,7 +367,7 @@ PRIMITIVE_UNSPEC(network-cleanup, network_cleanup, 0, 49)
 PRIMITIVE(receive-packet-to-u8vector, receive_packet_to_u8vector, 1, 50)
 {
   // reg1 is the vector in which to put the received packet
-  if (!RAM_VECTOR_P(reg1)) {
+  if (!RAM_VECTOR_P(vm->reg1)) {
     TYPE_ERROR("receive-packet-to-u8vector", "vector");
   }
 
@@ -311,24 +382,24 @@ PRIMITIVE(receive-packet-to-u8vector, receive_packet_to_u8vector, 1, 50)
     header.len = 0;
   }
 
-  if (ram_get_car (reg1) < header.len) {
+  if (ram_get_car (vm->reg1) < header.len) {
     ERROR("receive-packet-to-u8vector", "packet longer than vector");
   }
 
   if (header.len > 0) { // we have received a packet, write it in the vector
-    reg2 = VEC_TO_RAM_OBJ(ram_get_cdr (reg1));
-    reg1 = header.len; // we return the length of the received packet
-    a1 = 0;
-
-    while (a1 < reg1) {
-      ram_set_fieldn (reg2, a1 % 4, (char)packet[a1]);
-      a1++;
-      reg2 += (a1 % 4) ? 0 : 1;
+    vm->reg2 = VEC_TO_RAM_OBJ(ram_get_cdr (vm->reg1));
+    vm->reg1 = header.len; // we return the length of the received packet
+    vm->a1 = 0;
+
+    while (vm->a1 < vm->reg1) {
+      ram_set_fieldn (vm->reg2, vm->a1 % 4, (char)packet[vm->a1]);
+      vm->a1++;
+      vm->reg2 += (vm->a1 % 4) ? 0 : 1;
     }
 
-    reg2 = FALSE;
+    vm->reg2 = FALSE;
   } else { // no packet to be read
-    reg1 = FALSE;
+    vm->reg1 = FALSE;
   }
 
 #endif
@@ -339,40 +410,40 @@ PRIMITIVE(send-packet-from-u8vector, send_packet_from_u8vector, 2, 51)
   // reg1 is the vector which contains the packet to be sent
   // reg2 is the length of the packet
   // TODO only works with ram vectors for now
-  if (!RAM_VECTOR_P(reg1)) {
+  if (!RAM_VECTOR_P(vm->reg1)) {
     TYPE_ERROR("send-packet-from-vector!", "vector");
   }
 
-  a2 = decode_int (reg2); // TODO fix for bignums
-  a1 = 0;
+  vm->a2 = decode_int (vm->reg2); // TODO fix for bignums
+  vm->a1 = 0;
 
 #ifdef NETWORKING
 
   // TODO test if the length of the packet is longer than the length of the vector
-  if (ram_get_car (reg1) < a2) {
+  if (ram_get_car (vm->reg1) < vm->a2) {
     ERROR("send-packet-from-u8vector", "packet cannot be longer than vector");
   }
 
-  reg1 = VEC_TO_RAM_OBJ(ram_get_cdr (reg1));
+  vm->reg1 = VEC_TO_RAM_OBJ(ram_get_cdr (vm->reg1));
 
   // copy the packet to the output buffer
-  while (a1 < a2) {
-    buf[a1] = ram_get_fieldn (reg1, a1 % 4);
-    a1++;
-    reg1 += (a1 % 4) ? 0 : 1;
+  while (vm->a1 < vm->a2) {
+    buf[vm->a1] = ram_get_fieldn (vm->reg1, vm->a1 % 4);
+    vm->a1++;
+    vm->reg1 += (vm->a1 % 4) ? 0 : 1;
   }
 
   // TODO maybe I could just give pcap the pointer to the memory
 
-  if (pcap_sendpacket(handle, buf, a2) < 0) { // TODO an error has occurred, can we reuse the interface ?
-    reg1 = FALSE;
+  if (pcap_sendpacket(handle, buf, vm->a2) < 0) { // TODO an error has occurred, can we reuse the interface ?
+    vm->reg1 = FALSE;
   } else {
-    reg1 = TRUE;
+    vm->reg1 = TRUE;
   }
 
 #endif
 
-  reg2 = FALSE;
+  vm->reg2 = FALSE;
 }
 #endif
 
@@ -381,5 +452,45 @@ void primitives_computer_tests()
 {
   TESTM("primitives-computer");
 
+  TEST("High resolution clocks");
+
+    cell_p t0;
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = 2000000L };
+
+    primitive_clock_us();
+    t0 = vm->reg1;
+
+    EXPECT_TRUE(RAM_IS_FIXNUM(t0), "clock-us doesn't return a fixnum");
+
+    nanosleep(&ts, NULL);
+    primitive_clock_us();
+
+    EXPECT_TRUE(decode_int(vm->reg1) - decode_int(t0) >= 2000, "clock-us not in microseconds");
+
+    primitive_clock_ns();
+    t0 = vm->reg1;
+    primitive_clock_ns();
+
+    EXPECT_TRUE(decode_int(vm->reg1) > decode_int(t0), "clock-ns not increasing");
+
+    primitive_cycle_counter();
+    t0 = vm->reg1;
+    nanosleep(&ts, NULL);
+    primitive_cycle_counter();
+
+    EXPECT_TRUE(decode_int(vm->reg1) != decode_int(t0), "cycle-counter not counting");
+
+  TEST("Clock");
+
+    // Started 10 s ago: 1000 ticks of 10 ms
+
+    vm->clock_start = monotonic_clock() - 10000000000ULL;
+    primitive_clock();
+
+    EXPECT_TRUE((decode_int(vm->reg1) >= 1000) && (decode_int(vm->reg1) < 1010), "clock not in 10 ms ticks");
+
+    vm->clock_start = 0;
+
+  vm->reg1 = NIL;
 }
 #endif
@@ -1,5 +1,5 @@
 // primitives-control
-// Builtin Indexes: 1..5
+// Builtin Indexes: 1..5, 42..46
 
 #include "esp32-scheme-vm.h"
 #include "vm-arch.h"
@@ -8,20 +8,21 @@
 
 #include "interpreter.h"
 #include "primitives.h"
+#include "events.h"
 
 PRIMITIVE(return, return, 1, 1)
 {
-  EXPECT(RAM_IS_CONTINUATION(cont), "return", "continuation");
+  EXPECT(RAM_IS_CONTINUATION(vm->cont), "return", "continuation");
 
-  reg2  = RAM_GET_CONT_CLOSURE(cont);
+  vm->reg2  = RAM_GET_CONT_CLOSURE(vm->cont);
 
-  EXPECT(RAM_IS_CLOSURE(reg2), "return.1", "closure");
+  EXPECT(RAM_IS_CLOSURE(vm->reg2), "return.1", "closure");
 
-  entry = RAM_GET_CLOSURE_ENTRY_POINT(reg2);
-  env   = RAM_GET_CLOSURE_ENV(reg2);
-  cont  = RAM_GET_CONT_PARENT(cont);
-  reg2  = NIL;
-  pc.c  = program + entry;
+  vm->entry = RAM_GET_CLOSURE_ENTRY_POINT(vm->reg2);
+  vm->env   = RAM_GET_CLOSURE_ENV(vm->reg2);
+  vm->cont  = RAM_GET_CONT_PARENT(vm->cont);
+  vm->reg2  = NIL;
+  vm->pc.c  = vm->program + vm->entry;
 }
 
 PRIMITIVE_UNSPEC(pop, pop, 0, 2)
@@ -31,57 +32,173 @@ PRIMITIVE_UNSPEC(pop, pop, 0, 2)
 
 PRIMITIVE(get-cont, get_cont, 0, 3)
 {
-  EXPECT(RAM_IS_CONTINUATION(cont), "get-cont", "continuation");
+  EXPECT(RAM_IS_CONTINUATION(vm->cont), "get-cont", "continuation");
 
-  reg1 = cont;
+  vm->reg1 = vm->cont;
 }
 
 PRIMITIVE_UNSPEC(graft-to-cont, graft_to_cont, 2, 4)
 {
   /* reg2 is thunk to call, reg1 is continuation */
-  cont = reg1;
+  vm->cont = vm->reg1;
 
-  EXPECT(RAM_IS_CONTINUATION(cont), "graft-to-cont", "continuation");
+  EXPECT(RAM_IS_CONTINUATION(vm->cont), "graft-to-cont", "continuation");
 
-  reg1 = reg2;
-  env  = new_pair(reg1, env);
+  vm->reg1 = vm->reg2;
+  vm->env  = new_pair(vm->reg1, vm->env);
 
   build_environment(prepare_arguments(0));
 
-  env  = reg1;
-  pc.c = program + entry;
+  vm->env  = vm->reg1;
+  vm->pc.c = vm->program + vm->entry;
 
-  reg1 = NIL;
-  reg2 = NIL;
+  vm->reg1 = NIL;
+  vm->reg2 = NIL;
 }
 
 PRIMITIVE(return-to-cont, return_to_cont, 2, 5)
 {
   /* reg2 is value to return, reg1 is continuation */
-  cont = reg1;
+  vm->cont = vm->reg1;
 
-  EXPECT(RAM_IS_CONTINUATION(cont), "return-to-cont", "continuation");
+  EXPECT(RAM_IS_CONTINUATION(vm->cont), "return-to-cont", "continuation");
 
-  reg1 = reg2;
+  vm->reg1 = vm->reg2;
 
-  reg2  = RAM_GET_CONT_CLOSURE(cont);
+  vm->reg2  = RAM_GET_CONT_CLOSURE(vm->cont);
 
-  EXPECT(RAM_IS_CLOSURE(reg2), "return-to-cont.1", "closure");
+  EXPECT(RAM_IS_CLOSURE(vm->reg2), "return-to-cont.1", "closure");
 
-  entry = RAM_GET_CLOSURE_ENTRY_POINT(reg2);
-  env   = RAM_GET_CLOSURE_ENV(reg2);
-  cont  = RAM_GET_CONT_PARENT(cont);
+  vm->entry = RAM_GET_CLOSURE_ENTRY_POINT(vm->reg2);
+  vm->env   = RAM_GET_CLOSURE_ENV(vm->reg2);
+  vm->cont  = RAM_GET_CONT_PARENT(vm->cont);
 
-  pc.c = program + entry;
+  vm->pc.c = vm->program + vm->entry;
 
-  reg2 = NIL;
+  vm->reg2 = NIL;
 }
 
+// Native task scheduler (see task_switch() in interpreter.c)
+
+PRIMITIVE_UNSPEC(#%start-scheduler, start_scheduler, 0, 42)
+{
+  vm->root_task       = vm->cont;
+  vm->run_queue_head  = 0;
+  vm->run_queue_count = 0;
+}
+
+PRIMITIVE_UNSPEC(#%spawn, spawn, 1, 43)
+{
+  /* reg1 is the thunk to run as a new task */
+  EXPECT(RAM_IS_CONTINUATION(vm->root_task), "spawn", "started scheduler");
+
+  // The spawning task will be the next one to run
+  save_cont();
+  task_push_front(vm->cont);
+
+  // The new task returns to the continuation of start-first-process
+  vm->cont = vm->root_task;
+  vm->env  = new_pair(vm->reg1, vm->env);
+
+  closure_environment(0);
+
+  vm->env  = vm->reg1;
+  vm->pc.c = vm->program + vm->entry;
+
+  vm->reg1 = NIL;
+}
+
+PRIMITIVE_UNSPEC(#%yield, yield, 0, 44)
+{
+  task_switch();
+}
+
+PRIMITIVE_UNSPEC(#%exit, exit, 0, 45)
+{
+  // The running task is forgotten, its cells will be recovered by the GC.
+  // If other tasks are waiting for events, wait for one of them.
+  if ((vm->run_queue_count > 0) || (vm->waiter_count > 0)) {
+    task_resume(events_next_task());
+  }
+}
+
+PRIMITIVE_UNSPEC(set-time-slice!, set_time_slice, 1, 46)
+{
+  /* reg1 is the number of instructions a task can run before being
+     preempted, 0 for cooperative scheduling only */
+  vm->a1 = decode_int(vm->reg1);
+
+  if (vm->a1 < 0) {
+    TYPE_ERROR("set-time-slice!", "positive integer");
+  }
+
+  vm->time_slice = vm->slice_left = vm->a1;
+
+  vm->reg1 = NIL;
+}
 
 #if TESTS
 void primitives_control_tests()
 {
   TESTM("primitives-control");
 
+  TEST("Run queue");
+
+    cell_p k1, k2, k3;
+
+    vm->env = new_pair(encode_int(1), NIL);
+    vm->pc.c = vm->program;
+
+    save_cont(); k1 = vm->cont; task_push_back(k1);
+    save_cont(); k2 = vm->cont; task_push_back(k2);
+    save_cont(); k3 = vm->cont; task_push_front(k3);
+
+    vm->cont = NIL;
+    mm_gc();
+
+    #if DEBUGGING
+      EXPECT_TRUE(!is_free(k1) && !is_free(k2) && !is_free(k3), "Queued continuations not kept by the GC");
+    #endif
+
+    EXPECT_TRUE(vm->run_queue_count == 3, "Run queue count is wrong");
+    EXPECT_TRUE(task_pop_front() == k3,   "push_front not at the front of the queue");
+    EXPECT_TRUE(task_pop_front() == k1,   "push_back order not kept");
+    EXPECT_TRUE(task_pop_front() == k2,   "push_back order not kept");
+    EXPECT_TRUE(vm->run_queue_count == 0, "Run queue not empty");
+
+  TEST("Task Switch");
+
+    // Running task: stack (1), pc at 4. Queued task: stack (2 1), pc at 5.
+
+    uint8_t pgm[] = { 0xD7, 0xFB, 0, 0, 0xC0, 0xC0 };
+
+    vm->program = pgm;
+    vm->max_addr = sizeof(pgm);
+
+    vm->pc.c = vm->program + 5;
+    vm->env  = new_pair(encode_int(2), vm->env);
+    save_cont();
+    task_push_back(vm->cont);
+
+    vm->cont = NIL;
+    vm->env  = RAM_GET_CDR(vm->env);
+    vm->pc.c = vm->program + 4;
+
+    task_switch();
+
+    EXPECT_TRUE(vm->pc.c == vm->program + 5,                 "Queued task not resumed at its pc");
+    EXPECT_TRUE(RAM_GET_CAR(vm->env) == encode_int(2),   "Queued task stack not restored");
+    EXPECT_TRUE(vm->cont == NIL,                         "Queued task continuation not restored");
+    EXPECT_TRUE(vm->run_queue_count == 1,            "Suspended task not queued");
+
+    task_switch();
+
+    EXPECT_TRUE(vm->pc.c == vm->program + 4,                 "Suspended task not resumed at its pc");
+    EXPECT_TRUE(RAM_GET_CAR(vm->env) == encode_int(1),   "Suspended task stack not restored");
+    EXPECT_TRUE(RAM_GET_CDR(vm->env) == NIL,             "Value pushed on resumed task stack");
+
+    task_pop_front();
+    vm->env = vm->cont = NIL;
+    mm_gc();
 }
 #endif
@@ -0,0 +1,443 @@
+// primitives-file
+// Builtin Indexes: 75..83, 125
+
+#include "esp32-scheme-vm.h"
+#include "vm-arch.h"
+#include "mm.h"
+#include "testing.h"
+
+#include "primitives.h"
+
+#define FILES 1
+#include "files.h"
+#include "snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if WORKSTATION
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+/** Files.
+
+  Files are identified by their file descriptor. Data is read into and
+  written from a range of a u8vector, directly in the vector heap, such that
+  large files can be streamed in chunks of up to 64KB without building
+  intermediate lists. Errors return #f.
+
+  On a workstation, a file can also be mapped in memory (read-only). A mapped
+  file is identified by its map number (0..MAPPED_FILES-1) and is read by
+  copying a window of it into a u8vector with file-map-read. As u8vectors
+  are limited to 64KB, the mapping itself is not a u8vector: this way, files
+  of hundreds of MB can be scanned without any read system call.
+
+  Positions and lengths larger than 24 bits are returned as fixnums.
+
+ */
+
+#define FILE_READ       1
+#define FILE_WRITE      2
+#define FILE_APPEND     3
+#define FILE_READ_WRITE 4
+
+#define FILE_PATH_SIZE 256
+
+PRIVATE cell_p file_result(int64_t result)
+{
+  if (result < 0) {
+    return FALSE;
+  }
+  else {
+    return encode_int32(result);
+  }
+}
+
+/** file_path().
+
+  Copies the scheme string s in the C string path. Returns false if s is
+  not a string or is too long.
+
+ */
+
+PRIVATE bool file_path(cell_p s, char * path)
+{
+  cell_p chars;
+  int    length = 0;
+
+  if (IN_RAM(s) && RAM_IS_STRING(s)) {
+    chars = RAM_STRING_GET_CHARS(s);
+  }
+  else if (IN_ROM(s) && ROM_IS_STRING(s)) {
+    chars = ROM_STRING_GET_CHARS(s);
+  }
+  else {
+    TYPE_ERROR("file_path", "string");
+    return false;
+  }
+
+  while (chars != NIL) {
+    if (length >= (FILE_PATH_SIZE - 1)) {
+      ERROR("file_path", "Path too long");
+      return false;
+    }
+    if (IN_RAM(chars)) {
+      path[length++] = decode_int(RAM_GET_CAR(chars));
+      chars = RAM_GET_CDR(chars);
+    }
+    else {
+      path[length++] = decode_int(ROM_GET_CAR(chars));
+      chars = ROM_GET_CDR(chars);
+    }
+  }
+
+  path[length] = 0;
+
+  return true;
+}
+
+PRIVATE mapped_file * file_map_get(cell_p map)
+{
+  int32_t m = decode_int(map);
+
+  if ((m < 0) || (m >= MAPPED_FILES) || (vm->maps[m].data == NULL)) {
+    ERROR("file-map", "Invalid map number");
+    return NULL;
+  }
+
+  return &vm->maps[m];
+}
+
+PRIMITIVE(file-open, file_open, 2, 75)
+{
+  /* reg1 is the path, reg2 the mode: 1 read, 2 write (created or
+     truncated), 3 append, 4 read and write */
+  char path[FILE_PATH_SIZE];
+  int  flags;
+
+  switch (decode_int(vm->reg2)) {
+    case FILE_READ:       flags = O_RDONLY;                     break;
+    case FILE_WRITE:      flags = O_WRONLY | O_CREAT | O_TRUNC;  break;
+    case FILE_APPEND:     flags = O_WRONLY | O_CREAT | O_APPEND; break;
+    case FILE_READ_WRITE: flags = O_RDWR   | O_CREAT;            break;
+    default:
+      ERROR("file-open", "mode out of range");
+      flags = -1;
+  }
+
+  if ((flags != -1) && file_path(vm->reg1, path)) {
+    vm->reg1 = file_result(open(path, flags, 0666));
+  }
+  else {
+    vm->reg1 = FALSE;
+  }
+
+  vm->reg2 = NIL;
+}
+
+PRIMITIVE(file-read, file_read, 4, 76)
+{
+  /* reg1 is the file, data is read in the range reg3..reg4 of the u8vector
+     reg2. The result is the number of bytes read, 0 at the end of the
+     file. */
+  vm->a1 = decode_int(vm->reg1);
+  vm->a2 = decode_int(vm->reg3);
+  vm->a3 = decode_int(vm->reg4);
+
+  uint8_t * bytes = u8vector_bytes(vm->reg2, vm->a2, vm->a3);
+
+  vm->reg1 = (bytes == NULL) ? FALSE : file_result(read(vm->a1, bytes, vm->a3 - vm->a2));
+  vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+}
+
+PRIMITIVE(file-write, file_write, 4, 77)
+{
+  /* reg1 is the file, the range reg3..reg4 of the u8vector reg2 is
+     written. The result is the number of bytes written. */
+  vm->a1 = decode_int(vm->reg1);
+  vm->a2 = decode_int(vm->reg3);
+  vm->a3 = decode_int(vm->reg4);
+
+  uint8_t * bytes = u8vector_bytes(vm->reg2, vm->a2, vm->a3);
+
+  vm->reg1 = (bytes == NULL) ? FALSE : file_result(write(vm->a1, bytes, vm->a3 - vm->a2));
+  vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+}
+
+PRIMITIVE(file-seek, file_seek, 3, 78)
+{
+  /* reg1 is the file, reg2 the offset, reg3 the origin: 0 start of the
+     file, 1 current position, 2 end of the file. The result is the new
+     position. */
+  static const int whence[3] = { SEEK_SET, SEEK_CUR, SEEK_END };
+
+  vm->a1 = decode_int(vm->reg1);
+  vm->a2 = decode_int(vm->reg2);
+  vm->a3 = decode_int(vm->reg3);
+
+  if ((vm->a3 < 0) || (vm->a3 > 2)) {
+    ERROR("file-seek", "origin out of range");
+    vm->reg1 = FALSE;
+  }
+  else {
+    vm->reg1 = file_result(lseek(vm->a1, vm->a2, whence[vm->a3]));
+  }
+
+  vm->reg2 = vm->reg3 = NIL;
+}
+
+PRIMITIVE(file-close, file_close, 1, 79)
+{
+  vm->reg1 = file_result(close(decode_int(vm->reg1)));
+}
+
+PRIMITIVE(file-map, file_map, 1, 80)
+{
+  /* reg1 is the path. The result is the map number */
+  char path[FILE_PATH_SIZE];
+
+  if (!file_path(vm->reg1, path)) {
+    vm->reg1 = FALSE;
+    return;
+  }
+
+  vm->reg1 = FALSE;
+
+  #if WORKSTATION
+    for (int m = 0; m < MAPPED_FILES; m++) {
+      if (vm->maps[m].data == NULL) {
+        struct stat st;
+        int fd = open(path, O_RDONLY);
+
+        if (fd < 0) return;
+
+        if ((fstat(fd, &st) == 0) && (st.st_size > 0)) {
+          void * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+          if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            vm->maps[m].data = data;
+            vm->maps[m].size = st.st_size;
+            vm->reg1 = encode_int(m);
+          }
+        }
+
+        close(fd);
+        return;
+      }
+    }
+
+    ERROR("file-map", "Too many mapped files");
+  #endif
+}
+
+PRIMITIVE(file-map-length, file_map_length, 1, 81)
+{
+  mapped_file * map = file_map_get(vm->reg1);
+
+  vm->reg1 = (map == NULL) ? FALSE : file_result(map->size);
+}
+
+PRIMITIVE(file-map-read, file_map_read, 3, 82)
+{
+  /* reg1 is the map, reg2 the offset in the file. The u8vector reg3 is
+     filled from that offset. The result is the number of bytes copied,
+     less than the vector length at the end of the file. */
+  mapped_file * map = file_map_get(vm->reg1);
+  uint8_t * bytes;
+
+  vm->a2 = decode_int(vm->reg2);
+
+  if ((map == NULL) || (vm->a2 < 0) ||
+      ((bytes = u8vector_bytes(vm->reg3, 0, 0)) == NULL)) {
+    vm->reg1 = FALSE;
+  }
+  else {
+    size_t length = RAM_GET_VECTOR_LENGTH(vm->reg3);
+
+    if ((size_t) vm->a2 >= map->size) {
+      length = 0;
+    }
+    else if ((map->size - vm->a2) < length) {
+      length = map->size - vm->a2;
+    }
+
+    memcpy(bytes, map->data + vm->a2, length);
+    vm->reg1 = encode_int(length);
+  }
+
+  vm->reg2 = vm->reg3 = NIL;
+}
+
+PRIMITIVE(file-unmap, file_unmap, 1, 83)
+{
+  mapped_file * map = file_map_get(vm->reg1);
+
+  if (map != NULL) {
+    #if WORKSTATION
+      munmap(map->data, map->size);
+    #endif
+    map->data = NULL;
+    map->size = 0;
+    vm->reg1 = TRUE;
+  }
+  else {
+    vm->reg1 = FALSE;
+  }
+}
+
+PRIMITIVE(snapshot, snapshot, 1, 125)
+{
+  /* reg1 is the path of the snapshot (see snapshot.h). The result is #f
+     once written, #t when the snapshot is restored. As no value can be
+     told apart from both of them by an if, a snapshot that can't be
+     written is a fatal error. */
+  char path[FILE_PATH_SIZE];
+
+  if (!file_path(vm->reg1, path)) {
+    FATAL("snapshot", "Invalid path");
+  }
+
+  #if WORKSTATION
+    if (!snapshot_write(path)) {
+      FATAL("snapshot", "Snapshot not written");
+    }
+  #else
+    FATAL("snapshot", "Not available");
+  #endif
+
+  vm->reg1 = FALSE;
+}
+
+/** files_release().
+
+  Unmaps all the mapped files of the current context.
+
+ */
+
+void files_release()
+{
+  for (int m = 0; m < MAPPED_FILES; m++) {
+    if (vm->maps[m].data != NULL) {
+      #if WORKSTATION
+        munmap(vm->maps[m].data, vm->maps[m].size);
+      #endif
+      vm->maps[m].data = NULL;
+      vm->maps[m].size = 0;
+    }
+  }
+}
+
+#if TESTS
+void primitives_file_tests()
+{
+  char   name[] = "/tmp/file-test-XXXXXX";
+  cell_p file;
+  int    i;
+
+  TESTM("primitives-file");
+
+  close(mkstemp(name));
+
+  // The path and the data vector are kept on the stack (GC roots)
+
+  vm->env = NIL;
+  for (i = strlen(name) - 1; i >= 0; i--) vm->env = new_pair(encode_int(name[i]), vm->env);
+  vm->env = new_pair(new_string(vm->env), NIL);
+  vm->env = new_pair(new_vector(1000), vm->env);
+
+  for (i = 0; i < 1000; i++) {
+    VECTOR_SET_BYTE(RAM_GET_VECTOR_START(RAM_GET_CAR(vm->env)), i, i & 0xFF);
+  }
+
+  TEST("Write");
+
+    vm->reg1 = RAM_GET_CAR(RAM_GET_CDR(vm->env)); vm->reg2 = encode_int(FILE_WRITE);
+    primitive_file_open(); file = vm->reg1;
+    EXPECT_TRUE(file != FALSE, "Unable to open a file for writing");
+
+    for (i = 0; i < 100; i++) {
+      vm->reg1 = file; vm->reg2 = RAM_GET_CAR(vm->env); vm->reg3 = encode_int(0); vm->reg4 = encode_int(1000);
+      primitive_file_write();
+    }
+    EXPECT_TRUE(decode_int(vm->reg1) == 1000, "Data not written");
+
+    vm->reg1 = file; vm->reg2 = RAM_GET_CAR(vm->env); vm->reg3 = encode_int(10); vm->reg4 = encode_int(2000);
+    primitive_file_write();
+    EXPECT_TRUE(vm->reg1 == FALSE, "Invalid u8vector range accepted");
+
+    vm->reg1 = file; primitive_file_close();
+    EXPECT_TRUE(vm->reg1 == ZERO, "Unable to close a file");
+
+  TEST("Read and seek");
+
+    vm->reg1 = RAM_GET_CAR(RAM_GET_CDR(vm->env)); vm->reg2 = encode_int(FILE_READ);
+    primitive_file_open(); file = vm->reg1;
+    EXPECT_TRUE(file != FALSE, "Unable to open a file for reading");
+
+    vm->reg1 = file; vm->reg2 = encode_int(0); vm->reg3 = encode_int(2);
+    primitive_file_seek();
+    EXPECT_TRUE(decode_int(vm->reg1) == 100000, "File size is not 100000");
+
+    vm->reg1 = file; vm->reg2 = encode_int(99990); vm->reg3 = encode_int(0);
+    primitive_file_seek();
+
+    vm->reg1 = file; vm->reg2 = RAM_GET_CAR(vm->env); vm->reg3 = encode_int(0); vm->reg4 = encode_int(100);
+    primitive_file_read();
+    EXPECT_TRUE(vm->reg1 == encode_int(10), "Not reading up to the end of the file");
+    EXPECT_TRUE(VECTOR_GET_BYTE(RAM_GET_VECTOR_START(RAM_GET_CAR(vm->env)), 0) == 990 % 256,
+                "Data read is wrong");
+
+    vm->reg1 = file; vm->reg2 = RAM_GET_CAR(vm->env); vm->reg3 = encode_int(0); vm->reg4 = encode_int(100);
+    primitive_file_read();
+    EXPECT_TRUE(vm->reg1 == ZERO, "End of file not reported");
+
+    vm->reg1 = file; primitive_file_close();
+
+  TEST("Mapped file");
+
+    vm->reg1 = RAM_GET_CAR(RAM_GET_CDR(vm->env));
+    primitive_file_map(); file = vm->reg1;
+
+    #if WORKSTATION
+      EXPECT_TRUE(file != FALSE, "Unable to map a file");
+
+      vm->reg1 = file; primitive_file_map_length();
+      EXPECT_TRUE(decode_int(vm->reg1) == 100000, "Mapped length is not 100000");
+
+      vm->reg1 = file; vm->reg2 = encode_int(99500); vm->reg3 = RAM_GET_CAR(vm->env);
+      primitive_file_map_read();
+      EXPECT_TRUE(decode_int(vm->reg1) == 500, "Not copying up to the end of the map");
+      EXPECT_TRUE(VECTOR_GET_BYTE(RAM_GET_VECTOR_START(RAM_GET_CAR(vm->env)), 1) == 501 % 256,
+                  "Mapped data is wrong");
+
+      vm->reg1 = file; primitive_file_unmap();
+      EXPECT_TRUE(vm->reg1 == TRUE, "Unable to unmap a file");
+      EXPECT_TRUE(vm->maps[decode_int(file)].data == NULL, "File still mapped");
+
+    TEST("Snapshot failure");
+
+      jmp_buf exit_point;
+      char    bad[] = "/nonexistent-directory/app.snap";
+
+      vm->reg1 = NIL;
+      for (i = strlen(bad) - 1; i >= 0; i--) vm->reg1 = new_pair(encode_int(bad[i]), vm->reg1);
+      vm->reg1 = new_string(vm->reg1);
+
+      vm->exit_point = &exit_point;
+      i = setjmp(exit_point);
+      if (i == 0) primitive_snapshot();
+      vm->exit_point = NULL;
+
+      EXPECT_TRUE(i == 1, "Failed snapshot not reported as an error");
+    #endif
+
+  unlink(name);
+
+  vm->env = NIL;
+  vm->reg1 = vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+  mm_gc();
+}
+#endif
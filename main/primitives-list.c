@@ -1,5 +1,5 @@
 // primitives-list
-// Builtin Indexes: 6..12
+// Builtin Indexes: 6..12, 110..118
 
 #include "esp32-scheme-vm.h"
 #include "vm-arch.h"
@@ -10,34 +10,34 @@
 
 PRIMITIVE(pair?, pair_p, 1, 6)
 {
-  if (IN_RAM(reg1)) {
-    reg1 = ENCODE_BOOL(RAM_IS_PAIR(reg1));
+  if (IN_RAM(vm->reg1)) {
+    vm->reg1 = ENCODE_BOOL(RAM_IS_PAIR(vm->reg1));
   }
-  else if (IN_ROM(reg1)) {
-    reg1 = ENCODE_BOOL(ROM_IS_PAIR(reg1));
+  else if (IN_ROM(vm->reg1)) {
+    vm->reg1 = ENCODE_BOOL(ROM_IS_PAIR(vm->reg1));
   }
   else {
-    reg1 = FALSE;
+    vm->reg1 = FALSE;
   }
 }
 
 PRIMITIVE(cons, cons, 2, 7)
 {
-  reg1 = new_pair(reg1, reg2);
-  reg2 = NIL;
+  vm->reg1 = new_pair(vm->reg1, vm->reg2);
+  vm->reg2 = NIL;
 }
 
 PRIMITIVE(car, car, 1, 8)
 {
-  if (IN_RAM(reg1)) {
-    EXPECT(RAM_IS_PAIR(reg1), "car.0", "pair");
+  if (IN_RAM(vm->reg1)) {
+    EXPECT(RAM_IS_PAIR(vm->reg1), "car.0", "pair");
 
-    reg1 = RAM_GET_CAR(reg1);
+    vm->reg1 = RAM_GET_CAR(vm->reg1);
   }
-  else if (IN_ROM(reg1)) {
-    EXPECT(ROM_IS_PAIR(reg1), "car.1", "pair");
+  else if (IN_ROM(vm->reg1)) {
+    EXPECT(ROM_IS_PAIR(vm->reg1), "car.1", "pair");
 
-    reg1 = ROM_GET_CAR(reg1);
+    vm->reg1 = ROM_GET_CAR(vm->reg1);
   }
   else {
     TYPE_ERROR("car.2", "pair");
@@ -46,15 +46,15 @@ PRIMITIVE(car, car, 1, 8)
 
 PRIMITIVE(cdr, cdr, 1, 9)
 {
-  if (IN_RAM(reg1)) {
-    EXPECT(RAM_IS_PAIR(reg1), "cdr.0", "pair");
+  if (IN_RAM(vm->reg1)) {
+    EXPECT(RAM_IS_PAIR(vm->reg1), "cdr.0", "pair");
 
-    reg1 = RAM_GET_CDR(reg1);
+    vm->reg1 = RAM_GET_CDR(vm->reg1);
   }
-  else if (IN_ROM(reg1)) {
-    EXPECT(ROM_IS_PAIR(reg1), "cdr.1", "pair");
+  else if (IN_ROM(vm->reg1)) {
+    EXPECT(ROM_IS_PAIR(vm->reg1), "cdr.1", "pair");
 
-    reg1 = ROM_GET_CDR(reg1);
+    vm->reg1 = ROM_GET_CDR(vm->reg1);
   }
   else {
     TYPE_ERROR("cdr.2", "pair");
@@ -63,12 +63,12 @@ PRIMITIVE(cdr, cdr, 1, 9)
 
 PRIMITIVE_UNSPEC(set-car!, set_car_bang, 2, 10)
 {
-  if (IN_RAM(reg1)) {
-    EXPECT(RAM_IS_PAIR(reg1), "set-car!.0", "pair");
+  if (IN_RAM(vm->reg1)) {
+    EXPECT(RAM_IS_PAIR(vm->reg1), "set-car!.0", "pair");
 
-    RAM_SET_CAR(reg1, reg2);
-    reg1 = NIL;
-    reg2 = NIL;
+    RAM_SET_CAR(vm->reg1, vm->reg2);
+    vm->reg1 = NIL;
+    vm->reg2 = NIL;
   }
   else {
     TYPE_ERROR("set-car!.1", "pair");
@@ -77,12 +77,12 @@ PRIMITIVE_UNSPEC(set-car!, set_car_bang, 2, 10)
 
 PRIMITIVE_UNSPEC(set-cdr!, set_cdr_bang, 2, 11)
 {
-  if (IN_RAM(reg1)) {
-    EXPECT(RAM_IS_PAIR(reg1), "set-cdr!.0", "pair");
+  if (IN_RAM(vm->reg1)) {
+    EXPECT(RAM_IS_PAIR(vm->reg1), "set-cdr!.0", "pair");
 
-    RAM_SET_CDR(reg1, reg2);
-    reg1 = NIL;
-    reg2 = NIL;
+    RAM_SET_CDR(vm->reg1, vm->reg2);
+    vm->reg1 = NIL;
+    vm->reg2 = NIL;
   }
   else {
     TYPE_ERROR("set-cdr!.1", "pair");
@@ -91,14 +91,467 @@ PRIMITIVE_UNSPEC(set-cdr!, set_cdr_bang, 2, 11)
 
 PRIMITIVE(null?, null_p, 1, 12)
 {
-  reg1 = ENCODE_BOOL(reg1 == NIL);
+  vm->reg1 = ENCODE_BOOL(vm->reg1 == NIL);
 }
 
 
+/** List operations.
+
+  The following primitives walk lists in loops, instead of the recursive
+  procedures of the library. They work on RAM and ROM lists. Lists being
+  built are kept in the registers while allocating.
+
+ */
+
+PRIVATE bool list_pair_p(cell_p p)
+{
+  return ((IN_RAM(p)) && RAM_IS_PAIR(p)) || ((IN_ROM(p)) && ROM_IS_PAIR(p));
+}
+
+PRIVATE cell_p list_car(cell_p p) { return IN_RAM(p) ? RAM_GET_CAR(p) : ROM_GET_CAR(p); }
+PRIVATE cell_p list_cdr(cell_p p) { return IN_RAM(p) ? RAM_GET_CDR(p) : ROM_GET_CDR(p); }
+
+/** list_tail().
+
+  Returns the pair at index i of the list p, NIL if the list is too short.
+
+ */
+
+PRIVATE cell_p list_tail(cell_p p, int32_t i)
+{
+  for (; (i > 0) && list_pair_p(p); i--) p = list_cdr(p);
+
+  return ((i == 0) && list_pair_p(p)) ? p : NIL;
+}
+
+PRIMITIVE(length, length, 1, 110)
+{
+  /* The hare walks two pairs when the tortoise walks one: they meet if the
+     list is circular. The result is then #f. */
+  cell_p  slow = vm->reg1;
+  cell_p  fast = vm->reg1;
+  int32_t n    = 0;
+
+  while (list_pair_p(fast)) {
+    fast = list_cdr(fast);
+    n++;
+
+    if (!list_pair_p(fast)) break;
+
+    fast = list_cdr(fast);
+    slow = list_cdr(slow);
+    n++;
+
+    if (fast == slow) {
+      vm->reg1 = FALSE;
+      return;
+    }
+  }
+
+  vm->reg1 = encode_int(n);
+}
+
+PRIMITIVE(append, append, 2, 111)
+{
+  /* The pairs of reg1 are copied, the last one pointing at reg2. The copy
+     is kept in reg3. */
+  cell_p p    = vm->reg1;
+  cell_p last = NIL;
+
+  vm->reg3 = vm->reg2;
+
+  for (; list_pair_p(p); p = list_cdr(p)) {
+    cell_p q = new_pair(list_car(p), vm->reg2);
+
+    if (last == NIL) vm->reg3 = q;
+    else             RAM_SET_CDR(last, q);
+
+    last = q;
+  }
+
+  vm->reg1 = vm->reg3;
+  vm->reg2 = vm->reg3 = NIL;
+}
+
+PRIMITIVE(reverse, reverse, 1, 112)
+{
+  /* The reversed list is built in reg2 */
+  vm->reg2 = NIL;
+
+  for (cell_p p = vm->reg1; list_pair_p(p); p = list_cdr(p)) {
+    vm->reg2 = new_pair(list_car(p), vm->reg2);
+  }
+
+  vm->reg1 = vm->reg2;
+  vm->reg2 = NIL;
+}
+
+PRIMITIVE(reverse!, reverse_bang, 1, 113)
+{
+  /* The pairs of the RAM list reg1 are linked in the reverse order */
+  cell_p rev = NIL;
+
+  while (vm->reg1 != NIL) {
+    EXPECT((IN_RAM(vm->reg1)) && RAM_IS_PAIR(vm->reg1), "reverse!", "RAM list");
+
+    cell_p next = RAM_GET_CDR(vm->reg1);
+    RAM_SET_CDR(vm->reg1, rev);
+    rev  = vm->reg1;
+    vm->reg1 = next;
+  }
+
+  vm->reg1 = rev;
+}
+
+PRIMITIVE(list-ref, list_ref, 2, 114)
+{
+  cell_p p = list_tail(vm->reg1, decode_int(vm->reg2));
+
+  if (p == NIL) {
+    ERROR("list-ref", "index out of range");
+    vm->reg1 = FALSE;
+  }
+  else {
+    vm->reg1 = list_car(p);
+  }
+
+  vm->reg2 = NIL;
+}
+
+PRIMITIVE_UNSPEC(list-set!, list_set, 3, 115)
+{
+  cell_p p = list_tail(vm->reg1, decode_int(vm->reg2));
+
+  if (p == NIL) {
+    ERROR("list-set!", "index out of range");
+  }
+  else {
+    EXPECT(IN_RAM(p), "list-set!", "RAM list");
+
+    RAM_SET_CAR(p, vm->reg3);
+  }
+
+  vm->reg1 = vm->reg2 = vm->reg3 = NIL;
+}
+
+PRIMITIVE(memq, memq, 2, 116)
+{
+  /* reg1 is the object searched in the list reg2 */
+  cell_p p = vm->reg2;
+
+  while (list_pair_p(p) && (list_car(p) != vm->reg1)) p = list_cdr(p);
+
+  vm->reg1 = list_pair_p(p) ? p : FALSE;
+  vm->reg2 = NIL;
+}
+
+PRIMITIVE(assq, assq, 2, 117)
+{
+  /* reg1 is the key searched in the association list reg2 */
+  cell_p p;
+
+  for (p = vm->reg2; list_pair_p(p); p = list_cdr(p)) {
+    cell_p binding = list_car(p);
+
+    if (list_pair_p(binding) && (list_car(binding) == vm->reg1)) break;
+  }
+
+  vm->reg1 = list_pair_p(p) ? list_car(p) : FALSE;
+  vm->reg2 = NIL;
+}
+
+/** list_merge_sort().
+
+  Sorts the RAM list p of numbers in ascending (descending if descending
+  is true) order and returns it. The sort is a stable bottom-up merge
+  sort: runs of k pairs are merged, k doubling at each pass, by relinking
+  the pairs. Nothing is allocated.
+
+ */
+
+PRIVATE cell_p list_merge_sort(cell_p p, bool descending)
+{
+  for (int32_t k = 1; ; k *= 2) {
+    cell_p  head   = NIL;
+    cell_p  tail   = NIL;
+    int32_t merges = 0;
+
+    while (p != NIL) {
+      cell_p  q     = p;
+      int32_t psize = 0;
+      int32_t qsize = k;
+
+      merges++;
+
+      while ((psize < k) && (q != NIL)) {
+        q = RAM_GET_CDR(q);
+        psize++;
+      }
+
+      while ((psize > 0) || ((qsize > 0) && (q != NIL))) {
+        cell_p e;
+        bool   from_q;
+
+        if      (psize == 0)                  from_q = true;
+        else if ((qsize == 0) || (q == NIL))  from_q = false;
+        else {
+          int32_t vp = decode_int(RAM_GET_CAR(p));
+          int32_t vq = decode_int(RAM_GET_CAR(q));
+
+          from_q = descending ? (vq > vp) : (vq < vp);
+        }
+
+        if (from_q) { e = q; q = RAM_GET_CDR(q); qsize--; }
+        else        { e = p; p = RAM_GET_CDR(p); psize--; }
+
+        if (tail == NIL) head = e;
+        else             RAM_SET_CDR(tail, e);
+
+        tail = e;
+      }
+
+      p = q;
+    }
+
+    RAM_SET_CDR(tail, NIL);
+
+    if (merges <= 1) return head;
+
+    p = head;
+  }
+}
+
+/** int32_p().
+
+  Returns true if decode_int() gives the exact value of the number x: a
+  small int, a fixnum or a bignum that fits in 32 bits.
+
+ */
+
+PRIVATE bool int32_p(cell_p x)
+{
+  if (IS_SMALL_INT(x) || ((IN_RAM(x)) && RAM_IS_FIXNUM(x))) return true;
+
+  if ((IN_ROM(x)) && ROM_IS_BIGNUM(x)) return IS_SMALL_INT(ROM_GET_BIGNUM_HI(x));
+
+  if (!((IN_RAM(x)) && RAM_IS_BIGNUM(x))) return false;
+
+  x = RAM_GET_BIGNUM_HI(x);
+
+  if (IS_SMALL_INT(x)) return true;
+  if (!((IN_RAM(x)) && RAM_IS_BIGNUM(x))) return false;
+
+  // Two digits: the sign of the highest one must be the one of the number
+
+  uint16_t hi = RAM_GET_BIGNUM_VALUE(x);
+
+  return ((RAM_GET_BIGNUM_HI(x) == ZERO) && (hi < 0x8000)) ||
+         ((RAM_GET_BIGNUM_HI(x) == NEG1) && (hi >= 0x8000));
+}
+
+/** list_sortable().
+
+  Returns 1 if p is a proper RAM list of numbers compared exactly by
+  decode_int() (see int32_p()), 0 if it is a proper RAM list holding other
+  objects (e.g. wider bignums) and -1 if it is not a proper RAM list. A
+  circular list is found by a second pointer going at half speed.
+
+ */
+
+PRIVATE int list_sortable(cell_p p)
+{
+  cell_p slow   = p;
+  int    result = 1;
+
+  for (int32_t i = 0; p != NIL; i++) {
+    if (!((IN_RAM(p)) && RAM_IS_PAIR(p))) return -1;
+
+    if (!int32_p(RAM_GET_CAR(p))) result = 0;
+
+    p = RAM_GET_CDR(p);
+
+    if (i & 1) {
+      slow = RAM_GET_CDR(slow);
+      if (slow == p) return -1;
+    }
+  }
+
+  return result;
+}
+
+PRIMITIVE(#%list-sort!, list_sort, 2, 118)
+{
+  /* reg1 is a RAM list of numbers, reg2 is true for the descending order.
+     The sorted list is returned, #f if it holds numbers wider than 32
+     bits: sort! then uses the generic merge sort. */
+  switch (list_sortable(vm->reg1)) {
+    case 1:
+      if (vm->reg1 != NIL) vm->reg1 = list_merge_sort(vm->reg1, vm->reg2 != FALSE);
+      break;
+    case 0:
+      vm->reg1 = FALSE;
+      break;
+    default:
+      TYPE_ERROR("list-sort!", "RAM list");
+      break;
+  }
+
+  vm->reg2 = NIL;
+}
+
 #if TESTS
+PRIVATE cell_p list_test_range(int32_t n)
+{
+  // The list is built in reg4
+
+  vm->reg4 = NIL;
+  while (n > 0) vm->reg4 = new_pair(encode_int(--n), vm->reg4);
+
+  cell_p p = vm->reg4;
+  vm->reg4 = NIL;
+
+  return p;
+}
+
 void primitives_list_tests()
 {
+  cell_p lst;
+
   TESTM("primitives-list");
 
+  TEST("length");
+
+    vm->env = new_pair(list_test_range(10), NIL);
+    lst = RAM_GET_CAR(vm->env);
+
+    vm->reg1 = lst; primitive_length();
+    EXPECT_TRUE(vm->reg1 == encode_int(10), "Length of a list not right");
+
+    vm->reg1 = NIL; primitive_length();
+    EXPECT_TRUE(vm->reg1 == ZERO, "Length of the empty list not right");
+
+    RAM_SET_CDR(list_tail(lst, 9), list_tail(lst, 4));
+    vm->reg1 = lst; primitive_length();
+    EXPECT_TRUE(vm->reg1 == FALSE, "Circular list not detected");
+    RAM_SET_CDR(list_tail(lst, 9), NIL);
+
+  TEST("append and reverse");
+
+    vm->reg1 = lst; vm->reg2 = list_test_range(3); primitive_append();
+    EXPECT_TRUE((RAM_GET_CAR(list_tail(vm->reg1, 9)) == encode_int(9)) &&
+                (RAM_GET_CAR(list_tail(vm->reg1, 12)) == encode_int(2)) &&
+                (list_tail(vm->reg1, 13) == NIL) && (vm->reg1 != lst),
+                "Lists not appended");
+
+    vm->reg1 = NIL; vm->reg2 = lst; primitive_append();
+    EXPECT_TRUE(vm->reg1 == lst, "Append to the empty list not right");
+
+    vm->reg1 = lst; primitive_reverse();
+    EXPECT_TRUE((RAM_GET_CAR(vm->reg1) == encode_int(9)) && (RAM_GET_CAR(lst) == ZERO),
+                "List not reversed");
+
+    vm->reg1 = lst; primitive_reverse_bang();
+    EXPECT_TRUE((RAM_GET_CAR(vm->reg1) == encode_int(9)) && (RAM_GET_CDR(lst) == NIL),
+                "List not reversed in place");
+    lst = vm->reg1;
+    RAM_SET_CAR(vm->env, lst);
+
+  TEST("list-ref and list-set!");
+
+    vm->reg1 = lst; vm->reg2 = encode_int(3); primitive_list_ref();
+    EXPECT_TRUE(vm->reg1 == encode_int(6), "list-ref not right");
+
+    vm->reg1 = lst; vm->reg2 = encode_int(3); vm->reg3 = TRUE; primitive_list_set();
+    EXPECT_TRUE(RAM_GET_CAR(list_tail(lst, 3)) == TRUE, "list-set! not right");
+
+    vm->reg1 = lst; vm->reg2 = encode_int(10); primitive_list_ref();
+    EXPECT_TRUE(vm->reg1 == FALSE, "list-ref out of range accepted");
+
+  TEST("memq and assq");
+
+    vm->reg1 = encode_int(2); vm->reg2 = lst; primitive_memq();
+    EXPECT_TRUE(vm->reg1 == list_tail(lst, 7), "memq not right");
+
+    vm->reg1 = encode_int(42); vm->reg2 = lst; primitive_memq();
+    EXPECT_TRUE(vm->reg1 == FALSE, "memq found a missing element");
+
+    // The association list ((#f . 1) (#t . 0)) is built in the car of env
+
+    vm->env = new_pair(new_pair(TRUE, ZERO), vm->env);
+    RAM_SET_CAR(vm->env, new_pair(RAM_GET_CAR(vm->env), NIL));
+    vm->reg1 = new_pair(FALSE, encode_int(1));
+    RAM_SET_CAR(vm->env, new_pair(vm->reg1, RAM_GET_CAR(vm->env)));
+
+    vm->reg1 = TRUE; vm->reg2 = RAM_GET_CAR(vm->env); primitive_assq();
+    EXPECT_TRUE((vm->reg1 != FALSE) && (RAM_GET_CDR(vm->reg1) == ZERO), "assq not right");
+
+    vm->reg1 = NIL; vm->reg2 = RAM_GET_CAR(vm->env); primitive_assq();
+    EXPECT_TRUE(vm->reg1 == FALSE, "assq found a missing key");
+
+  TEST("Sort");
+
+    // 0..9 with the odd numbers negated, then sorted in both orders
+
+    lst = list_test_range(10);
+    RAM_SET_CAR(vm->env, lst);
+    for (cell_p p = lst; p != NIL; p = RAM_GET_CDR(p)) {
+      if (decode_int(RAM_GET_CAR(p)) & 1) RAM_SET_CAR(p, encode_int(-decode_int(RAM_GET_CAR(p))));
+    }
+
+    vm->reg1 = lst; vm->reg2 = FALSE; primitive_list_sort();
+    EXPECT_TRUE((decode_int(RAM_GET_CAR(vm->reg1)) == -9) &&
+                (RAM_GET_CAR(list_tail(vm->reg1, 5)) == ZERO) &&
+                (RAM_GET_CAR(list_tail(vm->reg1, 9)) == encode_int(8)) &&
+                (list_tail(vm->reg1, 10) == NIL),
+                "List not sorted in ascending order");
+    RAM_SET_CAR(vm->env, vm->reg1);
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = TRUE; primitive_list_sort();
+    EXPECT_TRUE((RAM_GET_CAR(vm->reg1) == encode_int(8)) &&
+                (decode_int(RAM_GET_CAR(list_tail(vm->reg1, 9))) == -9),
+                "List not sorted in descending order");
+
+    vm->reg1 = NIL; vm->reg2 = FALSE; primitive_list_sort();
+    EXPECT_TRUE(vm->reg1 == NIL, "Empty list not sorted");
+
+    // A bignum wider than 32 bits is left to the generic sort
+
+    vm->reg2 = new_bignum(256, ZERO);
+    vm->reg2 = new_bignum(0, vm->reg2);
+    vm->reg2 = new_bignum(0, vm->reg2);
+    vm->reg1 = new_pair(vm->reg2, RAM_GET_CAR(vm->env));
+    RAM_SET_CAR(vm->env, vm->reg1);
+    vm->reg2 = FALSE; primitive_list_sort();
+    EXPECT_TRUE(vm->reg1 == FALSE, "List with a bignum sorted");
+
+    vm->reg1 = RAM_GET_CAR(vm->env);
+    RAM_SET_CAR(vm->reg1, new_fixnum(-100000));
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = FALSE; primitive_list_sort();
+    EXPECT_TRUE((vm->reg1 != FALSE) && (decode_int(RAM_GET_CAR(vm->reg1)) == -100000),
+                "List with a fixnum not sorted");
+    RAM_SET_CAR(vm->env, vm->reg1);
+
+    // 2^31 doesn't fit in 32 bits, -2^31 does
+
+    vm->reg1 = new_bignum(-32768, ZERO);
+    vm->reg1 = new_bignum(0, vm->reg1);
+    EXPECT_TRUE(!int32_p(vm->reg1), "2^31 taken as a 32 bits number");
+    vm->reg1 = new_bignum(-32768, NEG1);
+    vm->reg1 = new_bignum(0, vm->reg1);
+    EXPECT_TRUE(int32_p(vm->reg1) && (decode_int(vm->reg1) == INT32_MIN), "-2^31 not a 32 bits number");
+
+    // Circular lists end the check
+
+    lst = list_test_range(3);
+    RAM_SET_CDR(list_tail(lst, 2), lst);
+    EXPECT_TRUE(list_sortable(lst) == -1, "Circular list accepted");
+    lst = list_tail(lst, 1);
+    RAM_SET_CDR(list_tail(lst, 1), lst);
+    EXPECT_TRUE(list_sortable(lst) == -1, "Circular list accepted");
+    EXPECT_TRUE(list_sortable(RAM_GET_CAR(vm->env)) == 1, "Proper list not accepted");
+
+  vm->env = NIL;
+  vm->reg1 = vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+  mm_gc();
 }
 #endif
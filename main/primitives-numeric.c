@@ -1,5 +1,5 @@
 // primitives-numeric
-// Builtin Indexes: 13..25
+// Builtin Indexes: 13..25, 122..124
 
 #include "esp32-scheme-vm.h"
 #include "vm-arch.h"
@@ -11,21 +11,34 @@
 #endif
 
 #include "primitives.h"
+#include "ports.h"
+
+#ifdef CONFIG_BIGNUM_LONG
+  // Fixnums (see clock-us) are converted to bignums before any operation
+
+  #define FIXNUM_TO_BIGNUM(r) if (IN_RAM(r) && RAM_IS_FIXNUM(r)) r = fixnum_to_bignum(r)
+
+  PRIVATE void fixnum_args()
+  {
+    FIXNUM_TO_BIGNUM(vm->reg1);
+    FIXNUM_TO_BIGNUM(vm->reg2);
+  }
+#endif
 
 PRIMITIVE(number?, number_p, 1, 13)
 {
-  if ((reg1 >= SMALL_INT_START) && (reg1 <= SMALL_INT_MAX)) {
-    reg1 = TRUE;
+  if ((vm->reg1 >= SMALL_INT_START) && (vm->reg1 <= SMALL_INT_MAX)) {
+    vm->reg1 = TRUE;
   }
   else {
-    if (IN_RAM(reg1)) {
-      reg1 = ENCODE_BOOL(RAM_IS_FIXNUM(reg1) || RAM_IS_BIGNUM(reg1));
+    if (IN_RAM(vm->reg1)) {
+      vm->reg1 = ENCODE_BOOL(RAM_IS_FIXNUM(vm->reg1) || RAM_IS_BIGNUM(vm->reg1));
     }
-    else if (IN_ROM(reg1)) {
-      reg1 = ENCODE_BOOL(ROM_IS_FIXNUM(reg1) || ROM_IS_BIGNUM(reg1));
+    else if (IN_ROM(vm->reg1)) {
+      vm->reg1 = ENCODE_BOOL(ROM_IS_FIXNUM(vm->reg1) || ROM_IS_BIGNUM(vm->reg1));
     }
     else {
-      reg1 = FALSE;
+      vm->reg1 = FALSE;
     }
   }
 }
@@ -33,162 +46,811 @@ PRIMITIVE(number?, number_p, 1, 13)
 PRIMITIVE(=, equal, 2, 14)
 {
 #ifdef CONFIG_BIGNUM_LONG
-  reg1 = ENCODE_BOOL(cmp(reg1, reg2) == 1);
+  fixnum_args();
+  vm->reg1 = ENCODE_BOOL(cmp(vm->reg1, vm->reg2) == 1);
 #else
   decode_2_int_args();
-  reg1 = ENCODE_BOOL(a1 == a2);
+  vm->reg1 = ENCODE_BOOL(vm->a1 == vm->a2);
 #endif
-  reg2 = FALSE;
+  vm->reg2 = FALSE;
 }
 
 PRIMITIVE(#%+, add, 2, 15)
 {
 #ifdef CONFIG_BIGNUM_LONG
-  reg1 = add (reg1, reg2);
+  fixnum_args();
+  vm->reg1 = add (vm->reg1, vm->reg2);
 #else
   decode_2_int_args();
-  reg1 = encode_int(a1 + a2);
+  vm->reg1 = encode_int(vm->a1 + vm->a2);
 #endif
-  reg2 = NIL;
+  vm->reg2 = NIL;
 }
 
 PRIMITIVE(#%-, sub, 2, 16)
 {
 #ifdef CONFIG_BIGNUM_LONG
-  reg1 = sub (reg1, reg2);
+  fixnum_args();
+  vm->reg1 = sub (vm->reg1, vm->reg2);
 #else
   decode_2_int_args();
-  reg1 = encode_int(a1 - a2);
+  vm->reg1 = encode_int(vm->a1 - vm->a2);
 #endif
-  reg2 = NIL;
+  vm->reg2 = NIL;
 }
 
 PRIMITIVE(#%mul-non-neg, mul_non_neg, 2, 17)
 {
 #ifdef CONFIG_BIGNUM_LONG
-  reg1 = mulnonneg (reg1, reg2);
+  fixnum_args();
+  vm->reg1 = mulnonneg (vm->reg1, vm->reg2);
 #else
   decode_2_int_args();
-  reg1 = encode_int(a1 * a2);
+  vm->reg1 = encode_int(vm->a1 * vm->a2);
 #endif
-  reg2 = NIL;
+  vm->reg2 = NIL;
 }
 
 PRIMITIVE(#%div-non-neg, div_non_neg, 2, 18)
 {
 #ifdef CONFIG_BIGNUM_LONG
-  if (obj_eq(reg2, ZERO)) {
+  fixnum_args();
+
+  if (obj_eq(vm->reg2, ZERO)) {
     ERROR("quotient", "divide by 0");
   }
 
-  reg1 = divnonneg (reg1, reg2);
+  vm->reg1 = divnonneg (vm->reg1, vm->reg2);
 #else
   decode_2_int_args ();
 
-  if (a2 == 0) {
+  if (vm->a2 == 0) {
     ERROR("quotient", "divide by 0");
   }
 
-  reg1 = encode_int(a1 / a2);
+  vm->reg1 = encode_int(vm->a1 / vm->a2);
 #endif
 
-  reg2 = NIL;
+  vm->reg2 = NIL;
 }
 
 PRIMITIVE(#%rem-non-neg, rem_non_neg, 2, 19)
 {
 #ifdef CONFIG_BIGNUM_LONG
-  if (obj_eq(reg2, ZERO)) {
+  fixnum_args();
+
+  if (obj_eq(vm->reg2, ZERO)) {
     ERROR("remainder", "divide by 0");
   }
 
-  reg3 = divnonneg (reg1, reg2);
-  reg4 = mulnonneg (reg2, reg3);
-  reg1 = sub(reg1, reg4);
-  reg3 = NIL;
-  reg4 = NIL;
+  vm->reg3 = divnonneg (vm->reg1, vm->reg2);
+  vm->reg4 = mulnonneg (vm->reg2, vm->reg3);
+  vm->reg1 = sub(vm->reg1, vm->reg4);
+  vm->reg3 = NIL;
+  vm->reg4 = NIL;
 #else
   decode_2_int_args ();
 
-  if (a2 == 0) {
+  if (vm->a2 == 0) {
     ERROR("remainder", "divide by 0");
   }
 
-  reg1 = encode_int(a1 % a2);
+  vm->reg1 = encode_int(vm->a1 % vm->a2);
 #endif
 
-  reg2 = NIL;
+  vm->reg2 = NIL;
 }
 
 PRIMITIVE(<, lt, 2, 20)
 {
 #ifdef CONFIG_BIGNUM_LONG
-  reg1 = ENCODE_BOOL(cmp (reg1, reg2) < 1);
+  fixnum_args();
+  vm->reg1 = ENCODE_BOOL(cmp (vm->reg1, vm->reg2) < 1);
 #else
   decode_2_int_args ();
-  reg1 = ENCODE_BOOL(a1 < a2);
+  vm->reg1 = ENCODE_BOOL(vm->a1 < vm->a2);
 #endif
-  reg2 = NIL;
+  vm->reg2 = NIL;
 }
 
 PRIMITIVE(>, gt, 2, 21)
 {
 #ifdef CONFIG_BIGNUM_LONG
-  reg1 = ENCODE_BOOL(cmp (reg1, reg2) > 1);
+  fixnum_args();
+  vm->reg1 = ENCODE_BOOL(cmp (vm->reg1, vm->reg2) > 1);
 #else
   decode_2_int_args ();
-  reg1 = ENCODE_BOOL(a1 > a2);
+  vm->reg1 = ENCODE_BOOL(vm->a1 > vm->a2);
 #endif
-  reg2 = NIL;
+  vm->reg2 = NIL;
 }
 
 PRIMITIVE(bitwise-ior, bitwise_ior, 2, 22)
 {
 #ifdef CONFIG_BIGNUM_LONG
-  reg1 = bitwise_ior(reg1, reg2);
+  fixnum_args();
+  vm->reg1 = bitwise_ior(vm->reg1, vm->reg2);
 #else
   decode_2_int_args ();
-  reg1 = encode_int(a1 | a2);
+  vm->reg1 = encode_int(vm->a1 | vm->a2);
 #endif
-  reg2 = NIL;
+  vm->reg2 = NIL;
 }
 
 PRIMITIVE(bitwise-xor, bitwise_xor, 2, 23)
 {
 #ifdef CONFIG_BIGNUM_LONG
-  reg1 = bitwise_xor(reg1, reg2);
+  fixnum_args();
+  vm->reg1 = bitwise_xor(vm->reg1, vm->reg2);
 #else
   decode_2_int_args ();
-  reg1 = encode_int(a1 ^ a2);
+  vm->reg1 = encode_int(vm->a1 ^ vm->a2);
 #endif
-  reg2 = NIL;
+  vm->reg2 = NIL;
 }
 
 PRIMITIVE(bitwise-and, bitwise_and, 2, 24)
 {
 #ifdef CONFIG_BIGNUM_LONG
-  reg1 = bitwise_and(reg1, reg2);
+  fixnum_args();
+  vm->reg1 = bitwise_and(vm->reg1, vm->reg2);
 #else
   decode_2_int_args ();
-  reg1 = encode_int(a1 & a2);
+  vm->reg1 = encode_int(vm->a1 & vm->a2);
 #endif
-  reg2 = NIL;
+  vm->reg2 = NIL;
 }
 
 PRIMITIVE(bitwise-not, bitwise_not, 1, 25)
 {
 #ifdef CONFIG_BIGNUM_LONG
-  reg1 = bitwise_not(reg1);
+  FIXNUM_TO_BIGNUM(vm->reg1);
+  vm->reg1 = bitwise_not(vm->reg1);
 #else
-  reg1 = encode_int(~ decode_int(reg1));
+  vm->reg1 = encode_int(~ decode_int(vm->reg1));
 #endif
 }
 
 
+/** Number conversions.
+
+  number->string and string->number work on the magnitude of the number
+  as an array of 16 bits digits in C memory, the least significant digit
+  first. Magnitudes fitting in 32 bits are converted with machine
+  arithmetic, two decimal digits at a time with the digit_pairs table.
+  Larger ones are divided in place by 10000, giving four decimal digits
+  for each pass over their digits, while radixes 2, 8 and 16 only slice
+  their bits.
+
+  The text is built backward from the end of a buffer, then written as
+  is to a port by #%write-number, or turned into a string by
+  #%number->string.
+
+ */
+
+#define NUMBER_TEXT_SIZE 34
+
+typedef struct {
+  char   * start;
+  uint16_t length;
+  char   * mem;                    // Buffer of large bignums, NULL otherwise
+  char     text[NUMBER_TEXT_SIZE]; // Buffer of 32 bits magnitudes
+} number_text;
+
+PRIVATE const char digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+PRIVATE const char radix_chars[] = "0123456789abcdef";
+
+PRIVATE bool is_number(cell_p p)
+{
+  if (IS_SMALL_INT(p)) return true;
+  if (IN_RAM(p))       return RAM_IS_FIXNUM(p) || RAM_IS_BIGNUM(p);
+  if (IN_ROM(p))       return ROM_IS_FIXNUM(p) || ROM_IS_BIGNUM(p);
+
+  return false;
+}
+
+PRIVATE uint8_t radix_shift(int32_t radix)
+{
+  switch (radix) {
+    case  2: return 1;
+    case  8: return 3;
+    case 16: return 4;
+    default: return 0;
+  }
+}
+
+PRIVATE uint8_t radix_arg(cell_p r, const char * proc)
+{
+  int32_t radix = decode_int(r);
+
+  if ((radix != 10) && (radix_shift(radix) == 0)) {
+    ERROR(proc, "radix must be 2, 8, 10 or 16");
+    radix = 10;
+  }
+
+  return radix;
+}
+
+/** format_uint32().
+
+  Puts the digits of v in radix before p. Returns the address of the
+  first digit.
+
+ */
+
+PRIVATE char * format_uint32(uint32_t v, uint8_t radix, char * p)
+{
+  uint8_t shift = radix_shift(radix);
+
+  if (shift) {
+    do {
+      *--p = radix_chars[v & (radix - 1)];
+      v >>= shift;
+    } while (v);
+  }
+  else {
+    while (v >= 100) {
+      uint8_t i = (v % 100) << 1;
+
+      v /= 100;
+      *--p = digit_pairs[i + 1];
+      *--p = digit_pairs[i];
+    }
+    if (v >= 10) {
+      *--p = digit_pairs[(v << 1) + 1];
+      *--p = digit_pairs[v << 1];
+    }
+    else {
+      *--p = '0' + v;
+    }
+  }
+
+  return p;
+}
+
+/** format_digits().
+
+  Puts the digits in radix of the magnitude d of count digits before p.
+  The magnitude has more than 32 bits and is destroyed. Returns the
+  address of the first digit.
+
+ */
+
+PRIVATE char * format_digits(uint16_t * d, uint16_t count, uint8_t radix, char * p)
+{
+  uint8_t shift = radix_shift(radix);
+
+  if (shift) {
+    uint32_t bits  = 0;
+    uint8_t  nbits = 0;
+
+    for (uint16_t i = 0; i < count; i++) {
+      bits  |= (uint32_t) d[i] << nbits;
+      nbits += 16;
+      while (nbits >= shift) {
+        *--p   = radix_chars[bits & (radix - 1)];
+        bits >>= shift;
+        nbits -= shift;
+      }
+    }
+    if (nbits > 0) *--p = radix_chars[bits];
+
+    while (*p == '0') p++;
+  }
+  else {
+    while (count > 2) {
+      uint32_t rem = 0;
+
+      for (int i = count - 1; i >= 0; i--) {
+        uint32_t v = (rem << 16) | d[i];
+
+        d[i] = v / 10000;
+        rem  = v % 10000;
+      }
+      if (d[count - 1] == 0) count--;
+
+      uint8_t lo = (rem % 100) << 1;
+      uint8_t hi = (rem / 100) << 1;
+
+      *--p = digit_pairs[lo + 1];
+      *--p = digit_pairs[lo];
+      *--p = digit_pairs[hi + 1];
+      *--p = digit_pairs[hi];
+    }
+    p = format_uint32(d[0] | ((uint32_t) d[1] << 16), 10, p);
+  }
+
+  return p;
+}
+
+/** bignum_magnitude().
+
+  Returns the number of digits of the magnitude of the bignum n, put in
+  a new array. *neg is set if n is negative.
+
+ */
+
+PRIVATE uint16_t bignum_magnitude(cell_p n, uint16_t ** digits, bool * neg)
+{
+  uint16_t   count = 2; // The top small int and one more for 32 bits values
+  uint16_t * d;
+  uint16_t   i;
+
+  for (cell_p p = n; !IS_SMALL_INT(p); p = IN_RAM(p) ? RAM_GET_BIGNUM_HI(p) : ROM_GET_BIGNUM_HI(p)) {
+    count++;
+  }
+
+  if ((d = malloc(count * sizeof(uint16_t))) == NULL) {
+    FATAL("number->string", "Unable to allocate a bignum magnitude");
+  }
+
+  for (i = 0; !IS_SMALL_INT(n); i++) {
+    if (IN_RAM(n)) {
+      d[i] = RAM_GET_BIGNUM_VALUE(n);
+      n    = RAM_GET_BIGNUM_HI(n);
+    }
+    else {
+      d[i] = ROM_GET_BIGNUM_VALUE(n);
+      n    = ROM_GET_BIGNUM_HI(n);
+    }
+  }
+  d[i++] = SMALL_INT_VALUE(n);
+  d[i]   = 0;
+
+  if ((*neg = (n == NEG1))) {
+    uint32_t carry = 1;
+
+    for (uint16_t j = 0; j < i; j++) {
+      carry = (uint16_t) ~d[j] + carry;
+      d[j]  = carry;
+      carry >>= 16;
+    }
+  }
+
+  while ((i > 0) && (d[i - 1] == 0)) i--;
+
+  *digits = d;
+  return i;
+}
+
+/** number_to_text().
+
+  Puts the characters of the number n in radix in t. number_text_free()
+  must be called when done with the text.
+
+ */
+
+PRIVATE void number_to_text(cell_p n, uint8_t radix, number_text * t)
+{
+  char * end = &t->text[NUMBER_TEXT_SIZE];
+  char * p;
+  bool   neg;
+
+  t->mem = NULL;
+
+  if (IS_SMALL_INT(n) || (IN_RAM(n) && RAM_IS_FIXNUM(n)) || (IN_ROM(n) && ROM_IS_FIXNUM(n))) {
+    int32_t v = IS_SMALL_INT(n) ? SMALL_INT_VALUE(n) :
+                IN_RAM(n)       ? RAM_GET_FIXNUM_VALUE(n) : ROM_GET_FIXNUM_VALUE(n);
+
+    neg = v < 0;
+    p   = format_uint32(neg ? - (uint32_t) v : (uint32_t) v, radix, end);
+  }
+  else {
+    uint16_t * d;
+    uint16_t   count = bignum_magnitude(n, &d, &neg);
+
+    if (count <= 2) {
+      p = format_uint32(d[0] | ((uint32_t) d[1] << 16), radix, end);
+    }
+    else {
+      if ((t->mem = malloc(count * 16 + 2)) == NULL) {
+        FATAL("number->string", "Unable to allocate a number text");
+      }
+      end = t->mem + count * 16 + 2;
+      p   = format_digits(d, count, radix, end);
+    }
+
+    free(d);
+  }
+
+  if (neg) *--p = '-';
+
+  t->start  = p;
+  t->length = end - p;
+}
+
+PRIVATE void number_text_free(number_text * t)
+{
+  free(t->mem);
+}
+
+/** next_char().
+
+  Returns the first character of the list *chars, -1 at its end, and
+  moves *chars to the next one.
+
+ */
+
+PRIVATE int32_t next_char(cell_p * chars)
+{
+  int32_t c = -1;
+
+  if (*chars != NIL) {
+    if (IN_RAM(*chars)) {
+      c      = decode_int(RAM_GET_CAR(*chars));
+      *chars = RAM_GET_CDR(*chars);
+    }
+    else {
+      c      = decode_int(ROM_GET_CAR(*chars));
+      *chars = ROM_GET_CDR(*chars);
+    }
+  }
+
+  return c;
+}
+
+/** text_to_number().
+
+  Returns the number written in radix in the characters list chars, #f
+  if it is not a number. A radix prefix (#b, #o, #d or #x) replaces
+  radix.
+
+ */
+
+PRIVATE cell_p text_to_number(cell_p chars, uint8_t radix)
+{
+  uint16_t   local[6];
+  uint16_t * d     = local;
+  uint16_t   size  = 2;
+  uint16_t   count = 0;
+  bool       neg   = false;
+  int32_t    c;
+  cell_p     result;
+
+  for (cell_p p = chars; p != NIL; p = IN_RAM(p) ? RAM_GET_CDR(p) : ROM_GET_CDR(p)) size++;
+  size = (size >> 2) + 2;   // At most 4 bits by character
+
+  if ((size > 6) && ((d = malloc(size * sizeof(uint16_t))) == NULL)) {
+    FATAL("string->number", "Unable to allocate a bignum magnitude");
+  }
+
+  c = next_char(&chars);
+
+  if (c == '#') {
+    c = next_char(&chars);
+    switch (c | 0x20) {
+      case 'b': radix =  2; break;
+      case 'o': radix =  8; break;
+      case 'd': radix = 10; break;
+      case 'x': radix = 16; break;
+      default:  c = -1;     break;
+    }
+    if (c != -1) c = next_char(&chars);
+  }
+
+  if ((c == '-') || (c == '+')) {
+    neg = c == '-';
+    c = next_char(&chars);
+  }
+
+  result = (c == -1) ? FALSE : NIL;
+
+  for (; (c != -1) && (result == NIL); c = next_char(&chars)) {
+    uint32_t carry;
+
+    if      ((c >= '0') && (c <= '9'))  carry = c - '0';
+    else if ((c | 0x20) >= 'a')         carry = (c | 0x20) - 'a' + 10;
+    else                                carry = radix;
+
+    if (carry >= radix) {
+      result = FALSE;
+    }
+    else {
+      for (uint16_t i = 0; i < count; i++) {
+        carry = (uint32_t) d[i] * radix + carry;
+        d[i]  = carry;
+        carry >>= 16;
+      }
+      if (carry) d[count++] = carry;
+    }
+  }
+
+  if (result == NIL) {
+    uint32_t m = (count > 0 ? d[0] : 0) | (count > 1 ? ((uint32_t) d[1] << 16) : 0);
+
+    if ((count <= 2) && (m <= (neg ? 0x80000000 : 0x7FFFFFFF))) {
+      result = encode_int32(neg ? - (int64_t) m : (int64_t) m);
+    }
+  }
+
+  if (result == NIL) {
+    // Builds the bignum from its most significant digit. The sign is in the
+    // small int ending the digits list.
+    uint16_t sign = 0;
+
+    if (neg) {
+      uint32_t carry = 1;
+
+      d[count++] = 0;
+      for (uint16_t i = 0; i < count; i++) {
+        carry = (uint16_t) ~d[i] + carry;
+        d[i]  = carry;
+        carry >>= 16;
+      }
+      sign = 0xFFFF;
+    }
+
+    while (d[count - 1] == sign) count--;
+
+    if (!neg && (d[count - 1] <= MAX_SMALL_INT_VALUE)) {
+      vm->reg2 = ENCODE_SMALL_INT(d[--count]);
+    }
+    else {
+      vm->reg2 = neg ? NEG1 : ZERO;
+    }
+
+    while (count > 0) vm->reg2 = new_bignum(d[--count], vm->reg2);
+
+    result = vm->reg2;
+    vm->reg2   = NIL;
+  }
+
+  if (d != local) free(d);
+
+  return result;
+}
+
+PRIMITIVE(#%number->string, number_to_string, 2, 122)
+{
+  number_text t;
+
+  if (!is_number(vm->reg1)) {
+    TYPE_ERROR("number->string", "number");
+    vm->reg1 = FALSE;
+  }
+  else {
+    number_to_text(vm->reg1, radix_arg(vm->reg2, "number->string"), &t);
+
+    vm->reg2 = NIL;
+    for (int i = t.length - 1; i >= 0; i--) vm->reg2 = new_pair(encode_int(t.start[i]), vm->reg2);
+
+    number_text_free(&t);
+
+    vm->reg1 = new_string(vm->reg2);
+  }
+
+  vm->reg2 = NIL;
+}
+
+PRIMITIVE(#%string->number, string_to_number, 2, 123)
+{
+  uint8_t radix = radix_arg(vm->reg2, "string->number");
+
+  if ((IN_RAM(vm->reg1)) && RAM_IS_STRING(vm->reg1)) {
+    vm->reg1 = text_to_number(RAM_STRING_GET_CHARS(vm->reg1), radix);
+  }
+  else if ((IN_ROM(vm->reg1)) && ROM_IS_STRING(vm->reg1)) {
+    vm->reg1 = text_to_number(ROM_STRING_GET_CHARS(vm->reg1), radix);
+  }
+  else {
+    TYPE_ERROR("string->number", "string");
+    vm->reg1 = FALSE;
+  }
+
+  vm->reg2 = NIL;
+}
+
+PRIMITIVE_UNSPEC(#%write-number, write_number, 3, 124)
+{
+  /* reg1 is the number, reg2 the radix and reg3 the port */
+  number_text t;
+
+  if (!is_number(vm->reg1)) {
+    TYPE_ERROR("write-number", "number");
+  }
+  else {
+    number_to_text(vm->reg1, radix_arg(vm->reg2, "write-number"), &t);
+    port_write(decode_int(vm->reg3), (uint8_t *) t.start, t.length);
+    number_text_free(&t);
+  }
+
+  vm->reg1 = vm->reg2 = vm->reg3 = NIL;
+}
+
 #if TESTS
+PRIVATE struct { int32_t value; uint8_t radix; const char * text; } numbers[] = {
+  {          0, 10, "0"           },
+  {         42, 10, "42"          },
+  {    -100000, 10, "-100000"     },
+  { 2147483647, 10, "2147483647"  },
+  {   (int32_t) 0x80000000, 10, "-2147483648" },
+  {     123456, 16, "1e240"       },
+  {    -123456,  8, "-361100"     },
+  {         10,  2, "1010"        }
+};
+
+PRIVATE struct { uint8_t radix; const char * text; } bignums[] = {
+  { 10, "2147483648"                         },
+  { 10, "-2147483649"                        },
+  { 10, "4294967296"                         },
+  { 10, "-4294967296"                        },
+  { 10, "123456789012345678901234567890"     },
+  { 10, "-100000000000000000000000000000000" },
+  { 16, "123456789abcdef0123456789"          },
+  { 16, "-10000000000000000"                 },
+  {  8, "7777777777777777777777"             },
+  {  2, "10000000000000000000000000000000000000000001" }
+};
+
+PRIVATE cell_p make_string(const char * text)
+{
+  vm->reg4 = NIL;
+  for (int i = strlen(text) - 1; i >= 0; i--) vm->reg4 = new_pair(encode_int((uint8_t) text[i]), vm->reg4);
+
+  cell_p p = new_string(vm->reg4);
+  vm->reg4 = NIL;
+
+  return p;
+}
+
+PRIVATE bool string_is(cell_p s, const char * text)
+{
+  if (!(IN_RAM(s) && RAM_IS_STRING(s))) return false;
+
+  cell_p chars = RAM_STRING_GET_CHARS(s);
+
+  while ((*text != 0) && (next_char(&chars) == (uint8_t) *text)) text++;
+
+  return (*text == 0) && (chars == NIL);
+}
+
 void primitives_numeric_tests()
 {
   TESTM("primitives-numeric");
 
+  TEST("Fixnum arguments");
+
+    vm->reg1 = new_fixnum(100000);
+    vm->reg2 = new_fixnum(99000);
+    primitive_sub();
+
+    EXPECT_TRUE(decode_int(vm->reg1) == 1000, "Fixnum subtraction");
+
+    vm->reg1 = new_fixnum(-200000);
+    vm->reg2 = new_fixnum(200001);
+    primitive_add();
+
+    EXPECT_TRUE(vm->reg1 == ENCODE_SMALL_INT(1), "Fixnum addition not normalized");
+
+    vm->reg1 = new_fixnum(-70000);
+    vm->reg2 = encode_int(3);
+    primitive_lt();
+
+    EXPECT_TRUE(vm->reg1 == TRUE, "Fixnum comparison");
+
+    vm->reg1 = new_fixnum(0x12345678);
+    vm->reg2 = new_fixnum(0x12345678);
+    primitive_equal();
+
+    EXPECT_TRUE(vm->reg1 == TRUE, "Fixnum equality");
+
+  TEST("number->string");
+
+    for (int i = 0; i < (int) (sizeof(numbers) / sizeof(numbers[0])); i++) {
+      vm->reg1 = new_fixnum(numbers[i].value);
+      vm->reg2 = encode_int(numbers[i].radix);
+      primitive_number_to_string();
+
+      EXPECT_TRUE(string_is(vm->reg1, numbers[i].text), "Number text not right");
+    }
+
+    vm->reg1 = encode_int(-1);
+    vm->reg2 = encode_int(16);
+    primitive_number_to_string();
+
+    EXPECT_TRUE(string_is(vm->reg1, "-1"), "Small int text not right");
+
+  TEST("string->number");
+
+    for (int i = 0; i < (int) (sizeof(numbers) / sizeof(numbers[0])); i++) {
+      vm->reg1 = make_string(numbers[i].text);
+      vm->reg2 = encode_int(numbers[i].radix);
+      primitive_string_to_number();
+
+      EXPECT_TRUE(decode_int(vm->reg1) == numbers[i].value, "Number value not right");
+    }
+
+    vm->reg1 = make_string("#xFF");
+    vm->reg2 = encode_int(10);
+    primitive_string_to_number();
+
+    EXPECT_TRUE(vm->reg1 == encode_int(255), "Radix prefix not used");
+
+    vm->reg1 = make_string("12a");
+    vm->reg2 = encode_int(10);
+    primitive_string_to_number();
+
+    EXPECT_TRUE(vm->reg1 == FALSE, "Invalid digit accepted");
+
+    vm->reg1 = make_string("-");
+    vm->reg2 = encode_int(10);
+    primitive_string_to_number();
+
+    EXPECT_TRUE(vm->reg1 == FALSE, "Sign without digits accepted");
+
+  TEST("Bignums");
+
+    for (int i = 0; i < (int) (sizeof(bignums) / sizeof(bignums[0])); i++) {
+      vm->reg1 = make_string(bignums[i].text);
+      vm->reg2 = encode_int(bignums[i].radix);
+      primitive_string_to_number();
+
+      vm->reg2 = encode_int(bignums[i].radix);
+      primitive_number_to_string();
+
+      EXPECT_TRUE(string_is(vm->reg1, bignums[i].text), "Bignum text not right");
+    }
+
+    // 2^40 - 1 from bignum arithmetic
+    vm->reg1 = make_string("1099511627775");
+    vm->reg2 = encode_int(10);
+    primitive_string_to_number();
+    vm->reg2 = encode_int(1);
+    primitive_add();
+    vm->reg2 = encode_int(16);
+    primitive_number_to_string();
+
+    EXPECT_TRUE(string_is(vm->reg1, "10000000000"), "Bignum from arithmetic not right");
+
+    vm->reg1 = make_string("-4294967296");
+    vm->reg2 = encode_int(10);
+    primitive_string_to_number();
+    vm->reg3 = vm->reg1;
+    vm->reg1 = make_string("4294967296");
+    vm->reg2 = encode_int(10);
+    primitive_string_to_number();
+    vm->reg2 = vm->reg3;
+    primitive_add();
+
+    EXPECT_TRUE(vm->reg1 == ENCODE_SMALL_INT(0), "Negative bignum not usable");
+
+  TEST("write-number");
+
+    char * output = NULL;
+    size_t size   = 0;
+    FILE * f      = open_memstream(&output, &size);
+    int8_t port   = port_open(f, 0);
+
+    vm->reg1 = make_string("-123456789012345678901234567890");
+    vm->reg2 = encode_int(10);
+    primitive_string_to_number();
+    vm->reg2 = encode_int(10);
+    vm->reg3 = encode_int(port);
+    primitive_write_number();
+
+    vm->reg1 = encode_int(200);
+    vm->reg2 = encode_int(2);
+    vm->reg3 = encode_int(port);
+    primitive_write_number();
+
+    port_close(port);
+
+    EXPECT_TRUE((size == 39) && (memcmp(output, "-12345678901234567890123456789011001000", 39) == 0),
+                "Number not written");
+
+    free(output);
+
+  vm->reg1 = vm->reg2 = vm->reg3 = vm->reg4 = NIL;
 }
 #endif
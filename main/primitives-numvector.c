@@ -0,0 +1,896 @@
+// primitives-numvector
+// Builtin Indexes: 90..102, 119
+
+#include "esp32-scheme-vm.h"
+#include "vm-arch.h"
+#include "mm.h"
+#include "testing.h"
+
+#include "primitives.h"
+
+#if __SSE2__
+  #include <emmintrin.h>
+#endif
+
+/** Numeric Vectors.
+
+  s16vectors and s32vectors are stored contiguously in the vector heap, as
+  u8vectors are. The kind of elements is kept in the user flags of the
+  vector cell (VECTOR_S16 or VECTOR_S32). The numvector primitives work on
+  both kinds, the s16vector and s32vector procedures of the library being
+  defined on top of them.
+
+  The kernels process whole vectors. Results are saturated to the element
+  type. Products can be scaled down by a right shift, for fixed point
+  arithmetic (e.g. a shift of 15 for Q15 values). On x86, the s16 kernels
+  use SSE2 (8 elements at a time), the others are scalar loops left to the
+  compiler.
+
+ */
+
+// The vector heap is made of 5 bytes cells: the elements of a vector are
+// not aligned. They are read and written through these structs, packed as
+// all the others (see esp32-scheme-vm.h), such that the compiler generates
+// accesses that are valid at any address.
+
+typedef struct { uint8_t v; } u8_elem;
+typedef struct { int16_t v; } s16_elem;
+typedef struct { int32_t v; } s32_elem;
+
+#define SAT16(x) (((x) > INT16_MAX) ? INT16_MAX : (((x) < INT16_MIN) ? INT16_MIN : (x)))
+#define SAT32(x) (((x) > INT32_MAX) ? INT32_MAX : (((x) < INT32_MIN) ? INT32_MIN : (x)))
+
+#define ELEMENT_SIZE(kind) (((kind) == VECTOR_S16) ? 2 : 4)
+
+/** numvector_data().
+
+  Returns the elements of the numeric vector v, setting its kind and its
+  number of elements. If kind is not VECTOR_U8, v must be of that kind.
+  Returns NULL if v is not a numeric vector.
+
+ */
+
+PRIVATE void * numvector_data(cell_p v, uint8_t * kind, int32_t * length)
+{
+  if (!(IN_RAM(v) && RAM_IS_VECTOR(v) &&
+        ((RAM_GET_VECTOR_KIND(v) == VECTOR_S16) || (RAM_GET_VECTOR_KIND(v) == VECTOR_S32)))) {
+    TYPE_ERROR("numvector", "s16vector or s32vector");
+    return NULL;
+  }
+
+  if ((*kind != VECTOR_U8) && (*kind != RAM_GET_VECTOR_KIND(v))) {
+    ERROR("numvector", "Vectors of different kinds");
+    return NULL;
+  }
+
+  *kind   = RAM_GET_VECTOR_KIND(v);
+  *length = RAM_GET_VECTOR_LENGTH(v) / ELEMENT_SIZE(*kind);
+
+  return &VECTOR_GET_BYTE(RAM_GET_VECTOR_START(v), 0);
+}
+
+// ----- s16 kernels -----
+
+PRIVATE void s16_add(s16_elem * d, const s16_elem * a, const s16_elem * b, int32_t n)
+{
+  int32_t i = 0;
+
+  #if __SSE2__
+    for (; i + 8 <= n; i += 8) {
+      __m128i x = _mm_loadu_si128((const __m128i *) (a + i));
+      __m128i y = _mm_loadu_si128((const __m128i *) (b + i));
+      _mm_storeu_si128((__m128i *) (d + i), _mm_adds_epi16(x, y));
+    }
+  #endif
+
+  for (; i < n; i++) d[i].v = SAT16(a[i].v + b[i].v);
+}
+
+PRIVATE void s16_mul(s16_elem * d, const s16_elem * a, const s16_elem * b, int32_t n, int shift)
+{
+  int32_t i = 0;
+
+  #if __SSE2__
+    __m128i count = _mm_cvtsi32_si128(shift);
+
+    for (; i + 8 <= n; i += 8) {
+      __m128i x  = _mm_loadu_si128((const __m128i *) (a + i));
+      __m128i y  = _mm_loadu_si128((const __m128i *) (b + i));
+      __m128i lo = _mm_mullo_epi16(x, y);
+      __m128i hi = _mm_mulhi_epi16(x, y);
+      __m128i p0 = _mm_sra_epi32(_mm_unpacklo_epi16(lo, hi), count);
+      __m128i p1 = _mm_sra_epi32(_mm_unpackhi_epi16(lo, hi), count);
+      _mm_storeu_si128((__m128i *) (d + i), _mm_packs_epi32(p0, p1));
+    }
+  #endif
+
+  for (; i < n; i++) {
+    int32_t p = ((int32_t) a[i].v * b[i].v) >> shift;
+    d[i].v = SAT16(p);
+  }
+}
+
+PRIVATE void s16_scale(s16_elem * d, const s16_elem * a, int16_t k, int32_t n, int shift)
+{
+  int32_t i = 0;
+
+  #if __SSE2__
+    __m128i count = _mm_cvtsi32_si128(shift);
+    __m128i y     = _mm_set1_epi16(k);
+
+    for (; i + 8 <= n; i += 8) {
+      __m128i x  = _mm_loadu_si128((const __m128i *) (a + i));
+      __m128i lo = _mm_mullo_epi16(x, y);
+      __m128i hi = _mm_mulhi_epi16(x, y);
+      __m128i p0 = _mm_sra_epi32(_mm_unpacklo_epi16(lo, hi), count);
+      __m128i p1 = _mm_sra_epi32(_mm_unpackhi_epi16(lo, hi), count);
+      _mm_storeu_si128((__m128i *) (d + i), _mm_packs_epi32(p0, p1));
+    }
+  #endif
+
+  for (; i < n; i++) {
+    int32_t p = ((int32_t) a[i].v * k) >> shift;
+    d[i].v = SAT16(p);
+  }
+}
+
+PRIVATE int64_t s16_dot(const s16_elem * a, const s16_elem * b, int32_t n)
+{
+  int64_t sum = 0;
+  int32_t i   = 0;
+
+  #if __SSE2__
+    // The 32 bits products are widened to 64 bits before being added: a
+    // pair of products of -32768 would overflow _mm_madd_epi16().
+
+    __m128i acc = _mm_setzero_si128();
+
+    for (; i + 8 <= n; i += 8) {
+      __m128i x  = _mm_loadu_si128((const __m128i *) (a + i));
+      __m128i y  = _mm_loadu_si128((const __m128i *) (b + i));
+      __m128i lo = _mm_mullo_epi16(x, y);
+      __m128i hi = _mm_mulhi_epi16(x, y);
+      __m128i p0 = _mm_unpacklo_epi16(lo, hi);
+      __m128i p1 = _mm_unpackhi_epi16(lo, hi);
+      __m128i s0 = _mm_srai_epi32(p0, 31);
+      __m128i s1 = _mm_srai_epi32(p1, 31);
+
+      acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(p0, s0));
+      acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(p0, s0));
+      acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(p1, s1));
+      acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(p1, s1));
+    }
+
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i *) lanes, acc);
+    sum = lanes[0] + lanes[1];
+  #endif
+
+  for (; i < n; i++) sum += (int32_t) a[i].v * b[i].v;
+
+  return sum;
+}
+
+PRIVATE int64_t s16_sum(const s16_elem * a, int32_t n)
+{
+  int64_t sum = 0;
+
+  for (int32_t i = 0; i < n; i++) sum += a[i].v;
+
+  return sum;
+}
+
+PRIVATE int16_t s16_min(const s16_elem * a, int32_t n)
+{
+  int16_t m = INT16_MAX;
+  int32_t i = 0;
+
+  #if __SSE2__
+    if (n >= 8) {
+      int16_t lanes[8];
+      __m128i acc = _mm_set1_epi16(INT16_MAX);
+
+      for (; i + 8 <= n; i += 8) {
+        acc = _mm_min_epi16(acc, _mm_loadu_si128((const __m128i *) (a + i)));
+      }
+
+      _mm_storeu_si128((__m128i *) lanes, acc);
+      for (int j = 0; j < 8; j++) if (lanes[j] < m) m = lanes[j];
+    }
+  #endif
+
+  for (; i < n; i++) if (a[i].v < m) m = a[i].v;
+
+  return m;
+}
+
+PRIVATE int16_t s16_max(const s16_elem * a, int32_t n)
+{
+  int16_t m = INT16_MIN;
+  int32_t i = 0;
+
+  #if __SSE2__
+    if (n >= 8) {
+      int16_t lanes[8];
+      __m128i acc = _mm_set1_epi16(INT16_MIN);
+
+      for (; i + 8 <= n; i += 8) {
+        acc = _mm_max_epi16(acc, _mm_loadu_si128((const __m128i *) (a + i)));
+      }
+
+      _mm_storeu_si128((__m128i *) lanes, acc);
+      for (int j = 0; j < 8; j++) if (lanes[j] > m) m = lanes[j];
+    }
+  #endif
+
+  for (; i < n; i++) if (a[i].v > m) m = a[i].v;
+
+  return m;
+}
+
+// ----- s32 kernels -----
+
+PRIVATE void s32_add(s32_elem * d, const s32_elem * a, const s32_elem * b, int32_t n)
+{
+  for (int32_t i = 0; i < n; i++) {
+    int64_t s = (int64_t) a[i].v + b[i].v;
+    d[i].v = SAT32(s);
+  }
+}
+
+PRIVATE void s32_mul(s32_elem * d, const s32_elem * a, const s32_elem * b, int32_t n, int shift)
+{
+  for (int32_t i = 0; i < n; i++) {
+    int64_t p = ((int64_t) a[i].v * b[i].v) >> shift;
+    d[i].v = SAT32(p);
+  }
+}
+
+PRIVATE void s32_scale(s32_elem * d, const s32_elem * a, int32_t k, int32_t n, int shift)
+{
+  for (int32_t i = 0; i < n; i++) {
+    int64_t p = ((int64_t) a[i].v * k) >> shift;
+    d[i].v = SAT32(p);
+  }
+}
+
+PRIVATE int64_t s32_dot(const s32_elem * a, const s32_elem * b, int32_t n)
+{
+  int64_t sum = 0;
+
+  for (int32_t i = 0; i < n; i++) sum += (int64_t) a[i].v * b[i].v;
+
+  return sum;
+}
+
+PRIVATE int64_t s32_sum(const s32_elem * a, int32_t n)
+{
+  int64_t sum = 0;
+
+  for (int32_t i = 0; i < n; i++) sum += a[i].v;
+
+  return sum;
+}
+
+PRIVATE int32_t s32_min(const s32_elem * a, int32_t n)
+{
+  int32_t m = INT32_MAX;
+
+  for (int32_t i = 0; i < n; i++) if (a[i].v < m) m = a[i].v;
+
+  return m;
+}
+
+PRIVATE int32_t s32_max(const s32_elem * a, int32_t n)
+{
+  int32_t m = INT32_MIN;
+
+  for (int32_t i = 0; i < n; i++) if (a[i].v > m) m = a[i].v;
+
+  return m;
+}
+
+// ----- Sort -----
+
+// Introsort: a quicksort on the median of three elements, switching to a
+// heapsort when the recursion gets too deep, and finishing the small
+// partitions with an insertion sort. The functions are defined for each
+// element type by SORT_FUNCTIONS, the elements being accessed through
+// their packed struct.
+
+#define SORT_THRESHOLD 16
+
+#define SORT_FUNCTIONS(name, elem, type)                                      \
+                                                                              \
+PRIVATE void name ## _sift(elem * a, int32_t i, int32_t n)                    \
+{                                                                             \
+  type x = a[i].v;                                                            \
+                                                                              \
+  for (int32_t c; (c = 2 * i + 1) < n; i = c) {                               \
+    if ((c + 1 < n) && (a[c + 1].v > a[c].v)) c++;                            \
+    if (a[c].v <= x) break;                                                   \
+    a[i].v = a[c].v;                                                          \
+  }                                                                           \
+                                                                              \
+  a[i].v = x;                                                                 \
+}                                                                             \
+                                                                              \
+PRIVATE void name ## _heapsort(elem * a, int32_t n)                           \
+{                                                                             \
+  for (int32_t i = n / 2 - 1; i >= 0; i--) name ## _sift(a, i, n);            \
+                                                                              \
+  for (int32_t i = n - 1; i > 0; i--) {                                       \
+    type x = a[0].v; a[0].v = a[i].v; a[i].v = x;                             \
+    name ## _sift(a, 0, i);                                                   \
+  }                                                                           \
+}                                                                             \
+                                                                              \
+PRIVATE void name ## _sort(elem * a, int32_t n, int depth)                    \
+{                                                                             \
+  while (n > SORT_THRESHOLD) {                                                \
+    if (depth-- == 0) {                                                       \
+      name ## _heapsort(a, n);                                                \
+      return;                                                                 \
+    }                                                                         \
+                                                                              \
+    type x = a[0].v, y = a[n / 2].v, z = a[n - 1].v;                          \
+    type m = (x < y) ? ((y < z) ? y : ((x < z) ? z : x))                      \
+                     : ((x < z) ? x : ((y < z) ? z : y));                     \
+    int32_t i = -1, j = n;                                                    \
+                                                                              \
+    for (;;) {                                                                \
+      do i++; while (a[i].v < m);                                             \
+      do j--; while (a[j].v > m);                                             \
+      if (i >= j) break;                                                      \
+      type t = a[i].v; a[i].v = a[j].v; a[j].v = t;                           \
+    }                                                                         \
+                                                                              \
+    if (j + 1 < n - j - 1) {                                                  \
+      name ## _sort(a, j + 1, depth);                                         \
+      a += j + 1;                                                             \
+      n -= j + 1;                                                             \
+    }                                                                         \
+    else {                                                                    \
+      name ## _sort(a + j + 1, n - j - 1, depth);                             \
+      n = j + 1;                                                              \
+    }                                                                         \
+  }                                                                           \
+                                                                              \
+  for (int32_t i = 1; i < n; i++) {                                           \
+    type x = a[i].v;                                                          \
+    int32_t j = i;                                                            \
+    for (; (j > 0) && (a[j - 1].v > x); j--) a[j].v = a[j - 1].v;             \
+    a[j].v = x;                                                               \
+  }                                                                           \
+}                                                                             \
+                                                                              \
+PRIVATE void name ## _reverse(elem * a, int32_t n)                            \
+{                                                                             \
+  for (int32_t i = 0, j = n - 1; i < j; i++, j--) {                           \
+    type t = a[i].v; a[i].v = a[j].v; a[j].v = t;                             \
+  }                                                                           \
+}
+
+SORT_FUNCTIONS(u8,  u8_elem,  uint8_t)
+SORT_FUNCTIONS(s16, s16_elem, int16_t)
+SORT_FUNCTIONS(s32, s32_elem, int32_t)
+
+PRIVATE int sort_depth(int32_t n)
+{
+  int depth = 0;
+
+  while (n > 1) { n >>= 1; depth += 2; }
+
+  return depth;
+}
+
+// ----- Primitives -----
+
+PRIMITIVE(#%make-numvector, make_numvector, 3, 90)
+{
+  /* reg1 is the kind (1: s16, 2: s32), reg2 the length and reg3 the
+     initial value of the elements */
+  decode_2_int_args();
+  vm->a3 = decode_int(vm->reg3);
+
+  if (((vm->a1 != VECTOR_S16) && (vm->a1 != VECTOR_S32)) ||
+      (vm->a2 < 0) || ((vm->a2 * ELEMENT_SIZE(vm->a1)) > UINT16_MAX)) {
+    ERROR("make-numvector", "kind or length out of range");
+    vm->reg1 = FALSE;
+  }
+  else {
+    vm->reg1 = new_vector(vm->a2 * ELEMENT_SIZE(vm->a1));
+    RAM_SET_VECTOR_KIND(vm->reg1, vm->a1);
+
+    void * data = &VECTOR_GET_BYTE(RAM_GET_VECTOR_START(vm->reg1), 0);
+
+    for (int32_t i = 0; i < vm->a2; i++) {
+      if (vm->a1 == VECTOR_S16) ((s16_elem *) data)[i].v = SAT16(vm->a3);
+      else                      ((s32_elem *) data)[i].v = vm->a3;
+    }
+  }
+
+  vm->reg2 = vm->reg3 = NIL;
+}
+
+PRIMITIVE(#%numvector-kind, numvector_kind, 1, 91)
+{
+  if (IN_RAM(vm->reg1) && RAM_IS_VECTOR(vm->reg1) &&
+      ((RAM_GET_VECTOR_KIND(vm->reg1) == VECTOR_S16) || (RAM_GET_VECTOR_KIND(vm->reg1) == VECTOR_S32))) {
+    vm->reg1 = encode_int(RAM_GET_VECTOR_KIND(vm->reg1));
+  }
+  else {
+    vm->reg1 = FALSE;
+  }
+}
+
+PRIMITIVE(numvector-length, numvector_length, 1, 92)
+{
+  uint8_t kind = VECTOR_U8;
+  int32_t length;
+
+  vm->reg1 = (numvector_data(vm->reg1, &kind, &length) == NULL) ? FALSE : encode_int(length);
+}
+
+PRIMITIVE(numvector-ref, numvector_ref, 2, 93)
+{
+  uint8_t kind = VECTOR_U8;
+  int32_t length;
+  void  * data = numvector_data(vm->reg1, &kind, &length);
+
+  vm->a2 = decode_int(vm->reg2);
+
+  if (data == NULL) {
+    vm->reg1 = FALSE;
+  }
+  else if ((vm->a2 < 0) || (vm->a2 >= length)) {
+    ERROR("numvector-ref", "Vector index invalid");
+    vm->reg1 = FALSE;
+  }
+  else {
+    vm->reg1 = encode_int32((kind == VECTOR_S16) ? ((s16_elem *) data)[vm->a2].v : ((s32_elem *) data)[vm->a2].v);
+  }
+
+  vm->reg2 = NIL;
+}
+
+PRIMITIVE_UNSPEC(numvector-set!, numvector_set, 3, 94)
+{
+  uint8_t kind = VECTOR_U8;
+  int32_t length;
+  void  * data = numvector_data(vm->reg1, &kind, &length);
+
+  vm->a2 = decode_int(vm->reg2);
+  vm->a3 = decode_int(vm->reg3);
+
+  if ((data != NULL) && ((vm->a2 < 0) || (vm->a2 >= length))) {
+    ERROR("numvector-set!", "Vector index invalid");
+  }
+  else if (data != NULL) {
+    if (kind == VECTOR_S16) ((s16_elem *) data)[vm->a2].v = SAT16(vm->a3);
+    else                    ((s32_elem *) data)[vm->a2].v = vm->a3;
+  }
+
+  vm->reg1 = vm->reg2 = vm->reg3 = NIL;
+}
+
+/** numvector_args().
+
+  Gets the elements of the vectors d (destination) and a, and of b if not
+  NIL, all of the same kind and length. Returns false if they are not.
+
+ */
+
+PRIVATE bool numvector_args(cell_p d, cell_p a, cell_p b,
+                            uint8_t * kind, void ** dd, void ** da, void ** db, int32_t * n)
+{
+  int32_t la, lb;
+
+  *kind = VECTOR_U8;
+
+  if (((*dd = numvector_data(d, kind, n))   == NULL) ||
+      ((*da = numvector_data(a, kind, &la)) == NULL)) {
+    return false;
+  }
+
+  lb = la;
+  if ((b != NIL) && ((*db = numvector_data(b, kind, &lb)) == NULL)) {
+    return false;
+  }
+
+  if ((*n != la) || (la != lb)) {
+    ERROR("numvector", "Vector lengths differ");
+    return false;
+  }
+
+  return true;
+}
+
+PRIVATE int shift_arg(cell_p s)
+{
+  int32_t shift = decode_int(s);
+
+  if ((shift < 0) || (shift > 31)) {
+    ERROR("numvector", "shift out of range");
+    shift = 0;
+  }
+
+  return shift;
+}
+
+PRIMITIVE_UNSPEC(numvector-add!, numvector_add, 3, 95)
+{
+  /* reg1[i] = reg2[i] + reg3[i] */
+  uint8_t kind;
+  void  * d, * a, * b = NULL;
+  int32_t n;
+
+  if (numvector_args(vm->reg1, vm->reg2, vm->reg3, &kind, &d, &a, &b, &n)) {
+    if (kind == VECTOR_S16) s16_add(d, a, b, n);
+    else                    s32_add(d, a, b, n);
+  }
+
+  vm->reg1 = vm->reg2 = vm->reg3 = NIL;
+}
+
+PRIMITIVE_UNSPEC(numvector-mul!, numvector_mul, 4, 96)
+{
+  /* reg1[i] = (reg2[i] * reg3[i]) >> reg4 */
+  uint8_t kind;
+  void  * d, * a, * b = NULL;
+  int32_t n;
+  int     shift = shift_arg(vm->reg4);
+
+  if (numvector_args(vm->reg1, vm->reg2, vm->reg3, &kind, &d, &a, &b, &n)) {
+    if (kind == VECTOR_S16) s16_mul(d, a, b, n, shift);
+    else                    s32_mul(d, a, b, n, shift);
+  }
+
+  vm->reg1 = vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+}
+
+PRIMITIVE_UNSPEC(numvector-scale!, numvector_scale, 4, 97)
+{
+  /* reg1[i] = (reg2[i] * reg3) >> reg4 */
+  uint8_t kind;
+  void  * d, * a;
+  int32_t n;
+  int     shift = shift_arg(vm->reg4);
+
+  vm->a3 = decode_int(vm->reg3);
+
+  if (numvector_args(vm->reg1, vm->reg2, NIL, &kind, &d, &a, NULL, &n)) {
+    if (kind == VECTOR_S16) s16_scale(d, a, SAT16(vm->a3), n, shift);
+    else                    s32_scale(d, a, vm->a3, n, shift);
+  }
+
+  vm->reg1 = vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+}
+
+PRIMITIVE(numvector-dot, numvector_dot, 2, 98)
+{
+  /* Sum of reg1[i] * reg2[i], saturated to 32 bits */
+  uint8_t kind;
+  void  * a = NULL, * b = NULL;
+  int32_t n;
+
+  if (numvector_args(vm->reg1, vm->reg2, NIL, &kind, &a, &b, NULL, &n)) {
+    int64_t sum = (kind == VECTOR_S16) ? s16_dot(a, b, n) : s32_dot(a, b, n);
+    vm->reg1 = encode_int32(SAT32(sum));
+  }
+  else {
+    vm->reg1 = FALSE;
+  }
+
+  vm->reg2 = NIL;
+}
+
+PRIMITIVE(numvector-sum, numvector_sum, 1, 99)
+{
+  /* Sum of the elements, saturated to 32 bits */
+  uint8_t kind = VECTOR_U8;
+  int32_t n;
+  void  * a = numvector_data(vm->reg1, &kind, &n);
+
+  if (a != NULL) {
+    int64_t sum = (kind == VECTOR_S16) ? s16_sum(a, n) : s32_sum(a, n);
+    vm->reg1 = encode_int32(SAT32(sum));
+  }
+  else {
+    vm->reg1 = FALSE;
+  }
+}
+
+PRIMITIVE(numvector-min, numvector_min, 1, 100)
+{
+  uint8_t kind = VECTOR_U8;
+  int32_t n;
+  void  * a = numvector_data(vm->reg1, &kind, &n);
+
+  if ((a != NULL) && (n > 0)) {
+    vm->reg1 = encode_int32((kind == VECTOR_S16) ? s16_min(a, n) : s32_min(a, n));
+  }
+  else {
+    vm->reg1 = FALSE;
+  }
+}
+
+PRIMITIVE(numvector-max, numvector_max, 1, 101)
+{
+  uint8_t kind = VECTOR_U8;
+  int32_t n;
+  void  * a = numvector_data(vm->reg1, &kind, &n);
+
+  if ((a != NULL) && (n > 0)) {
+    vm->reg1 = encode_int32((kind == VECTOR_S16) ? s16_max(a, n) : s32_max(a, n));
+  }
+  else {
+    vm->reg1 = FALSE;
+  }
+}
+
+PRIMITIVE_UNSPEC(numvector-fir!, numvector_fir, 4, 102)
+{
+  /* FIR filter: reg1[i] = (sum of reg3[k] * reg2[i + k]) >> reg4, for the
+     n - m + 1 first elements of reg1, n and m being the lengths of the
+     signal reg2 and of the coefficients reg3. */
+  uint8_t kind = VECTOR_U8;
+  int32_t ld, n, m;
+  void  * d, * x, * c;
+  int     shift = shift_arg(vm->reg4);
+
+  if (((d = numvector_data(vm->reg1, &kind, &ld)) != NULL) &&
+      ((x = numvector_data(vm->reg2, &kind, &n))  != NULL) &&
+      ((c = numvector_data(vm->reg3, &kind, &m))  != NULL)) {
+    if ((m == 0) || (m > n) || (ld < (n - m + 1))) {
+      ERROR("numvector-fir!", "Vector lengths invalid");
+    }
+    else if (kind == VECTOR_S16) {
+      for (int32_t i = 0; i <= (n - m); i++) {
+        int64_t y = s16_dot(((s16_elem *) x) + i, c, m) >> shift;
+        ((s16_elem *) d)[i].v = SAT16(y);
+      }
+    }
+    else {
+      for (int32_t i = 0; i <= (n - m); i++) {
+        int64_t y = s32_dot(((s32_elem *) x) + i, c, m) >> shift;
+        ((s32_elem *) d)[i].v = SAT32(y);
+      }
+    }
+  }
+
+  vm->reg1 = vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+}
+
+PRIMITIVE_UNSPEC(#%vector-sort!, vector_sort, 2, 119)
+{
+  /* reg1 is a u8vector, s16vector or s32vector sorted in place, reg2 is
+     true for the descending order */
+  if (!((IN_RAM(vm->reg1)) && RAM_IS_VECTOR(vm->reg1) && (RAM_GET_VECTOR_KIND(vm->reg1) != VECTOR_TABLE))) {
+    TYPE_ERROR("vector-sort!", "u8vector, s16vector or s32vector");
+  }
+  else {
+    void  * data = &VECTOR_GET_BYTE(RAM_GET_VECTOR_START(vm->reg1), 0);
+    int32_t n    = RAM_GET_VECTOR_LENGTH(vm->reg1);
+
+    switch (RAM_GET_VECTOR_KIND(vm->reg1)) {
+      case VECTOR_U8:
+        u8_sort(data, n, sort_depth(n));
+        if (vm->reg2 != FALSE) u8_reverse(data, n);
+        break;
+      case VECTOR_S16:
+        n /= 2;
+        s16_sort(data, n, sort_depth(n));
+        if (vm->reg2 != FALSE) s16_reverse(data, n);
+        break;
+      default:
+        n /= 4;
+        s32_sort(data, n, sort_depth(n));
+        if (vm->reg2 != FALSE) s32_reverse(data, n);
+        break;
+    }
+  }
+
+  vm->reg1 = vm->reg2 = NIL;
+}
+
+#if TESTS
+#define S16(v) ((s16_elem *) &VECTOR_GET_BYTE(RAM_GET_VECTOR_START(v), 0))
+#define S32(v) ((s32_elem *) &VECTOR_GET_BYTE(RAM_GET_VECTOR_START(v), 0))
+
+PRIVATE cell_p numvector_test_new(uint8_t kind, int32_t length, int32_t step)
+{
+  vm->reg1 = encode_int(kind); vm->reg2 = encode_int(length); vm->reg3 = ZERO;
+  primitive_make_numvector();
+
+  for (int32_t i = 0; i < length; i++) {
+    if (kind == VECTOR_S16) S16(vm->reg1)[i].v = i * step;
+    else                    S32(vm->reg1)[i].v = i * step;
+  }
+
+  return vm->reg1;
+}
+
+void primitives_numvector_tests()
+{
+  cell_p a, b;
+  bool ok;
+
+  TESTM("primitives-numvector");
+
+  // The vectors are kept on the stack (GC roots)
+
+  TEST("Make, ref and set!");
+
+    vm->reg1 = encode_int(VECTOR_S16); vm->reg2 = encode_int(20); vm->reg3 = encode_int(-3);
+    primitive_make_numvector();
+    vm->env = new_pair(vm->reg1, NIL);
+
+    primitive_numvector_length();
+    EXPECT_TRUE(vm->reg1 == encode_int(20), "s16vector length is wrong");
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = encode_int(19);
+    primitive_numvector_ref();
+    EXPECT_TRUE(decode_int(vm->reg1) == -3, "s16vector not initialized");
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = encode_int(4); vm->reg3 = encode_int(-30000);
+    primitive_numvector_set();
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = encode_int(4);
+    primitive_numvector_ref();
+    EXPECT_TRUE(decode_int(vm->reg1) == -30000, "s16vector-set! not working");
+
+    EXPECT_TRUE(!RAM_IS_U8VECTOR(RAM_GET_CAR(vm->env)), "s16vector recognised as a u8vector");
+
+    vm->reg1 = RAM_GET_CAR(vm->env);
+    primitive_numvector_kind();
+    EXPECT_TRUE(vm->reg1 == encode_int(VECTOR_S16), "s16vector kind is wrong");
+
+  TEST("s16 kernels");
+
+    vm->env = new_pair(numvector_test_new(VECTOR_S16, 21, 1000), vm->env);
+    a = RAM_GET_CAR(vm->env);
+    vm->env = new_pair(numvector_test_new(VECTOR_S16, 21, -2), vm->env);
+    b = RAM_GET_CAR(vm->env);
+    vm->env = new_pair(numvector_test_new(VECTOR_S16, 21, 0), vm->env);
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = a; vm->reg3 = a;
+    primitive_numvector_add();
+    EXPECT_TRUE((S16(RAM_GET_CAR(vm->env))[10].v == 20000) && (S16(RAM_GET_CAR(vm->env))[20].v == INT16_MAX),
+                "s16 add not saturated");
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = a; vm->reg3 = b; vm->reg4 = encode_int(1);
+    primitive_numvector_mul();
+    EXPECT_TRUE((S16(RAM_GET_CAR(vm->env))[3].v == -9000) && (S16(RAM_GET_CAR(vm->env))[20].v == INT16_MIN),
+                "s16 mul not right");
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = a; vm->reg3 = encode_int(-4); vm->reg4 = encode_int(2);
+    primitive_numvector_scale();
+    EXPECT_TRUE((S16(RAM_GET_CAR(vm->env))[17].v == -17000), "s16 scale not right");
+
+    vm->reg1 = a; vm->reg2 = b;
+    primitive_numvector_dot();
+    EXPECT_TRUE(decode_int(vm->reg1) == -5740000, "s16 dot product not right");
+
+    vm->reg1 = a;
+    primitive_numvector_sum();
+    EXPECT_TRUE(decode_int(vm->reg1) == 210000, "s16 sum not right");
+
+    vm->reg1 = b;
+    primitive_numvector_min();
+    EXPECT_TRUE(decode_int(vm->reg1) == -40, "s16 min not right");
+
+    vm->reg1 = b;
+    primitive_numvector_max();
+    EXPECT_TRUE(vm->reg1 == ZERO, "s16 max not right");
+
+    vm->reg1 = numvector_test_new(VECTOR_S16, 3, 0);
+    S16(vm->reg1)[0].v = 1; S16(vm->reg1)[1].v = 2; S16(vm->reg1)[2].v = 1;
+    vm->reg3 = vm->reg1; vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = b; vm->reg4 = encode_int(2);
+    primitive_numvector_fir();
+    EXPECT_TRUE((S16(RAM_GET_CAR(vm->env))[0].v == -2) && (S16(RAM_GET_CAR(vm->env))[18].v == -38),
+                "s16 FIR filter not right");
+
+  TEST("s32 kernels");
+
+    vm->env = new_pair(numvector_test_new(VECTOR_S32, 10, 100000), vm->env);
+    a = RAM_GET_CAR(vm->env);
+    vm->env = new_pair(numvector_test_new(VECTOR_S32, 10, 0), vm->env);
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = a; vm->reg3 = a; vm->reg4 = ZERO;
+    primitive_numvector_mul();
+    EXPECT_TRUE((S32(RAM_GET_CAR(vm->env))[9].v == INT32_MAX), "s32 mul not saturated");
+
+    vm->reg1 = a; vm->reg2 = a;
+    primitive_numvector_dot();
+    EXPECT_TRUE(decode_int(vm->reg1) == INT32_MAX, "s32 dot product not saturated");
+
+    vm->reg1 = a;
+    primitive_numvector_sum();
+    EXPECT_TRUE(decode_int(vm->reg1) == 4500000, "s32 sum not right");
+
+    vm->reg1 = a;
+    primitive_numvector_max();
+    EXPECT_TRUE(decode_int(vm->reg1) == 900000, "s32 max not right");
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = a; vm->reg3 = RAM_GET_CAR(RAM_GET_CDR(RAM_GET_CDR(vm->env)));
+    primitive_numvector_add();
+    EXPECT_TRUE(S32(RAM_GET_CAR(vm->env))[9].v == INT32_MAX, "Vectors of different kinds accepted");
+
+  TEST("Unaligned elements");
+
+    // The elements of a vector start at byte 5 * start of the vector heap:
+    // with an odd start, they are aligned neither on 2 nor on 4 bytes. The
+    // vectors below take 3 cells with their header, such that their starts
+    // alternate between odd and even.
+
+    for (int i = 0; i < 2; i++) {
+      vm->env = new_pair(numvector_test_new(VECTOR_S32, 2, -70000), vm->env);
+      a = RAM_GET_CAR(vm->env);
+      if (RAM_GET_VECTOR_START(a) & 1) break;
+    }
+
+    vm->reg1 = a; vm->reg2 = encode_int(1); vm->reg3 = encode_int32(-123456);
+    primitive_numvector_set();
+    vm->reg1 = a; vm->reg2 = a; vm->reg3 = a;
+    primitive_numvector_add();
+    vm->reg1 = a; vm->reg2 = encode_int(1);
+    primitive_numvector_ref();
+    EXPECT_TRUE((RAM_GET_VECTOR_START(a) & 1) && (decode_int(vm->reg1) == -246912),
+                "Unaligned s32 elements not right");
+
+    vm->reg1 = a;
+    primitive_numvector_sum();
+    EXPECT_TRUE(decode_int(vm->reg1) == -246912, "Unaligned s32 sum not right");
+
+    for (int i = 0; i < 2; i++) {
+      vm->env = new_pair(numvector_test_new(VECTOR_S16, 3, -5), vm->env);
+      b = RAM_GET_CAR(vm->env);
+      if (RAM_GET_VECTOR_START(b) & 1) break;
+    }
+
+    vm->reg1 = b; vm->reg2 = b; vm->reg3 = encode_int(3); vm->reg4 = ZERO;
+    primitive_numvector_scale();
+    vm->reg1 = b;
+    primitive_numvector_min();
+    EXPECT_TRUE((RAM_GET_VECTOR_START(b) & 1) && (decode_int(vm->reg1) == -30),
+                "Unaligned s16 elements not right");
+
+  TEST("Sort");
+
+    // Values in [-500, 500) in a scrambled order, more than the insertion
+    // sort threshold. A depth of 0 forces the heapsort.
+
+    vm->env = new_pair(numvector_test_new(VECTOR_S16, 1000, 0), vm->env);
+    a = RAM_GET_CAR(vm->env);
+    for (int32_t i = 0; i < 1000; i++) S16(a)[i].v = ((i * 7919) % 1000) - 500;
+
+    vm->reg1 = a; vm->reg2 = FALSE; primitive_vector_sort();
+    ok = true;
+    for (int32_t i = 0; i < 1000; i++) ok = ok && (S16(a)[i].v == i - 500);
+    EXPECT_TRUE(ok, "s16vector not sorted");
+
+    vm->reg1 = a; vm->reg2 = TRUE; primitive_vector_sort();
+    EXPECT_TRUE((S16(a)[0].v == 499) && (S16(a)[999].v == -500), "s16vector not sorted in descending order");
+
+    for (int32_t i = 0; i < 1000; i++) S16(a)[i].v = (i * 7919) % 1000;
+    s16_sort(S16(a), 1000, 0);
+    ok = true;
+    for (int32_t i = 0; i < 1000; i++) ok = ok && (S16(a)[i].v == i);
+    EXPECT_TRUE(ok, "Heapsort not right");
+
+    b = numvector_test_new(VECTOR_S32, 5, -100000);
+    vm->reg1 = b; vm->reg2 = FALSE; primitive_vector_sort();
+    EXPECT_TRUE((S32(b)[0].v == -400000) && (S32(b)[4].v == 0), "s32vector not sorted");
+
+    vm->reg1 = new_vector(40);
+    for (int32_t i = 0; i < 40; i++) VECTOR_GET_BYTE(RAM_GET_VECTOR_START(vm->reg1), i) = 39 - i;
+    a = vm->reg1; vm->reg2 = FALSE; primitive_vector_sort();
+    EXPECT_TRUE((VECTOR_GET_BYTE(RAM_GET_VECTOR_START(a), 0) == 0) &&
+                (VECTOR_GET_BYTE(RAM_GET_VECTOR_START(a), 39) == 39),
+                "u8vector not sorted");
+
+  vm->env = NIL;
+  vm->reg1 = vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+  mm_gc();
+}
+#endif
@@ -0,0 +1,326 @@
+// primitives-socket
+// Builtin Indexes: 64..74
+
+#include "esp32-scheme-vm.h"
+#include "vm-arch.h"
+#include "mm.h"
+#include "testing.h"
+
+#include "primitives.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/** Sockets.
+
+  TCP and UDP sockets are identified by their file descriptor. Data is
+  received into and sent from a range of a u8vector, directly in the vector
+  heap. In non-blocking mode, an operation that would block returns -1: the
+  task can then wait for the socket with fd-wait. Other errors return #f.
+
+  An address is a u8vector of 4 bytes (IPv4), or #f for any address.
+
+ */
+
+#define SOCKET_TCP 1
+#define SOCKET_UDP 2
+
+PRIVATE cell_p socket_result(int32_t result)
+{
+  if (result >= 0) {
+    return encode_int(result);
+  }
+  else if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINPROGRESS)) {
+    return encode_int(-1);
+  }
+  else {
+    return FALSE;
+  }
+}
+
+PRIVATE bool socket_address(struct sockaddr_in * addr, cell_p host, int32_t port)
+{
+  memset(addr, 0, sizeof(struct sockaddr_in));
+
+  addr->sin_family = AF_INET;
+  addr->sin_port   = htons(port);
+
+  if (host == FALSE) {
+    addr->sin_addr.s_addr = htonl(INADDR_ANY);
+  }
+  else {
+    uint8_t * bytes = u8vector_bytes(host, 0, 4);
+
+    if (bytes == NULL) return false;
+
+    memcpy(&addr->sin_addr.s_addr, bytes, 4);
+  }
+
+  return true;
+}
+
+PRIMITIVE(socket, socket, 1, 64)
+{
+  /* reg1 is the type: 1 for TCP, 2 for UDP */
+  vm->a1 = decode_int(vm->reg1);
+
+  if ((vm->a1 != SOCKET_TCP) && (vm->a1 != SOCKET_UDP)) {
+    ERROR("socket", "type out of range");
+    vm->reg1 = FALSE;
+    return;
+  }
+
+  vm->a2 = socket(AF_INET, (vm->a1 == SOCKET_TCP) ? SOCK_STREAM : SOCK_DGRAM, 0);
+
+  if (vm->a2 >= 0) {
+    int on = 1;
+    setsockopt(vm->a2, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  }
+
+  vm->reg1 = socket_result(vm->a2);
+}
+
+PRIMITIVE(socket-bind, socket_bind, 3, 65)
+{
+  /* reg1 is the socket, reg2 the address, reg3 the port */
+  struct sockaddr_in addr;
+
+  vm->a1 = decode_int(vm->reg1);
+
+  if (socket_address(&addr, vm->reg2, decode_int(vm->reg3))) {
+    vm->reg1 = socket_result(bind(vm->a1, (struct sockaddr *) &addr, sizeof(addr)));
+  }
+  else {
+    vm->reg1 = FALSE;
+  }
+
+  vm->reg2 = vm->reg3 = NIL;
+}
+
+PRIMITIVE(socket-listen, socket_listen, 2, 66)
+{
+  decode_2_int_args();
+
+  vm->reg1 = socket_result(listen(vm->a1, vm->a2));
+  vm->reg2 = NIL;
+}
+
+PRIMITIVE(socket-accept, socket_accept, 1, 67)
+{
+  vm->reg1 = socket_result(accept(decode_int(vm->reg1), NULL, NULL));
+}
+
+PRIMITIVE(socket-connect, socket_connect, 3, 68)
+{
+  /* reg1 is the socket, reg2 the address, reg3 the port */
+  struct sockaddr_in addr;
+
+  vm->a1 = decode_int(vm->reg1);
+
+  if (socket_address(&addr, vm->reg2, decode_int(vm->reg3))) {
+    vm->reg1 = socket_result(connect(vm->a1, (struct sockaddr *) &addr, sizeof(addr)));
+  }
+  else {
+    vm->reg1 = FALSE;
+  }
+
+  vm->reg2 = vm->reg3 = NIL;
+}
+
+PRIMITIVE(socket-recv, socket_recv, 4, 69)
+{
+  /* reg1 is the socket, data is received in the range reg3..reg4 of the
+     u8vector reg2. The result is the number of bytes received, 0 at the
+     end of the stream. */
+  vm->a1 = decode_int(vm->reg1);
+  vm->a2 = decode_int(vm->reg3);
+  vm->a3 = decode_int(vm->reg4);
+
+  uint8_t * bytes = u8vector_bytes(vm->reg2, vm->a2, vm->a3);
+
+  vm->reg1 = (bytes == NULL) ? FALSE : socket_result(recv(vm->a1, bytes, vm->a3 - vm->a2, 0));
+  vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+}
+
+PRIMITIVE(socket-send, socket_send, 4, 70)
+{
+  /* reg1 is the socket, the range reg3..reg4 of the u8vector reg2 is sent.
+     The result is the number of bytes sent. */
+  vm->a1 = decode_int(vm->reg1);
+  vm->a2 = decode_int(vm->reg3);
+  vm->a3 = decode_int(vm->reg4);
+
+  uint8_t * bytes = u8vector_bytes(vm->reg2, vm->a2, vm->a3);
+
+  vm->reg1 = (bytes == NULL) ? FALSE : socket_result(send(vm->a1, bytes, vm->a3 - vm->a2, MSG_NOSIGNAL));
+  vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+}
+
+PRIMITIVE(#%socket-sendto, socket_sendto, 4, 71)
+{
+  /* reg1 is the UDP socket, the range (car reg3)..(cdr reg3) of the
+     u8vector reg2 is sent to the address (car reg4), port (cdr reg4). The
+     pairs are built by socket-sendto (see library.scm), primitives having
+     at most 4 arguments. */
+  struct sockaddr_in addr;
+  uint8_t * bytes = NULL;
+
+  vm->a1 = decode_int(vm->reg1);
+
+  if (IN_RAM(vm->reg3) && RAM_IS_PAIR(vm->reg3) && IN_RAM(vm->reg4) && RAM_IS_PAIR(vm->reg4)) {
+    vm->a2 = decode_int(RAM_GET_CAR(vm->reg3));
+    vm->a3 = decode_int(RAM_GET_CDR(vm->reg3));
+
+    if (socket_address(&addr, RAM_GET_CAR(vm->reg4), decode_int(RAM_GET_CDR(vm->reg4)))) {
+      bytes = u8vector_bytes(vm->reg2, vm->a2, vm->a3);
+    }
+  }
+  else {
+    TYPE_ERROR("#%socket-sendto", "pair");
+  }
+
+  vm->reg1 = (bytes == NULL) ? FALSE : socket_result(sendto(vm->a1, bytes, vm->a3 - vm->a2, 0,
+                                                        (struct sockaddr *) &addr, sizeof(addr)));
+  vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+}
+
+PRIMITIVE(socket-close, socket_close, 1, 72)
+{
+  vm->reg1 = socket_result(close(decode_int(vm->reg1)));
+}
+
+PRIMITIVE(socket-set-nonblocking!, socket_set_nonblocking, 2, 73)
+{
+  /* reg1 is the socket, reg2 is true for non-blocking mode */
+  vm->a1 = decode_int(vm->reg1);
+  vm->a2 = fcntl(vm->a1, F_GETFL, 0);
+
+  if (vm->a2 >= 0) {
+    vm->a2 = (vm->reg2 == FALSE) ? (vm->a2 & ~O_NONBLOCK) : (vm->a2 | O_NONBLOCK);
+    vm->a2 = fcntl(vm->a1, F_SETFL, vm->a2);
+  }
+
+  vm->reg1 = socket_result(vm->a2);
+  vm->reg2 = NIL;
+}
+
+PRIMITIVE(socket-local-port, socket_local_port, 1, 74)
+{
+  struct sockaddr_in addr;
+  socklen_t length = sizeof(addr);
+
+  vm->a1 = getsockname(decode_int(vm->reg1), (struct sockaddr *) &addr, &length);
+
+  vm->reg1 = socket_result((vm->a1 < 0) ? vm->a1 : ntohs(addr.sin_port));
+}
+
+#if TESTS
+void primitives_socket_tests()
+{
+  cell_p server, client, conn, loopback;
+  int32_t port;
+
+  TESTM("primitives-socket");
+
+  TEST("TCP over loopback");
+
+    // The address and the receive buffer are kept on the stack (GC roots)
+
+    vm->env = new_pair(new_vector(10), NIL);
+    vm->env = new_pair(new_vector(4), vm->env);
+    loopback = RAM_GET_CAR(vm->env);
+    memcpy(u8vector_bytes(loopback, 0, 4), "\x7F\x00\x00\x01", 4);
+
+    vm->reg1 = encode_int(SOCKET_TCP); primitive_socket(); server = vm->reg1;
+    EXPECT_TRUE(server != FALSE, "Unable to create a TCP socket");
+
+    vm->reg1 = server; vm->reg2 = loopback; vm->reg3 = encode_int(0); primitive_socket_bind();
+    EXPECT_TRUE(vm->reg1 == ZERO, "Unable to bind a TCP socket");
+
+    vm->reg1 = server; vm->reg2 = encode_int(4); primitive_socket_listen();
+    EXPECT_TRUE(vm->reg1 == ZERO, "Unable to listen");
+
+    vm->reg1 = server; primitive_socket_local_port(); port = decode_int(vm->reg1);
+    EXPECT_TRUE(port > 0, "Unable to get the local port");
+
+    vm->reg1 = encode_int(SOCKET_TCP); primitive_socket(); client = vm->reg1;
+    vm->reg1 = client; vm->reg2 = loopback; vm->reg3 = encode_int(port); primitive_socket_connect();
+    EXPECT_TRUE(vm->reg1 == ZERO, "Unable to connect");
+
+    vm->reg1 = server; primitive_socket_accept(); conn = vm->reg1;
+    EXPECT_TRUE(decode_int(conn) >= 0, "Unable to accept a connection");
+
+    vm->reg2 = new_vector(5);
+    memcpy(u8vector_bytes(vm->reg2, 0, 5), "hello", 5);
+    vm->reg1 = client; vm->reg3 = encode_int(1); vm->reg4 = encode_int(5);
+    primitive_socket_send();
+    EXPECT_TRUE(vm->reg1 == encode_int(4), "Range of the u8vector not sent");
+
+    vm->reg2 = RAM_GET_CAR(RAM_GET_CDR(vm->env));
+    vm->reg1 = conn; vm->reg3 = encode_int(2); vm->reg4 = encode_int(10);
+    primitive_socket_recv();
+    EXPECT_TRUE(vm->reg1 == encode_int(4), "Data not received");
+    EXPECT_TRUE(memcmp(u8vector_bytes(RAM_GET_CAR(RAM_GET_CDR(vm->env)), 2, 6), "ello", 4) == 0,
+                "Data not received in the u8vector range");
+
+    vm->reg1 = conn; vm->reg2 = TRUE; primitive_socket_set_nonblocking();
+    vm->reg1 = conn; vm->reg2 = RAM_GET_CAR(RAM_GET_CDR(vm->env)); vm->reg3 = encode_int(0); vm->reg4 = encode_int(10);
+    primitive_socket_recv();
+    EXPECT_TRUE(vm->reg1 == encode_int(-1), "Non-blocking receive blocked");
+
+    vm->reg1 = conn; vm->reg2 = RAM_GET_CAR(RAM_GET_CDR(vm->env)); vm->reg3 = encode_int(8); vm->reg4 = encode_int(12);
+    primitive_socket_recv();
+    EXPECT_TRUE(vm->reg1 == FALSE, "Invalid u8vector range accepted");
+
+    vm->reg1 = client; primitive_socket_close();
+    vm->reg1 = conn; vm->reg2 = FALSE; primitive_socket_set_nonblocking();
+    vm->reg1 = conn; vm->reg2 = RAM_GET_CAR(RAM_GET_CDR(vm->env)); vm->reg3 = encode_int(0); vm->reg4 = encode_int(10);
+    primitive_socket_recv();
+    EXPECT_TRUE(vm->reg1 == ZERO, "End of stream not received");
+
+    vm->reg1 = conn;   primitive_socket_close();
+    vm->reg1 = server; primitive_socket_close();
+    EXPECT_TRUE(vm->reg1 == ZERO, "Unable to close a socket");
+
+  TEST("UDP over loopback");
+
+    vm->reg1 = encode_int(SOCKET_UDP); primitive_socket(); server = vm->reg1;
+    vm->reg1 = server; vm->reg2 = loopback; vm->reg3 = encode_int(0); primitive_socket_bind();
+    vm->reg1 = server; primitive_socket_local_port(); port = decode_int(vm->reg1);
+
+    vm->reg1 = encode_int(SOCKET_UDP); primitive_socket(); client = vm->reg1;
+
+    // new_vector() uses reg4: the vector is allocated first
+
+    vm->reg2 = new_vector(5);
+    memcpy(u8vector_bytes(vm->reg2, 0, 5), "xabcx", 5);
+    vm->reg3 = new_pair(encode_int(1), encode_int(4));
+    vm->reg4 = new_pair(loopback, encode_int(port));
+    vm->env  = new_pair(vm->reg2, vm->env);
+    vm->reg1 = client;
+    primitive_socket_sendto();
+    EXPECT_TRUE(vm->reg1 == encode_int(3), "Datagram not sent");
+
+    vm->reg2 = RAM_GET_CAR(vm->env);
+    vm->reg3 = new_pair(encode_int(2), encode_int(6));
+    vm->reg4 = new_pair(loopback, encode_int(port));
+    vm->reg1 = client;
+    primitive_socket_sendto();
+    EXPECT_TRUE(vm->reg1 == FALSE, "Invalid u8vector range sent");
+
+    vm->reg1 = server; vm->reg2 = RAM_GET_CAR(RAM_GET_CDR(RAM_GET_CDR(vm->env))); vm->reg3 = encode_int(0); vm->reg4 = encode_int(10);
+    primitive_socket_recv();
+    EXPECT_TRUE(vm->reg1 == encode_int(3), "Datagram not received");
+    EXPECT_TRUE(memcmp(u8vector_bytes(RAM_GET_CAR(RAM_GET_CDR(RAM_GET_CDR(vm->env))), 0, 3), "abc", 3) == 0,
+                "Datagram content");
+
+    vm->reg1 = client; primitive_socket_close();
+    vm->reg1 = server; primitive_socket_close();
+
+  vm->env = NIL;
+  vm->reg1 = vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+  mm_gc();
+}
+#endif
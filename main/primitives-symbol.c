@@ -0,0 +1,257 @@
+// primitives-symbol
+// Builtin Indexes: 57..58
+
+#include "esp32-scheme-vm.h"
+#include "vm-arch.h"
+#include "mm.h"
+#include "testing.h"
+#include "tables.h"
+
+#include "primitives.h"
+
+/** Symbols.
+
+  The names of the ROM symbols are null terminated strings in the symbol
+  names pool of the program. string->symbol first looks for the name in
+  the intern table, an equal? hash table (see primitives-table.c) mapping
+  names to symbols. When not found, the ROM symbols are searched and, as a
+  last resort, a RAM symbol is created. The result is added to the intern
+  table, such that a name is searched only once in the ROM symbols.
+
+  Strings being mutable, the intern table keys and the names of the RAM
+  symbols are copies of the string given to string->symbol, and
+  symbol->string returns a copy of the name of a RAM symbol: a string-set!
+  on any of these strings can't rename a symbol or corrupt the table.
+
+  A symbol being unique for its name, symbols are still compared with eq?.
+  The intern table is a GC root: symbols created at runtime are never
+  reclaimed.
+
+ */
+
+PRIVATE bool symbol_p(cell_p p)
+{
+  return ((IN_RAM(p)) && RAM_IS_SYMBOL(p)) || ((IN_ROM(p)) && ROM_IS_SYMBOL(p));
+}
+
+/** same_name().
+
+  Returns true if the characters of the list chars are the ones of the
+  null terminated string name.
+
+ */
+
+PRIVATE bool same_name(cell_p chars, const char * name)
+{
+  for (; *name && (chars != NIL); name++) {
+    cell_p c = IN_RAM(chars) ? RAM_GET_CAR(chars) : ROM_GET_CAR(chars);
+
+    if (decode_int(c) != (uint8_t) *name) return false;
+
+    chars = IN_RAM(chars) ? RAM_GET_CDR(chars) : ROM_GET_CDR(chars);
+  }
+
+  return (*name == 0) && (chars == NIL);
+}
+
+/** rom_symbol().
+
+  Returns the ROM symbol having the characters of the list chars as name,
+  NIL if none.
+
+ */
+
+PRIVATE cell_p rom_symbol(cell_p chars)
+{
+  for (int i = 0; i < vm->program[2]; i++) {
+    cell_p p = ROM_START_ADDR + i;
+
+    if (ROM_IS_SYMBOL(p) && ROM_IS_NAMED_SYMBOL(p) && same_name(chars, ROM_GET_SYMBOL_NAME(p))) {
+      return p;
+    }
+  }
+
+  return NIL;
+}
+
+/** name_to_string().
+
+  Returns a new string with the characters of name. The characters list
+  is kept in reg4 while allocating.
+
+ */
+
+PRIVATE cell_p name_to_string(const char * name)
+{
+  vm->reg4 = NIL;
+  for (int i = strlen(name) - 1; i >= 0; i--) vm->reg4 = new_pair(encode_int((uint8_t) name[i]), vm->reg4);
+
+  cell_p p = new_string(vm->reg4);
+  vm->reg4 = NIL;
+
+  return p;
+}
+
+/** copy_string().
+
+  Returns a new string with the characters of the list chars, that must
+  be reachable from a register. The copy is built in reg4.
+
+ */
+
+PRIVATE cell_p copy_string(cell_p chars)
+{
+  cell_p list = NIL;
+  cell_p p;
+
+  vm->reg4 = NIL;
+  while (chars != NIL) {
+    vm->reg4  = new_pair(IN_RAM(chars) ? RAM_GET_CAR(chars) : ROM_GET_CAR(chars), vm->reg4);
+    chars = IN_RAM(chars) ? RAM_GET_CDR(chars) : ROM_GET_CDR(chars);
+  }
+
+  // The cells are new: reversed in place
+  while (vm->reg4 != NIL) {
+    p    = vm->reg4;
+    vm->reg4 = RAM_GET_CDR(p);
+    RAM_SET_CDR(p, list);
+    list = p;
+  }
+
+  vm->reg4 = list;
+  p    = new_string(vm->reg4);
+  vm->reg4 = NIL;
+
+  return p;
+}
+
+PRIMITIVE(string->symbol, string_to_symbol, 1, 57)
+{
+  cell_p chars;
+
+  if      ((IN_RAM(vm->reg1)) && RAM_IS_STRING(vm->reg1)) chars = RAM_STRING_GET_CHARS(vm->reg1);
+  else if ((IN_ROM(vm->reg1)) && ROM_IS_STRING(vm->reg1)) chars = ROM_STRING_GET_CHARS(vm->reg1);
+  else {
+    TYPE_ERROR("string->symbol", "string");
+    return;
+  }
+
+  if (vm->symbols == NIL) vm->symbols = table_new(true);
+
+  vm->reg2 = table_get(vm->symbols, vm->reg1, NIL);
+
+  if (vm->reg2 == NIL) {
+    vm->reg3 = copy_string(chars);
+
+    if ((vm->reg2 = rom_symbol(chars)) == NIL) {
+      vm->reg2 = mm_new_ram_cell();
+
+      RAM_SET_TYPE(vm->reg2, SYMBOL_TYPE);
+      RAM_SET_SYMBOL_NEXT(vm->reg2, NIL);
+      RAM_SET_SYMBOL_NAME(vm->reg2, vm->reg3);
+    }
+
+    table_put(vm->symbols, vm->reg3, vm->reg2);
+  }
+
+  vm->reg1 = vm->reg2;
+  vm->reg2 = vm->reg3 = NIL;
+}
+
+PRIMITIVE(symbol->string, symbol_to_string, 1, 58)
+{
+  if (!symbol_p(vm->reg1)) {
+    TYPE_ERROR("symbol->string", "symbol");
+  }
+  else if (IN_RAM(vm->reg1)) {
+    vm->reg1 = copy_string(RAM_STRING_GET_CHARS(RAM_GET_SYMBOL_NAME(vm->reg1)));
+  }
+  else if (ROM_IS_NAMED_SYMBOL(vm->reg1)) {
+    vm->reg1 = name_to_string(ROM_GET_SYMBOL_NAME(vm->reg1));
+  }
+  else {
+    ERROR("symbol->string", "symbol without a name");
+    vm->reg1 = FALSE;
+  }
+}
+
+#if TESTS
+void primitives_symbol_tests()
+{
+  // One constant, the symbol foo with its name at address 10 of the
+  // program, after the code (halt)
+
+  uint8_t   pgm[14] = { 0xD7, 0xFB, 1, 0, 0xFF, 0xFF, 10, 0, 0x74, 0xC0, 'f', 'o', 'o', 0 };
+  cell_ptr  rom     = vm->rom_heap;
+  uint8_t * pg      = vm->program;
+  cell_p    sym, str;
+
+  vm->rom_heap = (cell_ptr) &pgm[4];
+  vm->program  = pgm;
+
+  TESTM("primitives-symbol");
+
+  TEST("ROM symbols");
+
+    vm->reg1 = ROM_START_ADDR;
+    primitive_symbol_to_string();
+    EXPECT_TRUE((IN_RAM(vm->reg1)) && RAM_IS_STRING(vm->reg1) && same_name(RAM_STRING_GET_CHARS(vm->reg1), "foo"),
+                "ROM symbol name not right");
+
+    primitive_string_to_symbol();
+    EXPECT_TRUE(vm->reg1 == ROM_START_ADDR, "ROM symbol not found by name");
+
+    vm->reg1 = name_to_string("foo");
+    primitive_string_to_symbol();
+    EXPECT_TRUE(vm->reg1 == ROM_START_ADDR, "ROM symbol not found in the intern table");
+
+  TEST("RAM symbols");
+
+    vm->reg1 = name_to_string("bar");
+    primitive_string_to_symbol();
+    sym = vm->reg1;
+    EXPECT_TRUE((IN_RAM(sym)) && RAM_IS_SYMBOL(sym), "RAM symbol not created");
+
+    mm_gc();
+
+    vm->reg1 = name_to_string("bar");
+    primitive_string_to_symbol();
+    EXPECT_TRUE(vm->reg1 == sym, "RAM symbol not unique");
+
+    vm->reg1 = sym;
+    primitive_symbol_to_string();
+    EXPECT_TRUE(same_name(RAM_STRING_GET_CHARS(vm->reg1), "bar"), "RAM symbol name not right");
+
+    vm->reg1 = name_to_string("baz");
+    primitive_string_to_symbol();
+    EXPECT_TRUE((vm->reg1 != sym) && (vm->reg1 != ROM_START_ADDR), "Different names give the same symbol");
+
+  TEST("Mutable strings");
+
+    // string-set! of the strings given to and returned by the primitives
+    vm->reg1 = str = name_to_string("qux");
+    primitive_string_to_symbol();
+    sym = vm->reg1;
+    RAM_SET_CAR(RAM_STRING_GET_CHARS(str), encode_int('k'));
+
+    vm->reg1 = sym;
+    primitive_symbol_to_string();
+    EXPECT_TRUE(same_name(RAM_STRING_GET_CHARS(vm->reg1), "qux"), "Symbol renamed by its string");
+    RAM_SET_CAR(RAM_STRING_GET_CHARS(vm->reg1), encode_int('k'));
+
+    vm->reg1 = name_to_string("qux");
+    primitive_string_to_symbol();
+    EXPECT_TRUE(vm->reg1 == sym, "Symbol not found after its strings changed");
+
+    vm->reg1 = name_to_string("kux");
+    primitive_string_to_symbol();
+    EXPECT_TRUE(vm->reg1 != sym, "Changed string found as the symbol");
+
+  vm->rom_heap = rom;
+  vm->program  = pg;
+
+  vm->symbols = NIL;
+  vm->reg1 = vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+  mm_gc();
+}
+#endif
@@ -0,0 +1,655 @@
+// primitives-table
+// Builtin Indexes: 103..109
+
+#include "esp32-scheme-vm.h"
+#include "vm-arch.h"
+#include "mm.h"
+#include "testing.h"
+
+#define TABLES 1
+#include "tables.h"
+
+#include "primitives.h"
+
+/** Hash Tables.
+
+  eq? tables hash the cell address of the keys: RAM cells never move, such
+  that the GC never requires a rehash. equal? tables hash and compare
+  integers (up to 32 bits) by value, strings by their characters and
+  u8vectors by their bytes. Other keys are compared with eq?.
+
+  A slot key is TABLE_EMPTY if the slot was never used, TABLE_DELETED if
+  its entry was deleted or moved to the new slots. The number of used
+  slots is kept under 3/4 of the capacity.
+
+ */
+
+#define TABLE_EMPTY        ((cell_p) 0xFF01)
+#define TABLE_DELETED      ((cell_p) 0xFF02)
+
+#define TABLE_MIN_CAPACITY 8
+#define TABLE_MAX_CAPACITY 8192   // The vector length is limited to 16 bits
+#define TABLE_MIGRATE_STEP 8      // Old slots moved by each operation
+
+#define TABLE_SIZE(cap)    (sizeof(table_header) + ((cap) * sizeof(table_slot)))
+#define TABLE_HEADER(t)    ((table_header *) &VECTOR_GET_BYTE(RAM_GET_VECTOR_START(t), 0))
+#define TABLE_SLOTS(t)     ((table_slot *) (TABLE_HEADER(t) + 1))
+#define TABLE_LIVE(k)      (((k) != TABLE_EMPTY) && ((k) != TABLE_DELETED))
+
+#define RAM_IS_TABLE(p)    (RAM_IS_VECTOR(p) && (RAM_GET_VECTOR_KIND(p) == VECTOR_TABLE))
+
+PRIVATE cell_p get_car(cell_p p) { return IN_RAM(p) ? RAM_GET_CAR(p) : ROM_GET_CAR(p); }
+PRIVATE cell_p get_cdr(cell_p p) { return IN_RAM(p) ? RAM_GET_CDR(p) : ROM_GET_CDR(p); }
+
+PRIVATE bool is_number(cell_p p)
+{
+  return IS_SMALL_INT(p) ||
+         ((IN_RAM(p)) && RAM_IS_NUMBER(p)) ||
+         ((IN_ROM(p)) && ROM_IS_NUMBER(p));
+}
+
+/** key_chars().
+
+  Returns the list of characters of the string p, or NIL if p is not a
+  string. An empty string is not distinguished from other keys: it is
+  compared with eq?.
+
+ */
+
+PRIVATE cell_p key_chars(cell_p p)
+{
+  if      ((IN_RAM(p)) && RAM_IS_STRING(p)) return RAM_STRING_GET_CHARS(p);
+  else if ((IN_ROM(p)) && ROM_IS_STRING(p)) return ROM_STRING_GET_CHARS(p);
+  else return NIL;
+}
+
+/** key_bytes().
+
+  Returns the length of the u8vector p, or -1 if p is not a u8vector. The
+  bytes are returned in *bytes, or, for a ROM u8vector stored as a list of
+  bytes, the list is returned in *list.
+
+ */
+
+PRIVATE int32_t key_bytes(cell_p p, const uint8_t ** bytes, cell_p * list)
+{
+  *bytes = NULL;
+  *list  = NIL;
+
+  if ((IN_RAM(p)) && RAM_IS_U8VECTOR(p)) {
+    *bytes = &VECTOR_GET_BYTE(RAM_GET_VECTOR_START(p), 0);
+    return RAM_GET_VECTOR_LENGTH(p);
+  }
+  else if ((IN_ROM(p)) && ROM_IS_VECTOR(p)) {
+    if (ROM_IS_PACKED_VECTOR(p)) *bytes = ROM_GET_VECTOR_BYTES(p);
+    else                         *list  = ROM_GET_VECTOR_START(p);
+    return ROM_GET_VECTOR_LENGTH(p);
+  }
+  else {
+    return -1;
+  }
+}
+
+PRIVATE uint8_t next_byte(const uint8_t ** bytes, cell_p * list)
+{
+  if (*bytes != NULL) return *(*bytes)++;
+
+  uint8_t b = decode_int(ROM_GET_CAR(*list));
+  *list = ROM_GET_CDR(*list);
+
+  return b;
+}
+
+/** key_hash().
+
+  Returns the hash value of key. Strings and u8vectors of equal? tables are
+  hashed with FNV-1a.
+
+ */
+
+PRIVATE uint32_t key_hash(cell_p key, bool equal)
+{
+  uint32_t h = key;
+
+  if (equal) {
+    const uint8_t * bytes;
+    cell_p list;
+    int32_t length;
+
+    if (is_number(key)) {
+      h = decode_int(key);
+    }
+    else if ((list = key_chars(key)) != NIL) {
+      h = 2166136261u;
+      for (; list != NIL; list = get_cdr(list)) h = (h ^ decode_int(get_car(list))) * 16777619u;
+    }
+    else if ((length = key_bytes(key, &bytes, &list)) >= 0) {
+      h = 2166136261u;
+      while (length--) h = (h ^ next_byte(&bytes, &list)) * 16777619u;
+    }
+  }
+
+  h *= 0x9E3779B1u;
+
+  return h ^ (h >> 16);
+}
+
+PRIVATE bool key_equal(cell_p a, cell_p b, bool equal)
+{
+  if (a == b) return true;
+  if (!equal) return false;
+
+  if (is_number(a)) {
+    return is_number(b) && (decode_int(a) == decode_int(b));
+  }
+
+  cell_p la = key_chars(a);
+
+  if (la != NIL) {
+    cell_p lb = key_chars(b);
+
+    if (lb == NIL) return false;
+
+    for (; (la != NIL) && (lb != NIL); la = get_cdr(la), lb = get_cdr(lb)) {
+      if (decode_int(get_car(la)) != decode_int(get_car(lb))) return false;
+    }
+
+    return la == lb;
+  }
+
+  const uint8_t * ba, * bb;
+  cell_p lsa, lsb;
+  int32_t length = key_bytes(a, &ba, &lsa);
+
+  if ((length < 0) || (key_bytes(b, &bb, &lsb) != length)) return false;
+
+  if ((ba != NULL) && (bb != NULL)) return memcmp(ba, bb, length) == 0;
+
+  while (length--) {
+    if (next_byte(&ba, &lsa) != next_byte(&bb, &lsb)) return false;
+  }
+
+  return true;
+}
+
+/** slot_find().
+
+  Returns the index of the slot of key in the slots of t, -1 if not found.
+
+ */
+
+PRIVATE int32_t slot_find(cell_p t, cell_p key, uint32_t h, bool equal)
+{
+  table_header * hdr   = TABLE_HEADER(t);
+  table_slot   * slots = TABLE_SLOTS(t);
+  uint32_t       mask  = hdr->capacity - 1;
+  uint32_t       i     = h & mask;
+
+  for (uint32_t n = 0; n < hdr->capacity; n++, i = (i + 1) & mask) {
+    if (slots[i].key == TABLE_EMPTY) return -1;
+    if ((slots[i].key != TABLE_DELETED) && key_equal(slots[i].key, key, equal)) return i;
+  }
+
+  return -1;
+}
+
+/** slot_insert().
+
+  Puts a new entry in the slots of t. The key must not be present and a
+  free slot must exist.
+
+ */
+
+PRIVATE void slot_insert(cell_p t, cell_p key, cell_p value, uint32_t h)
+{
+  table_header * hdr   = TABLE_HEADER(t);
+  table_slot   * slots = TABLE_SLOTS(t);
+  uint32_t       mask  = hdr->capacity - 1;
+  uint32_t       i     = h & mask;
+
+  while (TABLE_LIVE(slots[i].key)) i = (i + 1) & mask;
+
+  if (slots[i].key == TABLE_EMPTY) hdr->used += 1;
+
+  slots[i].key   = key;
+  slots[i].value = value;
+}
+
+PRIVATE void table_init(cell_p t, uint16_t capacity, bool equal)
+{
+  table_header * hdr   = TABLE_HEADER(t);
+  table_slot   * slots = TABLE_SLOTS(t);
+
+  hdr->count    = 0;
+  hdr->used     = 0;
+  hdr->capacity = capacity;
+  hdr->old      = NIL;
+  hdr->migrate  = 0;
+  hdr->equal    = equal;
+
+  for (uint32_t i = 0; i < capacity; i++) slots[i].key = TABLE_EMPTY;
+}
+
+/** table_migrate().
+
+  Moves up to step entries from the old slots of t to its slots. The old
+  slots are released once all of them were moved.
+
+ */
+
+PRIVATE void table_migrate(cell_p t, uint32_t step)
+{
+  table_header * hdr = TABLE_HEADER(t);
+  cell_p         old = hdr->old;
+
+  if (old == NIL) return;
+
+  table_slot * slots    = TABLE_SLOTS(old);
+  uint16_t     capacity = TABLE_HEADER(old)->capacity;
+
+  for (; (step > 0) && (hdr->migrate < capacity); step--, hdr->migrate++) {
+    table_slot * slot = &slots[hdr->migrate];
+
+    if (TABLE_LIVE(slot->key)) {
+      slot_insert(t, slot->key, slot->value, key_hash(slot->key, hdr->equal));
+      slot->key = TABLE_DELETED;
+    }
+  }
+
+  if (hdr->migrate >= capacity) hdr->old = NIL;
+}
+
+/** table_grow().
+
+  Gives new slots to t: twice as many if the table is at least 1/4 full,
+  else as many, to get rid of the deleted slots. The current slots become
+  the old slots of t. Returns false if the table cannot grow any more.
+
+ */
+
+PRIVATE bool table_grow(cell_p t)
+{
+  table_migrate(t, UINT32_MAX);
+
+  table_header * hdr      = TABLE_HEADER(t);
+  uint32_t       capacity = hdr->capacity;
+  bool           equal    = hdr->equal;
+  uint16_t       count    = hdr->count;
+
+  if ((count * 4) >= capacity) capacity *= 2;
+
+  if (capacity > TABLE_MAX_CAPACITY) {
+    ERROR("table-set!", "table full");
+    return false;
+  }
+
+  // The new vector is allocated, then its storage is swapped with the one
+  // of t: t keeps its identity, the new vector cell owns the old slots.
+
+  cell_p n = new_vector(TABLE_SIZE(capacity));
+
+  cell_p   start  = RAM_GET_VECTOR_START(t);
+  uint16_t length = RAM_GET_VECTOR_LENGTH(t);
+
+  RAM_SET_VECTOR_START(t, RAM_GET_VECTOR_START(n));
+  RAM_SET_VECTOR_LENGTH(t, RAM_GET_VECTOR_LENGTH(n));
+  RAM_SET_VECTOR_START(n, start);
+  RAM_SET_VECTOR_LENGTH(n, length);
+
+  VECTOR_SET_RAM_PTR(RAM_GET_VECTOR_START(t) - 1, t);
+  VECTOR_SET_RAM_PTR(start - 1, n);
+
+  RAM_SET_VECTOR_KIND(n, VECTOR_TABLE);
+
+  table_init(t, capacity, equal);
+
+  hdr        = TABLE_HEADER(t);
+  hdr->count = count;
+  hdr->old   = n;
+
+  return true;
+}
+
+/** tables_gc_mark().
+
+  Marks the keys and values of the reachable tables. As a table can be
+  reached from the entries of another one, the RAM is scanned until no
+  more tables are found. The gc_flip flag tells the tables already
+  scanned. Called by mm_gc() once the roots are marked.
+
+ */
+
+void tables_gc_mark()
+{
+  if (!vm->tables) return;
+
+  bool again = true;
+
+  while (again) {
+    again = false;
+
+    for (cell_p p = vm->reserved_cells_count; p < vm->ram_heap_top; p++) {
+      if (RAM_IS_MARKED(p) && RAM_IS_TABLE(p) && !RAM_IS_FLIPPED(p)) {
+        table_header * hdr = TABLE_HEADER(p);
+
+        RAM_SET_FLIP(p);
+
+        for (uint32_t i = 0; i < hdr->capacity; i++) {
+          table_slot * slot = &TABLE_SLOTS(p)[i];
+
+          if (TABLE_LIVE(slot->key)) {
+            mm_mark(slot->key);
+            mm_mark(slot->value);
+          }
+        }
+
+        mm_mark(hdr->old);
+        again = true;
+      }
+    }
+  }
+
+  for (cell_p p = vm->reserved_cells_count; p < vm->ram_heap_top; p++) {
+    if (RAM_IS_TABLE(p)) RAM_CLR_FLIP(p);
+  }
+}
+
+PRIVATE bool table_arg(cell_p t, char * proc)
+{
+  if ((IN_RAM(t)) && RAM_IS_TABLE(t)) return true;
+
+  TYPE_ERROR(proc, "table");
+  return false;
+}
+
+/** table_new().
+
+  Returns a new empty table. Its keys are compared with equal? if equal is
+  true, else with eq?.
+
+ */
+
+cell_p table_new(bool equal)
+{
+  cell_p t = new_vector(TABLE_SIZE(TABLE_MIN_CAPACITY));
+
+  RAM_SET_VECTOR_KIND(t, VECTOR_TABLE);
+  table_init(t, TABLE_MIN_CAPACITY, equal);
+
+  vm->tables = true;
+
+  return t;
+}
+
+/** table_get().
+
+  Returns the value of key in the table t, deflt if not found.
+
+ */
+
+cell_p table_get(cell_p t, cell_p key, cell_p deflt)
+{
+  table_migrate(t, TABLE_MIGRATE_STEP);
+
+  table_header * hdr = TABLE_HEADER(t);
+  uint32_t h = key_hash(key, hdr->equal);
+  int32_t  i;
+
+  if ((i = slot_find(t, key, h, hdr->equal)) >= 0) {
+    return TABLE_SLOTS(t)[i].value;
+  }
+  else if ((hdr->old != NIL) && ((i = slot_find(hdr->old, key, h, hdr->equal)) >= 0)) {
+    return TABLE_SLOTS(hdr->old)[i].value;
+  }
+  else {
+    return deflt;
+  }
+}
+
+/** table_put().
+
+  Sets the value of key in the table t. As the table may grow, t, key and
+  value must be reachable from the GC roots.
+
+ */
+
+void table_put(cell_p t, cell_p key, cell_p value)
+{
+  table_migrate(t, TABLE_MIGRATE_STEP);
+
+  table_header * hdr = TABLE_HEADER(t);
+  uint32_t h = key_hash(key, hdr->equal);
+  int32_t  i;
+
+  if ((i = slot_find(t, key, h, hdr->equal)) >= 0) {
+    TABLE_SLOTS(t)[i].value = value;
+  }
+  else if ((hdr->old != NIL) && ((i = slot_find(hdr->old, key, h, hdr->equal)) >= 0)) {
+    TABLE_SLOTS(hdr->old)[i].value = value;
+  }
+  else if ((((hdr->used + 1) * 4) <= (hdr->capacity * 3)) || table_grow(t)) {
+    slot_insert(t, key, value, h);
+    TABLE_HEADER(t)->count += 1;
+  }
+}
+
+PRIMITIVE(#%make-table, make_table, 1, 103)
+{
+  /* reg1 is true for an equal? table */
+  vm->reg1 = table_new(vm->reg1 != FALSE);
+}
+
+PRIMITIVE(#%table-ref, table_ref, 3, 104)
+{
+  /* reg1 is the table, reg2 the key, reg3 the value returned if not found */
+  if (table_arg(vm->reg1, "table-ref")) {
+    vm->reg1 = table_get(vm->reg1, vm->reg2, vm->reg3);
+  }
+
+  vm->reg2 = vm->reg3 = NIL;
+}
+
+PRIMITIVE_UNSPEC(table-set!, table_set, 3, 105)
+{
+  /* reg1 is the table, reg2 the key, reg3 the value */
+  if (table_arg(vm->reg1, "table-set!")) {
+    table_put(vm->reg1, vm->reg2, vm->reg3);
+  }
+
+  vm->reg1 = vm->reg2 = vm->reg3 = NIL;
+}
+
+PRIMITIVE_UNSPEC(table-delete!, table_delete, 2, 106)
+{
+  /* reg1 is the table, reg2 the key */
+  if (table_arg(vm->reg1, "table-delete!")) {
+    table_migrate(vm->reg1, TABLE_MIGRATE_STEP);
+
+    table_header * hdr = TABLE_HEADER(vm->reg1);
+    uint32_t h = key_hash(vm->reg2, hdr->equal);
+    int32_t  i;
+
+    if ((i = slot_find(vm->reg1, vm->reg2, h, hdr->equal)) >= 0) {
+      TABLE_SLOTS(vm->reg1)[i].key = TABLE_DELETED;
+      hdr->count -= 1;
+    }
+    else if ((hdr->old != NIL) && ((i = slot_find(hdr->old, vm->reg2, h, hdr->equal)) >= 0)) {
+      TABLE_SLOTS(hdr->old)[i].key = TABLE_DELETED;
+      hdr->count -= 1;
+    }
+  }
+
+  vm->reg1 = vm->reg2 = NIL;
+}
+
+PRIMITIVE(table-count, table_count, 1, 107)
+{
+  vm->reg1 = table_arg(vm->reg1, "table-count") ? encode_int(TABLE_HEADER(vm->reg1)->count) : FALSE;
+}
+
+PRIMITIVE(table?, table_p, 1, 108)
+{
+  vm->reg1 = ENCODE_BOOL((IN_RAM(vm->reg1)) && RAM_IS_TABLE(vm->reg1));
+}
+
+PRIMITIVE(table->list, table_to_list, 1, 109)
+{
+  /* Returns the entries of the table reg1 as an association list. The
+     table is kept in reg2, the list in reg3 and the entry in reg4 while
+     allocating. */
+  if (table_arg(vm->reg1, "table->list")) {
+    vm->reg2 = vm->reg1;
+    vm->reg3 = NIL;
+
+    // The old slots are scanned first, then the new ones
+
+    for (int pass = 0; pass < 2; pass++) {
+      cell_p   t        = (pass == 0) ? TABLE_HEADER(vm->reg2)->old : vm->reg2;
+      uint32_t capacity = (t == NIL) ? 0 : TABLE_HEADER(t)->capacity;
+
+      for (uint32_t i = 0; i < capacity; i++) {
+        if (TABLE_LIVE(TABLE_SLOTS(t)[i].key)) {
+          vm->reg4 = new_pair(TABLE_SLOTS(t)[i].key, TABLE_SLOTS(t)[i].value);
+          vm->reg3 = new_pair(vm->reg4, vm->reg3);
+        }
+      }
+    }
+
+    vm->reg1 = vm->reg3;
+  }
+
+  vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+}
+
+#if TESTS
+PRIVATE cell_p table_test_string(const char * str)
+{
+  // The characters list is kept in reg4 while allocating
+
+  vm->reg4 = NIL;
+  for (int i = strlen(str) - 1; i >= 0; i--) vm->reg4 = new_pair(encode_int(str[i]), vm->reg4);
+
+  return new_string(vm->reg4);
+}
+
+PRIVATE cell_p table_test_get(cell_p table, cell_p key, cell_p deflt)
+{
+  vm->reg1 = table; vm->reg2 = key; vm->reg3 = deflt;
+  primitive_table_ref();
+  return vm->reg1;
+}
+
+PRIVATE void table_test_put(cell_p table, cell_p key, cell_p value)
+{
+  vm->reg1 = table; vm->reg2 = key; vm->reg3 = value;
+  primitive_table_set();
+}
+
+PRIVATE int32_t table_test_count(cell_p table)
+{
+  vm->reg1 = table;
+  primitive_table_count();
+  return decode_int(vm->reg1);
+}
+
+void primitives_table_tests()
+{
+  cell_p eq_table, equal_table, s1, s2;
+  bool ok;
+
+  TESTM("primitives-table");
+
+  TEST("eq? table");
+
+    // Tables and keys are kept in env (GC roots). RAM cells never move.
+
+    s1  = table_test_string("key"); vm->env = new_pair(s1, NIL);
+    s2  = table_test_string("key"); vm->env = new_pair(s2, vm->env);
+
+    vm->reg1 = FALSE; primitive_make_table(); eq_table = vm->reg1;
+    vm->env = new_pair(eq_table, vm->env);
+
+    vm->reg1 = eq_table; primitive_table_p();
+    EXPECT_TRUE(vm->reg1 == TRUE, "table? not true for a table");
+    vm->reg1 = new_vector(4); primitive_table_p();
+    EXPECT_TRUE(vm->reg1 == FALSE, "table? true for a u8vector");
+
+    table_test_put(eq_table, s1, encode_int(1));
+    table_test_put(eq_table, encode_int(7), encode_int(2));
+    EXPECT_TRUE(table_test_get(eq_table, s1, FALSE) == encode_int(1), "eq? key not found");
+    EXPECT_TRUE(table_test_get(eq_table, s2, FALSE) == FALSE, "eq? table compares strings");
+    EXPECT_TRUE(table_test_get(eq_table, encode_int(7), FALSE) == encode_int(2), "Small int key not found");
+
+    table_test_put(eq_table, s1, encode_int(3));
+    EXPECT_TRUE(table_test_count(eq_table) == 2, "Entry duplicated");
+    EXPECT_TRUE(table_test_get(eq_table, s1, FALSE) == encode_int(3), "Value not replaced");
+
+    vm->reg1 = eq_table; vm->reg2 = s1; primitive_table_delete();
+    EXPECT_TRUE(table_test_get(eq_table, s1, TRUE) == TRUE, "Entry not deleted");
+    EXPECT_TRUE(table_test_count(eq_table) == 1, "Count not right after delete");
+
+  TEST("equal? table");
+
+    vm->reg1 = TRUE; primitive_make_table(); equal_table = vm->reg1;
+    vm->env = new_pair(equal_table, vm->env);
+
+    table_test_put(equal_table, s1, encode_int(1));
+    EXPECT_TRUE(table_test_get(equal_table, s2, FALSE) == encode_int(1), "Strings not compared by value");
+    EXPECT_TRUE(table_test_get(equal_table, table_test_string("kez"), FALSE) == FALSE,
+                "Different strings found equal");
+
+    table_test_put(equal_table, new_fixnum(100000), encode_int(2));
+    EXPECT_TRUE(table_test_get(equal_table, encode_int32(100000), FALSE) == encode_int(2),
+                "Numbers not compared by value");
+
+    vm->reg1 = new_vector(3); memcpy(u8vector_bytes(vm->reg1, 0, 3), "abc", 3);
+    table_test_put(equal_table, vm->reg1, encode_int(3));
+    vm->reg1 = new_vector(3); memcpy(u8vector_bytes(vm->reg1, 0, 3), "abc", 3);
+    EXPECT_TRUE(table_test_get(equal_table, vm->reg1, FALSE) == encode_int(3), "u8vectors not compared by value");
+    vm->reg1 = new_vector(3); memcpy(u8vector_bytes(vm->reg1, 0, 3), "abd", 3);
+    EXPECT_TRUE(table_test_get(equal_table, vm->reg1, FALSE) == FALSE, "Different u8vectors found equal");
+
+  TEST("Incremental growth");
+
+    for (int i = 0; i < 1000; i++) table_test_put(equal_table, encode_int(i), encode_int(i * 2));
+
+    EXPECT_TRUE(TABLE_HEADER(equal_table)->capacity == 2048, "Table capacity not right");
+
+    ok = true;
+    for (int i = 0; i < 1000; i++) {
+      ok = ok && (decode_int(table_test_get(equal_table, encode_int(i), FALSE)) == (i * 2));
+    }
+    EXPECT_TRUE(ok, "Entries lost while growing");
+
+    for (int i = 0; i < 1000; i += 2) {
+      vm->reg1 = equal_table; vm->reg2 = encode_int(i); primitive_table_delete();
+    }
+
+    EXPECT_TRUE(table_test_count(equal_table) == 503, "Count not right after deletes");
+    EXPECT_TRUE(decode_int(table_test_get(equal_table, encode_int(999), FALSE)) == 1998,
+                "Entry lost after deletes");
+
+  TEST("Garbage Collector");
+
+    table_test_put(equal_table, table_test_string("gc"), new_pair(encode_int(5), NIL));
+    mm_gc();
+    mm_gc();
+
+    vm->reg1 = table_test_get(equal_table, table_test_string("gc"), FALSE);
+    EXPECT_TRUE((vm->reg1 != FALSE) && (RAM_GET_CAR(vm->reg1) == encode_int(5)), "Entry not kept by the GC");
+    EXPECT_TRUE(table_test_get(equal_table, s2, FALSE) == encode_int(1), "String key lost by the GC");
+
+  TEST("table->list");
+
+    vm->reg1 = eq_table; primitive_table_to_list();
+
+    EXPECT_TRUE((vm->reg1 != NIL) && (RAM_GET_CDR(vm->reg1) == NIL) &&
+                (RAM_GET_CAR(RAM_GET_CAR(vm->reg1)) == encode_int(7)) &&
+                (RAM_GET_CDR(RAM_GET_CAR(vm->reg1)) == encode_int(2)),
+                "Association list not right");
+
+  vm->env = NIL;
+  vm->reg1 = vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+  mm_gc();
+}
+#endif
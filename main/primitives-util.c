@@ -1,5 +1,5 @@
 // primitives-utils
-// Builtin Indexes: 26..32
+// Builtin Indexes: 26..32, 120..121
 
 #include "esp32-scheme-vm.h"
 #include "vm-arch.h"
@@ -7,60 +7,61 @@
 #include "testing.h"
 
 #include "primitives.h"
+#include "bignum.h"
 
 PRIMITIVE(eq?, eq_p, 2, 26)
 {
-  reg1 = ENCODE_BOOL(reg1 == reg2);
-  reg2 = NIL;
+  vm->reg1 = ENCODE_BOOL(vm->reg1 == vm->reg2);
+  vm->reg2 = NIL;
 }
 
 PRIMITIVE(not, not, 1, 27)
 {
-  reg1 = ENCODE_BOOL(reg1 == FALSE);
+  vm->reg1 = ENCODE_BOOL(vm->reg1 == FALSE);
 }
 
 PRIMITIVE(symbol?, symbol_p, 1, 28)
 {
-  if (IN_RAM(reg1)) {
-    reg1 = ENCODE_BOOL(RAM_IS_SYMBOL(reg1));
+  if (IN_RAM(vm->reg1)) {
+    vm->reg1 = ENCODE_BOOL(RAM_IS_SYMBOL(vm->reg1));
   }
-  else if (IN_ROM(reg1)) {
-    reg1 = ENCODE_BOOL(ROM_IS_SYMBOL(reg1));
+  else if (IN_ROM(vm->reg1)) {
+    vm->reg1 = ENCODE_BOOL(ROM_IS_SYMBOL(vm->reg1));
   }
   else {
-    reg1 = FALSE;
+    vm->reg1 = FALSE;
   }
 }
 
 PRIMITIVE(boolean?, boolean_p, 1, 29)
 {
-  reg1 = ENCODE_BOOL((reg1 == FALSE) || (reg1 == TRUE));
+  vm->reg1 = ENCODE_BOOL((vm->reg1 == FALSE) || (vm->reg1 == TRUE));
 }
 
 PRIMITIVE(string?, string_p, 1, 30)
 {
-  if (IN_RAM(reg1)) {
-    reg1 = ENCODE_BOOL(RAM_IS_STRING(reg1));
+  if (IN_RAM(vm->reg1)) {
+    vm->reg1 = ENCODE_BOOL(RAM_IS_STRING(vm->reg1));
   }
-  else if (IN_ROM(reg1)) {
-    reg1 = ENCODE_BOOL(ROM_IS_STRING(reg1));
+  else if (IN_ROM(vm->reg1)) {
+    vm->reg1 = ENCODE_BOOL(ROM_IS_STRING(vm->reg1));
   }
   else {
-    reg1 = FALSE;
+    vm->reg1 = FALSE;
   }
 }
 
 PRIMITIVE(string->list, string2list, 1, 31)
 {
-  if (IN_RAM(reg1)) {
-    EXPECT(RAM_IS_STRING(reg1), "string->list.0", "string");
+  if (IN_RAM(vm->reg1)) {
+    EXPECT(RAM_IS_STRING(vm->reg1), "string->list.0", "string");
 
-    reg1 = RAM_STRING_GET_CHARS(reg1);
+    vm->reg1 = RAM_STRING_GET_CHARS(vm->reg1);
   }
-  else if (IN_ROM(reg1)) {
-    EXPECT(ROM_IS_STRING(reg1), "string->list.1", "string");
+  else if (IN_ROM(vm->reg1)) {
+    EXPECT(ROM_IS_STRING(vm->reg1), "string->list.1", "string");
 
-    reg1 = ROM_STRING_GET_CHARS(reg1);
+    vm->reg1 = ROM_STRING_GET_CHARS(vm->reg1);
   }
   else {
     TYPE_ERROR("string->list.2", "string");
@@ -69,14 +70,357 @@ PRIMITIVE(string->list, string2list, 1, 31)
 
 PRIMITIVE(list->string, list2string, 1, 32)
 {
-  reg1 = new_string(reg1);
+  vm->reg1 = new_string(vm->reg1);
 }
 
 
+/** equal?.
+
+  Structures are walked iteratively: the cdrs are followed in a loop and
+  the cars that are pairs or strings are kept in a stack, to be compared
+  later. The stack starts in the C stack and is moved to a growing one on
+  the heap when full. Strings are compared through their lists of
+  characters and vectors with memcmp(). Numbers are compared by value.
+
+ */
+
+#define EQUAL_STACK_SIZE 32
+
+PRIVATE bool any_pair_p(cell_p p)
+{
+  return ((IN_RAM(p)) && RAM_IS_PAIR(p)) || ((IN_ROM(p)) && ROM_IS_PAIR(p));
+}
+
+PRIVATE cell_p any_car(cell_p p) { return IN_RAM(p) ? RAM_GET_CAR(p) : ROM_GET_CAR(p); }
+PRIVATE cell_p any_cdr(cell_p p) { return IN_RAM(p) ? RAM_GET_CDR(p) : ROM_GET_CDR(p); }
+
+/** any_chars().
+
+  Returns the list of characters of the string p, FALSE if p is not a
+  string.
+
+ */
+
+PRIVATE cell_p any_chars(cell_p p)
+{
+  if      ((IN_RAM(p)) && RAM_IS_STRING(p)) return RAM_STRING_GET_CHARS(p);
+  else if ((IN_ROM(p)) && ROM_IS_STRING(p)) return ROM_STRING_GET_CHARS(p);
+  else return FALSE;
+}
+
+/** vector_contents().
+
+  Returns the length in bytes of the vector v, -1 if v is not a vector.
+  Its kind is returned in *kind and its bytes in *bytes or, for a ROM
+  u8vector stored as a list of bytes, the list in *list.
+
+ */
+
+PRIVATE int32_t vector_contents(cell_p v, uint8_t * kind, const uint8_t ** bytes, cell_p * list)
+{
+  *kind  = VECTOR_U8;
+  *bytes = NULL;
+  *list  = NIL;
+
+  if ((IN_RAM(v)) && RAM_IS_VECTOR(v) && (RAM_GET_VECTOR_KIND(v) != VECTOR_TABLE)) {
+    *kind  = RAM_GET_VECTOR_KIND(v);
+    *bytes = &VECTOR_GET_BYTE(RAM_GET_VECTOR_START(v), 0);
+    return RAM_GET_VECTOR_LENGTH(v);
+  }
+  else if ((IN_ROM(v)) && ROM_IS_VECTOR(v)) {
+    if (ROM_IS_PACKED_VECTOR(v)) *bytes = ROM_GET_VECTOR_BYTES(v);
+    else                         *list  = ROM_GET_VECTOR_START(v);
+    return ROM_GET_VECTOR_LENGTH(v);
+  }
+  else {
+    return -1;
+  }
+}
+
+PRIVATE bool vectors_equal(cell_p a, cell_p b)
+{
+  uint8_t         ka, kb;
+  const uint8_t * ba, * bb;
+  cell_p          la, lb;
+  int32_t         n = vector_contents(a, &ka, &ba, &la);
+
+  if ((n < 0) || (vector_contents(b, &kb, &bb, &lb) != n) || (ka != kb)) return false;
+
+  if ((ba != NULL) && (bb != NULL)) return memcmp(ba, bb, n) == 0;
+
+  for (int32_t i = 0; i < n; i++) {
+    uint8_t x, y;
+
+    if (ba != NULL) x = ba[i]; else { x = decode_int(ROM_GET_CAR(la)); la = ROM_GET_CDR(la); }
+    if (bb != NULL) y = bb[i]; else { y = decode_int(ROM_GET_CAR(lb)); lb = ROM_GET_CDR(lb); }
+
+    if (x != y) return false;
+  }
+
+  return true;
+}
+
+/** atom_equal().
+
+  Compares a and b, which are neither pairs nor strings.
+
+ */
+
+PRIVATE bool atom_equal(cell_p a, cell_p b)
+{
+  if (a == b) return true;
+
+  if (IS_SMALL_INT(a) || ((IN_RAM(a)) && RAM_IS_NUMBER(a)) || ((IN_ROM(a)) && ROM_IS_NUMBER(a))) {
+    if (!(IS_SMALL_INT(b) || ((IN_RAM(b)) && RAM_IS_NUMBER(b)) || ((IN_ROM(b)) && ROM_IS_NUMBER(b)))) {
+      return false;
+    }
+
+    #ifdef CONFIG_BIGNUM_LONG
+      // Bignums of any size are compared digit by digit. As with =, a
+      // fixnum compared to another kind of number is converted to a
+      // bignum, which may not fit in 32 bits. cmp() doesn't allocate:
+      // the converted fixnum needs no root.
+
+      bool fa = (IN_RAM(a)) && RAM_IS_FIXNUM(a);
+      bool fb = (IN_RAM(b)) && RAM_IS_FIXNUM(b);
+
+      if (fa != fb) {
+        if (fa) a = fixnum_to_bignum(a);
+        else    b = fixnum_to_bignum(b);
+      }
+
+      if (!(fa && fb)) return cmp(a, b) == 1;
+    #endif
+
+    return decode_int(a) == decode_int(b);
+  }
+
+  return vectors_equal(a, b);
+}
+
+PRIVATE bool deep_equal(cell_p a, cell_p b)
+{
+  cell_p   local[EQUAL_STACK_SIZE][2];
+  cell_p (*stack)[2] = local;
+  int      size      = EQUAL_STACK_SIZE;
+  int      top       = 0;
+  bool     equal     = false;
+  cell_p   ca, cb;
+
+  for (;;) {
+    if (a != b) {
+      if (any_pair_p(a)) {
+        if (!any_pair_p(b)) break;
+
+        ca = any_car(a);
+        cb = any_car(b);
+
+        if (ca != cb) {
+          if (!(any_pair_p(ca) || (any_chars(ca) != FALSE))) {
+            if (!atom_equal(ca, cb)) break;
+          }
+          else {
+            if (top == size) {
+              cell_p (*grown)[2] = (stack == local) ? malloc(2 * sizeof(local))
+                                                    : realloc(stack, 2 * size * sizeof(*stack));
+              if (grown == NULL) {
+                FATAL("equal?", "Unable to allocate memory");
+                break;
+              }
+              if (stack == local) memcpy(grown, local, sizeof(local));
+              stack = grown;
+              size *= 2;
+            }
+
+            stack[top][0] = ca;
+            stack[top][1] = cb;
+            top++;
+          }
+        }
+
+        a = any_cdr(a);
+        b = any_cdr(b);
+        continue;
+      }
+
+      if ((ca = any_chars(a)) != FALSE) {
+        if ((cb = any_chars(b)) == FALSE) break;
+
+        a = ca;
+        b = cb;
+        continue;
+      }
+
+      if (!atom_equal(a, b)) break;
+    }
+
+    if (top == 0) {
+      equal = true;
+      break;
+    }
+
+    top--;
+    a = stack[top][0];
+    b = stack[top][1];
+  }
+
+  if (stack != local) free(stack);
+
+  return equal;
+}
+
+PRIMITIVE(equal?, equal_p, 2, 120)
+{
+  vm->reg1 = ENCODE_BOOL(deep_equal(vm->reg1, vm->reg2));
+  vm->reg2 = NIL;
+}
+
+PRIMITIVE(assoc, assoc, 2, 121)
+{
+  /* reg1 is the key searched with equal? in the association list reg2 */
+  cell_p p;
+
+  for (p = vm->reg2; any_pair_p(p); p = any_cdr(p)) {
+    cell_p binding = any_car(p);
+
+    if (any_pair_p(binding) && deep_equal(any_car(binding), vm->reg1)) break;
+  }
+
+  vm->reg1 = any_pair_p(p) ? any_car(p) : FALSE;
+  vm->reg2 = NIL;
+}
+
 #if TESTS
+/** util_test_data().
+
+  Returns the list (1 "ab" (100000 . #u8(1 2)) x) nested depth times in
+  the car of a pair. x is the last element. The structure is built in
+  reg2..reg4.
+
+ */
+
+PRIVATE cell_p util_test_data(int depth, cell_p x)
+{
+  // new_vector() uses reg4: the vector is allocated first
+
+  vm->reg3 = new_vector(2);
+  VECTOR_GET_BYTE(RAM_GET_VECTOR_START(vm->reg3), 0) = 1;
+  VECTOR_GET_BYTE(RAM_GET_VECTOR_START(vm->reg3), 1) = 2;
+  vm->reg2 = new_fixnum(100000);
+  vm->reg3 = new_pair(vm->reg2, vm->reg3);
+
+  vm->reg4 = new_pair(x, NIL);
+  vm->reg4 = new_pair(vm->reg3, vm->reg4);
+
+  vm->reg3 = new_pair(encode_int('b'), NIL);
+  vm->reg3 = new_pair(encode_int('a'), vm->reg3);
+  vm->reg3 = new_string(vm->reg3);
+  vm->reg4 = new_pair(vm->reg3, vm->reg4);
+  vm->reg4 = new_pair(encode_int(1), vm->reg4);
+
+  while (depth-- > 0) vm->reg4 = new_pair(vm->reg4, NIL);
+
+  cell_p p = vm->reg4;
+  vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+
+  return p;
+}
+
 void primitives_util_tests()
 {
   TESTM("primitives-util");
 
+  TEST("equal?");
+
+    vm->env = new_pair(util_test_data(0, TRUE), NIL);
+    vm->env = new_pair(util_test_data(0, TRUE), vm->env);
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = RAM_GET_CAR(RAM_GET_CDR(vm->env));
+    primitive_equal_p();
+    EXPECT_TRUE(vm->reg1 == TRUE, "Equal structures not equal");
+
+    vm->env = new_pair(util_test_data(0, FALSE), vm->env);
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = RAM_GET_CAR(RAM_GET_CDR(vm->env));
+    primitive_equal_p();
+    EXPECT_TRUE(vm->reg1 == FALSE, "Different structures equal");
+
+    vm->reg1 = new_fixnum(5); vm->reg2 = encode_int(5);
+    primitive_equal_p();
+    EXPECT_TRUE(vm->reg1 == TRUE, "Numbers not compared by value");
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = encode_int(5);
+    primitive_equal_p();
+    EXPECT_TRUE(vm->reg1 == FALSE, "A list equal to a number");
+
+  TEST("Deep structures");
+
+    // Nested in the cars: one sublist pending at a time
+
+    vm->env = new_pair(util_test_data(100, TRUE), vm->env);
+    vm->env = new_pair(util_test_data(100, TRUE), vm->env);
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = RAM_GET_CAR(RAM_GET_CDR(vm->env));
+    primitive_equal_p();
+    EXPECT_TRUE(vm->reg1 == TRUE, "Deep equal structures not equal");
+
+    vm->env = new_pair(util_test_data(100, FALSE), vm->env);
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = RAM_GET_CAR(RAM_GET_CDR(vm->env));
+    primitive_equal_p();
+    EXPECT_TRUE(vm->reg1 == FALSE, "Deep different structures equal");
+
+    // More sublists pending than EQUAL_STACK_SIZE: the stack is grown
+
+    for (int i = 0; i < 2; i++) {
+      vm->reg3 = NIL;
+      for (int n = 0; n < (3 * EQUAL_STACK_SIZE); n++) {
+        vm->reg4 = new_pair(encode_int(n), NIL);
+        vm->reg3 = new_pair(vm->reg4, vm->reg3);
+      }
+      vm->env  = new_pair(vm->reg3, vm->env);
+      vm->reg3 = vm->reg4 = NIL;
+    }
+
+    // The first sublists are compared last
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = RAM_GET_CAR(RAM_GET_CDR(vm->env));
+    primitive_equal_p();
+    EXPECT_TRUE(vm->reg1 == TRUE, "Wide equal structures not equal");
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = RAM_GET_CAR(RAM_GET_CDR(vm->env));
+    RAM_SET_CAR(RAM_GET_CAR(vm->reg1), encode_int(0));
+    primitive_equal_p();
+    EXPECT_TRUE(vm->reg1 == FALSE, "Wide different structures equal");
+
+  TEST("Fixnums and bignums");
+
+    // 2^40 and 100000 as bignums, little digit first
+
+    vm->reg2 = new_bignum(256, ZERO);
+    vm->reg2 = new_bignum(0, vm->reg2);
+    vm->reg2 = new_bignum(0, vm->reg2);
+    vm->reg1 = new_fixnum(5);
+    primitive_equal_p();
+    EXPECT_TRUE(vm->reg1 == FALSE, "Fixnum equal to a wide bignum");
+
+    vm->reg2 = new_bignum(0x86A0, ENCODE_SMALL_INT(1));
+    vm->reg1 = new_fixnum(100000);
+    primitive_equal_p();
+    EXPECT_TRUE(vm->reg1 == TRUE, "Fixnum not equal to its bignum");
+
+  TEST("assoc");
+
+    vm->env = new_pair(util_test_data(0, TRUE), vm->env);
+    RAM_SET_CAR(vm->env, new_pair(RAM_GET_CAR(vm->env), encode_int(7)));
+    RAM_SET_CAR(vm->env, new_pair(RAM_GET_CAR(vm->env), NIL));
+    vm->reg1 = util_test_data(0, TRUE);
+    vm->reg2 = RAM_GET_CAR(vm->env);
+    primitive_assoc();
+    EXPECT_TRUE((vm->reg1 != FALSE) && (RAM_GET_CDR(vm->reg1) == encode_int(7)), "assoc not right");
+
+  vm->env = NIL;
+  vm->reg1 = vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+  mm_gc();
 }
 #endif
@@ -1,5 +1,5 @@
 // primitives-vector
-// Builtin Indexes: 33..37
+// Builtin Indexes: 33..37, 84..89
 
 #include "esp32-scheme-vm.h"
 #include "vm-arch.h"
@@ -10,54 +10,60 @@
 
 PRIMITIVE(u8vector?, u8vector_p, 1, 33)
 {
-  if (IN_RAM(reg1)) {
-    reg1 = ENCODE_BOOL(RAM_IS_VECTOR(reg1));
+  if (IN_RAM(vm->reg1)) {
+    vm->reg1 = ENCODE_BOOL(RAM_IS_U8VECTOR(vm->reg1));
   }
-  else if (IN_ROM(reg1)) {
-    reg1 = ENCODE_BOOL(ROM_IS_VECTOR(reg1));
+  else if (IN_ROM(vm->reg1)) {
+    vm->reg1 = ENCODE_BOOL(ROM_IS_VECTOR(vm->reg1));
   }
   else {
     ERROR("u8vector?", "pointer in ROM or RAM");
-    reg1 = FALSE;
+    vm->reg1 = FALSE;
   }
 }
 
 PRIMITIVE(#%make-u8vector, make_u8vector, 1, 34)
 {
-  reg1 = new_vector(decode_int(reg1));
+  vm->reg1 = new_vector(decode_int(vm->reg1));
 }
 
 PRIMITIVE(u8vector-ref, u8vector_ref, 2, 35)
 {
-  a2 = decode_int(reg2);
+  vm->a2 = decode_int(vm->reg2);
 
-  if (IN_RAM(reg1)) {
-    EXPECT(RAM_IS_VECTOR(reg1), "u8vector-ref.0", "vector");
+  if (IN_RAM(vm->reg1)) {
+    EXPECT(RAM_IS_U8VECTOR(vm->reg1), "u8vector-ref.0", "vector");
 
-    if (RAM_GET_VECTOR_LENGTH(reg1) <= a2) {
+    if (RAM_GET_VECTOR_LENGTH(vm->reg1) <= vm->a2) {
       ERROR("u8vector-ref.1", "Vector index invalid");
     }
 
-    reg1 = RAM_GET_VECTOR_START(reg1);
+    vm->reg1 = RAM_GET_VECTOR_START(vm->reg1);
 
-    reg1 = encode_int(VECTOR_GET_BYTE(reg1, a2));
-    reg2 = NIL;
+    vm->reg1 = encode_int(VECTOR_GET_BYTE(vm->reg1, vm->a2));
+    vm->reg2 = NIL;
   }
-  else if (IN_ROM(reg1)) {
-    EXPECT(ROM_IS_VECTOR(reg1), "u8vector-ref.2", "vector");
+  else if (IN_ROM(vm->reg1)) {
+    EXPECT(ROM_IS_VECTOR(vm->reg1), "u8vector-ref.2", "vector");
 
-    if (ROM_GET_VECTOR_LENGTH(reg1) <= a2) {
+    if (ROM_GET_VECTOR_LENGTH(vm->reg1) <= vm->a2) {
       ERROR("u8vector-ref.3", "Vector index invalid");
     }
 
-    reg1 = ROM_GET_VECTOR_START(reg1);
+    if (ROM_IS_PACKED_VECTOR(vm->reg1)) {
+      vm->reg1 = encode_int(ROM_GET_VECTOR_BYTES(vm->reg1)[vm->a2]);
+      vm->reg2 = NIL;
+      return;
+    }
+
+    vm->reg1 = ROM_GET_VECTOR_START(vm->reg1);
 
-    while (a2--) {
-      reg1 = ROM_GET_CDR(reg1);
+    while (vm->a2--) {
+      vm->reg1 = ROM_GET_CDR(vm->reg1);
     }
 
-    reg1 = ROM_GET_CAR(reg1);
-    reg2 = NIL;
+    vm->reg1 = ROM_GET_CAR(vm->reg1);
+    vm->reg2 = NIL;
     return;
   }
   else {
@@ -69,50 +75,271 @@ PRIMITIVE(u8vector-ref, u8vector_ref, 2, 35)
 PRIMITIVE_UNSPEC(u8vector-set!, u8vector_set, 3, 36)
   // TODO a lot in common with ref, abstract that
 {
-  a2 = decode_int(reg2); // TODO adapt for bignums
-  a3 = decode_int(reg3);
+  vm->a2 = decode_int(vm->reg2); // TODO adapt for bignums
+  vm->a3 = decode_int(vm->reg3);
 
-  if ((a3 < 0) || (a3 > 255)) {
+  if ((vm->a3 < 0) || (vm->a3 > 255)) {
     ERROR("u8vector-set!.0", "byte vectors can only contain bytes");
   }
 
-  if (IN_RAM(reg1)) {
-    EXPECT(RAM_IS_VECTOR(reg1), "u8vector-set!.1", "vector");
+  if (IN_RAM(vm->reg1)) {
+    EXPECT(RAM_IS_U8VECTOR(vm->reg1), "u8vector-set!.1", "vector");
 
-    if (RAM_GET_VECTOR_LENGTH(reg1) <= a2) {
+    if (RAM_GET_VECTOR_LENGTH(vm->reg1) <= vm->a2) {
       ERROR("u8vector-set!.2", "vector index invalid");
     }
 
-    a1 = RAM_GET_VECTOR_START(reg1);
+    vm->a1 = RAM_GET_VECTOR_START(vm->reg1);
   }
   else {
     TYPE_ERROR("u8vector-set!.3", "vector");
   }
 
-  VECTOR_SET_BYTE(a1, a2, a3);
+  VECTOR_SET_BYTE(vm->a1, vm->a2, vm->a3);
 
-  reg1 = reg2 = reg3 = NIL;
+  vm->reg1 = vm->reg2 = vm->reg3 = NIL;
 }
 
 PRIMITIVE(u8vector-length, u8vector_length, 1, 37)
 {
-  if (IN_RAM(reg1)) {
-    EXPECT(RAM_IS_VECTOR(reg1), "u8vector-length.0", "vector");
+  if (IN_RAM(vm->reg1)) {
+    EXPECT(RAM_IS_U8VECTOR(vm->reg1), "u8vector-length.0", "vector");
 
-    reg1 = encode_int(RAM_GET_VECTOR_LENGTH(reg1));
+    vm->reg1 = encode_int(RAM_GET_VECTOR_LENGTH(vm->reg1));
   }
-  else if (IN_ROM(reg1)) {
-    EXPECT(ROM_IS_VECTOR(reg1), "u8vector-length.1", "vector");
+  else if (IN_ROM(vm->reg1)) {
+    EXPECT(ROM_IS_VECTOR(vm->reg1), "u8vector-length.1", "vector");
 
-    reg1 = encode_int(ROM_GET_VECTOR_LENGTH(reg1));
+    vm->reg1 = encode_int(ROM_GET_VECTOR_LENGTH(vm->reg1));
   }
   else {
     TYPE_ERROR("u8vector-length.2", "vector");
 
-    reg1 = ZERO;
+    vm->reg1 = ZERO;
+  }
+}
+
+/** Bulk operations.
+
+  The following primitives work on whole ranges of u8vectors with
+  memmove(), memset(), memcmp() and memchr() over the vector heap. Packed
+  ROM u8vectors are used in place. Older programs have ROM u8vectors as
+  lists of bytes: they are first copied in a temporary buffer by
+  vector_bytes().
+
+ */
+
+PRIVATE int32_t vector_length(cell_p v)
+{
+  if (IN_RAM(v) && RAM_IS_U8VECTOR(v)) {
+    return RAM_GET_VECTOR_LENGTH(v);
+  }
+  else if (IN_ROM(v) && ROM_IS_VECTOR(v)) {
+    return ROM_GET_VECTOR_LENGTH(v);
+  }
+  else {
+    return -1;
   }
 }
 
+/** vector_bytes().
+
+  Returns the address of the bytes start..end of the u8vector v. For a ROM
+  u8vector stored as a list, the bytes are copied in a buffer returned in *copy, to be
+  released by the caller with free(). Returns NULL if v is not a u8vector
+  or the range is invalid.
+
+ */
+
+PRIVATE const uint8_t * vector_bytes(cell_p v, int32_t start, int32_t end, uint8_t ** copy)
+{
+  *copy = NULL;
+
+  if (IN_ROM(v) && ROM_IS_VECTOR(v)) {
+    if ((start < 0) || (start > end) || (end > ROM_GET_VECTOR_LENGTH(v))) {
+      ERROR("u8vector", "Vector range invalid");
+      return NULL;
+    }
+
+    if (ROM_IS_PACKED_VECTOR(v)) return ROM_GET_VECTOR_BYTES(v) + start;
+
+    if ((*copy = malloc(end - start + 1)) == NULL) {
+      FATAL("u8vector", "Unable to allocate memory");
+      return NULL;
+    }
+
+    cell_p p = ROM_GET_VECTOR_START(v);
+
+    for (int32_t i = 0; i < end; i++, p = ROM_GET_CDR(p)) {
+      if (i >= start) (*copy)[i - start] = decode_int(ROM_GET_CAR(p));
+    }
+
+    return *copy;
+  }
+
+  return u8vector_bytes(v, start, end);
+}
+
+PRIMITIVE_UNSPEC(#%u8vector-copy!, u8vector_copy, 4, 84)
+{
+  /* reg1 is the source, reg2 the source start, reg3 the target and reg4
+     the pair (target-start . n). The ranges can overlap. */
+  uint8_t * copy;
+  const uint8_t * from;
+  uint8_t * to;
+
+  if (!(IN_RAM(vm->reg4) && RAM_IS_PAIR(vm->reg4))) {
+    TYPE_ERROR("u8vector-copy!.0", "pair");
+  }
+  else {
+    vm->a1 = decode_int(vm->reg2);
+    vm->a2 = decode_int(RAM_GET_CAR(vm->reg4));
+    vm->a3 = decode_int(RAM_GET_CDR(vm->reg4));
+
+    if ((vm->a3 > 0) &&
+        ((to   = u8vector_bytes(vm->reg3, vm->a2, vm->a2 + vm->a3))          != NULL) &&
+        ((from = vector_bytes(vm->reg1, vm->a1, vm->a1 + vm->a3, &copy)) != NULL)) {
+      memmove(to, from, vm->a3);
+      free(copy);
+    }
+  }
+
+  vm->reg1 = vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+}
+
+PRIMITIVE_UNSPEC(#%u8vector-fill!, u8vector_fill, 4, 85)
+{
+  /* reg1 is the u8vector, reg2 the byte, reg3..reg4 the range */
+  vm->a2 = decode_int(vm->reg2);
+
+  if ((vm->a2 < 0) || (vm->a2 > 255)) {
+    ERROR("u8vector-fill!", "byte vectors can only contain bytes");
+  }
+  else {
+    uint8_t * bytes = u8vector_bytes(vm->reg1, decode_int(vm->reg3), decode_int(vm->reg4));
+
+    if (bytes != NULL) memset(bytes, vm->a2, decode_int(vm->reg4) - decode_int(vm->reg3));
+  }
+
+  vm->reg1 = vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+}
+
+/** vector_compare().
+
+  Compares the u8vectors x and y in lexicographic order, a shorter vector
+  being smaller than a longer one starting with the same bytes. Returns
+  -1, 0 or 1, 2 if x or y is not a u8vector.
+
+ */
+
+PRIVATE int vector_compare(cell_p x, cell_p y)
+{
+  int32_t lx = vector_length(x);
+  int32_t ly = vector_length(y);
+  uint8_t * copy_x, * copy_y;
+  const uint8_t * bx, * by;
+  int result;
+
+  if ((lx < 0) || (ly < 0)) {
+    TYPE_ERROR("u8vector-compare", "u8vector");
+    return 2;
+  }
+
+  bx = vector_bytes(x, 0, lx, &copy_x);
+  by = vector_bytes(y, 0, ly, &copy_y);
+
+  if ((bx == NULL) || (by == NULL)) {
+    free(copy_x);
+    free(copy_y);
+    return 2;
+  }
+
+  result = memcmp(bx, by, (lx < ly) ? lx : ly);
+
+  free(copy_x);
+  free(copy_y);
+
+  if (result == 0) result = lx - ly;
+
+  return (result < 0) ? -1 : ((result > 0) ? 1 : 0);
+}
+
+PRIMITIVE(u8vector-equal?, u8vector_equal, 2, 86)
+{
+  vm->reg1 = ENCODE_BOOL((vector_length(vm->reg1) == vector_length(vm->reg2)) &&
+                     (vector_compare(vm->reg1, vm->reg2) == 0));
+  vm->reg2 = NIL;
+}
+
+PRIMITIVE(u8vector-compare, u8vector_compare, 2, 87)
+{
+  vm->a1 = vector_compare(vm->reg1, vm->reg2);
+
+  vm->reg1 = (vm->a1 == 2) ? FALSE : encode_int(vm->a1);
+  vm->reg2 = NIL;
+}
+
+PRIMITIVE(#%u8vector-index, u8vector_index, 4, 88)
+{
+  /* reg1 is the u8vector, reg2 the byte searched in the range reg3..reg4.
+     The result is the index of the first occurence, #f if none. */
+  uint8_t * copy;
+  const uint8_t * bytes, * found = NULL;
+
+  vm->a2 = decode_int(vm->reg2);
+  vm->a3 = decode_int(vm->reg3);
+
+  bytes = vector_bytes(vm->reg1, vm->a3, decode_int(vm->reg4), &copy);
+
+  if (bytes != NULL) {
+    found = memchr(bytes, vm->a2, decode_int(vm->reg4) - vm->a3);
+  }
+
+  vm->reg1 = (found == NULL) ? FALSE : encode_int(vm->a3 + (found - bytes));
+  vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+
+  free(copy);
+}
+
+PRIMITIVE(list->u8vector, list2u8vector, 1, 89)
+{
+  /* reg1 is a list of bytes, kept in reg1 while the vector is allocated */
+  cell_p p;
+  uint16_t length = 0;
+
+  for (p = vm->reg1; p != NIL; length++) {
+    if (IN_RAM(p) && RAM_IS_PAIR(p)) {
+      p = RAM_GET_CDR(p);
+    }
+    else if (IN_ROM(p) && ROM_IS_PAIR(p)) {
+      p = ROM_GET_CDR(p);
+    }
+    else {
+      TYPE_ERROR("list->u8vector", "list");
+      vm->reg1 = FALSE;
+      return;
+    }
+  }
+
+  vm->reg2 = new_vector(length);
+
+  uint8_t * bytes = u8vector_bytes(vm->reg2, 0, length);
+
+  for (p = vm->reg1; p != NIL; bytes++) {
+    if (IN_RAM(p)) {
+      *bytes = decode_int(RAM_GET_CAR(p));
+      p = RAM_GET_CDR(p);
+    }
+    else {
+      *bytes = decode_int(ROM_GET_CAR(p));
+      p = ROM_GET_CDR(p);
+    }
+  }
+
+  vm->reg1 = vm->reg2;
+  vm->reg2 = NIL;
+}
+
 
 #if TESTS
 void primitives_vector_tests()
@@ -121,34 +348,146 @@ void primitives_vector_tests()
 
   TEST("Make u8 vector");
 
-    reg1 = encode_int(7);
+    vm->reg1 = encode_int(7);
     primitive_make_u8vector();
-    cell_p v = reg1;
+    cell_p v = vm->reg1;
     EXPECT_TRUE(RAM_IS_VECTOR(v), "make_u8vector doesn't return a vector");
     EXPECT_TRUE(RAM_GET_VECTOR_LENGTH(v) == 7, "Vector length is wrong");
 
   TEST("u8 vector length");
 
     primitive_u8vector_length();
-    EXPECT_TRUE(RAM_GET_VECTOR_LENGTH(v) == decode_int(reg1), "Vector length not returned properly");
+    EXPECT_TRUE(RAM_GET_VECTOR_LENGTH(v) == decode_int(vm->reg1), "Vector length not returned properly");
 
   TEST("u8 vector predicate");
 
-    reg1 = v;
+    vm->reg1 = v;
     primitive_u8vector_p();
-    EXPECT_TRUE(reg1 == TRUE, "Vector not recognised as such");
+    EXPECT_TRUE(vm->reg1 == TRUE, "Vector not recognised as such");
 
   TEST("u8 vector set! and ref");
 
-    reg1 = v;
-    reg2 = encode_int(2);
-    reg3 = encode_int(23);
+    vm->reg1 = v;
+    vm->reg2 = encode_int(2);
+    vm->reg3 = encode_int(23);
     primitive_u8vector_set();
 
-    reg1 = v;
-    reg2 = encode_int(2);
+    vm->reg1 = v;
+    vm->reg2 = encode_int(2);
     primitive_u8vector_ref();
 
-    EXPECT_TRUE(decode_int(reg1) == 23, "unable to set and ref a vector entry");
+    EXPECT_TRUE(decode_int(vm->reg1) == 23, "unable to set and ref a vector entry");
+
+  // The vectors are kept on the stack (GC roots)
+
+  TEST("list->u8vector");
+
+    vm->reg1 = NIL;
+    for (int i = 9; i >= 0; i--) vm->reg1 = new_pair(encode_int(i * 10), vm->reg1);
+    primitive_list2u8vector();
+    vm->env = new_pair(vm->reg1, NIL);
+    EXPECT_TRUE(RAM_GET_VECTOR_LENGTH(vm->reg1) == 10, "Vector length is wrong");
+    EXPECT_TRUE(VECTOR_GET_BYTE(RAM_GET_VECTOR_START(vm->reg1), 9) == 90, "Vector content is wrong");
+
+  TEST("Copy and fill");
+
+    vm->env = new_pair(new_vector(10), vm->env);
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = encode_int(7); vm->reg3 = ZERO; vm->reg4 = encode_int(10);
+    primitive_u8vector_fill();
+    EXPECT_TRUE(VECTOR_GET_BYTE(RAM_GET_VECTOR_START(RAM_GET_CAR(vm->env)), 9) == 7, "Vector not filled");
+
+    vm->reg4 = new_pair(encode_int(2), encode_int(5));
+    vm->reg1 = RAM_GET_CAR(RAM_GET_CDR(vm->env)); vm->reg2 = encode_int(1); vm->reg3 = RAM_GET_CAR(vm->env);
+    primitive_u8vector_copy();
+    EXPECT_TRUE((VECTOR_GET_BYTE(RAM_GET_VECTOR_START(RAM_GET_CAR(vm->env)), 1) == 7) &&
+                (VECTOR_GET_BYTE(RAM_GET_VECTOR_START(RAM_GET_CAR(vm->env)), 2) == 10) &&
+                (VECTOR_GET_BYTE(RAM_GET_VECTOR_START(RAM_GET_CAR(vm->env)), 6) == 50) &&
+                (VECTOR_GET_BYTE(RAM_GET_VECTOR_START(RAM_GET_CAR(vm->env)), 7) == 7),
+                "Vector range not copied");
+
+    vm->reg4 = new_pair(encode_int(1), encode_int(8));
+    vm->reg1 = vm->reg3 = RAM_GET_CAR(RAM_GET_CDR(vm->env)); vm->reg2 = ZERO;
+    primitive_u8vector_copy();
+    EXPECT_TRUE(VECTOR_GET_BYTE(RAM_GET_VECTOR_START(RAM_GET_CAR(RAM_GET_CDR(vm->env))), 8) == 70,
+                "Overlapping ranges not copied");
+
+  TEST("Compare and search");
+
+    vm->reg1 = vm->reg2 = RAM_GET_CAR(vm->env);
+    primitive_u8vector_equal();
+    EXPECT_TRUE(vm->reg1 == TRUE, "Vector not equal to itself");
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = RAM_GET_CAR(RAM_GET_CDR(vm->env));
+    primitive_u8vector_equal();
+    EXPECT_TRUE(vm->reg1 == FALSE, "Different vectors are equal");
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = RAM_GET_CAR(RAM_GET_CDR(vm->env));
+    primitive_u8vector_compare();
+    EXPECT_TRUE(vm->reg1 == encode_int(1), "Vectors not compared properly");
+
+    vm->reg1 = RAM_GET_CAR(RAM_GET_CDR(vm->env)); vm->reg2 = RAM_GET_CAR(vm->env);
+    primitive_u8vector_compare();
+    EXPECT_TRUE(vm->reg1 == encode_int(-1), "Vectors not compared properly");
+
+    // An s16vector with the same bytes is not a u8vector
+
+    vm->reg1 = new_vector(10);
+    for (int i = 0; i < 10; i++) {
+      VECTOR_SET_BYTE(RAM_GET_VECTOR_START(vm->reg1), i,
+                      VECTOR_GET_BYTE(RAM_GET_VECTOR_START(RAM_GET_CAR(vm->env)), i));
+    }
+    RAM_SET_VECTOR_KIND(vm->reg1, VECTOR_S16);
+    EXPECT_TRUE(vector_length(vm->reg1) == -1, "s16vector taken as a u8vector");
+
+    RAM_SET_VECTOR_KIND(vm->reg1, VECTOR_TABLE);
+    EXPECT_TRUE(vector_length(vm->reg1) == -1, "Table taken as a u8vector");
+
+    RAM_SET_VECTOR_KIND(vm->reg1, VECTOR_S16);
+    vm->reg2 = RAM_GET_CAR(vm->env);
+    primitive_u8vector_equal();
+    EXPECT_TRUE(vm->reg1 == FALSE, "s16vector equal to a u8vector");
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = encode_int(50); vm->reg3 = ZERO; vm->reg4 = encode_int(10);
+    primitive_u8vector_index();
+    EXPECT_TRUE(vm->reg1 == encode_int(6), "Byte not found");
+
+    vm->reg1 = RAM_GET_CAR(vm->env); vm->reg2 = encode_int(50); vm->reg3 = ZERO; vm->reg4 = encode_int(6);
+    primitive_u8vector_index();
+    EXPECT_TRUE(vm->reg1 == FALSE, "Byte found outside of the range");
+
+  TEST("Packed ROM u8vector");
+
+    {
+      // One constant, a u8vector of 4 bytes packed at address 10 of the
+      // program, after the code (halt)
+
+      uint8_t pgm[14] = { 0xD7, 0xFB, 1, 0, 10, 0, 4, 0, 0x70, 0xC0, 1, 2, 3, 0 };
+      cell_ptr rom  = vm->rom_heap;
+      uint8_t * pg  = vm->program;
+
+      vm->rom_heap = (cell_ptr) &pgm[4];
+      vm->program  = pgm;
+      pgm[13]  = 250;
+
+      vm->reg1 = ROM_START_ADDR; vm->reg2 = encode_int(3);
+      primitive_u8vector_ref();
+      EXPECT_TRUE(vm->reg1 == encode_int(250), "Packed ROM u8vector not indexed");
+
+      vm->reg1 = ROM_START_ADDR; vm->reg2 = RAM_GET_CAR(vm->env);
+      primitive_u8vector_compare();
+      EXPECT_TRUE(vm->reg1 == encode_int(-1), "Packed ROM u8vector not compared");
+
+      vm->reg1 = ROM_START_ADDR; vm->reg2 = encode_int(250); vm->reg3 = ZERO; vm->reg4 = encode_int(4);
+      primitive_u8vector_index();
+      EXPECT_TRUE(vm->reg1 == encode_int(3), "Packed ROM u8vector not searched");
+
+      vm->rom_heap = rom;
+      vm->program  = pg;
+    }
+
+  vm->env = NIL;
+  vm->reg1 = vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+  mm_gc();
 }
 #endif
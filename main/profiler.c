@@ -0,0 +1,1027 @@
+#include "esp32-scheme-vm.h"
+
+#if PROFILING
+
+#include "vm-arch.h"
+#include "mm.h"
+#include "primitives.h"
+#include "interpreter.h"
+#include "ports.h"
+#include "testing.h"
+#include "image.h"
+
+#define PROFILER 1
+#include "profiler.h"
+
+#include <time.h>
+#include <sys/time.h>
+#if defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+#endif
+
+PRIVATE const char * const opcode_names[PROFILE_OPCODES] = {
+  "LDCS1", "LDCS2", "LDSTK1", "LDSTK2", "LDS", "STS", "CALLC", "JUMPC",
+  "JUMPS", "BRSF", "LDC",
+  "CALL", "JUMP", "BR", "BRF", "CLOS", "CALLR", "JUMPR", "BRR", "BRRF",
+  "CLOSR", "LOOP", "0xBB", "0xBC", "PRIMX", "LD", "ST",
+  "PRIM"
+};
+
+typedef struct {
+  uint32_t        id;
+  profile_counter counter;
+} profile_entry;
+
+PRIVATE uint64_t profile_cycles()
+{
+  #if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+  #elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (v));
+    return v;
+  #else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  #endif
+}
+
+/** profile_opcode().
+
+  Returns the index in opcode_names of the instruction at p: the high
+  nibble for the instructions below 0xB0, one entry per instruction of
+  the 0xB0 group and a single entry for the short primitive calls.
+
+ */
+
+PRIVATE int profile_opcode(const uint8_t * p)
+{
+  if (*p < INSTR_CALL ) return *p >> 4;
+  if (*p < PRIMITIVE1) return 11 + (*p & 0x0F);
+  return PROFILE_OPCODES - 1;
+}
+
+/** profile_primitive().
+
+  Returns the index of the primitive called by the instruction at p, -1
+  if it is not a primitive call.
+
+ */
+
+PRIVATE int profile_primitive(const uint8_t * p)
+{
+  if (*p >= PRIMITIVE1 ) return *p - PRIMITIVE1;
+  if (*p == INSTR_PRIMX) return 64 + p[1];
+  return -1;
+}
+
+PRIVATE const char * primitive_name(int index)
+{
+  return (index < primitive_count) ? primitive_names[index] : "";
+}
+
+PRIVATE void profile_account(struct profile * prof, uint32_t address, uint64_t cycles)
+{
+  const uint8_t * p = vm->program + address;
+  int prim;
+
+  prof->opcodes[profile_opcode(p)].count++;
+  prof->opcodes[profile_opcode(p)].cycles += cycles;
+
+  if ((prim = profile_primitive(p)) >= 0) {
+    prof->primitives[prim].count++;
+    prof->primitives[prim].cycles += cycles;
+  }
+
+  prof->addresses[address].count++;
+  prof->addresses[address].cycles += cycles;
+}
+
+/** profile_start().
+
+  Starts the profiling of the program loaded in the current context. The
+  counters will be written in the JSON file filename by profile_report().
+
+ */
+
+bool profile_start(char * filename, char * program_name)
+{
+  struct profile * prof;
+
+  profile_release();
+
+  if ((prof = calloc(1, sizeof(struct profile))) == NULL) return false;
+
+  if ((prof->addresses = calloc(vm->max_addr, sizeof(profile_counter))) == NULL) {
+    free(prof);
+    return false;
+  }
+
+  prof->filename     = filename;
+  prof->program_name = program_name;
+  prof->size         = vm->max_addr;
+  prof->last_address = -1;
+
+  vm->profile = prof;
+
+  return true;
+}
+
+/** profile_step().
+
+  Called by interpreter() before the execution of the instruction at p.
+  The cycles elapsed since the previous call are accounted to the previous
+  instruction. The cost of the accounting itself is not.
+
+ */
+
+void profile_step(const uint8_t * p)
+{
+  struct profile * prof = vm->profile;
+
+  if (prof->last_address >= 0) {
+    profile_account(prof, prof->last_address, profile_cycles() - prof->last_cycles);
+  }
+
+  prof->last_address = p - vm->program;
+  prof->last_cycles  = profile_cycles();
+}
+
+void profile_release()
+{
+  if (vm->profile != NULL) {
+    free(vm->profile->addresses);
+    free(vm->profile);
+    vm->profile = NULL;
+  }
+}
+
+PRIVATE int compare_entries(const void * a, const void * b)
+{
+  const profile_entry * e1 = a;
+  const profile_entry * e2 = b;
+
+  if (e1->counter.cycles != e2->counter.cycles) {
+    return (e1->counter.cycles < e2->counter.cycles) ? 1 : -1;
+  }
+  if (e1->counter.count != e2->counter.count) {
+    return (e1->counter.count < e2->counter.count) ? 1 : -1;
+  }
+  return (e1->id < e2->id) ? -1 : (e1->id > e2->id);
+}
+
+/** sorted_entries().
+
+  Returns the counters of the table executed at least once, sorted by
+  decreasing cycles, and their number in count. The result is to be freed
+  by the caller.
+
+ */
+
+PRIVATE profile_entry * sorted_entries(profile_counter * table, uint32_t size, uint32_t * count)
+{
+  profile_entry * entries = malloc((size ? size : 1) * sizeof(profile_entry));
+
+  *count = 0;
+  if (entries == NULL) return NULL;
+
+  for (uint32_t i = 0; i < size; i++) {
+    if (table[i].count > 0) {
+      entries[*count].id      = i;
+      entries[*count].counter = table[i];
+      (*count)++;
+    }
+  }
+
+  qsort(entries, *count, sizeof(profile_entry), compare_entries);
+
+  return entries;
+}
+
+PRIVATE const char * address_name(uint32_t address)
+{
+  int prim = profile_primitive(vm->program + address);
+
+  return (prim >= 0) ? primitive_name(prim) : opcode_names[profile_opcode(vm->program + address)];
+}
+
+PRIVATE void print_table(const char * title, profile_entry * entries, uint32_t count,
+                         uint64_t total_count, uint64_t total_cycles, int kind)
+{
+  fprintf(stderr, "\n  %-24s %12s %6s %14s %6s %10s\n",
+          title, "Count", "%", "Cycles", "%", "Cycles/Ex");
+
+  for (uint32_t i = 0; i < count; i++) {
+    profile_counter * c = &entries[i].counter;
+    char name[40];
+
+    switch (kind) {
+      case 0 : snprintf(name, sizeof(name), "%s", opcode_names[entries[i].id]); break;
+      case 1 : snprintf(name, sizeof(name), "%3u %s", entries[i].id, primitive_name(entries[i].id)); break;
+      default: snprintf(name, sizeof(name), "%5u %s", entries[i].id, address_name(entries[i].id)); break;
+    }
+
+    fprintf(stderr, "  %-24.24s %12llu %6.2f %14llu %6.2f %10.1f\n",
+            name,
+            (unsigned long long) c->count,
+            total_count  ? (100.0 * c->count)  / total_count  : 0.0,
+            (unsigned long long) c->cycles,
+            total_cycles ? (100.0 * c->cycles) / total_cycles : 0.0,
+            (double) c->cycles / c->count);
+  }
+}
+
+PRIVATE void write_json_string(FILE * f, const char * s)
+{
+  fputc('"', f);
+  for (; *s; s++) {
+    if ((*s == '"') || (*s == '\\')) fprintf(f, "\\%c", *s);
+    else if ((uint8_t) *s < 0x20) fprintf(f, "\\u%04x", *s);
+    else fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+PRIVATE void write_json_counter(FILE * f, profile_counter * c, bool last)
+{
+  fprintf(f, "\"count\": %llu, \"cycles\": %llu }%s\n",
+          (unsigned long long) c->count, (unsigned long long) c->cycles, last ? "" : ",");
+}
+
+/** profile_report().
+
+  Accounts the last instruction executed, prints the tables of the
+  counters sorted by cycles on stderr (all the opcodes and primitives,
+  the PROFILE_TOP_COUNT first addresses) and writes the JSON file. Returns
+  false if the file can't be written.
+
+ */
+
+bool profile_report()
+{
+  struct profile * prof = vm->profile;
+  profile_entry  * ops, * prims, * addrs;
+  uint32_t         op_count, prim_count, addr_count;
+  uint64_t         total_count = 0, total_cycles = 0;
+  FILE           * f;
+
+  if (prof == NULL) return false;
+
+  if (prof->last_address >= 0) {
+    profile_account(prof, prof->last_address, profile_cycles() - prof->last_cycles);
+    prof->last_address = -1;
+  }
+
+  for (int i = 0; i < PROFILE_OPCODES; i++) {
+    total_count  += prof->opcodes[i].count;
+    total_cycles += prof->opcodes[i].cycles;
+  }
+
+  ops   = sorted_entries(prof->opcodes,    PROFILE_OPCODES,    &op_count);
+  prims = sorted_entries(prof->primitives, PROFILE_PRIMITIVES, &prim_count);
+  addrs = sorted_entries(prof->addresses,  prof->size,         &addr_count);
+
+  if ((ops == NULL) || (prims == NULL) || (addrs == NULL)) {
+    free(ops); free(prims); free(addrs);
+    ERROR("profile_report", "Not enough memory");
+    return false;
+  }
+
+  fprintf(stderr, "\nProfile of %s: %llu instructions, %llu cycles\n",
+          prof->program_name, (unsigned long long) total_count, (unsigned long long) total_cycles);
+
+  print_table("Opcode",    ops,   op_count,   total_count, total_cycles, 0);
+  print_table("Primitive", prims, prim_count, total_count, total_cycles, 1);
+  print_table("Address",   addrs,
+              (addr_count < PROFILE_TOP_COUNT) ? addr_count : PROFILE_TOP_COUNT,
+              total_count, total_cycles, 2);
+  fputc('\n', stderr);
+
+  if ((f = fopen(prof->filename, "w")) != NULL) {
+    fprintf(f, "{\n  \"program\": ");
+    write_json_string(f, prof->program_name);
+    fprintf(f, ",\n  \"instructions\": %llu,\n  \"cycles\": %llu,\n  \"opcodes\": [\n",
+            (unsigned long long) total_count, (unsigned long long) total_cycles);
+
+    for (uint32_t i = 0; i < op_count; i++) {
+      fprintf(f, "    { \"name\": \"%s\", ", opcode_names[ops[i].id]);
+      write_json_counter(f, &ops[i].counter, i == (op_count - 1));
+    }
+
+    fprintf(f, "  ],\n  \"primitives\": [\n");
+
+    for (uint32_t i = 0; i < prim_count; i++) {
+      fprintf(f, "    { \"index\": %u, \"name\": ", prims[i].id);
+      write_json_string(f, primitive_name(prims[i].id));
+      fprintf(f, ", ");
+      write_json_counter(f, &prims[i].counter, i == (prim_count - 1));
+    }
+
+    fprintf(f, "  ],\n  \"addresses\": [\n");
+
+    for (uint32_t i = 0; i < addr_count; i++) {
+      fprintf(f, "    { \"pc\": %u, \"opcode\": \"%s\", ",
+              addrs[i].id, opcode_names[profile_opcode(vm->program + addrs[i].id)]);
+      write_json_counter(f, &addrs[i].counter, i == (addr_count - 1));
+    }
+
+    fprintf(f, "  ]\n}\n");
+  }
+
+  free(ops); free(prims); free(addrs);
+
+  if ((f == NULL) || (fclose(f) != 0)) {
+    ERROR_MSG("profile_report: Unable to write file %s.", prof->filename);
+    return false;
+  }
+
+  return true;
+}
+
+/** Sampling profiler (see profiler.h).
+
+  owners holds for each byte of the program the entry of the procedure it
+  belongs to, -1 if it was not reached. A sample is a stack of frames, the
+  innermost first: procedure entries, addresses not reached by
+  map_procedures() (FRAME_PC) and the mark of a truncated stack.
+
+  The samples are aggregated as they are taken: the distinct stacks are
+  kept once in frames (their depth followed by their frames) with their
+  sample count, found from the hash of their frames in index (open
+  addressing, linear probing). The memory used depends on the number of
+  distinct stacks, not on the time the program runs.
+
+ */
+
+#define FRAME_PC         0x80000000u
+#define FRAME_TRUNCATED  0xFFFFFFFFu
+
+typedef struct {
+  uint32_t hash;
+  uint32_t start;     // Of the depth in frames
+  uint32_t count;
+} profile_stack;
+
+typedef struct {
+  char          * filename;
+  uint32_t        size;
+  int32_t       * owners;
+  char         ** names;
+  uint32_t      * frames;
+  uint32_t        frames_length;
+  uint32_t        frames_capacity;
+  profile_stack * stacks;
+  uint32_t        stack_count;
+  uint32_t        stack_capacity;
+  uint32_t      * index;          // Stack number + 1, 0 if empty
+  uint32_t        index_capacity; // A power of 2
+  uint32_t        sample_count;
+} profile_sampler;
+
+PRIVATE profile_sampler sampler;
+
+typedef enum { FLOW_NEXT, FLOW_BRANCH, FLOW_GOTO, FLOW_CALL, FLOW_TAIL, FLOW_STOP } flow_kind;
+
+/** decode_flow().
+
+  Returns the length of the instruction at address and, in kind and
+  target, how it transfers the control. The target of FLOW_CALL and
+  FLOW_TAIL instructions is the entry of a procedure, the one of
+  FLOW_BRANCH and FLOW_GOTO instructions an address of the same one.
+
+ */
+
+PRIVATE int decode_flow(uint32_t address, flow_kind * kind, int32_t * target)
+{
+  const uint8_t * p = vm->program + address;
+
+  *kind = FLOW_NEXT;
+
+  switch (*p & 0xF0) {
+    case INSTR_JUMPC : *kind = FLOW_STOP;                                   return 1;
+    case INSTR_JUMPS : *kind = FLOW_TAIL;   *target = address + 1 + (*p & 0x0F); return 1;
+    case INSTR_BRSF  : *kind = FLOW_BRANCH; *target = address + 1 + (*p & 0x0F); return 1;
+    case INSTR_LDC   :                                                      return 2;
+    case INSTR_CALL  : break;
+    case PRIMITIVE1  :
+      if ((*p == PRIMITIVE1) || (*p == (PRIMITIVE1 + 1))) *kind = FLOW_STOP; // halt, return
+      return 1;
+    default          :                                                      return 1;
+  }
+
+  switch (*p) {
+    case INSTR_CALL  : *kind = FLOW_CALL;   break;
+    case INSTR_JUMP  : *kind = FLOW_TAIL;   break;
+    case INSTR_BR    : *kind = FLOW_GOTO;   break;
+    case INSTR_BRF   : *kind = FLOW_BRANCH; break;
+    case INSTR_CLOS  : *kind = FLOW_CALL;   break;
+    case INSTR_CALLR : *kind = FLOW_CALL;   break;
+    case INSTR_JUMPR : *kind = FLOW_TAIL;   break;
+    case INSTR_BRR   : *kind = FLOW_GOTO;   break;
+    case INSTR_BRRF  : *kind = FLOW_BRANCH; break;
+    case INSTR_CLOSR : *kind = FLOW_CALL;   break;
+    case INSTR_LOOP  :
+      *kind   = FLOW_TAIL;
+      *target = p[2] | (p[3] << 8);
+      return 4;
+    case INSTR_PRIMX :
+    case INSTR_LD    :
+    case INSTR_ST    :                      return 2;
+    default          : *kind = FLOW_STOP;   return 1;
+  }
+
+  if (*p < INSTR_CALLR) {
+    *target = p[1] | (p[2] << 8);
+    return 3;
+  }
+
+  *target = address + 2 + p[1] - 128;
+  return 2;
+}
+
+/** map_procedures().
+
+  Fills the owners table, following the code of each procedure from its
+  entry. Returns false if there is not enough memory.
+
+ */
+
+PRIVATE bool map_procedures()
+{
+  uint32_t   size  = sampler.size;
+  int32_t  * procs = malloc((size + 1) * sizeof(int32_t));
+  int32_t  * work  = malloc((size + 1) * sizeof(int32_t));
+  uint32_t   proc_count = 0, work_count;
+  uint32_t   code  = 4 + (vm->program[2] * 5);
+
+  if ((procs == NULL) || (work == NULL)) {
+    free(procs); free(work);
+    return false;
+  }
+
+  for (uint32_t a = 0; a < size; a++) sampler.owners[a] = -1;
+
+  // The code at the proc point has no number of arguments byte
+
+  if (code < size) procs[proc_count++] = code;
+
+  while (proc_count > 0) {
+    int32_t proc = procs[--proc_count];
+
+    work_count = 0;
+    work[work_count++] = (proc == code) ? proc : proc + 1;
+    sampler.owners[proc] = proc;
+
+    while (work_count > 0) {
+      uint32_t a = work[--work_count];
+
+      while ((a < size) && ((sampler.owners[a] < 0) || (a == proc))) {
+        flow_kind kind;
+        int32_t   target = -1;
+        int       length = decode_flow(a, &kind, &target);
+
+        for (int i = 0; (i < length) && ((a + i) < size); i++) sampler.owners[a + i] = proc;
+
+        if ((target >= 0) && (target < size) && (sampler.owners[target] < 0)) {
+          if ((kind == FLOW_CALL) || (kind == FLOW_TAIL)) {
+            sampler.owners[target] = target;
+            procs[proc_count++] = target;
+          }
+          else if ((kind == FLOW_BRANCH) || (kind == FLOW_GOTO)) {
+            work[work_count++] = target;
+          }
+        }
+
+        if ((kind == FLOW_GOTO) || (kind == FLOW_TAIL) || (kind == FLOW_STOP)) break;
+
+        a += length;
+      }
+    }
+  }
+
+  free(procs);
+  free(work);
+
+  return true;
+}
+
+/** load_symbols().
+
+  Reads the names of the procedures from the symbol file filename, if it
+  exists. The characters of a name that have a meaning in the folded
+  format are replaced with '_'.
+
+ */
+
+PRIVATE void load_symbols(char * filename)
+{
+  FILE   * f = fopen(filename, "r");
+  char     line[256];
+  char     name[200];
+  long     address;
+
+  if (f == NULL) return;
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if ((sscanf(line, "%li %199s", &address, name) != 2) ||
+        (address < 0) || (address >= sampler.size)) continue;
+
+    for (char * c = name; *c; c++) if (*c == ';') *c = '_';
+
+    free(sampler.names[address]);
+    sampler.names[address] = strdup(name);
+  }
+
+  fclose(f);
+}
+
+PRIVATE void sample_handler(int sig)
+{
+  profile_sample_due = 1;
+}
+
+/** profile_sampling_start().
+
+  Starts the sampling of the program loaded in the current context, from
+  the file program_filename, the stacks to be written in the file
+  filename. Returns false if the sampler can't be started.
+
+ */
+
+bool profile_sampling_start(char * filename, char * program_filename)
+{
+  struct sigaction sa;
+  struct itimerval timer;
+  char           * sym;
+  char           * ext;
+
+  profile_sampling_release();
+
+  sampler.filename = filename;
+  sampler.size     = vm->max_addr;
+  sampler.owners   = malloc(vm->max_addr * sizeof(int32_t));
+  sampler.names    = calloc(vm->max_addr, sizeof(char *));
+
+  if ((sampler.owners == NULL) || (sampler.names == NULL) || !map_procedures()) {
+    ERROR("profile_sampling_start", "Not enough memory");
+    profile_sampling_release();
+    return false;
+  }
+
+  if ((sym = malloc(strlen(program_filename) + 5)) != NULL) {
+    strcpy(sym, program_filename);
+    if (((ext = strrchr(sym, '.')) == NULL) || (strchr(ext, '/') != NULL)) ext = sym + strlen(sym);
+    strcpy(ext, ".sym");
+    load_symbols(sym);
+    free(sym);
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = sample_handler;
+  sa.sa_flags   = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+
+  timer.it_interval.tv_sec  = 0;
+  timer.it_interval.tv_usec = 1000000 / PROFILE_SAMPLE_HZ;
+  timer.it_value            = timer.it_interval;
+
+  if ((sigaction(SIGPROF, &sa, NULL) != 0) || (setitimer(ITIMER_PROF, &timer, NULL) != 0)) {
+    ERROR("profile_sampling_start", "Unable to start the timer");
+    profile_sampling_release();
+    return false;
+  }
+
+  return true;
+}
+
+/** stack_add().
+
+  Adds a sample of the depth frames to the count of its stack, the stack
+  being added if it is a new one. The sample is lost if there is not
+  enough memory.
+
+ */
+
+PRIVATE void stack_add(uint32_t * frames, uint32_t depth)
+{
+  uint32_t        hash = image_hash(IMAGE_HASH_INIT, frames, depth * sizeof(uint32_t));
+  uint32_t        mask = sampler.index_capacity - 1;
+  uint32_t        i;
+  profile_stack * st;
+
+  for (i = hash & mask; sampler.index_capacity && sampler.index[i]; i = (i + 1) & mask) {
+    st = &sampler.stacks[sampler.index[i] - 1];
+    if ((st->hash == hash) && (sampler.frames[st->start] == depth) &&
+        (memcmp(&sampler.frames[st->start + 1], frames, depth * sizeof(uint32_t)) == 0)) {
+      st->count++;
+      return;
+    }
+  }
+
+  // A new stack: the index is kept at most 3/4 full
+
+  if (((sampler.stack_count + 1) * 4) > (sampler.index_capacity * 3)) {
+    uint32_t   capacity = sampler.index_capacity ? sampler.index_capacity * 2 : 256;
+    uint32_t * index    = calloc(capacity, sizeof(uint32_t));
+
+    if (index == NULL) return;
+
+    for (uint32_t s = 0; s < sampler.stack_count; s++) {
+      for (i = sampler.stacks[s].hash & (capacity - 1); index[i]; i = (i + 1) & (capacity - 1));
+      index[i] = s + 1;
+    }
+
+    free(sampler.index);
+    sampler.index          = index;
+    sampler.index_capacity = capacity;
+    mask = capacity - 1;
+
+    for (i = hash & mask; sampler.index[i]; i = (i + 1) & mask);
+  }
+
+  if (sampler.stack_count >= sampler.stack_capacity) {
+    uint32_t        capacity = sampler.stack_capacity ? sampler.stack_capacity * 2 : 64;
+    profile_stack * stacks   = realloc(sampler.stacks, capacity * sizeof(profile_stack));
+
+    if (stacks == NULL) return;
+
+    sampler.stacks         = stacks;
+    sampler.stack_capacity = capacity;
+  }
+
+  if ((sampler.frames_length + depth + 1) > sampler.frames_capacity) {
+    uint32_t   capacity = (sampler.frames_capacity * 2) + PROFILE_MAX_DEPTH + 1;
+    uint32_t * f        = realloc(sampler.frames, capacity * sizeof(uint32_t));
+
+    if (f == NULL) return;
+
+    sampler.frames          = f;
+    sampler.frames_capacity = capacity;
+  }
+
+  st = &sampler.stacks[sampler.stack_count++];
+  st->hash  = hash;
+  st->start = sampler.frames_length;
+  st->count = 1;
+
+  sampler.frames[sampler.frames_length++] = depth;
+  memcpy(&sampler.frames[sampler.frames_length], frames, depth * sizeof(uint32_t));
+  sampler.frames_length += depth;
+
+  sampler.index[i] = sampler.stack_count;
+}
+
+PRIVATE uint32_t sample_frame(uint32_t address)
+{
+  if ((address < sampler.size) && (sampler.owners[address] >= 0)) return sampler.owners[address];
+  return FRAME_PC | address;
+}
+
+/** profile_sample().
+
+  Called by interpreter() before the execution of the instruction at p
+  when profile_sample_due is set. Records the procedures of p and of the
+  return addresses of the continuations. Beyond PROFILE_MAX_DEPTH frames,
+  the outermost ones are replaced by a [truncated] frame, such that the
+  stack still starts with a single root.
+
+ */
+
+void profile_sample(const uint8_t * p)
+{
+  uint32_t frames[PROFILE_MAX_DEPTH];
+  uint32_t depth = 0;
+  cell_p   k     = vm->cont;
+
+  profile_sample_due = 0;
+
+  if (sampler.owners == NULL) return;
+
+  frames[depth++] = sample_frame(p - vm->program);
+
+  while ((k < vm->ram_heap_end) && RAM_IS_CONTINUATION(k)) {
+    if (depth == (PROFILE_MAX_DEPTH - 1)) {
+      frames[depth++] = FRAME_TRUNCATED;
+      break;
+    }
+    frames[depth++] = sample_frame(RAM_GET_CLOSURE_ENTRY_POINT(RAM_GET_CONT_CLOSURE(k)));
+    k = RAM_GET_CONT_PARENT(k);
+  }
+
+  stack_add(frames, depth);
+  sampler.sample_count++;
+}
+
+/** frame_name().
+
+  Puts in buffer the name of a frame of a sample.
+
+ */
+
+PRIVATE void frame_name(uint32_t frame, char * buffer, int size)
+{
+  if (frame == FRAME_TRUNCATED) {
+    snprintf(buffer, size, "[truncated]");
+  }
+  else if (frame & FRAME_PC) {
+    snprintf(buffer, size, "pc@%u", frame & ~FRAME_PC);
+  }
+  else if (sampler.names[frame] != NULL) {
+    snprintf(buffer, size, "%s", sampler.names[frame]);
+  }
+  else if (frame == (4 + (vm->program[2] * 5))) {
+    snprintf(buffer, size, "toplevel");
+  }
+  else {
+    snprintf(buffer, size, "proc@%u", frame);
+  }
+}
+
+typedef struct {
+  char   * text;
+  uint32_t count;
+} folded_stack;
+
+PRIVATE int compare_stacks(const void * a, const void * b)
+{
+  return strcmp(((const folded_stack *) a)->text, ((const folded_stack *) b)->text);
+}
+
+/** profile_sampling_report().
+
+  Stops the sampler and writes the folded stacks, sorted, in its file.
+  Stacks given the same text (procedures with the same name) are merged.
+  Returns false if the file can't be written.
+
+ */
+
+bool profile_sampling_report()
+{
+  struct itimerval timer;
+  folded_stack   * folded;
+  char             name[256];
+  FILE           * f;
+
+  if (sampler.owners == NULL) return false;
+
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  profile_sample_due = 0;
+
+  if ((folded = calloc(sampler.stack_count + 1, sizeof(folded_stack))) == NULL) {
+    ERROR("profile_sampling_report", "Not enough memory");
+    return false;
+  }
+
+  for (uint32_t s = 0; s < sampler.stack_count; s++) {
+    uint32_t * frames = &sampler.frames[sampler.stacks[s].start];
+    uint32_t   depth  = *frames++;
+    size_t     size   = 0;
+    FILE     * str    = open_memstream(&folded[s].text, &size);
+
+    // Outermost first
+    for (int32_t i = depth - 1; i >= 0; i--) {
+      frame_name(frames[i], name, sizeof(name));
+      fprintf(str, (i == (depth - 1)) ? "%s" : ";%s", name);
+    }
+    fclose(str);
+    folded[s].count = sampler.stacks[s].count;
+  }
+
+  qsort(folded, sampler.stack_count, sizeof(folded_stack), compare_stacks);
+
+  if ((f = fopen(sampler.filename, "w")) != NULL) {
+    for (uint32_t s = 0; s < sampler.stack_count; ) {
+      uint32_t count = 0;
+      uint32_t e     = s;
+
+      while ((e < sampler.stack_count) && (strcmp(folded[s].text, folded[e].text) == 0)) {
+        count += folded[e++].count;
+      }
+      fprintf(f, "%s %u\n", folded[s].text, count);
+      s = e;
+    }
+  }
+
+  for (uint32_t s = 0; s < sampler.stack_count; s++) free(folded[s].text);
+  free(folded);
+
+  fprintf(stderr, "\nSampling profile of %u samples written in %s\n", sampler.sample_count, sampler.filename);
+
+  if ((f == NULL) || (fclose(f) != 0)) {
+    ERROR_MSG("profile_sampling_report: Unable to write file %s.", sampler.filename);
+    return false;
+  }
+
+  return true;
+}
+
+void profile_sampling_release()
+{
+  struct itimerval timer;
+
+  if (sampler.owners != NULL) {
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+  }
+
+  if (sampler.names != NULL) {
+    for (uint32_t a = 0; a < sampler.size; a++) free(sampler.names[a]);
+  }
+
+  free(sampler.owners);
+  free(sampler.names);
+  free(sampler.frames);
+  free(sampler.stacks);
+  free(sampler.index);
+  memset(&sampler, 0, sizeof(sampler));
+  profile_sample_due = 0;
+}
+
+#if TESTS
+void profiler_tests()
+{
+  uint8_t hello[] = {
+    0xD7, 0xFB, 0, 0,       //     header: no constant, no global
+    0xA0, 0x45,             //  4: LDC 65
+    0x05,                   //  6: LDCS 1
+    0xE9,                   //  7: #%putchar
+    0xC0,                   //  8: #%halt
+    0xBD, 0x3D              //  9: PRIMX 125 (snapshot), not executed
+  };
+
+  char         name[] = "/tmp/profile-XXXXXX";
+  char       * output = NULL;
+  size_t       size   = 0;
+  char         json[4096];
+  FILE       * f;
+  jmp_buf      exit_point;
+  vm_context * main_ctx = vm;
+  vm_context * ctx;
+
+  TESTM("profiler");
+
+  close(mkstemp(name));
+
+  TEST("Counters");
+
+    vm_select(ctx = vm_new_context());
+
+    vm->program  = hello;
+    vm->max_addr = sizeof(hello);
+
+    EXPECT_TRUE(mm_init(vm->program), "Heaps not initialized");
+    EXPECT_TRUE(profile_start(name, "hello"), "Profiler not started");
+
+    vm->out = open_memstream(&output, &size);
+
+    vm->exit_point = &exit_point;
+    if (setjmp(exit_point) == 0) interpreter();
+    vm->exit_point = NULL;
+
+    ports_release();
+    fclose(vm->out);
+    vm->out = NULL;
+
+    EXPECT_TRUE((size == 1) && (output[0] == 'A'), "Program not run");
+
+    EXPECT_TRUE(vm->profile->last_address == 8, "Last instruction not pending");
+    EXPECT_TRUE(vm->profile->opcodes[10].count == 1, "LDC not counted");
+    EXPECT_TRUE(vm->profile->opcodes[0].count  == 1, "LDCS1 not counted");
+    EXPECT_TRUE(vm->profile->opcodes[PROFILE_OPCODES - 1].count == 1, "Primitive calls not counted");
+    EXPECT_TRUE(vm->profile->primitives[41].count == 1, "#%%putchar not counted");
+    EXPECT_TRUE((vm->profile->addresses[4].count == 1) &&
+                (vm->profile->addresses[6].count == 1) &&
+                (vm->profile->addresses[7].count == 1) &&
+                (vm->profile->addresses[5].count == 0), "Addresses not counted");
+
+    profile_step(vm->program + 9);
+    profile_step(vm->program + 4);
+    EXPECT_TRUE(vm->profile->primitives[0].count == 1, "#%%halt not counted");
+    EXPECT_TRUE((vm->profile->primitives[125].count == 1) &&
+                (vm->profile->opcodes[24].count == 1), "Extended primitive not counted");
+
+  TEST("Report");
+
+    EXPECT_TRUE(profile_report(), "Report not written");
+    EXPECT_TRUE((vm->profile->addresses[4].count == 2) &&
+                (vm->profile->last_address == -1), "Last instruction not accounted");
+
+    f = fopen(name, "r");
+    size = fread(json, 1, sizeof(json) - 1, f);
+    json[size] = 0;
+    fclose(f);
+
+    EXPECT_TRUE(strstr(json, "\"program\": \"hello\"") != NULL, "Program name not in the report");
+    EXPECT_TRUE(strstr(json, "\"instructions\": 6,") != NULL, "Instruction count wrong");
+    EXPECT_TRUE(strstr(json, "{ \"index\": 41, \"name\": \"#%putchar\", \"count\": 1,") != NULL,
+                "Primitive not in the report");
+    EXPECT_TRUE(strstr(json, "{ \"pc\": 4, \"opcode\": \"LDC\", \"count\": 2,") != NULL,
+                "Address not in the report");
+
+    profile_release();
+    EXPECT_TRUE(vm->profile == NULL, "Profiler not released");
+
+    vm_delete_context(ctx);
+
+  TEST("Sampling");
+
+    uint8_t calls[] = {
+      0xD7, 0xFB, 0, 0,       //     header: no constant, no global
+      0xB5, 0x83,             //  4: CALLR 9
+      0xC0,                   //  6: #%halt
+      0x00, 0x00,             //  7: not reached
+      0x00,                   //  9: entry of a procedure without argument
+      0x05,                   // 10: LDCS 1
+      0xB2, 0x0E, 0x00,       // 11: BR 14
+      0xC1                    // 14: return
+    };
+
+    char   prog[] = "/tmp/sampling-XXXXXX";
+    char   sym[40];
+
+    vm_select(ctx = vm_new_context());
+
+    vm->program  = calls;
+    vm->max_addr = sizeof(calls);
+
+    EXPECT_TRUE(mm_init(vm->program), "Heaps not initialized");
+
+    close(mkstemp(prog));
+    snprintf(sym, sizeof(sym), "%s.sym", prog);
+    f = fopen(sym, "w");
+    fprintf(f, "9 leaf;proc\n");
+    fclose(f);
+
+    EXPECT_TRUE(profile_sampling_start(name, prog), "Sampler not started");
+
+    EXPECT_TRUE((sampler.owners[4] == 4) && (sampler.owners[6] == 4), "Entry point code not mapped");
+    EXPECT_TRUE((sampler.owners[7] == -1) && (sampler.owners[8] == -1), "Unreached code mapped");
+    EXPECT_TRUE((sampler.owners[9]  == 9) && (sampler.owners[12] == 9) &&
+                (sampler.owners[14] == 9), "Procedure not mapped");
+    EXPECT_TRUE(strcmp(sampler.names[9], "leaf_proc") == 0, "Symbol not loaded");
+
+    vm->cont = NIL;
+    profile_sample(vm->program + 4);
+    profile_sample(vm->program + 7);
+
+    vm->reg1 = new_closure(NIL, 6);
+    vm->cont = new_cont(NIL, vm->reg1);
+    vm->reg1 = NIL;
+
+    profile_sample_due = 1;
+    profile_sample(vm->program + 10);
+    profile_sample(vm->program + 14);
+
+    EXPECT_TRUE((sampler.sample_count == 4) && (profile_sample_due == 0), "Samples not taken");
+    EXPECT_TRUE(profile_sampling_report(), "Stacks not written");
+
+    f = fopen(name, "r");
+    size = fread(json, 1, sizeof(json) - 1, f);
+    json[size] = 0;
+    fclose(f);
+
+    EXPECT_TRUE(strcmp(json, "pc@7 1\ntoplevel 1\ntoplevel;leaf_proc 2\n") == 0, "Folded stacks wrong");
+    EXPECT_TRUE((sampler.stack_count == 3) && (sampler.frames_length == 7), "Samples not aggregated");
+
+  TEST("Deep stacks");
+
+    vm->reg1 = new_closure(NIL, 6);
+    for (int i = 0; i < PROFILE_MAX_DEPTH + 10; i++) vm->cont = new_cont(vm->cont, vm->reg1);
+    vm->reg1 = NIL;
+
+    profile_sample(vm->program + 10);
+    profile_sample(vm->program + 10);
+
+    EXPECT_TRUE((sampler.sample_count == 6) && (sampler.stack_count == 4), "Deep stack not aggregated");
+    EXPECT_TRUE(profile_sampling_report(), "Stacks not written");
+
+    f = fopen(name, "r");
+    size = fread(json, 1, sizeof(json) - 1, f);
+    json[size] = 0;
+    fclose(f);
+
+    int frames = 1;
+    for (char * c = json; *c != '\n'; c++) frames += (*c == ';');
+
+    EXPECT_TRUE((strncmp(json, "[truncated];toplevel;toplevel;", 30) == 0) &&
+                (strstr(json, ";toplevel;leaf_proc 2\npc@7 1\n") != NULL), "Deep stack not truncated");
+    EXPECT_TRUE(frames == PROFILE_MAX_DEPTH, "Deep stack depth wrong");
+
+    profile_sampling_release();
+    EXPECT_TRUE(sampler.owners == NULL, "Sampler not released");
+
+    vm->cont = NIL;
+    vm_delete_context(ctx);
+    vm_select(main_ctx);
+
+    free(output);
+    unlink(name);
+    unlink(prog);
+    unlink(sym);
+}
+#endif
+
+#endif // PROFILING
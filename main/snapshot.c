@@ -0,0 +1,419 @@
+#include "esp32-scheme-vm.h"
+
+#if WORKSTATION
+
+#include "vm-arch.h"
+#include "mm.h"
+#include "bignum.h"
+#include "hexfile.h"
+#include "interpreter.h"
+#include "ports.h"
+#include "files.h"
+#include "testing.h"
+
+#define SNAPSHOT 1
+#include "snapshot.h"
+
+#define SNAPSHOT_SECTIONS 5
+
+typedef struct {
+  FILE   * file;
+  uint32_t offset;
+} image_writer;
+
+PRIVATE uint32_t image_align(uint32_t offset)
+{
+  return (offset + IMAGE_ALIGN - 1) & ~(IMAGE_ALIGN - 1);
+}
+
+/** write_section().
+
+  Writes the length bytes of data at the current position of the image,
+  preceded by the padding bringing it to offset.
+
+ */
+
+PRIVATE bool write_section(image_writer * w, uint32_t offset, const void * data, uint32_t length)
+{
+  const uint8_t * bytes = data;
+
+  while (w->offset < offset) {
+    w->offset++;
+    if (fputc(0, w->file) == EOF) return false;
+  }
+
+  w->offset += length;
+
+  return fwrite(bytes, 1, length, w->file) == length;
+}
+
+/** snapshot_write().
+
+  Writes the program and the state of the VM in the snapshot file
+  filename. The stack saved has #t on top: the result of the snapshot
+  primitive once restored. Returns false if the snapshot can't be taken.
+
+ */
+
+bool snapshot_write(char * filename)
+{
+  snapshot_state st;
+  image_writer   w;
+  bool           ok;
+
+  struct {
+    image_header  hdr;
+    image_section sec[SNAPSHOT_SECTIONS];
+  } img;
+
+  if (vm->waiter_count > 0) {
+    ERROR("snapshot", "Tasks are waiting for events");
+    return false;
+  }
+
+  for (int m = 0; m < MAPPED_FILES; m++) {
+    if (vm->maps[m].data != NULL) {
+      ERROR("snapshot", "Files are mapped");
+      return false;
+    }
+  }
+
+  memset(&st, 0, sizeof(st));
+
+  st.stack              = new_pair(TRUE, vm->env);
+  st.pc_offset          = vm->pc.c - vm->program;
+  st.continuation       = vm->cont;
+  st.free_cells         = vm->free_cells;
+  st.heap_top           = vm->ram_heap_top;
+  st.vector_free_cells  = vm->vector_free_cells;
+  st.free_cells_count   = vm->free_cells_count;
+  st.used_cells_count   = vm->used_cells_count;
+  st.vector_cells_count = vm->vector_cells_count;
+  st.root_task          = vm->root_task;
+  st.symbols            = vm->symbols;
+  st.tables             = vm->tables;
+  st.run_queue_head     = vm->run_queue_head;
+  st.run_queue_count    = vm->run_queue_count;
+  st.time_slice         = vm->time_slice;
+  st.slice_left         = vm->slice_left;
+  memcpy(st.run_queue, vm->run_queue, sizeof(st.run_queue));
+
+  memset(&img, 0, sizeof(img));
+  memcpy(img.hdr.magic, IMAGE_MAGIC, 4);
+  img.hdr.version       = IMAGE_VERSION;
+  img.hdr.section_count = SNAPSHOT_SECTIONS;
+  img.hdr.constants     = vm->program[2];
+  img.hdr.globals       = vm->program[3];
+  img.hdr.entry_point   = 4 + (vm->program[2] * 5);
+
+  img.sec[0] = (image_section) { IMAGE_SECTION_PROGRAM,   0, vm->max_addr };
+  img.sec[1] = (image_section) { IMAGE_SECTION_STATE,     0, sizeof(snapshot_state) };
+  img.sec[2] = (image_section) { IMAGE_SECTION_RAM_DATA,  0, vm->ram_heap_size * sizeof(cell_data) };
+  img.sec[3] = (image_section) { IMAGE_SECTION_RAM_FLAGS, 0, vm->ram_heap_size * sizeof(cell_flags) };
+  img.sec[4] = (image_section) { IMAGE_SECTION_VECTORS,   0, vm->vector_heap_size * sizeof(cell) };
+
+  uint32_t offset = sizeof(img);
+
+  for (int i = 0; i < SNAPSHOT_SECTIONS; i++) {
+    img.sec[i].offset = image_align(offset);
+    offset = img.sec[i].offset + img.sec[i].length;
+  }
+  img.hdr.size = offset;
+
+  img.hdr.hash = image_hash(IMAGE_HASH_INIT, img.sec, sizeof(img.sec));
+  img.hdr.hash = image_hash(img.hdr.hash, vm->program, img.sec[0].length);
+
+  img.hdr.data_hash = image_hash(IMAGE_HASH_INIT,   &st,            img.sec[1].length);
+  img.hdr.data_hash = image_hash(img.hdr.data_hash, vm->ram_heap_data,  img.sec[2].length);
+  img.hdr.data_hash = image_hash(img.hdr.data_hash, vm->ram_heap_flags, img.sec[3].length);
+  img.hdr.data_hash = image_hash(img.hdr.data_hash, vm->vector_heap,    img.sec[4].length);
+
+  if ((w.file = fopen(filename, "wb")) == NULL) {
+    ERROR_MSG("snapshot: Unable to open file %s.", filename);
+    return false;
+  }
+
+  w.offset = sizeof(img);
+
+  ok = (fwrite(&img, 1, sizeof(img), w.file) == sizeof(img)) &&
+       write_section(&w, img.sec[0].offset, vm->program,        img.sec[0].length) &&
+       write_section(&w, img.sec[1].offset, &st,            img.sec[1].length) &&
+       write_section(&w, img.sec[2].offset, vm->ram_heap_data,  img.sec[2].length) &&
+       write_section(&w, img.sec[3].offset, vm->ram_heap_flags, img.sec[3].length) &&
+       write_section(&w, img.sec[4].offset, vm->vector_heap,    img.sec[4].length);
+
+  ok = (fclose(w.file) == 0) && ok;
+
+  if (!ok) ERROR_MSG("snapshot: Unable to write file %s.", filename);
+
+  return ok;
+}
+
+/** snapshot_loaded().
+
+  Returns true if the program loaded by program_load() is a snapshot.
+
+ */
+
+bool snapshot_loaded()
+{
+  return image_section_find(IMAGE_SECTION_STATE) != NULL;
+}
+
+/** ram_cell_valid().
+
+  Returns true if p is NIL or a cell of a RAM heap of size cells.
+
+ */
+
+PRIVATE bool ram_cell_valid(cell_p p, uint32_t size)
+{
+  return (p == NIL) || (p < size);
+}
+
+/** snapshot_restore().
+
+  Replaces mm_init() for a snapshot loaded by program_load(): the heaps
+  and the state of the VM are the ones of the snapshot. interpreter()
+  will resume the execution where the snapshot was taken.
+
+ */
+
+bool snapshot_restore()
+{
+  image_section  * state = image_section_find(IMAGE_SECTION_STATE);
+  image_section  * data  = image_section_find(IMAGE_SECTION_RAM_DATA);
+  image_section  * flags = image_section_find(IMAGE_SECTION_RAM_FLAGS);
+  image_section  * vecs  = image_section_find(IMAGE_SECTION_VECTORS);
+  snapshot_state * st;
+  uint32_t         ram_size, vector_size;
+
+  if ((state == NULL) || (data == NULL) || (flags == NULL) || (vecs == NULL) ||
+      (state->length != sizeof(snapshot_state)) ||
+      ((data->length / sizeof(cell_data)) != (flags->length / sizeof(cell_flags))) ||
+      ((data->length / sizeof(cell_data)) >= ROM_START_ADDR)) {
+    ERROR("snapshot_restore", "Snapshot sections are wrong");
+    return false;
+  }
+
+  st = (snapshot_state *) (vm->image + state->offset);
+
+  if (st->pc_offset >= vm->max_addr) {
+    ERROR("snapshot_restore", "Program counter out of the program");
+    return false;
+  }
+
+  // The state is used to index the heaps: it must stay within them
+
+  ram_size    = data->length / sizeof(cell_data);
+  vector_size = vecs->length / sizeof(cell);
+
+  if ((st->heap_top < ((vm->program[3] + 1) >> 1)) || (st->heap_top > ram_size) ||
+      !ram_cell_valid(st->free_cells,   ram_size) ||
+      !ram_cell_valid(st->stack,        ram_size) ||
+      !ram_cell_valid(st->continuation, ram_size) ||
+      (st->vector_free_cells > vector_size)       ||
+      (st->run_queue_head  >= RUN_QUEUE_SIZE)     ||
+      (st->run_queue_count >  RUN_QUEUE_SIZE)) {
+    ERROR("snapshot_restore", "Heap state out of the heaps");
+    return false;
+  }
+
+  for (int i = 0; i < st->run_queue_count; i++) {
+    if (!ram_cell_valid(st->run_queue[(st->run_queue_head + i) % RUN_QUEUE_SIZE], ram_size)) {
+      ERROR("snapshot_restore", "Task out of the heap");
+      return false;
+    }
+  }
+
+  if (vm->ram_heap_data != NULL) mm_release();
+
+  vm->ram_heap_data    = (cell_data_ptr)  (vm->image + data->offset);
+  vm->ram_heap_flags   = (cell_flags_ptr) (vm->image + flags->offset);
+  vm->vector_heap      = (cell_ptr)       (vm->image + vecs->offset);
+  vm->ram_heap_size    = ram_size;
+  vm->vector_heap_size = vector_size;
+  vm->ram_heap_end     = vm->ram_heap_size;
+  vm->rom_heap         = (cell_ptr) &vm->program[4];
+  vm->heaps_mapped     = true;
+
+  vm->global_count         = vm->program[3];
+  vm->reserved_cells_count = (vm->global_count + 1) >> 1;
+
+  vm->reg1 = vm->reg2 = vm->reg3 = vm->reg4 = NIL;
+  bignum_gc_init();
+
+  vm->env                = st->stack;
+  vm->cont               = st->continuation;
+  vm->pc.c               = vm->program + st->pc_offset;
+  vm->free_cells         = st->free_cells;
+  vm->ram_heap_top       = st->heap_top;
+  vm->vector_free_cells  = st->vector_free_cells;
+  vm->free_cells_count   = st->free_cells_count;
+  vm->used_cells_count   = st->used_cells_count;
+  vm->vector_cells_count = st->vector_cells_count;
+  vm->root_task          = st->root_task;
+  vm->symbols            = st->symbols;
+  vm->tables             = st->tables;
+  vm->run_queue_head     = st->run_queue_head;
+  vm->run_queue_count    = st->run_queue_count;
+  vm->time_slice         = st->time_slice;
+  vm->slice_left         = st->slice_left;
+  memcpy(vm->run_queue, st->run_queue, sizeof(vm->run_queue));
+
+  memset(vm->waiters, 0, sizeof(vm->waiters));
+  vm->waiter_count = 0;
+  vm->suspending   = 0;
+  vm->wakeups      = 0;
+
+  memset(vm->timer_wheel, 0, sizeof(vm->timer_wheel));
+  vm->timer_count  = 0;
+
+  #if STATISTICS
+    vm->gc_call_counter = 0;
+    vm->max_gc_duration = 0;
+  #endif
+
+  if (vm->in  == NULL) vm->in  = stdin;
+  if (vm->out == NULL) vm->out = stdout;
+
+  vm->resume = true;
+
+  return true;
+}
+
+#if TESTS
+void snapshot_tests()
+{
+  uint8_t hello[] = {
+    0xD7, 0xFB, 0, 1,       //     header: no constant, one global
+    0xA0, 0x45,             //  4: LDC 65
+    0x05,                   //  6: LDCS 1
+    0xE9,                   //  7: #%putchar
+    0xC0                    //  8: #%halt
+  };
+
+  char         name[] = "/tmp/snapshot-XXXXXX";
+  char       * output = NULL;
+  size_t       size   = 0;
+  jmp_buf      exit_point;
+  vm_context * main_ctx = vm;
+  vm_context * ctx;
+  uint32_t     offset;
+  FILE       * f;
+  int          byte;
+
+  TESTM("snapshot");
+
+  close(mkstemp(name));
+
+  TEST("Write");
+
+    vm_select(ctx = vm_new_context());
+
+    vm->program  = hello;
+    vm->max_addr = sizeof(hello);
+
+    EXPECT_TRUE(mm_init(vm->program), "Heaps not initialized");
+
+    GLOBAL_SET(0, encode_int(42));
+    vm->env  = new_pair(encode_int(7), NIL);
+    vm->pc.c = vm->program + 4;
+
+    EXPECT_TRUE(snapshot_write(name), "Snapshot not written");
+
+    vm_delete_context(ctx);
+
+  TEST("Restore");
+
+    vm_select(ctx = vm_new_context());
+
+    vm->out = open_memstream(&output, &size);
+
+    EXPECT_TRUE(program_load(name) && snapshot_loaded(), "Snapshot not loaded");
+    EXPECT_TRUE(snapshot_restore(), "Snapshot not restored");
+    EXPECT_TRUE(vm->resume && (vm->pc.c == (vm->program + 4)), "Program counter not restored");
+    EXPECT_TRUE(RAM_GET_CAR(vm->env) == TRUE, "Snapshot result not on the stack");
+    EXPECT_TRUE(decode_int(RAM_GET_CAR(RAM_GET_CDR(vm->env))) == 7, "Stack not restored");
+    EXPECT_TRUE(decode_int(GLOBAL_GET(0)) == 42, "Global not restored");
+
+    vm->exit_point = &exit_point;
+    if (setjmp(exit_point) == 0) interpreter();
+    vm->exit_point = NULL;
+
+    ports_release();
+    fclose(vm->out);
+    vm->out = NULL;
+
+    EXPECT_TRUE((size == 1) && (output[0] == 'A'), "Restored program not resumed");
+
+    program_release();
+    vm_delete_context(ctx);
+
+  TEST("State out of the heaps");
+
+    // The mapping is private: the state can be changed in memory
+
+    vm_select(ctx = vm_new_context());
+
+    EXPECT_TRUE(program_load(name), "Snapshot not loaded");
+
+    {
+      snapshot_state * st = (snapshot_state *)
+        (vm->image + image_section_find(IMAGE_SECTION_STATE)->offset);
+      uint32_t ram_size   = image_section_find(IMAGE_SECTION_RAM_DATA)->length / sizeof(cell_data);
+      cell_p   top        = st->heap_top;
+
+      st->heap_top = ram_size + 1;
+      EXPECT_TRUE(!snapshot_restore(), "Heap top out of the heap restored");
+      st->heap_top = top;
+
+      st->continuation = ram_size;
+      EXPECT_TRUE(!snapshot_restore(), "Continuation out of the heap restored");
+      st->continuation = NIL;
+
+      st->run_queue_count = 1;
+      st->run_queue[st->run_queue_head] = ROM_START_ADDR;
+      EXPECT_TRUE(!snapshot_restore(), "Task out of the heap restored");
+      st->run_queue_count = 0;
+
+      EXPECT_TRUE(snapshot_restore(), "Snapshot not restored");
+    }
+
+    program_release();
+    vm_delete_context(ctx);
+
+  TEST("Data hash");
+
+    // A byte of the RAM heap changed: only seen when image_check is set
+
+    vm_select(ctx = vm_new_context());
+
+    EXPECT_TRUE(program_load(name), "Snapshot not loaded");
+    offset = image_section_find(IMAGE_SECTION_RAM_DATA)->offset;
+    program_release();
+
+    f = fopen(name, "r+b");
+    fseek(f, offset, SEEK_SET);
+    byte = fgetc(f);
+    fseek(f, offset, SEEK_SET);
+    fputc(byte ^ 1, f);
+    fclose(f);
+
+    EXPECT_TRUE(program_load(name), "Heap data checked without image_check");
+    program_release();
+
+    image_check = true;
+    EXPECT_TRUE(!program_load(name) && (vm->image == NULL), "Heap data not checked with image_check");
+    image_check = false;
+
+    program_release();
+    vm_delete_context(ctx);
+    vm_select(main_ctx);
+
+    free(output);
+    unlink(name);
+}
+#endif
+
+#endif // WORKSTATION
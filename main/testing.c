@@ -46,6 +46,16 @@ void conduct_tests()
   primitives_vector_tests();
   hexfile_tests();
   interpreter_tests();
+  batch_tests();
+  events_tests();
+  ports_tests();
+  primitives_socket_tests();
+  primitives_file_tests();
+  primitives_numvector_tests();
+  primitives_table_tests();
+  primitives_symbol_tests();
+  snapshot_tests();
+  profiler_tests();
 
   fprintf(stderr,
     "\n\n--------------------\nTests completed: %d\nTests failed: %d\n--------------------\n",
@@ -66,7 +76,7 @@ void TRACE(char * format, ...)
     //show(env);
     //putchar('\n');
     va_start(ap, format);
-    fprintf(stderr, "[%ld]", last_pc.c - program);
+    fprintf(stderr, "[%ld]", vm->last_pc.c - vm->program);
     vfprintf(stderr, format, ap);
     fflush(stdout);
   }
@@ -5,6 +5,64 @@
 
 #include "mm.h"
 #include "testing.h"
+#include "events.h"
+#include "ports.h"
+#include "files.h"
+#include "profiler.h"
+
+PRIVATE vm_context main_vm = { .epoll_fd = -1, .wakeup_fd = -1 };
+
+VM_THREAD_LOCAL vm_context * vm = &main_vm;
+
+/** vm_new_context().
+
+  Allocates a new virtual machine context. Its heaps are allocated by
+  mm_init() once the context is selected with vm_select().
+
+ */
+
+vm_context * vm_new_context()
+{
+  vm_context * ctx = (vm_context *) calloc(1, sizeof(vm_context));
+
+  if (ctx != NULL) {
+    ctx->epoll_fd  = -1;
+    ctx->wakeup_fd = -1;
+  }
+
+  return ctx;
+}
+
+/** vm_delete_context().
+
+  Releases the heaps of a context and the context itself. If it was the
+  context in use, the initial context of the process is selected.
+
+ */
+
+void vm_delete_context(vm_context * ctx)
+{
+  if (ctx == NULL) return;
+
+  vm_context * current = vm;
+
+  vm = ctx;
+  mm_release();
+  events_close();
+  ports_release();
+  files_release();
+  #if PROFILING
+    profile_release();
+  #endif
+  vm = (current == ctx) ? &main_vm : current;
+
+  if (ctx != &main_vm) free(ctx);
+}
+
+void vm_select(vm_context * ctx)
+{
+  vm = ctx;
+}
 
 void vm_arch_init()
 {
@@ -14,12 +72,12 @@ cell_p pop()
 {
   #if DEBUGGING
     // all the cons linking stack elements together are from the RAM Heap.
-    if ((env != NIL) && !RAM_IS_PAIR(env)) {
+    if ((vm->env != NIL) && !RAM_IS_PAIR(vm->env)) {
       FATAL("pop.0", "HEAP BROKEN!!!");
     }
   #endif
 
-  if (env == NIL) {
+  if (vm->env == NIL) {
     #if DEBUGGING
       WARNING("pop.1", "Environment exhausted");
     #endif
@@ -27,16 +85,16 @@ cell_p pop()
     return NIL;
   }
 
-  cell_p p = RAM_GET_CAR(env);
+  cell_p p = RAM_GET_CAR(vm->env);
 
-  cell_p f = env; // freed cell to be returned to the free list
-  env = RAM_GET_CDR(env);
+  cell_p f = vm->env; // freed cell to be returned to the free list
+  vm->env = RAM_GET_CDR(vm->env);
 
   #if 0 //DEBUGGING
-    if (is_free(f) || (f >= ram_heap_size)) {
+    if (is_free(f) || (f >= vm->ram_heap_size)) {
       FATAL("pop.2", "GC Broken");
     }
-    if ((p < ram_heap_size) && is_free(p)) {
+    if ((p < vm->ram_heap_size) && is_free(p)) {
       FATAL("pop.3", "GC Broken");
     }
   #endif
@@ -45,14 +103,14 @@ cell_p pop()
   return p;
 }
 
-cell_p new_closure(cell_p env, code_p code)
+cell_p new_closure(cell_p env_p, code_p code)
 {
   cell_p p = mm_new_ram_cell();
 
-  EXPECT((env == NIL) || RAM_IS_PAIR(env), "new_closure.0", "pair");
+  EXPECT((env_p == NIL) || RAM_IS_PAIR(env_p), "new_closure.0", "pair");
 
   RAM_SET_TYPE(p, CLOSURE_TYPE);
-  RAM_SET_CLOSURE_ENV(p, env);
+  RAM_SET_CLOSURE_ENV(p, env_p);
   RAM_SET_CLOSURE_ENTRY_POINT(p, code);
 
   return p;
@@ -120,19 +178,44 @@ cell_p new_vector(uint16_t length)
   // As mm_new_vector_cell may call garbage collection, it is required
   // to use a reg to save the allocated cell during potential gc() call.
 
-  reg4 = mm_new_ram_cell();
+  vm->reg4 = mm_new_ram_cell();
 
-  RAM_SET_TYPE(reg4, VECTOR_TYPE);
-  RAM_SET_VECTOR_START(reg4, mm_new_vector_cell(length, reg4));
-  RAM_SET_VECTOR_LENGTH(reg4, length);
+  RAM_SET_TYPE(vm->reg4, VECTOR_TYPE);
+  RAM_SET_VECTOR_KIND(vm->reg4, VECTOR_U8);
+  RAM_SET_VECTOR_START(vm->reg4, mm_new_vector_cell(length, vm->reg4));
+  RAM_SET_VECTOR_LENGTH(vm->reg4, length);
 
-  cell_p p = reg4;
-  reg4 = NIL;
+  cell_p p = vm->reg4;
+  vm->reg4 = NIL;
 
   return p;
 }
 
-// Can decode up to 24 bits
+/** u8vector_bytes().
+
+  Returns the address in the vector heap of byte start of the u8vector v,
+  checking that start..end is a valid range of v. Returns NULL if not.
+  The address is valid until the next allocation (the GC compacts the
+  vector heap).
+
+ */
+
+uint8_t * u8vector_bytes(cell_p v, int32_t start, int32_t end)
+{
+  if (!(IN_RAM(v) && RAM_IS_VECTOR(v) && (RAM_GET_VECTOR_KIND(v) != VECTOR_TABLE))) {
+    TYPE_ERROR("u8vector_bytes", "u8vector");
+    return NULL;
+  }
+
+  if ((start < 0) || (start > end) || (end > RAM_GET_VECTOR_LENGTH(v))) {
+    ERROR("u8vector_bytes", "Vector range invalid");
+    return NULL;
+  }
+
+  return &VECTOR_GET_BYTE(RAM_GET_VECTOR_START(v), start);
+}
+
+// Can decode up to 32 bits from RAM, 24 bits from ROM
 int32_t decode_int(cell_p p)
 {
   int val;
@@ -149,15 +232,27 @@ int32_t decode_int(cell_p p)
       val = SMALL_INT_VALUE(p);
     }
   }
+  else if (IN_RAM(p) && RAM_IS_FIXNUM(p)) {
+    val = RAM_GET_FIXNUM_VALUE(p);
+  }
   else if (IN_RAM(p)) {
     EXPECT(RAM_IS_BIGNUM(p), "decode_int.1", "bignum");
-    EXPECT(IS_SMALL_INT(RAM_GET_BIGNUM_HI(p)), "decode_int.3", "small int");
-    val = RAM_GET_BIGNUM_VALUE(p) + (SMALL_INT_VALUE(RAM_GET_BIGNUM_HI(p)));
+    val = (uint16_t) RAM_GET_BIGNUM_VALUE(p);
+    p   = RAM_GET_BIGNUM_HI(p);
+    if (IN_RAM(p) && RAM_IS_BIGNUM(p)) {
+      // 32 bits value (file positions)
+      EXPECT(IS_SMALL_INT(RAM_GET_BIGNUM_HI(p)), "decode_int.2", "small int");
+      val += ((uint32_t) (uint16_t) RAM_GET_BIGNUM_VALUE(p)) << 16;
+    }
+    else {
+      EXPECT(IS_SMALL_INT(p), "decode_int.3", "small int");
+      val += SMALL_INT_VALUE(p) << 16;
+    }
   }
   else if (IN_ROM(p)) {
     EXPECT(ROM_IS_BIGNUM(p), "decode_int.4", "bignum");
     EXPECT(IS_SMALL_INT(ROM_GET_BIGNUM_HI(p)), "decode_int.5", "small int");
-    val = ROM_GET_BIGNUM_VALUE(p) + (SMALL_INT_VALUE(ROM_GET_BIGNUM_HI(p)));
+    val = ((uint16_t) ROM_GET_BIGNUM_VALUE(p)) + (SMALL_INT_VALUE(ROM_GET_BIGNUM_HI(p)) << 16);
   }
   else {
     TYPE_ERROR("decode_int.6", "fixnum");
@@ -169,8 +264,8 @@ int32_t decode_int(cell_p p)
 
 void decode_2_int_args ()
 {
-  a1 = decode_int(reg1);
-  a2 = decode_int(reg2);
+  vm->a1 = decode_int(vm->reg1);
+  vm->a2 = decode_int(vm->reg2);
 }
 
 cell_p encode_int(int32_t val)
@@ -185,6 +280,22 @@ cell_p encode_int(int32_t val)
 }
 
 
+/** encode_int32().
+
+  Encodes val as encode_int() does when it can, as a fixnum otherwise.
+
+ */
+
+cell_p encode_int32(int32_t val)
+{
+  if ((val >= -65536) && (val < 0x07FFFFF)) {
+    return encode_int(val);
+  }
+  else {
+    return new_fixnum(val);
+  }
+}
+
 #if TESTS
 void vm_arch_tests()
 {
@@ -210,12 +321,12 @@ void vm_arch_tests()
 
   TEST("pop()");
 
-    env = NIL;
+    vm->env = NIL;
     // A warning message will appear on console if debugging enabled
     EXPECT_TRUE(pop() == NIL, "Empty environment doesn't return NIL on pop()");
 
-    env = new_pair(encode_int(1), encode_int(2));
-    env = new_pair(p, env);
+    vm->env = new_pair(encode_int(1), encode_int(2));
+    vm->env = new_pair(p, vm->env);
 
     q = pop();
     EXPECT_TRUE(RAM_GET_CAR(q) == NIL && RAM_GET_CDR(q) == FALSE, "pop() doesn't return the top env cell");
@@ -256,8 +367,42 @@ void vm_arch_tests()
       EXPECT_TRUE(decode_int(q) == i, "Small Int decoding wrong");
     }
     EXPECT_TRUE(decode_int(p) == 1000, "Expected decoded value is not 1000");
+    EXPECT_TRUE(decode_int(encode_int(50000))   ==  50000,   "Expected decoded value is not 50000");
+    EXPECT_TRUE(decode_int(encode_int(-50000))  == -50000,   "Expected decoded value is not -50000");
+    EXPECT_TRUE(decode_int(encode_int(1000000)) ==  1000000, "Expected decoded value is not 1000000");
+    vm->env = new_bignum(0x1234, ZERO);
+    EXPECT_TRUE(decode_int(new_bignum(0x5678, vm->env)) == 0x12345678, "Expected decoded value is not 0x12345678");
+
+  vm->env = NIL;
+  mm_gc();
+
+  TEST("VM Contexts");
+
+    uint8_t pgm[7] = { 0xD7, 0xFB, 0, 2, 0, 0, 0 };
+
+    vm_context * main_ctx = vm;
+    vm_context * ctx      = vm_new_context();
+
+    EXPECT_TRUE(ctx != NULL, "Unable to allocate a VM context");
+
+    vm->env = new_pair(encode_int(1), NIL);
+    p   = vm->env;
+
+    vm_select(ctx);
+    EXPECT_TRUE(mm_init(pgm), "mm Initialisation of a new context failed");
+    EXPECT_TRUE(vm->env == NIL,   "Registers of a new context not initialized");
+
+    vm->env = new_pair(encode_int(2), NIL);
+    EXPECT_TRUE(RAM_GET_CAR(vm->env) == encode_int(2), "Cell of the new context not set");
+
+    vm_select(main_ctx);
+    EXPECT_TRUE(vm->env == p,                        "Register of the initial context changed");
+    EXPECT_TRUE(RAM_GET_CAR(p) == encode_int(1), "Heap of the initial context changed");
+
+    vm_delete_context(ctx);
+    EXPECT_TRUE(vm == main_ctx, "Current context changed by vm_delete_context()");
 
-  env = NIL;
+  vm->env = NIL;
   mm_gc();
 }
 #endif
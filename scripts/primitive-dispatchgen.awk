@@ -23,15 +23,15 @@ function primitivegen(primitiveclass, offset) {
       continue;
     }
 
-    if(pr[i, "arguments"] > 3) 	print "            reg4 = pop();"
-    if(pr[i, "arguments"] > 2)	print "            reg3 = pop();"
-    if(pr[i, "arguments"] > 1)	print "            reg2 = pop();"
-    if(pr[i, "arguments"] > 0)	print "            reg1 = pop();"
+    if(pr[i, "arguments"] > 3) 	print "            vm->reg4 = pop();"
+    if(pr[i, "arguments"] > 2)	print "            vm->reg3 = pop();"
+    if(pr[i, "arguments"] > 1)	print "            vm->reg2 = pop();"
+    if(pr[i, "arguments"] > 0)	print "            vm->reg1 = pop();"
 
     print "            primitive_" pr[i, "c_name"] "();"
 
     if(!match(pr[i, "scheme_options"], "unspecified-result"))
-      print "            env = new_pair(reg1, env);"
+      print "            vm->env = new_pair(vm->reg1, vm->env);"
 
     print "            break;"
     if ((i < (offset + 15)) && (pr[i + 1, "scheme_name"])) print ""
@@ -0,0 +1,24 @@
+# Dispatch of the extended primitives (64..319): opcode #xBD followed by
+# (index - 64)
+
+END {
+  for (i = 64; i <= max_idx; i++) {
+    if(!pr[i, "scheme_name"]) continue;
+
+    print "              case " (i - 64) " :"
+    print "                TRACE(\"  (%s <%d>)\\n\", \"" pr[i, "scheme_name"] "\", " pr[i, "arguments"] ");"
+
+    if(pr[i, "arguments"] > 3) 	print "                vm->reg4 = pop();"
+    if(pr[i, "arguments"] > 2)	print "                vm->reg3 = pop();"
+    if(pr[i, "arguments"] > 1)	print "                vm->reg2 = pop();"
+    if(pr[i, "arguments"] > 0)	print "                vm->reg1 = pop();"
+
+    print "                primitive_" pr[i, "c_name"] "();"
+
+    if(!match(pr[i, "scheme_options"], "unspecified-result"))
+      print "                vm->env = new_pair(vm->reg1, vm->env);"
+
+    print "                break;"
+    if ((i < max_idx) && (pr[i + 1, "scheme_name"])) print ""
+  }
+}
@@ -11,6 +11,8 @@ END {
   }
 
   print "};"
+  print ""
+  print "const int primitive_count = " (max_idx + 1) ";"
   print "#endif /* CONFIG_DEBUG_STRINGS */"
 
   print ""
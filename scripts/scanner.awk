@@ -29,10 +29,13 @@ BEGIN {
 
   if (idx > max_idx) max_idx = idx
 
-  if (idx >= 64) {
+  # 0..63 are coded in the opcode (#xC0..#xFF), 64..319 use the
+  # extended primitive opcode (#xBD) followed by (index - 64)
+
+  if (idx >= 320) {
 		print "" > "/dev/stderr"
-		print "  ERROR: More than 64 (0..63) primitives are defined." > "/dev/stderr"
-		print "    The bytecode cannot reference more than 64 different" > "/dev/stderr"
+		print "  ERROR: More than 320 (0..319) primitives are defined." > "/dev/stderr"
+		print "    The bytecode cannot reference more than 320 different" > "/dev/stderr"
 		print "    primitives at the moment." > "/dev/stderr"
 		print "" > "/dev/stderr"
 		exit 1
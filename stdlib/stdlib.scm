@@ -13,21 +13,32 @@
 
 (define sleep
   (lambda (duration)
-    (#%sleep-aux (#%+ (clock) duration))))
-
-(define #%sleep-aux
-  (lambda (wake-up)
-    (if (< (clock) wake-up)
-        (#%sleep-aux wake-up)
-        #f)))
+    ;; duration in clock ticks (1/100 sec)
+    (#%sleep (* duration 10))
+    #f))
 
 (define (display x)
         (if (string? x)
-            (for-each putchar (string->list x))
+            (#%write-string x 0)
             (write x)
             )
         )
 
+(define (write-string x . port)
+        (#%write-string x (if (pair? port) (car port) 0)))
+
+(define (flush-output . port)
+        (#%flush-output (if (pair? port) (car port) 0)))
+
+(define (set-flush-policy! policy size . port)
+        (#%set-flush-policy! (if (pair? port) (car port) 0) policy size))
+
+(define (open-output-port fd)
+        (#%open-output-port fd))
+
+(define (close-output-port port)
+        (#%close-output-port port))
+
 (define (newline) (#%putchar #\newline 3))
 
 (define (displayln x)
@@ -40,13 +51,13 @@
 		                  (display x)
 		                  (#%putchar #\" 3)))
 	            ((number? x)
-	             (display (number->string x)))
+	             (#%write-number x 10 0))
 	            ((pair? x)
 	             (begin (#%putchar #\( 3)
                       (write (car x))
                       (#%write-list (cdr x))))
 	            ((symbol? x)
-	             (display "#<symbol>"))
+	             (display (symbol->string x)))
 	            ((boolean? x)
 	             (display (if x "#t" "#f")))
 	            (else
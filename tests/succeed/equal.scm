@@ -0,0 +1,7 @@
+(define a (list 1 "two" (list 3 (u8vector 4 5)) 100000))
+(define b (list 1 "two" (list 3 (u8vector 4 5)) 100000))
+(displayln (equal? a b))
+(displayln (equal? a (list 1 "two" (list 3 (u8vector 4 6)) 100000)))
+(displayln (equal? "abc" (list->string (list #\a #\b #\c))))
+(displayln (equal? 'x 'x))
+(displayln (assoc (list 1 2) '(((1) . a) ((1 2) . b))))
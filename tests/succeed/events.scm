@@ -0,0 +1,12 @@
+;; tasks waiting for events let the other tasks run
+
+(start-first-process
+ (lambda ()
+   (spawn (lambda ()
+            (displayln (wakeup-wait 1 #f))
+            (displayln (fd-wait -1 0 10))))
+   (displayln "A")
+   (wakeup 1)
+   (displayln (wakeup-wait 2 50))))
+
+(displayln "DONE")
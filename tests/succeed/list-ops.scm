@@ -0,0 +1,14 @@
+(define l (list 1 2 3 4 5))
+(displayln (length l))
+(displayln (append l '(6 7)))
+(displayln (reverse l))
+(displayln (list-ref l 2))
+(list-set! l 2 'x)
+(displayln l)
+(displayln (memq 'x l))
+(displayln (memq 'y l))
+(displayln (assq 'b '((a . 1) (b . 2))))
+(define c (list 1 2 3))
+(set-cdr! (cddr c) c)
+(displayln (length c))
+(displayln (reverse! (list 1 2 3)))
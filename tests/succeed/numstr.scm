@@ -0,0 +1,11 @@
+(displayln (number->string 1234567))
+(displayln (number->string -255 16))
+(displayln (number->string 10 2))
+(displayln (string->number "-4096"))
+(displayln (string->number "ff" 16))
+(displayln (string->number "#o777"))
+(displayln (string->number "12x"))
+(define big (* (* 65536 65536) 65536))
+(displayln big)
+(displayln (number->string (- 0 big) 16))
+(displayln (= big (string->number "281474976710656")))
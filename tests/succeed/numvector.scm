@@ -0,0 +1,24 @@
+(define x (s16vector 1 2 3 4 5 6 7 8 9 10))
+(define y (make-s16vector 10 2))
+(define z (make-s16vector 10))
+(display (s16vector-length x))
+(display " ")
+(display (s16vector? x))
+(display (u8vector? x))
+(display "\n")
+(numvector-mul! z x y 0)
+(display (s16vector-ref z 9))
+(display " ")
+(display (numvector-dot x y))
+(display " ")
+(display (numvector-sum x))
+(display "\n")
+(numvector-fir! z x (s16vector 1 1) 1)
+(display (s16vector-ref z 0))
+(display (s16vector-ref z 8))
+(display "\n")
+(define w (list->s32vector '(100000 -5 7)))
+(display (numvector-min w))
+(display " ")
+(display (numvector-max w))
+(display "\n")
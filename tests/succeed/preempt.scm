@@ -0,0 +1,23 @@
+;; preemptive scheduling: the tasks never yield
+
+(define done 0)
+
+(define (busy)
+  (let loop ((i 0))
+    (if (< i 200)
+        (loop (+ i 1))))
+  (set! done (+ done 1)))
+
+(set-time-slice! 50)
+
+(start-first-process
+ (lambda ()
+   (spawn busy)
+   (spawn busy)
+   (let wait ()
+     (if (< done 2)
+         (wait)))
+   (displayln done)))
+
+(set-time-slice! 0)
+(displayln "DONE")
@@ -0,0 +1,32 @@
+;; self tail calls reuse the frame of the running procedure
+
+(define (sum-to n acc)
+  (if (= n 0)
+      acc
+      (let ((m (- n 1)))
+        (sum-to m (+ acc n)))))
+
+(displayln (sum-to 100 0))
+
+(displayln
+ (let loop ((i 0) (l '()))
+   (if (< i 5)
+       (loop (+ i 1) (cons i l))
+       l)))
+
+(let loop ((i 20000))
+  (if (> i 0)
+      (loop (- i 1))
+      (displayln 'done)))
+
+;; a continuation captured in the loop body resumes its own iteration
+(define k #f)
+(define resumed 0)
+(displayln
+ (let loop ((i 0) (acc '()))
+   (if (= i 2) (call/cc (lambda (c) (set! k c))))
+   (if (< i 4)
+       (loop (+ i 1) (cons i acc))
+       acc)))
+(set! resumed (+ resumed 1))
+(if (< resumed 2) (k #f))
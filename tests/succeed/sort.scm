@@ -0,0 +1,10 @@
+(displayln (sort! (list 5 -3 8 0 2 2 -7) <))
+(displayln (sort (list 5 -3 8 0 2) >))
+(define pairs (list (cons 2 'a) (cons 1 'b) (cons 2 'c) (cons 0 'd)))
+(displayln (sort! pairs (lambda (x y) (< (car x) (car y)))))
+(define v (s16vector 300 -20 7 1000 -5))
+(vector-sort! v <)
+(displayln (list (s16vector-ref v 0) (s16vector-ref v 2) (s16vector-ref v 4)))
+(define u (u8vector 9 3 200 4))
+(vector-sort! u (lambda (x y) (> x y)))
+(displayln (list (u8vector-ref u 0) (u8vector-ref u 3)))
@@ -0,0 +1,14 @@
+(define s (string->symbol "hello"))
+(display (eq? s 'hello))
+(display (eq? (string->symbol "other") 'hello))
+(newline)
+(display (symbol->string 'world))
+(newline)
+(define r (string->symbol "runtime"))
+(display (eq? r (string->symbol (symbol->string r))))
+(display (symbol? r))
+(newline)
+(display 'abc)
+(display " ")
+(display r)
+(newline)
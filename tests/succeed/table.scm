@@ -0,0 +1,38 @@
+(define t (make-equal-table))
+(table-set! t "one" 1)
+(table-set! t 2 "two")
+(table-set! t (u8vector 1 2 3) 'bytes)
+(display (table-ref t "one"))
+(display " ")
+(display (table-ref t 2))
+(display " ")
+(display (table-ref t (u8vector 1 2 3)))
+(display " ")
+(display (table-ref t "none" 'missing))
+(display "\n")
+(define k (list 1 2))
+(define e (make-eq-table))
+(table-set! e k 1)
+(display (table-ref e k))
+(display " ")
+(display (table-ref e (list 1 2)))
+(display " ")
+(display (table? e))
+(display (table? k))
+(display "\n")
+(define fill
+  (lambda (n)
+    (if (< 0 n)
+        (begin (table-set! t n (* n n))
+               (fill (- n 1))))))
+(fill 300)
+(table-delete! t 10)
+(table-delete! t "one")
+(display (table-count t))
+(display " ")
+(display (table-ref t 300))
+(display " ")
+(display (table-ref t 10))
+(display " ")
+(display (length (table->list t)))
+(display "\n")
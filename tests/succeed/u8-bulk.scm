@@ -0,0 +1,19 @@
+(define x (make-u8vector 6 9))
+(define y (list->u8vector '(1 2 3 4 5 6)))
+(display (u8vector-ref x 5))
+(display "\n")
+(u8vector-fill! x 0)
+(display (u8vector-equal? x (u8vector 0 0 0 0 0 0)))
+(display (u8vector-equal? x y))
+(display (equal? y '#u8(1 2 3 4 5 6)))
+(display "\n")
+(u8vector-copy! y 0 y 1 5)
+(display (equal? y (u8vector 1 1 2 3 4 5)))
+(display "\n")
+(display (u8vector-compare x y))
+(display (u8vector-compare y x))
+(display (u8vector-compare y y))
+(display "\n")
+(display (u8vector-index y 3))
+(display (u8vector-index y 7))
+(display "\n")